@@ -0,0 +1,77 @@
+// Checks of the GL-free allocators the mesh heap is built on. Run by ctest; exits non-zero on the first failure
+#include <cstdint>
+#include <iostream>
+
+#include "OffsetAllocator.h"
+
+static int Failures = 0;
+
+#define CHECK(condition) \
+    do { if (!(condition)) { std::cout << __FILE__ << ":" << __LINE__ << ": failed: " #condition << std::endl; ++Failures; } } while (0)
+
+// BufferHeap makes an arena of exactly the mesh's size when the mesh is larger than its arenas, and takes the mesh from
+// it at once, so a block must come out of an arena of exactly its own size whether or not that size starts a bin
+static void TestExactFit()
+{
+    const uint32_t sizes[] = { 1, 7, 8, 9, 17, 100, 1000, 2097153, 3000000, 4194304, 4194305, 5000001, (1u << 31) - 1 };
+    for (uint32_t size : sizes)
+    {
+        OffsetAllocator allocator;
+        allocator.Reset(size);
+        const OffsetAllocator::Allocation block = allocator.Allocate(size);
+        CHECK(block.IsValid());
+        CHECK(block.Offset == 0);
+        CHECK(allocator.GetFreeBytes() == 0);
+        allocator.Free(block);
+        CHECK(allocator.GetFreeBytes() == size);
+    }
+}
+
+// an oversize mesh, as BufferHeap::place sizes it: vertices, 16 bit indices and the slack to align the vertices
+static void TestOversizeMesh()
+{
+    const uint32_t arenaBytes = 4u << 20;
+    const uint32_t stride = 9 * sizeof(float);
+    const uint32_t bytes = 100003 * stride + 300000 * sizeof(uint16_t) + stride - 1;
+    CHECK(bytes > arenaBytes);
+    OffsetAllocator allocator;
+    allocator.Reset(bytes);
+    const OffsetAllocator::Allocation block = allocator.Allocate(bytes);
+    CHECK(block.IsValid());
+    CHECK(allocator.Allocate(1).IsValid() == false);
+}
+
+// GetLargestFree promises Allocate succeeds with what it returns
+static void TestLargestFree()
+{
+    OffsetAllocator allocator;
+    allocator.Reset(1000);
+    CHECK(allocator.GetLargestFree() == 1000);
+    const OffsetAllocator::Allocation small = allocator.Allocate(17);
+    CHECK(small.IsValid());
+    CHECK(allocator.GetLargestFree() == 983);
+    const OffsetAllocator::Allocation rest = allocator.Allocate(allocator.GetLargestFree());
+    CHECK(rest.IsValid());
+    CHECK(allocator.GetFreeBytes() == 0);
+    CHECK(allocator.GetLargestFree() == 0);
+
+    // and still once the free space is split into blocks of several bins
+    allocator.Free(small);
+    allocator.Free(rest);
+    OffsetAllocator::Allocation blocks[8];
+    for (uint32_t i = 0; i < 8; ++i)
+        blocks[i] = allocator.Allocate(100 + i * 13);
+    for (uint32_t i = 0; i < 8; i += 2)
+        allocator.Free(blocks[i]);
+    CHECK(allocator.Allocate(allocator.GetLargestFree()).IsValid());
+}
+
+int main()
+{
+    TestExactFit();
+    TestOversizeMesh();
+    TestLargestFree();
+    if (Failures == 0)
+        std::cout << "All allocator checks passed" << std::endl;
+    return Failures == 0 ? 0 : 1;
+}
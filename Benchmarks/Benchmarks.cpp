@@ -0,0 +1,1292 @@
+// Microbenchmarks for the CPU side of the Project1 renderer
+//
+// Build on Linux with CMake (see CMakeLists.txt), then run
+//      ./Benchmarks --benchmark_out=bench.json --benchmark_out_format=json
+// or the bench_json target to get a JSON report for regression tracking.
+
+#include <array>
+#include <cmath>
+#include <cstdio>           // remove
+#include <cstdlib>          // malloc, free
+#include <cstring>          // memcpy
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#define ALLOCATION_COUNTER_IMPLEMENTATION
+#include "AllocationCounter.h"
+#include "Bvh.h"
+#include "Camera.h"
+#include "CommandList.h"
+#include "DynamicResolution.h"
+#include "FrameArena.h"
+#include "FrameEncoder.h"
+#include "Input.h"
+#include "JobSystem.h"
+#include "LightClusters.h"
+#include "MeshChunks.h"
+#include "MeshNormals.h"
+#include "Meshlets.h"
+#include "OcclusionCuller.h"
+#include "OffsetAllocator.h"
+#include "Particles.h"
+#include "Primitives.h"
+#include "StaticBatching.h"
+
+// OBJ_Loader.h is the same single header Source.cpp uses; it is optional here
+#if __has_include("OBJ_Loader.h")
+#include "OBJ_Loader.h"
+#define HAVE_OBJ_LOADER 1
+#endif
+
+namespace
+{
+    // Vertex layout used by UCreateMeshFromVerts in proj1.cpp: x, y, z, material slot, u, v
+    const int floatsPerVertex = 3;
+    const int floatsPerMaterial = 1;
+    const int floatsPerUv = 2;
+    const int floatsPerEntry = floatsPerVertex + floatsPerMaterial + floatsPerUv;
+
+    // The mesh proj1.cpp draws every box with, and its vertices as UCreateMeshFromVerts uploads them
+    constexpr PrimitiveMesh<24, 36> cube = MakeCube();
+    constexpr auto cubeVerts = Interleave<PRIMITIVE_POSITION, floatsPerMaterial + floatsPerUv>(cube, [](const PrimitiveVertex& vertex) {
+        return std::array<float, floatsPerMaterial + floatsPerUv>{ vertex.Normal[1] < 0.0f ? 0.0f : 1.0f, vertex.Position[0] * 0.5f + 0.5f, vertex.Position[2] * 0.5f + 0.5f };
+    });
+
+    // One draw in URender(): a translate/rotate/scale model matrix
+    struct SceneObject
+    {
+        glm::vec3 position;
+        float angle;
+        glm::vec3 scale;
+    };
+
+    // Deterministic scene so runs are comparable
+    std::vector<SceneObject> MakeScene(int count)
+    {
+        std::vector<SceneObject> objects(count);
+        const int side = 64;
+        for (int i = 0; i < count; ++i)
+        {
+            SceneObject& object = objects[i];
+            object.position = glm::vec3(float(i % side) - side / 2, float((i / side) % side) * 0.5f, -float(i / (side * side)));
+            object.angle = float(i) * 0.01f;
+            object.scale = glm::vec3(0.2f, 0.9f, 0.4f);
+        }
+        return objects;
+    }
+
+    // Unit cubes scattered through a 400 x 40 x 400 volume with random sizes
+    std::vector<Aabb> MakeBounds(int count)
+    {
+        std::mt19937 rng(1234);
+        std::uniform_real_distribution<float> position(-200.f, 200.f);
+        std::uniform_real_distribution<float> height(0.f, 40.f);
+        std::uniform_real_distribution<float> size(0.1f, 1.5f);
+        std::vector<Aabb> bounds(count);
+        for (Aabb& box : bounds)
+        {
+            const glm::vec3 center(position(rng), height(rng), position(rng));
+            const glm::vec3 extent(size(rng), size(rng), size(rng));
+            box = Aabb(center - extent, center + extent);
+        }
+        return bounds;
+    }
+
+    // count wall segments side by side across the view of MakeSceneCamera, in front of most of the MakeBounds volume
+    std::vector<Occluder> MakeWalls(int count, const std::vector<glm::vec3>& positions)
+    {
+        std::vector<Occluder> walls;
+        const float width = 160.f / float(count);
+        for (int i = 0; i < count; ++i)
+        {
+            glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(-80.f + width * (float(i) + 0.5f), 20.f, 60.f));
+            model = glm::scale(model, glm::vec3(width * 0.5f, 20.f, 0.5f));
+            walls.push_back({ positions.data(), cube.Indices.data(), uint32_t(cube.GetIndexCount()), model });
+        }
+        return walls;
+    }
+
+    std::vector<glm::vec3> CubeVertices()
+    {
+        std::vector<glm::vec3> vertices;
+        for (const PrimitiveVertex& vertex : cube.Vertices)
+            vertices.push_back(glm::vec3(vertex.Position[0], vertex.Position[1], vertex.Position[2]));
+        return vertices;
+    }
+
+    // A 1080p perspective camera looking into the middle of the MakeBounds volume
+    Camera MakeSceneCamera()
+    {
+        Camera camera(glm::vec3(0.f, 20.f, 150.f));
+        camera.SetViewport(1920, 1080);
+        camera.SetPerspective(true);
+        return camera;
+    }
+
+    // Reports the heap allocations per iteration made since since. The benchmarks that use it warm up before the loop,
+    // so anything but 0 means the steady state still allocates
+    void SetAllocationCounter(benchmark::State& state, uint64_t since)
+    {
+        state.counters["allocations"] = benchmark::Counter(double(UGetHeapAllocations() - since), benchmark::Counter::kAvgIterations);
+    }
+
+    // Lights of radius 3 to 8 scattered through the part of the world MakeSceneCamera sees
+    std::vector<PointLight> MakeLights(int count)
+    {
+        std::mt19937 rng(4321);
+        std::uniform_real_distribution<float> across(-60.f, 60.f);
+        std::uniform_real_distribution<float> height(0.f, 40.f);
+        std::uniform_real_distribution<float> depth(60.f, 140.f);
+        std::uniform_real_distribution<float> radius(3.f, 8.f);
+        std::vector<PointLight> lights(count);
+        for (PointLight& light : lights)
+        {
+            light.Position = glm::vec3(across(rng), height(rng), depth(rng));
+            light.Radius = radius(rng);
+            light.Color = glm::vec3(1.f, 0.9f, 0.8f);
+        }
+        return lights;
+    }
+
+    // Stand-ins for visible fragments: random world points in the same volume
+    std::vector<glm::vec3> MakeFragments(int count)
+    {
+        std::mt19937 rng(99);
+        std::uniform_real_distribution<float> across(-60.f, 60.f);
+        std::uniform_real_distribution<float> height(0.f, 40.f);
+        std::uniform_real_distribution<float> depth(60.f, 140.f);
+        std::vector<glm::vec3> fragments(count);
+        for (glm::vec3& fragment : fragments)
+            fragment = glm::vec3(across(rng), height(rng), depth(rng));
+        return fragments;
+    }
+
+    // The falloff term of the fragment shader in proj1.cpp
+    glm::vec3 ShadeLight(const PointLight& light, const glm::vec3& position)
+    {
+        const float distance = glm::length(light.Position - position);
+        if (distance >= light.Radius)
+            return glm::vec3(0.f);
+        const float falloff = 1.f - distance / light.Radius;
+        return light.Color * (light.Intensity * falloff * falloff);
+    }
+}
+
+
+// Mouse events only record the new angles; the orientation is rebuilt once when it is next read
+static void BM_CameraMouseMovement(benchmark::State& state)
+{
+    Camera camera(glm::vec3(0.f, 1.f, 3.f));
+    float direction = 1.f;
+    for (auto _ : state)
+    {
+        camera.ProcessMouseMovement(3.f * direction, 1.f * direction);
+        direction = -direction;
+        benchmark::DoNotOptimize(camera.GetVersion());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CameraMouseMovement);
+
+// Cache hit: nothing moved since the last frame
+static void BM_CameraGetViewMatrix(benchmark::State& state)
+{
+    Camera camera(glm::vec3(0.f, 1.f, 3.f));
+    for (auto _ : state)
+    {
+        glm::mat4 view = camera.GetViewMatrix();
+        benchmark::DoNotOptimize(view);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CameraGetViewMatrix);
+
+// Cache miss: one mouse event per frame, then everything a frame reads (orientation, view, projection, frustum)
+static void BM_CameraUpdateAndMatrices(benchmark::State& state)
+{
+    Camera camera(glm::vec3(0.f, 1.f, 3.f));
+    camera.SetViewport(800, 600);
+    float direction = 1.f;
+    for (auto _ : state)
+    {
+        camera.ProcessMouseMovement(3.f * direction, 1.f * direction);
+        direction = -direction;
+        benchmark::DoNotOptimize(camera.GetViewProjectionMatrix());
+        benchmark::DoNotOptimize(camera.GetFrustum());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CameraUpdateAndMatrices);
+
+// Mouse events per frame, applied to the camera one at a time as mouse_callback used to
+static void BM_InputPerEvent(benchmark::State& state)
+{
+    Camera camera(glm::vec3(0.f, 1.f, 3.f));
+    const int eventsPerFrame = int(state.range(0));
+    for (auto _ : state)
+    {
+        for (int e = 0; e < eventsPerFrame; ++e)
+        {
+            camera.ProcessMouseMovement(0.5f, (e & 1) ? 0.25f : -0.25f);
+            benchmark::DoNotOptimize(camera.GetFront());
+        }
+        benchmark::DoNotOptimize(camera.GetViewProjectionMatrix());
+    }
+    state.SetItemsProcessed(state.iterations() * eventsPerFrame);
+}
+BENCHMARK(BM_InputPerEvent)->RangeMultiplier(4)->Range(1, 256);
+
+// The same events through the input queue, coalesced into one camera update per frame
+static void BM_InputCoalesced(benchmark::State& state)
+{
+    Camera camera(glm::vec3(0.f, 1.f, 3.f));
+    static InputQueue queue;
+    InputFrame input;
+    const int eventsPerFrame = int(state.range(0));
+    for (auto _ : state)
+    {
+        for (int e = 0; e < eventsPerFrame; ++e)
+        {
+            queue.Push({ INPUT_MOUSE_MOVE, 0.0, 0.5, (e & 1) ? 0.25 : -0.25, 0, 0 });
+        }
+        input.Drain(queue);
+        camera.ProcessMouseMovement(input.MouseX, input.MouseY);
+        benchmark::DoNotOptimize(camera.GetViewProjectionMatrix());
+    }
+    state.SetItemsProcessed(state.iterations() * eventsPerFrame);
+}
+BENCHMARK(BM_InputCoalesced)->RangeMultiplier(4)->Range(1, 256);
+
+// The per-object path from URender(): the cached view-projection once, then model and MVP per draw
+static void BM_ObjectMVP(benchmark::State& state)
+{
+    Camera camera(glm::vec3(0.f, 1.f, 3.f));
+    camera.SetViewport(800, 600);
+    const std::vector<SceneObject> objects = MakeScene(int(state.range(0)));
+    std::vector<glm::mat4> transforms(objects.size());
+
+    for (auto _ : state)
+    {
+        const glm::mat4& viewProjection = camera.GetViewProjectionMatrix();
+
+        for (size_t i = 0; i < objects.size(); ++i)
+        {
+            const SceneObject& object = objects[i];
+            glm::mat4 model = glm::mat4(1.0f);
+            model = glm::translate(model, object.position);
+            model = glm::rotate(model, object.angle, glm::vec3(0.f, 1.f, 0.f));
+            model = glm::scale(model, object.scale);
+
+            transforms[i] = viewProjection * model;
+        }
+        benchmark::DoNotOptimize(transforms.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ObjectMVP)->RangeMultiplier(4)->Range(16, 1 << 16);
+
+static void BM_BvhBuild(benchmark::State& state)
+{
+    const std::vector<Aabb> bounds = MakeBounds(int(state.range(0)));
+    for (auto _ : state)
+    {
+        Bvh bvh;
+        bvh.Build(bounds);
+        benchmark::DoNotOptimize(bvh.GetNodeCount());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_BvhBuild)->RangeMultiplier(8)->Range(1 << 10, 1 << 20)->Unit(benchmark::kMillisecond);
+
+// Every object moved a little; the boxes are updated without rebuilding
+static void BM_BvhRefit(benchmark::State& state)
+{
+    std::vector<Aabb> bounds = MakeBounds(int(state.range(0)));
+    Bvh bvh;
+    bvh.Build(bounds);
+    for (Aabb& box : bounds)
+    {
+        box.Min += glm::vec3(0.25f, 0.f, 0.f);
+        box.Max += glm::vec3(0.25f, 0.f, 0.f);
+    }
+    for (auto _ : state)
+    {
+        bvh.Refit(bounds);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_BvhRefit)->RangeMultiplier(8)->Range(1 << 10, 1 << 20)->Unit(benchmark::kMicrosecond);
+
+static void BM_FrustumCullLinear(benchmark::State& state)
+{
+    const std::vector<Aabb> bounds = MakeBounds(int(state.range(0)));
+    const Camera camera = MakeSceneCamera();
+    std::vector<uint32_t> visible;
+    visible.reserve(bounds.size());
+    for (auto _ : state)
+    {
+        visible.clear();
+        const Frustum& frustum = camera.GetFrustum();
+        for (uint32_t i = 0; i < uint32_t(bounds.size()); ++i)
+        {
+            if (frustum.IntersectsAabb(bounds[i].Min, bounds[i].Max))
+                visible.push_back(i);
+        }
+        benchmark::DoNotOptimize(visible.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.counters["visible"] = double(visible.size());
+}
+BENCHMARK(BM_FrustumCullLinear)->RangeMultiplier(8)->Range(1 << 10, 1 << 20)->Unit(benchmark::kMicrosecond);
+
+static void BM_FrustumCullBvh(benchmark::State& state)
+{
+    const std::vector<Aabb> bounds = MakeBounds(int(state.range(0)));
+    const Camera camera = MakeSceneCamera();
+    Bvh bvh;
+    bvh.Build(bounds);
+    std::vector<uint32_t> visible;
+    visible.reserve(bounds.size());
+    for (auto _ : state)
+    {
+        visible.clear();
+        bvh.QueryFrustum(camera.GetFrustum(), visible);
+        benchmark::DoNotOptimize(visible.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.counters["visible"] = double(visible.size());
+}
+BENCHMARK(BM_FrustumCullBvh)->RangeMultiplier(8)->Range(1 << 10, 1 << 20)->Unit(benchmark::kMicrosecond);
+
+// Picking rays fanned across the viewport
+static void BM_RaycastBvh(benchmark::State& state)
+{
+    const std::vector<Aabb> bounds = MakeBounds(int(state.range(0)));
+    const Camera camera = MakeSceneCamera();
+    Bvh bvh;
+    bvh.Build(bounds);
+    int ray = 0;
+    for (auto _ : state)
+    {
+        const Ray r = camera.GetRay(float((ray * 97) % 1920), float((ray * 61) % 1080));
+        ++ray;
+        uint32_t object;
+        float distance;
+        benchmark::DoNotOptimize(bvh.Raycast(r, 1000.f, object, distance));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RaycastBvh)->RangeMultiplier(8)->Range(1 << 10, 1 << 20);
+
+static void BM_RaycastLinear(benchmark::State& state)
+{
+    const std::vector<Aabb> bounds = MakeBounds(int(state.range(0)));
+    const Camera camera = MakeSceneCamera();
+    int ray = 0;
+    for (auto _ : state)
+    {
+        const Ray r = camera.GetRay(float((ray * 97) % 1920), float((ray * 61) % 1080));
+        ++ray;
+        const glm::vec3 inverseDirection = 1.0f / r.Direction;
+        float closest = 1000.f;
+        uint32_t object = 0;
+        for (uint32_t i = 0; i < uint32_t(bounds.size()); ++i)
+        {
+            float t;
+            if (IntersectRayAabb(r.Origin, inverseDirection, bounds[i], closest, t))
+            {
+                closest = t;
+                object = i;
+            }
+        }
+        benchmark::DoNotOptimize(object);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RaycastLinear)->RangeMultiplier(8)->Range(1 << 10, 1 << 20);
+
+// The CPU side of a GPU pick at the same points: the objects whose bounds touch a GPU_PICK_REGION (9) pixel square,
+// which are then drawn into the ID target. The GPU finds the closest triangle among them, where the ray cast stops at bounds
+static void BM_PickRegionBvh(benchmark::State& state)
+{
+    const std::vector<Aabb> bounds = MakeBounds(int(state.range(0)));
+    const Camera camera = MakeSceneCamera();
+    Bvh bvh;
+    bvh.Build(bounds);
+    std::vector<uint32_t> candidates;
+    int pick = 0;
+    size_t drawn = 0;
+    for (auto _ : state)
+    {
+        const glm::mat4 region = camera.GetPickMatrix(float((pick * 97) % 1920), float((pick * 61) % 1080), 9);
+        ++pick;
+        candidates.clear();
+        bvh.QueryFrustum(Frustum::FromMatrix(region), candidates);
+        drawn += candidates.size();
+        benchmark::DoNotOptimize(candidates.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["drawn"] = double(drawn) / double(state.iterations());
+}
+BENCHMARK(BM_PickRegionBvh)->RangeMultiplier(8)->Range(1 << 10, 1 << 20);
+
+// Occluder rasterization only: range(0) wall segments on range(1) threads
+static void BM_OcclusionRasterize(benchmark::State& state)
+{
+    const std::vector<glm::vec3> vertices = CubeVertices();
+    const std::vector<Occluder> walls = MakeWalls(int(state.range(0)), vertices);
+    const Camera camera = MakeSceneCamera();
+    JobSystem jobs(int(state.range(1)) - 1);
+    OcclusionCuller culler;
+    culler.SetJobSystem(&jobs);
+    culler.SetBudget(1000.0);
+    for (auto _ : state)
+    {
+        culler.Rasterize(camera.GetViewProjectionMatrix(), walls, std::chrono::steady_clock::now());
+        benchmark::DoNotOptimize(culler.GetDepth().data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.counters["triangles"] = double(culler.GetStats().TrianglesRasterized);
+}
+BENCHMARK(BM_OcclusionRasterize)->ArgsProduct({ { 8, 64, 512 }, { 1, 2, 4 } })->Unit(benchmark::kMicrosecond)->UseRealTime();
+
+// The whole pass URender() runs after frustum culling: 16 walls, then range(0) occludees tested against them
+static void BM_OcclusionCull(benchmark::State& state)
+{
+    const std::vector<Aabb> bounds = MakeBounds(int(state.range(0)));
+    const std::vector<glm::vec3> vertices = CubeVertices();
+    const std::vector<Occluder> walls = MakeWalls(16, vertices);
+    const Camera camera = MakeSceneCamera();
+    JobSystem jobs(int(state.range(1)) - 1);
+    OcclusionCuller culler;
+    culler.SetJobSystem(&jobs);
+    culler.SetBudget(1000.0);
+    std::vector<uint8_t> visible(bounds.size(), 1);
+    culler.Cull(camera.GetViewProjectionMatrix(), walls, bounds, visible);
+    const uint64_t allocations = UGetHeapAllocations();
+    for (auto _ : state)
+    {
+        visible.assign(bounds.size(), 1);
+        culler.Cull(camera.GetViewProjectionMatrix(), walls, bounds, visible);
+        benchmark::DoNotOptimize(visible.data());
+    }
+    SetAllocationCounter(state, allocations);
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.counters["tested"] = double(culler.GetStats().Tested);
+    state.counters["rejected"] = double(culler.GetStats().Rejected);
+}
+BENCHMARK(BM_OcclusionCull)->ArgsProduct({ { 1 << 10, 1 << 14, 1 << 17 }, { 1, 4 } })->Unit(benchmark::kMicrosecond)->UseRealTime();
+
+// The transform pass of URender() on range(1) threads: one model-view-projection per object, in batches of 64
+static void BM_JobParallelTransforms(benchmark::State& state)
+{
+    const std::vector<SceneObject> objects = MakeScene(int(state.range(0)));
+    std::vector<glm::mat4> models(objects.size());
+    for (size_t i = 0; i < objects.size(); ++i)
+    {
+        glm::mat4 model = glm::translate(glm::mat4(1.0f), objects[i].position);
+        model = glm::rotate(model, objects[i].angle, glm::vec3(0.f, 1.f, 0.f));
+        models[i] = glm::scale(model, objects[i].scale);
+    }
+    const Camera camera = MakeSceneCamera();
+    JobSystem jobs(int(state.range(1)) - 1);
+    std::vector<glm::mat4> transforms(objects.size());
+    for (auto _ : state)
+    {
+        const glm::mat4& viewProjection = camera.GetViewProjectionMatrix();
+        jobs.ParallelFor("transform batch", uint32_t(models.size()), 64, [&](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t i = begin; i < end; ++i)
+                transforms[i] = viewProjection * models[i];
+        });
+        benchmark::DoNotOptimize(transforms.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_JobParallelTransforms)->ArgsProduct({ { 1 << 10, 1 << 14, 1 << 17 }, { 1, 2, 4, 8 } })->Unit(benchmark::kMicrosecond)->UseRealTime();
+
+// Draw recording in URender(): range(0) objects into command lists of 64 draws, recorded on range(1) threads
+static void BM_CommandRecord(benchmark::State& state)
+{
+    const uint32_t batch = 64;
+    const std::vector<SceneObject> objects = MakeScene(int(state.range(0)));
+    std::vector<glm::mat4> models(objects.size());
+    for (size_t i = 0; i < objects.size(); ++i)
+        models[i] = glm::scale(glm::translate(glm::mat4(1.0f), objects[i].position), objects[i].scale);
+    const Camera camera = MakeSceneCamera();
+    JobSystem jobs(int(state.range(1)) - 1);
+    std::vector<CommandList> lists((objects.size() + batch - 1) / batch);
+    for (auto _ : state)
+    {
+        const glm::mat4& viewProjection = camera.GetViewProjectionMatrix();
+        jobs.ParallelFor("record batch", uint32_t(models.size()), batch, [&](uint32_t begin, uint32_t end)
+        {
+            CommandList& list = lists[begin / batch];
+            list.Reset();
+            list.SetProgram(1);
+            for (uint32_t i = begin; i < end; ++i)
+            {
+                list.BindMesh(1 + i % 3);
+                list.SetUniform(0, viewProjection * models[i]);
+                list.DrawIndexed(36);
+            }
+        });
+        benchmark::DoNotOptimize(lists.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.counters["bytesPerDraw"] = double(lists[0].GetSizeInBytes()) / double(std::min<size_t>(batch, objects.size()));
+}
+BENCHMARK(BM_CommandRecord)->ArgsProduct({ { 1 << 10, 1 << 14, 1 << 17 }, { 1, 2, 4, 8 } })->Unit(benchmark::kMicrosecond)->UseRealTime();
+
+// Merging range(0) static cubes of the MakeScene layout into batches, once per run of the scene
+static void BM_StaticBatchBuild(benchmark::State& state)
+{
+    const std::vector<SceneObject> objects = MakeScene(int(state.range(0)));
+    const StaticMesh mesh = { cubeVerts.data(), uint32_t(cube.GetVertexCount()), floatsPerEntry, cube.Indices.data(), uint32_t(cube.GetIndexCount()) };
+    StaticBatcher batcher;
+    for (auto _ : state)
+    {
+        batcher.Clear();
+        for (size_t i = 0; i < objects.size(); ++i)
+        {
+            const glm::mat4 model = glm::scale(glm::translate(glm::mat4(1.0f), objects[i].position), objects[i].scale);
+            batcher.Add(mesh, model, uint32_t(i % 2));
+        }
+        batcher.Build();
+        benchmark::DoNotOptimize(batcher.GetBatches().data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.counters["batches"] = double(batcher.GetStats().Batches);
+}
+BENCHMARK(BM_StaticBatchBuild)->RangeMultiplier(8)->Range(64, 1 << 15)->Unit(benchmark::kMicrosecond);
+
+// Recording range(0) static cubes each frame, one draw per object (range(1) == 0) or one per static batch (range(1) == 1)
+static void BM_StaticBatchRecord(benchmark::State& state)
+{
+    const std::vector<SceneObject> objects = MakeScene(int(state.range(0)));
+    std::vector<glm::mat4> models(objects.size());
+    StaticBatcher batcher;
+    const StaticMesh mesh = { cubeVerts.data(), uint32_t(cube.GetVertexCount()), floatsPerEntry, cube.Indices.data(), uint32_t(cube.GetIndexCount()) };
+    for (size_t i = 0; i < objects.size(); ++i)
+    {
+        models[i] = glm::scale(glm::translate(glm::mat4(1.0f), objects[i].position), objects[i].scale);
+        batcher.Add(mesh, models[i], 0);
+    }
+    batcher.Build();
+    const bool batched = state.range(1) != 0;
+    const size_t draws = batched ? batcher.GetBatches().size() : objects.size();
+
+    CommandList list;
+    for (auto _ : state)
+    {
+        list.Reset();
+        list.SetProgram(1);
+        for (size_t i = 0; i < draws; ++i)
+        {
+            list.BindMesh(batched ? uint32_t(1 + i) : 1);
+            list.SetUniform(0, batched ? glm::mat4(1.0f) : models[i]);
+            list.DrawIndexed(batched ? uint32_t(batcher.GetBatches()[i].Indices.size()) : 36);
+        }
+        benchmark::DoNotOptimize(list.GetSizeInBytes());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.counters["draws"] = double(draws);
+}
+BENCHMARK(BM_StaticBatchRecord)->ArgsProduct({ { 1 << 10, 1 << 14 }, { 0, 1 } })->Unit(benchmark::kMicrosecond);
+
+// A flat grid of range(0) by range(0) quads, one unit each, in the six float layout the app uses
+static void MakeGrid(int quads, std::vector<float>& vertices, std::vector<uint32_t>& indices)
+{
+    const int side = quads + 1;
+    vertices.clear();
+    indices.clear();
+    for (int row = 0; row < side; ++row)
+    {
+        for (int column = 0; column < side; ++column)
+            vertices.insert(vertices.end(), { float(column), 0.0f, float(row), 0.0f, float(column), float(row) });
+    }
+    for (int row = 0; row < quads; ++row)
+    {
+        for (int column = 0; column < quads; ++column)
+        {
+            const uint32_t corner = uint32_t(row * side + column);
+            indices.insert(indices.end(), { corner, corner + side, corner + 1, corner + 1, corner + side, corner + uint32_t(side) + 1 });
+        }
+    }
+}
+
+// Cutting a large mesh into chunks, as done once when a chunk file is written
+static void BM_MeshChunkSplit(benchmark::State& state)
+{
+    std::vector<float> vertices;
+    std::vector<uint32_t> indices;
+    MakeGrid(int(state.range(0)), vertices, indices);
+    std::vector<MeshChunk> chunks;
+    for (auto _ : state)
+    {
+        USplitMeshIntoChunks(vertices.data(), uint32_t(vertices.size() / 6), 6, indices.data(), indices.size(), MESH_CHUNK_SIZE, chunks);
+        benchmark::DoNotOptimize(chunks.data());
+    }
+    state.SetItemsProcessed(state.iterations() * int64_t(indices.size() / 3));
+    state.counters["chunks"] = double(chunks.size());
+}
+BENCHMARK(BM_MeshChunkSplit)->RangeMultiplier(4)->Range(64, 1024)->Unit(benchmark::kMillisecond);
+
+// Reading one chunk back, what the pager's file thread does per chunk it pages in. Mostly the page cache, so this is
+// the cost on top of the disk
+static void BM_MeshChunkRead(benchmark::State& state)
+{
+    std::vector<float> vertices;
+    std::vector<uint32_t> indices;
+    MakeGrid(int(state.range(0)), vertices, indices);
+    std::vector<MeshChunk> chunks;
+    USplitMeshIntoChunks(vertices.data(), uint32_t(vertices.size() / 6), 6, indices.data(), indices.size(), MESH_CHUNK_SIZE, chunks);
+    const std::string path = "bench_chunks_" + std::to_string(state.range(0)) + ".mchk";
+    MeshChunkFile file;
+    if (!UWriteMeshChunks(path, 6, chunks) || !UReadMeshChunkTable(path, file))
+    {
+        state.SkipWithError("could not write the chunk file");
+        return;
+    }
+
+    std::ifstream stream(path, std::ios::binary);
+    MeshChunk chunk;
+    uint32_t next = 0;
+    uint64_t bytes = 0;
+    for (auto _ : state)
+    {
+        UReadMeshChunk(stream, file, next, chunk);
+        bytes += file.GetChunkBytes(next);
+        next = (next + 7) % uint32_t(file.Chunks.size());
+        benchmark::DoNotOptimize(chunk.Vertices.data());
+    }
+    state.SetBytesProcessed(int64_t(bytes));
+    stream.close();
+    std::remove(path.c_str());
+}
+BENCHMARK(BM_MeshChunkRead)->Arg(256)->Arg(1024)->Unit(benchmark::kMicrosecond);
+
+// A range(0) quads square grid with rolling hills, in 16 bit indices, centred on the origin
+static void MakeHills(int quads, std::vector<float>& vertices, std::vector<uint16_t>& indices)
+{
+    std::vector<uint32_t> wide;
+    MakeGrid(quads, vertices, wide);
+    for (size_t v = 0; v < vertices.size(); v += 6)
+    {
+        vertices[v] -= quads * 0.5f;
+        vertices[v + 2] -= quads * 0.5f;
+        vertices[v + 1] = 3.0f * std::sin(vertices[v] * 0.2f) * std::cos(vertices[v + 2] * 0.15f);
+    }
+    indices.assign(wide.begin(), wide.end());
+}
+
+// The offline step that groups a chunk's triangles into meshlets
+static void BM_BuildMeshlets(benchmark::State& state)
+{
+    std::vector<float> vertices;
+    std::vector<uint16_t> source;
+    MakeHills(int(state.range(0)), vertices, source);
+    std::vector<uint16_t> indices;
+    std::vector<Meshlet> meshlets;
+    for (auto _ : state)
+    {
+        indices = source;
+        UBuildMeshlets(vertices.data(), uint32_t(vertices.size() / 6), 6, indices, meshlets);
+        benchmark::DoNotOptimize(meshlets.data());
+    }
+    state.SetItemsProcessed(state.iterations() * int64_t(source.size() / 3));
+    state.counters["meshlets"] = double(meshlets.size());
+    state.counters["triangles per meshlet"] = double(source.size() / 3) / double(meshlets.size());
+}
+BENCHMARK(BM_BuildMeshlets)->Arg(32)->Arg(64)->Arg(128)->Unit(benchmark::kMicrosecond);
+
+// Culling the meshlets of a hilly grid the scene camera looks across, frustum first and then by normal cone, as the mesh
+// pager does for each resident chunk in view. Counts what each test rejected
+static void BM_MeshletCull(benchmark::State& state)
+{
+    std::vector<float> vertices;
+    std::vector<uint16_t> indices;
+    MakeHills(128, vertices, indices);
+    std::vector<Meshlet> meshlets;
+    UBuildMeshlets(vertices.data(), uint32_t(vertices.size() / 6), 6, indices, meshlets);
+    Camera camera = MakeSceneCamera();
+    camera.SetPosition(glm::vec3(0.0f, 12.0f, 80.0f));
+    const Frustum& frustum = camera.GetFrustum();
+    const glm::vec3 eye = camera.GetPosition();
+    uint32_t outside = 0, backfacing = 0, drawn = 0;
+    for (auto _ : state)
+    {
+        outside = backfacing = drawn = 0;
+        for (const Meshlet& meshlet : meshlets)
+        {
+            if (!frustum.IntersectsAabb(meshlet.Bounds.Min, meshlet.Bounds.Max))
+                outside++;
+            else if (UIsMeshletBackfacing(meshlet, eye))
+                backfacing++;
+            else
+                drawn += meshlet.IndexCount / 3;
+        }
+        benchmark::DoNotOptimize(drawn);
+    }
+    state.SetItemsProcessed(state.iterations() * int64_t(meshlets.size()));
+    state.counters["outside"] = double(outside) / double(meshlets.size());
+    state.counters["facing away"] = double(backfacing) / double(meshlets.size());
+    state.counters["triangles drawn"] = double(drawn) / double(indices.size() / 3);
+}
+BENCHMARK(BM_MeshletCull)->Unit(benchmark::kMicrosecond);
+
+// Normals with the default crease angle and tangents for a hilly grid of range(0) quads a side, which is 10M triangles at
+// the largest, on range(1) threads. Items are triangles
+static void BM_GenerateTangentSpace(benchmark::State& state)
+{
+    const int quads = int(state.range(0));
+    std::vector<float> vertices;
+    std::vector<uint32_t> indices;
+    MakeGrid(quads, vertices, indices);
+    for (size_t v = 0; v < vertices.size(); v += 6)
+        vertices[v + 1] = 3.0f * std::sin(vertices[v] * 0.2f) * std::cos(vertices[v + 2] * 0.15f);
+    JobSystem jobs(int(state.range(1)) - 1);
+    TangentSpaceGenerator generator;
+    generator.SetJobSystem(&jobs);
+    TangentSpaceMesh mesh;
+    for (auto _ : state)
+    {
+        generator.Generate(vertices.data(), uint32_t(vertices.size() / 6), 6, 4, indices.data(), indices.size(), MESH_DEFAULT_CREASE_ANGLE, mesh);
+        benchmark::DoNotOptimize(mesh.Tangents.data());
+    }
+    state.SetItemsProcessed(state.iterations() * int64_t(indices.size() / 3));
+    state.counters["vertices out"] = double(mesh.Source.size());
+}
+BENCHMARK(BM_GenerateTangentSpace)->ArgsProduct({ { 256, 1024, 2236 }, { 1, 4 } })->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// A 1080p frame as glReadPixels returns it: range(0) 0 is a rendered looking frame, a black background behind shaded
+// boxes, and 1 is noise, the worst case for the PNG encoder. At 60 frames a second the writer has 16.7 ms for each
+static std::vector<uint8_t> MakeFrame(int width, int height, bool noise)
+{
+    std::vector<uint8_t> frame(size_t(width) * height * 4, 255);
+    std::mt19937 rng(5);
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            uint8_t* pixel = &frame[(size_t(y) * width + x) * 4];
+            const bool box = (x / 240 + y / 270) % 3 == 0;
+            for (int c = 0; c < 3; ++c)
+                pixel[c] = noise ? uint8_t(rng()) : box ? uint8_t((x * (c + 1) + y) / 16) : 0;
+        }
+    }
+    return frame;
+}
+
+static void BM_EncodePng(benchmark::State& state)
+{
+    const std::vector<uint8_t> frame = MakeFrame(1920, 1080, state.range(0) != 0);
+    PngEncoder encoder;
+    size_t bytes = 0;
+    for (auto _ : state)
+    {
+        bytes = encoder.Encode(frame.data(), 1920, 1080).size();
+        benchmark::DoNotOptimize(bytes);
+    }
+    state.SetBytesProcessed(state.iterations() * int64_t(frame.size()));
+    state.counters["KB"] = double(bytes / 1024);
+}
+BENCHMARK(BM_EncodePng)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+static void BM_EncodeY4m(benchmark::State& state)
+{
+    const std::vector<uint8_t> frame = MakeFrame(1920, 1080, state.range(0) != 0);
+    Y4mEncoder encoder;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(encoder.Encode(frame.data(), 1920, 1080).data());
+    state.SetBytesProcessed(state.iterations() * int64_t(frame.size()));
+}
+BENCHMARK(BM_EncodeY4m)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+// One step of the CPU reference particle simulation with range(0) particles live, on range(1) threads. The emitters are
+// proj1's fountains, and the pool is run full first, so every step retires and spawns about as many as it would there
+static void BM_ParticleStep(benchmark::State& state)
+{
+    const uint32_t budget = uint32_t(state.range(0));
+    ParticleEmitter emitters[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        emitters[i].Position = glm::vec3(i & 1 ? 1.4f : -2.8f, -0.41f, i & 2 ? -1.4f : 1.4f);
+        emitters[i].Life = 2.0f;
+        emitters[i].Velocity = glm::vec3(0.0f, 3.5f, 0.0f);
+        emitters[i].Spread = 1.0f;
+        emitters[i].Rate = float(budget) / (4 * 2.0f) * 1.1f;
+    }
+    JobSystem jobs(int(state.range(1)) - 1);
+    ParticleSimulator simulator;
+    simulator.SetJobSystem(&jobs);
+    simulator.Create(budget);
+    ParticleStep step;
+    uint32_t nextId = 0;
+    for (int i = 0; i < 180; ++i)
+    {
+        UScheduleParticles(emitters, 4, 1.0f / 60.0f, -4.51f, nextId, step);
+        simulator.Step(step);
+    }
+    for (auto _ : state)
+    {
+        UScheduleParticles(emitters, 4, 1.0f / 60.0f, -4.51f, nextId, step);
+        simulator.Step(step);
+        benchmark::DoNotOptimize(simulator.GetCount());
+    }
+    state.SetItemsProcessed(state.iterations() * int64_t(simulator.GetCount()));
+    state.counters["particles"] = double(simulator.GetCount());
+}
+BENCHMARK(BM_ParticleStep)->ArgsProduct({ { 1 << 16, 1 << 20 }, { 1, 4 } })->Unit(benchmark::kMicrosecond)->UseRealTime();
+
+// Mesh sized blocks, 1 to 64 KB, churned the way paging meshes in and out does: range(0) live blocks, and every iteration
+// frees a random one and allocates a new one. The buffer heap's allocator against the general heap doing the same
+static void BM_OffsetAllocatorChurn(benchmark::State& state)
+{
+    const size_t live = size_t(state.range(0));
+    std::mt19937 rng(99);
+    std::uniform_int_distribution<uint32_t> size(1024, 64 * 1024);
+    OffsetAllocator allocator;
+    allocator.Reset(uint32_t(live) * 64 * 1024);
+    std::vector<OffsetAllocator::Allocation> blocks;
+    for (size_t i = 0; i < live; ++i)
+        blocks.push_back(allocator.Allocate(size(rng)));
+    for (auto _ : state)
+    {
+        OffsetAllocator::Allocation& block = blocks[rng() % live];
+        allocator.Free(block);
+        block = allocator.Allocate(size(rng));
+        benchmark::DoNotOptimize(block.Offset);
+    }
+    state.counters["largest free KB"] = double(allocator.GetLargestFree() / 1024);
+    for (const OffsetAllocator::Allocation& block : blocks)
+        allocator.Free(block);
+}
+BENCHMARK(BM_OffsetAllocatorChurn)->Arg(64)->Arg(1024)->Arg(16384);
+
+static void BM_MallocChurn(benchmark::State& state)
+{
+    const size_t live = size_t(state.range(0));
+    std::mt19937 rng(99);
+    std::uniform_int_distribution<uint32_t> size(1024, 64 * 1024);
+    std::vector<void*> blocks;
+    for (size_t i = 0; i < live; ++i)
+        blocks.push_back(std::malloc(size(rng)));
+    for (auto _ : state)
+    {
+        void*& block = blocks[rng() % live];
+        std::free(block);
+        block = std::malloc(size(rng));
+        benchmark::DoNotOptimize(block);
+    }
+    for (void* block : blocks)
+        std::free(block);
+}
+BENCHMARK(BM_MallocChurn)->Arg(64)->Arg(1024)->Arg(16384);
+
+// The resolution controller against a simulated GPU whose frame time is a fixed cost plus a per pixel cost, with
+// measurement noise; the load is range(0) times the target at full resolution. Reports how many frames the scale took to
+// settle for good and how often it changed, which should be a handful and not once every few frames
+static void BM_ResolutionConverge(benchmark::State& state)
+{
+    const double target = DYNAMIC_RESOLUTION_TARGET_MS;
+    const double perPixel = target * double(state.range(0)) * 0.01 - 1.0;
+    const int frames = 600;
+    int settledAt = 0, changes = 0;
+    for (auto _ : state)
+    {
+        std::mt19937 rng(7);
+        std::normal_distribution<double> noise(0.0, 0.03);
+        ResolutionController controller;
+        float scale = controller.GetScale();
+        for (int frame = 0; frame < frames; ++frame)
+        {
+            const double gpuMs = (1.0 + perPixel * double(scale) * double(scale)) * (1.0 + noise(rng));
+            const float next = controller.Update(gpuMs);
+            if (next != scale)
+                settledAt = frame;
+            scale = next;
+        }
+        changes = controller.GetChanges();
+        benchmark::DoNotOptimize(scale);
+    }
+    state.SetItemsProcessed(state.iterations() * frames);
+    state.counters["settled_frame"] = double(settledAt);
+    state.counters["changes"] = double(changes);
+}
+// loads in percent of the target: within the dead band, a little over, twice over, and over what the lowest scale fixes
+BENCHMARK(BM_ResolutionConverge)->Arg(90)->Arg(120)->Arg(200)->Arg(600)->Unit(benchmark::kMicrosecond);
+
+// Decoding on the render thread, with a backend that only sums what it is given instead of calling GL
+static void BM_CommandReplay(benchmark::State& state)
+{
+    struct NullBackend
+    {
+        uint64_t sum = 0;
+        void SetProgram(uint32_t id) { sum += id; }
+        void BindMesh(uint32_t id) { sum += id; }
+        void BindTexture(uint32_t unit, uint32_t id) { sum += unit + id; }
+        void SetUniform(int32_t location, uint32_t value) { sum += uint64_t(location) + value; }
+        void SetUniform(int32_t location, const float* matrix) { sum += uint64_t(location) + uint64_t(matrix[15]); }
+        void DrawIndexed(uint32_t indexCount, uint32_t firstIndex, int32_t baseVertex) { sum += indexCount + firstIndex + uint32_t(baseVertex); }
+        void DrawIndirect(uint32_t buffer, uint32_t firstCommand, uint32_t commandCount) { sum += buffer + firstCommand + commandCount; }
+    };
+
+    CommandList list;
+    list.SetProgram(1);
+    for (int64_t i = 0; i < state.range(0); ++i)
+    {
+        list.BindMesh(1 + uint32_t(i % 3));
+        list.SetUniform(0, glm::mat4(1.0f));
+        list.DrawIndexed(36);
+    }
+    for (auto _ : state)
+    {
+        NullBackend backend;
+        list.Execute(backend);
+        benchmark::DoNotOptimize(backend.sum);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_CommandReplay)->RangeMultiplier(8)->Range(1 << 10, 1 << 17)->Unit(benchmark::kMicrosecond);
+
+// The depth pre-pass replays every command list a second time with a backend like GLDepthBackend in proj1.cpp (depth
+// program and uniform locations swapped in, textures and materials dropped); this is what it adds on the CPU per frame
+static void BM_DepthPrepassReplay(benchmark::State& state)
+{
+    struct NullBackend
+    {
+        uint64_t sum = 0;
+        void SetProgram(uint32_t id) { sum += id; }
+        void BindMesh(uint32_t id) { sum += id; }
+        void BindTexture(uint32_t unit, uint32_t id) { sum += unit + id; }
+        void SetUniform(int32_t location, uint32_t value) { sum += uint64_t(location) + value; }
+        void SetUniform(int32_t location, const float* matrix) { sum += uint64_t(location) + uint64_t(matrix[15]); }
+        void DrawIndexed(uint32_t indexCount, uint32_t firstIndex, int32_t baseVertex) { sum += indexCount + firstIndex + uint32_t(baseVertex); }
+        void DrawIndirect(uint32_t buffer, uint32_t firstCommand, uint32_t commandCount) { sum += buffer + firstCommand + commandCount; }
+    };
+    struct DepthBackend : NullBackend
+    {
+        void SetProgram(uint32_t) { NullBackend::SetProgram(7); }
+        void BindTexture(uint32_t, uint32_t) {}
+        void SetUniform(int32_t location, const float* matrix) { NullBackend::SetUniform(location == 0 ? 10 : 11, matrix); }
+        void SetUniform(int32_t, uint32_t) {}
+    };
+
+    const bool prepass = state.range(1) != 0;
+    CommandList list;
+    list.SetProgram(1);
+    list.SetUniform(1, glm::mat4(1.0f));
+    for (int64_t i = 0; i < state.range(0); ++i)
+    {
+        list.BindMesh(1 + uint32_t(i % 3));
+        list.BindTexture(0, 4);
+        list.SetUniform(0, glm::mat4(1.0f));
+        list.SetUniform(2, uint32_t(i));
+        list.DrawIndexed(36);
+    }
+    for (auto _ : state)
+    {
+        NullBackend backend;
+        DepthBackend depthBackend;
+        if (prepass)
+            list.Execute(depthBackend);
+        list.Execute(backend);
+        benchmark::DoNotOptimize(backend.sum + depthBackend.sum);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_DepthPrepassReplay)->ArgsProduct({ { 1 << 10, 1 << 14 }, { 0, 1 } })->Unit(benchmark::kMicrosecond);
+
+// Depth precision of the regular projection (24 bit fixed point depth, -1 to 1 clip range) against reversed-Z (32 bit
+// float depth, 0 to 1, infinite far plane): the smallest distance in front of a surface at which another surface still
+// gets a different stored depth, as counters in millimetres. The timed part only evaluates the stored depths
+static void BM_DepthPrecision(benchmark::State& state)
+{
+    const bool reverseZ = state.range(0) != 0;
+    Camera camera(glm::vec3(0.0f));
+    camera.SetViewport(1920, 1080);
+    camera.SetReverseZ(reverseZ);
+    const glm::mat4 projection = camera.GetDrawViewProjectionMatrix();
+
+    // what ends up in the depth buffer for a point straight ahead at this distance
+    const auto stored = [&projection, reverseZ](double distance) -> double
+    {
+        const glm::vec4 clip = projection * glm::vec4(0.0f, 0.0f, float(-distance), 1.0f);
+        const float ndc = clip.z / clip.w;
+        if (reverseZ)
+            return double(ndc);
+        return std::floor((double(ndc) * 0.5 + 0.5) * double((1 << 24) - 1) + 0.5);
+    };
+    const auto resolvable = [&stored](double distance)
+    {
+        const double here = stored(distance);
+        double low = 0.0, high = distance;
+        for (int i = 0; i < 60; ++i)
+        {
+            const double middle = 0.5 * (low + high);
+            (stored(distance - middle) != here ? high : low) = middle;
+        }
+        return high * 1000.0;
+    };
+
+    for (auto _ : state)
+    {
+        double sum = 0.0;
+        for (int i = 1; i <= 1000; ++i)
+            sum += stored(double(NEAR_PLANE) + double(FAR_PLANE - NEAR_PLANE) * double(i) / 1000.0);
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * 1000);
+    state.counters["mm_at_1"] = resolvable(1.0);
+    state.counters["mm_at_10"] = resolvable(10.0);
+    state.counters["mm_at_99"] = resolvable(99.0);
+}
+BENCHMARK(BM_DepthPrecision)->Arg(0)->Arg(1);
+
+// Scheduling overhead: range(0) empty jobs on one counter, waited for from outside the pool
+static void BM_JobRunWait(benchmark::State& state)
+{
+    JobSystem jobs(int(state.range(1)) - 1);
+    auto runAll = [&]()
+    {
+        JobCounter counter;
+        for (int64_t i = 0; i < state.range(0); ++i)
+            jobs.Run("empty", []() {}, &counter);
+        jobs.Wait(counter);
+    };
+    runAll();
+    const uint64_t allocations = UGetHeapAllocations();
+    for (auto _ : state)
+        runAll();
+    SetAllocationCounter(state, allocations);
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_JobRunWait)->ArgsProduct({ { 64, 1024 }, { 1, 4 } })->Unit(benchmark::kMicrosecond)->UseRealTime();
+
+// UUpdateLights: range(0) lights sorted into the 16 x 9 x 24 cluster grid on range(1) threads
+static void BM_ClusterAssign(benchmark::State& state)
+{
+    const std::vector<PointLight> lights = MakeLights(int(state.range(0)));
+    const Camera camera = MakeSceneCamera();
+    JobSystem jobs(int(state.range(1)) - 1);
+    ClusteredLighting clusters;
+    clusters.SetJobSystem(&jobs);
+    auto assign = [&]()
+    {
+        clusters.Assign(lights, camera.GetViewMatrix(), camera.GetProjectionMatrix(), camera.GetViewportWidth(), camera.GetViewportHeight(),
+            NEAR_PLANE, FAR_PLANE);
+    };
+    assign();
+    const uint64_t allocations = UGetHeapAllocations();
+    for (auto _ : state)
+    {
+        assign();
+        benchmark::DoNotOptimize(clusters.GetLightIndices().data());
+    }
+    SetAllocationCounter(state, allocations);
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.counters["assignments"] = double(clusters.GetStats().Assignments);
+    state.counters["max per cluster"] = double(clusters.GetStats().MaxPerCluster);
+}
+BENCHMARK(BM_ClusterAssign)->ArgsProduct({ { 16, 128, 1024, 4096 }, { 1, 4 } })->Unit(benchmark::kMicrosecond)->UseRealTime();
+
+// What the fragment shader did before clustering: every fragment loops over all range(0) lights
+static void BM_ShadeAllLights(benchmark::State& state)
+{
+    const std::vector<PointLight> lights = MakeLights(int(state.range(0)));
+    const std::vector<glm::vec3> fragments = MakeFragments(1 << 12);
+    for (auto _ : state)
+    {
+        glm::vec3 total(0.f);
+        for (const glm::vec3& fragment : fragments)
+        {
+            for (const PointLight& light : lights)
+                total += ShadeLight(light, fragment);
+        }
+        benchmark::DoNotOptimize(total);
+    }
+    state.SetItemsProcessed(state.iterations() * int64_t(fragments.size()));
+}
+BENCHMARK(BM_ShadeAllLights)->RangeMultiplier(8)->Range(16, 4096)->Unit(benchmark::kMicrosecond);
+
+// The clustered fragment shader: find the fragment's cluster, then loop over its lights only. Assignment is not timed
+static void BM_ShadeClustered(benchmark::State& state)
+{
+    const std::vector<PointLight> lights = MakeLights(int(state.range(0)));
+    const std::vector<glm::vec3> fragments = MakeFragments(1 << 12);
+    const Camera camera = MakeSceneCamera();
+    ClusteredLighting clusters;
+    clusters.Assign(lights, camera.GetViewMatrix(), camera.GetProjectionMatrix(), camera.GetViewportWidth(), camera.GetViewportHeight(),
+        NEAR_PLANE, FAR_PLANE);
+    const std::vector<uint32_t>& indices = clusters.GetLightIndices();
+    const glm::mat4& view = camera.GetViewMatrix();
+    const glm::mat4& viewProjection = camera.GetViewProjectionMatrix();
+    const glm::vec2 viewport(float(camera.GetViewportWidth()), float(camera.GetViewportHeight()));
+    for (auto _ : state)
+    {
+        glm::vec3 total(0.f);
+        for (const glm::vec3& fragment : fragments)
+        {
+            const glm::vec4 clip = viewProjection * glm::vec4(fragment, 1.f);
+            const glm::vec2 window = (glm::vec2(clip) / clip.w * 0.5f + 0.5f) * viewport;
+            const float viewDepth = -(view * glm::vec4(fragment, 1.f)).z;
+            const ClusterRange& range = clusters.GetRange(clusters.GetClusterIndex(window.x, window.y, viewDepth));
+            for (uint32_t i = range.Offset; i < range.Offset + range.Count; ++i)
+                total += ShadeLight(lights[indices[i]], fragment);
+        }
+        benchmark::DoNotOptimize(total);
+    }
+    state.SetItemsProcessed(state.iterations() * int64_t(fragments.size()));
+    state.counters["lights per cluster"] = double(clusters.GetStats().Assignments) / double(clusters.GetClusterCount());
+}
+BENCHMARK(BM_ShadeClustered)->RangeMultiplier(8)->Range(16, 4096)->Unit(benchmark::kMicrosecond);
+
+// Per-frame scratch the way UCullOccluded used to make it: a fresh std::vector of range(0) (distance, object) pairs
+static void BM_FrameScratchHeap(benchmark::State& state)
+{
+    const uint64_t allocations = UGetHeapAllocations();
+    for (auto _ : state)
+    {
+        std::vector<std::pair<float, uint32_t> > scratch;
+        scratch.reserve(size_t(state.range(0)));
+        for (int64_t i = 0; i < state.range(0); ++i)
+            scratch.push_back({ float(i), uint32_t(i) });
+        benchmark::DoNotOptimize(scratch.data());
+    }
+    SetAllocationCounter(state, allocations);
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_FrameScratchHeap)->RangeMultiplier(8)->Range(8, 1 << 15);
+
+// The same scratch from a FrameArena, reset every iteration as URenderLoop resets it every frame
+static void BM_FrameScratchArena(benchmark::State& state)
+{
+    FrameArena arena;
+    const uint64_t allocations = UGetHeapAllocations();
+    for (auto _ : state)
+    {
+        arena.Reset();
+        FrameVector<std::pair<float, uint32_t> > scratch{ ArenaAllocator<std::pair<float, uint32_t> >(arena) };
+        scratch.reserve(size_t(state.range(0)));
+        for (int64_t i = 0; i < state.range(0); ++i)
+            scratch.push_back({ float(i), uint32_t(i) });
+        benchmark::DoNotOptimize(scratch.data());
+    }
+    SetAllocationCounter(state, allocations);
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_FrameScratchArena)->RangeMultiplier(8)->Range(8, 1 << 15);
+
+// CPU side of UCreateMeshFromVerts for N cubes: the vertices and indices are read from the constexpr arrays, so all
+// that is left is the copy glBufferData makes (here into a staging buffer) and gathering the positions for culling
+static void BM_MeshFromVerts(benchmark::State& state)
+{
+    const int meshCount = int(state.range(0));
+    std::vector<float> staging(cubeVerts.size() + cube.Indices.size());
+    std::vector<glm::vec3> positions;
+    positions.reserve(cube.GetVertexCount());
+
+    for (auto _ : state)
+    {
+        for (int m = 0; m < meshCount; ++m)
+        {
+            std::memcpy(staging.data(), cubeVerts.data(), sizeof(cubeVerts));
+            std::memcpy(staging.data() + cubeVerts.size(), cube.Indices.data(), sizeof(cube.Indices));
+            positions.clear();
+            for (size_t v = 0; v < cube.GetVertexCount(); ++v)
+                positions.push_back(glm::vec3(cubeVerts[v * floatsPerEntry], cubeVerts[v * floatsPerEntry + 1], cubeVerts[v * floatsPerEntry + 2]));
+            benchmark::DoNotOptimize(staging.data());
+            benchmark::DoNotOptimize(positions.data());
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * meshCount);
+    state.counters["bytesPerMesh"] = double(sizeof(cubeVerts) + sizeof(cube.Indices));
+}
+BENCHMARK(BM_MeshFromVerts)->RangeMultiplier(4)->Range(16, 1 << 14);
+
+// What a primitive costs at startup when it is generated at runtime, next to copying the one the compiler built
+template <int Slices>
+static void BM_PrimitiveRuntime(benchmark::State& state)
+{
+    // called through a pointer the optimizer cannot see through, so the generator runs here and not at compile time
+    auto make = &MakeSphere<Slices, Slices / 2>;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(make);
+        auto sphere = make();
+        auto verts = Interleave<PRIMITIVE_POSITION | PRIMITIVE_NORMAL | PRIMITIVE_UV>(sphere);
+        benchmark::DoNotOptimize(sphere);
+        benchmark::DoNotOptimize(verts);
+    }
+    state.SetItemsProcessed(state.iterations() * (Slices + 1) * (Slices / 2 + 1));
+}
+BENCHMARK_TEMPLATE(BM_PrimitiveRuntime, 16);
+BENCHMARK_TEMPLATE(BM_PrimitiveRuntime, 32);
+
+template <int Slices>
+static void BM_PrimitiveConstexpr(benchmark::State& state)
+{
+    static constexpr auto sphere = MakeSphere<Slices, Slices / 2>();
+    static constexpr auto verts = Interleave<PRIMITIVE_POSITION | PRIMITIVE_NORMAL | PRIMITIVE_UV>(sphere);
+    std::vector<float> staging(verts.size());
+    std::vector<uint16_t> indices(sphere.Indices.size());
+    for (auto _ : state)
+    {
+        std::memcpy(staging.data(), verts.data(), sizeof(verts));
+        std::memcpy(indices.data(), sphere.Indices.data(), sizeof(sphere.Indices));
+        benchmark::DoNotOptimize(staging.data());
+        benchmark::DoNotOptimize(indices.data());
+    }
+    state.SetItemsProcessed(state.iterations() * (Slices + 1) * (Slices / 2 + 1));
+}
+BENCHMARK_TEMPLATE(BM_PrimitiveConstexpr, 16);
+BENCHMARK_TEMPLATE(BM_PrimitiveConstexpr, 32);
+
+#ifdef HAVE_OBJ_LOADER
+// Writes an OBJ with N separate cube groups, the shape of the scenes Source.cpp loads
+static std::string WriteCubeObj(int cubeCount)
+{
+    const std::string path = "bench_cubes_" + std::to_string(cubeCount) + ".obj";
+    std::ofstream file(path);
+    for (int c = 0; c < cubeCount; ++c)
+    {
+        file << "o cube" << c << "\n";
+        for (const PrimitiveVertex& vertex : cube.Vertices)
+        {
+            file << "v " << vertex.Position[0] + 3.f * c << " " << vertex.Position[1] << " " << vertex.Position[2] << "\n";
+        }
+        for (size_t t = 0; t < cube.GetIndexCount(); t += 3)
+        {
+            file << "f " << cube.Indices[t] + 1 + 24 * c << " " << cube.Indices[t + 1] + 1 + 24 * c << " " << cube.Indices[t + 2] + 1 + 24 * c << "\n";
+        }
+    }
+    return path;
+}
+
+static void BM_ObjLoad(benchmark::State& state)
+{
+    const std::string path = WriteCubeObj(int(state.range(0)));
+    for (auto _ : state)
+    {
+        objl::Loader loader;
+        bool loaded = loader.LoadFile(path);
+        benchmark::DoNotOptimize(loaded);
+        benchmark::DoNotOptimize(loader.LoadedMeshes.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    std::remove(path.c_str());
+}
+BENCHMARK(BM_ObjLoad)->RangeMultiplier(4)->Range(16, 1 << 12)->Unit(benchmark::kMillisecond);
+#endif
+
+BENCHMARK_MAIN();
@@ -0,0 +1,85 @@
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// Counts every allocation made through operator new (containers, std::function, strings...) on any thread, so a
+// frame can check how many it made. Allocations GL drivers and GLFW make with malloc directly are not seen.
+// Define ALLOCATION_COUNTER_IMPLEMENTATION in exactly one source file before including this header; that file
+// replaces the global operator new and delete. Without it the counter stays at zero
+inline std::atomic<uint64_t> gHeapAllocationCount{ 0 };
+
+inline uint64_t UGetHeapAllocations()
+{
+	return gHeapAllocationCount.load(std::memory_order_relaxed);
+}
+
+#ifdef ALLOCATION_COUNTER_IMPLEMENTATION
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+void* operator new(std::size_t size)
+{
+	gHeapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+	if (void* memory = std::malloc(size ? size : 1))
+		return memory;
+	throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+	gHeapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+	const std::size_t align = std::size_t(alignment);
+	// aligned_alloc wants a multiple of the alignment
+	size = (std::max<std::size_t>(size, 1) + align - 1) / align * align;
+#ifdef _WIN32
+	void* memory = _aligned_malloc(size, align);
+#else
+	void* memory = std::aligned_alloc(align, size);
+#endif
+	if (memory)
+		return memory;
+	throw std::bad_alloc();
+}
+
+// GCC inlines these into callers and then flags the free of memory it saw come from operator new, not knowing
+// the new above is malloc underneath
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+	operator delete(memory);
+}
+
+void operator delete(void* memory, std::align_val_t) noexcept
+{
+#ifdef _WIN32
+	_aligned_free(memory);
+#else
+	std::free(memory);
+#endif
+}
+
+void operator delete(void* memory, std::size_t, std::align_val_t alignment) noexcept
+{
+	operator delete(memory, alignment);
+}
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+
+#include <cfloat>
+
+#include <glm/glm.hpp>
+
+// Axis aligned bounding box. A default constructed box is empty and grows to fit whatever is added to it
+struct Aabb
+{
+	glm::vec3 Min = glm::vec3(FLT_MAX);
+	glm::vec3 Max = glm::vec3(-FLT_MAX);
+
+	Aabb() {}
+	Aabb(const glm::vec3& min, const glm::vec3& max) : Min(min), Max(max) {}
+
+	void Grow(const glm::vec3& point)
+	{
+		Min = glm::min(Min, point);
+		Max = glm::max(Max, point);
+	}
+
+	void Grow(const Aabb& box)
+	{
+		Min = glm::min(Min, box.Min);
+		Max = glm::max(Max, box.Max);
+	}
+
+	bool IsEmpty() const { return Min.x > Max.x; }
+	glm::vec3 Center() const { return (Min + Max) * 0.5f; }
+	glm::vec3 Extent() const { return Max - Min; }
+
+	// used by the surface area heuristic; empty boxes cost nothing
+	float SurfaceArea() const
+	{
+		if (IsEmpty())
+			return 0.0f;
+		const glm::vec3 e = Max - Min;
+		return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+	}
+};
+
+// returns the world space box around a model space box after transforming it by a matrix (Arvo's method)
+inline Aabb TransformAabb(const Aabb& box, const glm::mat4& m)
+{
+	const glm::vec3 center = glm::vec3(m * glm::vec4(box.Center(), 1.0f));
+	const glm::vec3 half = box.Extent() * 0.5f;
+	glm::vec3 extent(0.0f);
+	for (int row = 0; row < 3; ++row)
+		extent[row] = glm::abs(m[0][row]) * half.x + glm::abs(m[1][row]) * half.y + glm::abs(m[2][row]) * half.z;
+	return Aabb(center - extent, center + extent);
+}
+
+
+// Half-infinite ray, used for picking
+struct Ray
+{
+	glm::vec3 Origin;
+	glm::vec3 Direction;
+};
+
+// slab test. On a hit, returns true and the entry distance along the ray (0 if the origin is inside the box)
+inline bool IntersectRayAabb(const glm::vec3& origin, const glm::vec3& inverseDirection, const Aabb& box, float maxDistance, float& distance)
+{
+	float tMin = 0.0f;
+	float tMax = maxDistance;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float t0 = (box.Min[axis] - origin[axis]) * inverseDirection[axis];
+		float t1 = (box.Max[axis] - origin[axis]) * inverseDirection[axis];
+		if (t0 > t1)
+		{
+			const float t = t0;
+			t0 = t1;
+			t1 = t;
+		}
+		tMin = t0 > tMin ? t0 : tMin;
+		tMax = t1 < tMax ? t1 : tMax;
+		if (tMin > tMax)
+			return false;
+	}
+	distance = tMin;
+	return true;
+}
+#endif
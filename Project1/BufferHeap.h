@@ -0,0 +1,346 @@
+#ifndef BUFFER_HEAP_H
+#define BUFFER_HEAP_H
+
+
+#include <cstdint>
+#include <initializer_list>
+#include <iostream>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "GpuMemory.h"
+#include "OffsetAllocator.h"
+
+typedef uint32_t BufferRangeHandle;
+const BufferRangeHandle NO_BUFFER_RANGE = 0xffffffffu;
+
+const uint32_t BUFFER_HEAP_DEFAULT_ARENA = 4u << 20;
+const uint32_t BUFFER_HEAP_MAX_ATTRIBUTES = 8;
+
+// Where a mesh's vertices and indices ended up: bind Vao, then draw IndexCount indices from FirstIndex with BaseVertex
+struct BufferRange
+{
+	GLuint Vao = 0;
+	GLuint Buffer = 0;
+	uint32_t FirstIndex = 0;
+	int32_t BaseVertex = 0;
+	uint32_t IndexCount = 0;
+	uint32_t VertexCount = 0;
+};
+
+struct BufferHeapStats
+{
+	uint32_t Arenas = 0;
+	uint32_t Ranges = 0;
+	uint64_t ArenaBytes = 0;
+	uint64_t UsedBytes = 0;
+	uint64_t LargestFreeBytes = 0;      // the largest block any arena can still hand out
+	uint64_t MovedBytes = 0;            // by Defragment, since Create
+	uint32_t Moves = 0;
+};
+
+
+// Sub-allocates the vertices and indices of many meshes of one vertex format from a few large buffers (arenas) instead
+// of a buffer pair each. Each arena has one VAO with the arena bound as both vertex and index buffer, so meshes in the
+// same arena draw back to back without rebinding anything. A mesh is one block of its arena: the vertices, aligned to the
+// vertex size so a base vertex reaches them, then the 16 bit indices.
+// Blocks come from an OffsetAllocator per arena; when none has room a new arena is made, at least large enough for the
+// mesh. Defragment moves meshes out of the emptiest arena into the others' free space on the GPU and releases it once
+// empty; the ranges of moved meshes change, which GetVersion tells. Only use it on the thread that owns the GL context
+class BufferHeap
+{
+public:
+	// attributeSizes are the float counts of the vertex attributes in order, bound to locations 0, 1, .... owner is what the
+	// arenas are recorded under in gGpuMemory
+	void Create(std::initializer_list<uint32_t> attributeSizes, const char* owner, uint32_t arenaBytes = BUFFER_HEAP_DEFAULT_ARENA)
+	{
+		AttributeCount = 0;
+		FloatsPerVertex = 0;
+		for (uint32_t size : attributeSizes)
+		{
+			if (AttributeCount < BUFFER_HEAP_MAX_ATTRIBUTES)
+				AttributeSizes[AttributeCount++] = size;
+			FloatsPerVertex += size;
+		}
+		Owner = owner;
+		ArenaBytes = arenaBytes;
+		Stats = BufferHeapStats();
+		Version = 0;
+	}
+
+	void Destroy()
+	{
+		for (Arena& arena : Arenas)
+			releaseArena(arena);
+		Arenas.clear();
+		Slots.clear();
+		FreeSlots.clear();
+		Stats = BufferHeapStats();
+	}
+
+	// copies a mesh into the heap. vertices holds vertexCount vertices of the heap's format
+	BufferRangeHandle Allocate(const float* vertices, uint32_t vertexCount, const uint16_t* indices, uint32_t indexCount)
+	{
+		Slot slot;
+		slot.Range.VertexCount = vertexCount;
+		slot.Range.IndexCount = indexCount;
+		if (!place(slot, NO_ARENA))
+			return NO_BUFFER_RANGE;
+
+		const Arena& arena = Arenas[slot.Arena];
+		const uint32_t vertexBytes = vertexCount * getStride();
+		glBindBuffer(GL_COPY_WRITE_BUFFER, arena.Buffer);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, slot.VertexOffset, vertexBytes, vertices);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, slot.VertexOffset + vertexBytes, indexCount * sizeof(uint16_t), indices);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		slot.Live = true;
+		BufferRangeHandle handle;
+		if (!FreeSlots.empty())
+		{
+			handle = FreeSlots.back();
+			FreeSlots.pop_back();
+			Slots[handle] = slot;
+		}
+		else
+		{
+			handle = BufferRangeHandle(Slots.size());
+			Slots.push_back(slot);
+		}
+		Stats.Ranges++;
+		return handle;
+	}
+
+	void Free(BufferRangeHandle handle)
+	{
+		if (handle == NO_BUFFER_RANGE || handle >= Slots.size() || !Slots[handle].Live)
+			return;
+		Slot& slot = Slots[handle];
+		Arenas[slot.Arena].Allocator.Free(slot.Block);
+		Stats.UsedBytes -= slot.Bytes;
+		slot = Slot();
+		FreeSlots.push_back(handle);
+		Stats.Ranges--;
+	}
+
+	const BufferRange& Get(BufferRangeHandle handle) const { return Slots[handle].Range; }
+
+	// moves meshes out of the arena with the least in use into the other arenas, copying at most maxBytes, and releases
+	// the arena once it is empty. Does nothing unless the others have room for all of it, so meshes never move twice on
+	// the way. Returns the bytes copied
+	uint64_t Defragment(uint64_t maxBytes)
+	{
+		uint32_t source = NO_ARENA;
+		uint64_t othersFree = 0;
+		for (uint32_t a = 0; a < uint32_t(Arenas.size()); ++a)
+		{
+			const Arena& arena = Arenas[a];
+			if (arena.Buffer == 0)
+				continue;
+			othersFree += arena.Allocator.GetFreeBytes();
+			if (source == NO_ARENA || getUsed(arena) < getUsed(Arenas[source]))
+				source = a;
+		}
+		if (source == NO_ARENA)
+			return 0;
+		Arena& emptiest = Arenas[source];
+		othersFree -= emptiest.Allocator.GetFreeBytes();
+		if (emptiest.Allocator.GetAllocationCount() == 0)
+		{
+			// left over from earlier moves; the last arena stays for the next Allocate
+			if (Stats.Arenas > 1)
+				releaseArena(emptiest);
+			return 0;
+		}
+		// the slack leaves room for the blocks rounding up past the free space in what they leave behind
+		if (Stats.Arenas < 2 || getUsed(emptiest) + getUsed(emptiest) / 4 > othersFree)
+			return 0;
+
+		uint64_t moved = 0;
+		for (Slot& slot : Slots)
+		{
+			if (moved >= maxBytes)
+				break;
+			if (!slot.Live || slot.Arena != source)
+				continue;
+			const Slot before = slot;
+			if (!place(slot, source))
+				break;
+
+			const uint32_t bytes = slot.Range.VertexCount * getStride() + slot.Range.IndexCount * uint32_t(sizeof(uint16_t));
+			glBindBuffer(GL_COPY_READ_BUFFER, Arenas[before.Arena].Buffer);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, Arenas[slot.Arena].Buffer);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, before.VertexOffset, slot.VertexOffset, bytes);
+			Arenas[before.Arena].Allocator.Free(before.Block);
+			Stats.UsedBytes -= before.Bytes;
+			moved += bytes;
+			Stats.Moves++;
+		}
+		if (moved > 0)
+		{
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+			Stats.MovedBytes += moved;
+			Version++;
+		}
+		if (emptiest.Allocator.GetAllocationCount() == 0)
+			releaseArena(emptiest);
+		return moved;
+	}
+
+	// changes whenever Defragment moved a mesh, so draws recorded from older ranges must be rebuilt
+	uint32_t GetVersion() const { return Version; }
+
+	const BufferHeapStats& GetStats()
+	{
+		Stats.LargestFreeBytes = 0;
+		for (const Arena& arena : Arenas)
+		{
+			if (arena.Buffer != 0 && arena.Allocator.GetLargestFree() > Stats.LargestFreeBytes)
+				Stats.LargestFreeBytes = arena.Allocator.GetLargestFree();
+		}
+		return Stats;
+	}
+
+private:
+	static const uint32_t NO_ARENA = 0xffffffffu;
+
+	struct Arena
+	{
+		GLuint Buffer = 0;
+		GLuint Vao = 0;
+		OffsetAllocator Allocator;
+	};
+
+	struct Slot
+	{
+		uint32_t Arena = NO_ARENA;
+		OffsetAllocator::Allocation Block;
+		uint32_t Bytes = 0;             // of the block, alignment included
+		uint32_t VertexOffset = 0;
+		BufferRange Range;
+		bool Live = false;
+	};
+
+	std::vector<Arena> Arenas;          // released ones keep their place, with Buffer 0, so slots' indices stay put
+	std::vector<Slot> Slots;
+	std::vector<BufferRangeHandle> FreeSlots;
+	BufferHeapStats Stats;
+	const char* Owner = "buffer heap";
+	uint32_t ArenaBytes = BUFFER_HEAP_DEFAULT_ARENA;
+	uint32_t AttributeSizes[BUFFER_HEAP_MAX_ATTRIBUTES];
+	uint32_t AttributeCount = 0;
+	uint32_t FloatsPerVertex = 0;
+	uint32_t Version = 0;
+
+	uint32_t getStride() const { return FloatsPerVertex * uint32_t(sizeof(float)); }
+	static uint64_t getUsed(const Arena& arena) { return arena.Allocator.GetCapacity() - arena.Allocator.GetFreeBytes(); }
+
+	// finds a block for slot's counts in any arena but skip, making an arena if none has room, and fills in where it went
+	bool place(Slot& slot, uint32_t skip)
+	{
+		const uint32_t stride = getStride();
+		// up to stride - 1 bytes in front so the vertices start on a multiple of the stride
+		const uint64_t bytes = uint64_t(slot.Range.VertexCount) * stride + uint64_t(slot.Range.IndexCount) * sizeof(uint16_t) + stride - 1;
+		if (stride == 0 || bytes >= (1ull << 31))
+		{
+			std::cout << "ERROR::BUFFER_HEAP::" << Owner << "::mesh of " << bytes << " bytes is too large" << std::endl;
+			return false;
+		}
+
+		uint32_t arena = NO_ARENA;
+		OffsetAllocator::Allocation block;
+		for (uint32_t a = 0; a < uint32_t(Arenas.size()) && !block.IsValid(); ++a)
+		{
+			if (a == skip || Arenas[a].Buffer == 0)
+				continue;
+			block = Arenas[a].Allocator.Allocate(uint32_t(bytes));
+			arena = a;
+		}
+		if (!block.IsValid())
+		{
+			// moving meshes out of an arena never grows the heap
+			if (skip != NO_ARENA)
+				return false;
+			arena = createArena(uint32_t(bytes) > ArenaBytes ? uint32_t(bytes) : ArenaBytes);
+			block = Arenas[arena].Allocator.Allocate(uint32_t(bytes));
+			if (!block.IsValid())
+			{
+				std::cout << "ERROR::BUFFER_HEAP::" << Owner << "::no block of " << bytes << " bytes in a new arena of " << Arenas[arena].Allocator.GetCapacity()
+					<< " bytes" << std::endl;
+				releaseArena(Arenas[arena]);
+				return false;
+			}
+		}
+
+		const uint32_t vertexOffset = (block.Offset + stride - 1) / stride * stride;
+		slot.Arena = arena;
+		slot.Block = block;
+		slot.Bytes = uint32_t(bytes);
+		slot.VertexOffset = vertexOffset;
+		slot.Range.Vao = Arenas[arena].Vao;
+		slot.Range.Buffer = Arenas[arena].Buffer;
+		slot.Range.BaseVertex = int32_t(vertexOffset / stride);
+		slot.Range.FirstIndex = (vertexOffset + slot.Range.VertexCount * stride) / uint32_t(sizeof(uint16_t));
+		Stats.UsedBytes += bytes;
+		return true;
+	}
+
+	uint32_t createArena(uint32_t bytes)
+	{
+		uint32_t index = uint32_t(Arenas.size());
+		for (uint32_t a = 0; a < uint32_t(Arenas.size()); ++a)
+		{
+			if (Arenas[a].Buffer == 0)
+			{
+				index = a;
+				break;
+			}
+		}
+		if (index == Arenas.size())
+			Arenas.push_back(Arena());
+		Arena& arena = Arenas[index];
+
+		glGenBuffers(1, &arena.Buffer);
+		glGenVertexArrays(1, &arena.Vao);
+		glBindVertexArray(arena.Vao);
+		glBindBuffer(GL_ARRAY_BUFFER, arena.Buffer);
+		// immutable storage lets the driver place the arena once; it is only written with glBufferSubData and copies
+		if (GLEW_ARB_buffer_storage)
+			UBufferStorage(GL_ARRAY_BUFFER, arena.Buffer, bytes, NULL, GL_DYNAMIC_STORAGE_BIT, Owner);
+		else
+			UBufferData(GL_ARRAY_BUFFER, arena.Buffer, bytes, NULL, GL_STATIC_DRAW, Owner);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, arena.Buffer);
+
+		const GLsizei stride = GLsizei(getStride());
+		size_t offset = 0;
+		for (uint32_t a = 0; a < AttributeCount; ++a)
+		{
+			glVertexAttribPointer(a, GLint(AttributeSizes[a]), GL_FLOAT, GL_FALSE, stride, (const void*)(offset * sizeof(float)));
+			glEnableVertexAttribArray(a);
+			offset += AttributeSizes[a];
+		}
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		arena.Allocator.Reset(bytes);
+		Stats.Arenas++;
+		Stats.ArenaBytes += bytes;
+		return index;
+	}
+
+	void releaseArena(Arena& arena)
+	{
+		if (arena.Buffer == 0)
+			return;
+		Stats.ArenaBytes -= arena.Allocator.GetCapacity();
+		Stats.Arenas--;
+		glDeleteVertexArrays(1, &arena.Vao);
+		UDeleteBuffers(1, &arena.Buffer);
+		arena.Buffer = 0;
+		arena.Vao = 0;
+		arena.Allocator.Reset(0);
+	}
+};
+#endif
@@ -0,0 +1,368 @@
+#ifndef BVH_H
+#define BVH_H
+
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Bounds.h"
+#include "Frustum.h"
+
+// Tree limits. The depth cap bounds the fixed traversal stacks below
+const int BVH_BINS = 16;
+const uint32_t BVH_MAX_LEAF_SIZE = 4;
+const int BVH_MAX_DEPTH = 64;
+
+
+// One node of the flat node array: 32 bytes, so two fit in a cache line.
+// An interior node (Count == 0) has its children next to each other at LeftFirst and LeftFirst + 1;
+// a leaf owns Count entries of the object index array starting at LeftFirst
+struct BvhNode
+{
+	glm::vec3 Min;
+	uint32_t LeftFirst;
+	glm::vec3 Max;
+	uint32_t Count;
+
+	bool IsLeaf() const { return Count != 0; }
+};
+
+
+// Bounding volume hierarchy over one box per scene object, built with a binned surface area heuristic.
+// Moving objects are handled with Refit, which keeps the topology and only updates the boxes
+class Bvh
+{
+public:
+	// builds the tree. bounds[i] is the world space box of object i
+	void Build(const std::vector<Aabb>& bounds)
+	{
+		const uint32_t objectCount = uint32_t(bounds.size());
+		Nodes.clear();
+		ObjectIndices.resize(objectCount);
+		LeafBounds.resize(objectCount);
+		if (objectCount == 0)
+			return;
+
+		// the boxes and centroids are partitioned together with the indices, so the build reads them sequentially
+		// and LeafBounds ends up in leaf order for the queries
+		Centroids.resize(objectCount);
+		for (uint32_t i = 0; i < objectCount; ++i)
+		{
+			ObjectIndices[i] = i;
+			LeafBounds[i] = bounds[i];
+			Centroids[i] = bounds[i].Center();
+		}
+
+		// a binary tree with leaves of at least one object never needs more than 2N - 1 nodes
+		Nodes.resize(2 * size_t(objectCount) - 1);
+		BvhNode& root = Nodes[0];
+		root.LeftFirst = 0;
+		root.Count = objectCount;
+		Aabb rootBox;
+		for (uint32_t i = 0; i < objectCount; ++i)
+			rootBox.Grow(bounds[i]);
+		root.Min = rootBox.Min;
+		root.Max = rootBox.Max;
+		uint32_t nodesUsed = 1;
+
+		// split nodes from an explicit stack rather than by recursion; the depth travels with each entry
+		struct BuildEntry { uint32_t Node; int Depth; };
+		std::vector<BuildEntry> stack;
+		stack.push_back({ 0, 0 });
+		while (!stack.empty())
+		{
+			const BuildEntry entry = stack.back();
+			stack.pop_back();
+
+			Aabb leftBox, rightBox;
+			uint32_t leftCount = 0;
+			if (entry.Depth + 1 >= BVH_MAX_DEPTH || !split(Nodes[entry.Node], leftBox, rightBox, leftCount))
+				continue;
+
+			BvhNode& node = Nodes[entry.Node];
+			const uint32_t left = nodesUsed;
+			nodesUsed += 2;
+			Nodes[left].LeftFirst = node.LeftFirst;
+			Nodes[left].Count = leftCount;
+			Nodes[left].Min = leftBox.Min;
+			Nodes[left].Max = leftBox.Max;
+			Nodes[left + 1].LeftFirst = node.LeftFirst + leftCount;
+			Nodes[left + 1].Count = node.Count - leftCount;
+			Nodes[left + 1].Min = rightBox.Min;
+			Nodes[left + 1].Max = rightBox.Max;
+			node.LeftFirst = left;
+			node.Count = 0;
+
+			stack.push_back({ left + 1, entry.Depth + 1 });
+			stack.push_back({ left, entry.Depth + 1 });
+		}
+		Nodes.resize(nodesUsed);
+		Centroids.clear();
+	}
+
+	// updates every box bottom up after objects moved. Children are always stored after their parent, so one reverse pass is enough.
+	// The tree gets less efficient if objects move far; rebuild when that matters
+	void Refit(const std::vector<Aabb>& bounds)
+	{
+		for (size_t i = 0; i < ObjectIndices.size(); ++i)
+			LeafBounds[i] = bounds[ObjectIndices[i]];
+
+		for (size_t n = Nodes.size(); n-- > 0;)
+		{
+			BvhNode& node = Nodes[n];
+			Aabb box;
+			if (node.IsLeaf())
+			{
+				for (uint32_t i = 0; i < node.Count; ++i)
+					box.Grow(LeafBounds[node.LeftFirst + i]);
+			}
+			else
+			{
+				const BvhNode& left = Nodes[node.LeftFirst];
+				const BvhNode& right = Nodes[node.LeftFirst + 1];
+				box.Grow(Aabb(left.Min, left.Max));
+				box.Grow(Aabb(right.Min, right.Max));
+			}
+			node.Min = box.Min;
+			node.Max = box.Max;
+		}
+	}
+
+	// appends the index of every object whose box is at least partly inside the frustum
+	void QueryFrustum(const Frustum& frustum, std::vector<uint32_t>& visible) const
+	{
+		if (Nodes.empty())
+			return;
+
+		uint32_t stack[BVH_MAX_DEPTH];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0)
+		{
+			const BvhNode& node = Nodes[stack[--top]];
+			const Frustum_Test test = frustum.ClassifyAabb(node.Min, node.Max);
+			if (test == FRUSTUM_OUTSIDE)
+				continue;
+			if (test == FRUSTUM_INSIDE)
+			{
+				// nothing below can be outside; skip the plane tests
+				appendSubtree(node, visible);
+				continue;
+			}
+			if (node.IsLeaf())
+			{
+				for (uint32_t i = node.LeftFirst; i < node.LeftFirst + node.Count; ++i)
+				{
+					if (frustum.IntersectsAabb(LeafBounds[i].Min, LeafBounds[i].Max))
+						visible.push_back(ObjectIndices[i]);
+				}
+				continue;
+			}
+			stack[top++] = node.LeftFirst + 1;
+			stack[top++] = node.LeftFirst;
+		}
+	}
+
+	// finds the closest object box along the ray. Returns false if nothing is hit within maxDistance
+	bool Raycast(const Ray& ray, float maxDistance, uint32_t& object, float& distance) const
+	{
+		if (Nodes.empty())
+			return false;
+
+		const glm::vec3 inverseDirection = 1.0f / ray.Direction;
+		float closest = maxDistance;
+		bool hit = false;
+
+		uint32_t stack[BVH_MAX_DEPTH];
+		int top = 0;
+		float entry;
+		if (!IntersectRayAabb(ray.Origin, inverseDirection, Aabb(Nodes[0].Min, Nodes[0].Max), closest, entry))
+			return false;
+		stack[top++] = 0;
+		while (top > 0)
+		{
+			const BvhNode& node = Nodes[stack[--top]];
+			if (node.IsLeaf())
+			{
+				for (uint32_t i = node.LeftFirst; i < node.LeftFirst + node.Count; ++i)
+				{
+					float t;
+					if (IntersectRayAabb(ray.Origin, inverseDirection, LeafBounds[i], closest, t))
+					{
+						closest = t;
+						object = ObjectIndices[i];
+						hit = true;
+					}
+				}
+				continue;
+			}
+
+			// visit the nearer child first so later boxes can be rejected by the shrinking distance
+			uint32_t nearChild = node.LeftFirst;
+			uint32_t farChild = node.LeftFirst + 1;
+			float nearT, farT;
+			bool nearHit = IntersectRayAabb(ray.Origin, inverseDirection, Aabb(Nodes[nearChild].Min, Nodes[nearChild].Max), closest, nearT);
+			bool farHit = IntersectRayAabb(ray.Origin, inverseDirection, Aabb(Nodes[farChild].Min, Nodes[farChild].Max), closest, farT);
+			if (farHit && (!nearHit || farT < nearT))
+			{
+				const uint32_t child = nearChild; nearChild = farChild; farChild = child;
+				const float t = nearT; nearT = farT; farT = t;
+				const bool h = nearHit; nearHit = farHit; farHit = h;
+			}
+			if (farHit)
+				stack[top++] = farChild;
+			if (nearHit)
+				stack[top++] = nearChild;
+		}
+
+		if (hit)
+			distance = closest;
+		return hit;
+	}
+
+	bool IsEmpty() const { return Nodes.empty(); }
+	size_t GetNodeCount() const { return Nodes.size(); }
+	const std::vector<BvhNode>& GetNodes() const { return Nodes; }
+	const std::vector<uint32_t>& GetObjectIndices() const { return ObjectIndices; }
+
+private:
+	std::vector<BvhNode> Nodes;
+	std::vector<uint32_t> ObjectIndices;    // leaf ranges index into this
+	std::vector<Aabb> LeafBounds;           // object boxes, in the same order as ObjectIndices
+	std::vector<glm::vec3> Centroids;       // only used while building
+
+	// picks the cheapest binned SAH split of a node and partitions its objects. Returns false if the node should stay a leaf
+	bool split(const BvhNode& node, Aabb& bestLeft, Aabb& bestRight, uint32_t& bestLeftCount)
+	{
+		if (node.Count <= BVH_MAX_LEAF_SIZE)
+			return false;
+
+		const uint32_t first = node.LeftFirst;
+		const uint32_t last = node.LeftFirst + node.Count;
+
+		Aabb centroidBox;
+		for (uint32_t i = first; i < last; ++i)
+			centroidBox.Grow(Centroids[i]);
+
+		// cost of not splitting, in units of one object test
+		const float nodeArea = Aabb(node.Min, node.Max).SurfaceArea();
+		float bestCost = float(node.Count);
+		int bestAxis = -1;
+		int bestBin = 0;
+
+		// bin all three axes in one pass so each object box is read once
+		Aabb binBox[3][BVH_BINS];
+		uint32_t binCount[3][BVH_BINS] = {};
+		glm::vec3 scale(0.0f);
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			const float extent = centroidBox.Max[axis] - centroidBox.Min[axis];
+			scale[axis] = extent > 0.0f ? float(BVH_BINS) / extent : 0.0f;
+		}
+		for (uint32_t i = first; i < last; ++i)
+		{
+			const glm::vec3 offset = (Centroids[i] - centroidBox.Min) * scale;
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				const int bin = glm::min(BVH_BINS - 1, int(offset[axis]));
+				binBox[axis][bin].Grow(LeafBounds[i]);
+				binCount[axis][bin]++;
+			}
+		}
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			if (scale[axis] == 0.0f)
+				continue;
+
+			// sweep from both ends to get the area and count on each side of every bin boundary
+			float leftArea[BVH_BINS - 1], rightArea[BVH_BINS - 1];
+			uint32_t leftCount[BVH_BINS - 1], rightCount[BVH_BINS - 1];
+			Aabb leftBox, rightBox;
+			uint32_t leftSum = 0, rightSum = 0;
+			for (int i = 0; i < BVH_BINS - 1; ++i)
+			{
+				leftSum += binCount[axis][i];
+				leftBox.Grow(binBox[axis][i]);
+				leftCount[i] = leftSum;
+				leftArea[i] = leftBox.SurfaceArea();
+
+				rightSum += binCount[axis][BVH_BINS - 1 - i];
+				rightBox.Grow(binBox[axis][BVH_BINS - 1 - i]);
+				rightCount[BVH_BINS - 2 - i] = rightSum;
+				rightArea[BVH_BINS - 2 - i] = rightBox.SurfaceArea();
+			}
+
+			for (int i = 0; i < BVH_BINS - 1; ++i)
+			{
+				if (leftCount[i] == 0 || rightCount[i] == 0)
+					continue;
+				// one traversal step plus the expected object tests on each side
+				const float cost = 1.0f + (leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i]) / nodeArea;
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestBin = i;
+				}
+			}
+		}
+
+		if (bestAxis < 0)
+			return false;
+
+		// partition the index range in place around the chosen bin boundary
+		const float lo = centroidBox.Min[bestAxis];
+		const float axisScale = scale[bestAxis];
+		uint32_t i = first;
+		uint32_t j = last;
+		bestLeft = Aabb();
+		bestRight = Aabb();
+		while (i < j)
+		{
+			const int bin = glm::min(BVH_BINS - 1, int((Centroids[i][bestAxis] - lo) * axisScale));
+			if (bin <= bestBin)
+			{
+				bestLeft.Grow(LeafBounds[i]);
+				++i;
+			}
+			else
+			{
+				--j;
+				bestRight.Grow(LeafBounds[i]);
+				std::swap(ObjectIndices[i], ObjectIndices[j]);
+				std::swap(LeafBounds[i], LeafBounds[j]);
+				std::swap(Centroids[i], Centroids[j]);
+			}
+		}
+		bestLeftCount = i - first;
+		return bestLeftCount != 0 && bestLeftCount != node.Count;
+	}
+
+	// adds every object under a node without testing it
+	void appendSubtree(const BvhNode& root, std::vector<uint32_t>& visible) const
+	{
+		uint32_t stack[BVH_MAX_DEPTH];
+		int top = 0;
+		const BvhNode* node = &root;
+		for (;;)
+		{
+			if (node->IsLeaf())
+			{
+				visible.insert(visible.end(), ObjectIndices.begin() + node->LeftFirst, ObjectIndices.begin() + node->LeftFirst + node->Count);
+				if (top == 0)
+					return;
+				node = &Nodes[stack[--top]];
+			}
+			else
+			{
+				stack[top++] = node->LeftFirst + 1;
+				node = &Nodes[node->LeftFirst];
+			}
+		}
+	}
+};
+#endif
@@ -4,9 +4,15 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
 
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
+#include "Bounds.h"
+#include "Frustum.h"
+
 // Defines several possible options for camera movement. Used as abstraction to stay away from window-system specific input methods
 enum Camera_Movement {
 	FORWARD,
@@ -23,56 +29,213 @@ const float PITCH = 0.0f;
 const float SPEED = 2.5f;
 const float SENSITIVITY = 0.1f;
 const float ZOOM = 45.0f;
+const float NEAR_PLANE = 0.1f;
+const float FAR_PLANE = 100.0f;
+const float ORTHO_HALF_HEIGHT = 2.0f;
 
 
-// An abstract camera class that processes input and calculates the corresponding Euler Angles, Vectors and Matrices for use in OpenGL
+// An abstract camera class that processes input and calculates the corresponding orientation, vectors and matrices for use in OpenGL.
+// Input only records the change and bumps a version counter; the orientation quaternion, vectors, matrices and frustum
+// are rebuilt lazily the first time they are asked for, so everything that reads them in a frame shares one cached set.
 class Camera
 {
 public:
-	// camera Attributes
-	glm::vec3 Position;
-	glm::vec3 Front;
-	glm::vec3 Up;
-	glm::vec3 Right;
-	glm::vec3 WorldUp;
-	glm::vec3 Down;
-	// euler Angles
-	float Yaw;
-	float Pitch;
 	// camera options
 	float MovementSpeed;
 	float MouseSensitivity;
-	float Zoom;
 
 	// constructor with vectors
-	Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), float yaw = YAW, float pitch = PITCH) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
+	Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), float yaw = YAW, float pitch = PITCH) : MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
 	{
 		Position = position;
 		WorldUp = up;
 		Yaw = yaw;
 		Pitch = pitch;
-		updateCameraVectors();
 	}
 	// constructor with scalar values
-	Camera(float posX, float posY, float posZ, float upX, float upY, float upZ, float yaw, float pitch) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
+	Camera(float posX, float posY, float posZ, float upX, float upY, float upZ, float yaw, float pitch) : MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
 	{
 		Position = glm::vec3(posX, posY, posZ);
 		WorldUp = glm::vec3(upX, upY, upZ);
 		Yaw = yaw;
 		Pitch = pitch;
-		updateCameraVectors();
 	}
 
-	// returns the view matrix calculated using Euler Angles and the LookAt Matrix
-	glm::mat4 GetViewMatrix()
+	const glm::vec3& GetPosition() const { return Position; }
+	float GetYaw() const { return Yaw; }
+	float GetPitch() const { return Pitch; }
+	float GetZoom() const { return Zoom; }
+	bool IsPerspective() const { return Perspective; }
+	bool IsReverseZ() const { return ReverseZ; }
+	float GetAspect() const { return float(ViewportWidth) / float(ViewportHeight); }
+
+	void SetPosition(const glm::vec3& position)
+	{
+		if (position == Position)
+			return;
+		Position = position;
+		++PositionVersion;
+	}
+
+	// switches between the perspective and the orthographic projection
+	void SetPerspective(bool perspective)
+	{
+		if (perspective == Perspective)
+			return;
+		Perspective = perspective;
+		++ProjectionVersion;
+	}
+
+	// switches the matrix draws are transformed with to reversed-Z: depth 1 at the near plane falling to 0 at an infinite
+	// far plane (FAR_PLANE in the orthographic view), for a 0 to 1 clip depth range (glClipControl) and a float depth
+	// buffer. Culling, picking and the light clusters keep the regular matrices and FAR_PLANE
+	void SetReverseZ(bool reverseZ)
+	{
+		if (reverseZ == ReverseZ)
+			return;
+		ReverseZ = reverseZ;
+		++ProjectionVersion;
+	}
+
+	// keeps the projection aspect in step with the framebuffer. A minimized window reports 0x0, which is ignored
+	void SetViewport(int width, int height)
+	{
+		if (width <= 0 || height <= 0 || (width == ViewportWidth && height == ViewportHeight))
+			return;
+		ViewportWidth = width;
+		ViewportHeight = height;
+		++ProjectionVersion;
+	}
+
+	// changes whenever anything that affects the matrices changes; lets callers cache their own derived data
+	unsigned int GetVersion() const { return OrientationVersion + PositionVersion + ProjectionVersion; }
+
+	const glm::quat& GetOrientation() const { updateCameraVectors(); return Orientation; }
+	const glm::vec3& GetFront() const { updateCameraVectors(); return Front; }
+	const glm::vec3& GetRight() const { updateCameraVectors(); return Right; }
+	const glm::vec3& GetUp() const { updateCameraVectors(); return Up; }
+
+	// returns the view matrix calculated from the orientation quaternion and position
+	const glm::mat4& GetViewMatrix() const
+	{
+		const unsigned int version = OrientationVersion + PositionVersion;
+		if (ViewStamp != version)
+		{
+			updateCameraVectors();
+			View = glm::translate(glm::mat4_cast(glm::conjugate(Orientation)), -Position);
+			ViewStamp = version;
+		}
+		return View;
+	}
+
+	// returns the perspective (using Zoom as the vertical field of view in degrees) or orthographic projection for the current viewport
+	const glm::mat4& GetProjectionMatrix() const
+	{
+		if (ProjectionStamp != ProjectionVersion)
+		{
+			const float aspect = GetAspect();
+			if (Perspective)
+				Projection = glm::perspective(glm::radians(Zoom), aspect, NEAR_PLANE, FAR_PLANE);
+			else
+				Projection = glm::ortho(-ORTHO_HALF_HEIGHT * aspect, ORTHO_HALF_HEIGHT * aspect, -ORTHO_HALF_HEIGHT, ORTHO_HALF_HEIGHT, NEAR_PLANE, FAR_PLANE);
+			ProjectionStamp = ProjectionVersion;
+		}
+		return Projection;
+	}
+
+	const glm::mat4& GetViewProjectionMatrix() const
+	{
+		const unsigned int version = GetVersion();
+		if (ViewProjectionStamp != version)
+		{
+			ViewProjection = GetProjectionMatrix() * GetViewMatrix();
+			ViewProjectionStamp = version;
+		}
+		return ViewProjection;
+	}
+
+	// returns the view-projection matrix draws are transformed with: the regular one, or its reversed-Z form
+	const glm::mat4& GetDrawViewProjectionMatrix() const
+	{
+		if (!ReverseZ)
+			return GetViewProjectionMatrix();
+		const unsigned int version = GetVersion();
+		if (DrawViewProjectionStamp != version)
+		{
+			// only the row that makes clip space z changes: z = near against w = -z in view space in perspective,
+			// (z + far) / (far - near) against w = 1 in orthographic
+			glm::mat4 projection = GetProjectionMatrix();
+			if (Perspective)
+			{
+				projection[2][2] = 0.0f;
+				projection[3][2] = NEAR_PLANE;
+			}
+			else
+			{
+				projection[2][2] = 1.0f / (FAR_PLANE - NEAR_PLANE);
+				projection[3][2] = FAR_PLANE / (FAR_PLANE - NEAR_PLANE);
+			}
+			DrawViewProjection = projection * GetViewMatrix();
+			DrawViewProjectionStamp = version;
+		}
+		return DrawViewProjection;
+	}
+
+	// returns the world space clip planes of the current view-projection matrix
+	const Frustum& GetFrustum() const
+	{
+		const unsigned int version = GetVersion();
+		if (FrustumStamp != version)
+		{
+			FrustumPlanes = Frustum::FromMatrix(GetViewProjectionMatrix());
+			FrustumStamp = version;
+		}
+		return FrustumPlanes;
+	}
+
+	// returns the world space ray through a point on the viewport, in window pixels with the origin at the top left (as GLFW reports the cursor)
+	Ray GetRay(float screenX, float screenY) const
+	{
+		const glm::vec2 ndc(2.0f * screenX / float(ViewportWidth) - 1.0f, 1.0f - 2.0f * screenY / float(ViewportHeight));
+		const glm::mat4 inverseViewProjection = glm::inverse(GetViewProjectionMatrix());
+		glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndc.x, ndc.y, -1.0f, 1.0f);
+		glm::vec4 farPoint = inverseViewProjection * glm::vec4(ndc.x, ndc.y, 1.0f, 1.0f);
+		nearPoint /= nearPoint.w;
+		farPoint /= farPoint.w;
+
+		Ray ray;
+		ray.Origin = glm::vec3(nearPoint);
+		ray.Direction = glm::normalize(glm::vec3(farPoint) - glm::vec3(nearPoint));
+		return ray;
+	}
+
+	// returns the view-projection matrix of a region size pixels square around a point on the viewport (in the pixels
+	// GetRay takes): what the camera sees there, stretched over a viewport of size by size pixels. Drawing with it into
+	// a target that small rasterizes only the pixels around the point, and its frustum culls everything else. forDrawing
+	// picks the reversed-Z matrix when that is on, like GetDrawViewProjectionMatrix
+	glm::mat4 GetPickMatrix(float screenX, float screenY, int size, bool forDrawing = false) const
 	{
-		return glm::lookAt(Position, Position + Front, Up);
+		const glm::vec2 ndc(2.0f * screenX / float(ViewportWidth) - 1.0f, 1.0f - 2.0f * screenY / float(ViewportHeight));
+		const glm::vec2 scale(float(ViewportWidth) / float(size), float(ViewportHeight) / float(size));
+		glm::mat4 region(1.0f);
+		region[0][0] = scale.x;
+		region[1][1] = scale.y;
+		region[3][0] = -ndc.x * scale.x;
+		region[3][1] = -ndc.y * scale.y;
+		return region * (forDrawing ? GetDrawViewProjectionMatrix() : GetViewProjectionMatrix());
 	}
 
+	int GetViewportWidth() const { return ViewportWidth; }
+	int GetViewportHeight() const { return ViewportHeight; }
+
 	// processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
 	void ProcessKeyboard(Camera_Movement direction, float deltaTime)
 	{
+		updateCameraVectors();
+
 		float velocity = MovementSpeed * deltaTime;
+		if (velocity == 0.0f)
+			return;
 		if (direction == FORWARD)
 			Position += Front * velocity;
 		if (direction == BACKWARD)
@@ -85,14 +248,17 @@ public:
 			Position += Up * velocity;
 		if (direction == DOWN)
 			Position -= Up * velocity;
+		++PositionVersion;
 	}
 
 	// processes input received from a mouse input system. Expects the offset value in both the x and y direction.
-	void ProcessMouseMovement(float xoffset, float yoffset, GLboolean constrainPitch = true)
+	void ProcessMouseMovement(float xoffset, float yoffset, bool constrainPitch = true)
 	{
 		xoffset *= MouseSensitivity;
 		yoffset *= MouseSensitivity;
 
+		const float oldYaw = Yaw;
+		const float oldPitch = Pitch;
 		Yaw += xoffset;
 		Pitch += yoffset;
 
@@ -105,33 +271,85 @@ public:
 				Pitch = -89.0f;
 		}
 
-		// update Front, Right and Up Vectors using the updated Euler angles
-		updateCameraVectors();
+		// the vectors are rebuilt on the next read, not on every event
+		if (Yaw != oldYaw || Pitch != oldPitch)
+			++OrientationVersion;
 	}
 
 	// processes input received from a mouse scroll-wheel event. Only requires input on the vertical wheel-axis
 	void ProcessMouseScroll(float yoffset)
 	{
+		const float oldZoom = Zoom;
 		Zoom -= (float)yoffset;
 		if (Zoom < 1.0f)
 			Zoom = 1.0f;
 		if (Zoom > 45.0f)
 			Zoom = 45.0f;
+		if (Zoom != oldZoom)
+			++ProjectionVersion;
 	}
 
 private:
-	// calculates the front vector from the Camera's (updated) Euler Angles
-	void updateCameraVectors()
-	{
-		// calculate the new Front vector
-		glm::vec3 front;
-		front.x = cos(glm::radians(Yaw)) * cos(glm::radians(Pitch));
-		front.y = sin(glm::radians(Pitch));
-		front.z = sin(glm::radians(Yaw)) * cos(glm::radians(Pitch));
-		Front = glm::normalize(front);
-		// also re-calculate the Right and Up vector
-		Right = glm::normalize(glm::cross(Front, WorldUp));  // normalize the vectors, because their length gets closer to 0 the more you look up or down which results in slower movement.
-		Up = glm::normalize(glm::cross(Right, Front));
+	// camera Attributes
+	glm::vec3 Position;
+	glm::vec3 WorldUp;
+	// euler Angles, kept so pitch can be clamped
+	float Yaw;
+	float Pitch;
+	float Zoom;
+	// projection
+	bool Perspective = true;
+	bool ReverseZ = false;
+	int ViewportWidth = 1;
+	int ViewportHeight = 1;
+
+	// bumped by every change; the stamps below record which version a cached value was built from
+	unsigned int OrientationVersion = 1;
+	unsigned int PositionVersion = 1;
+	unsigned int ProjectionVersion = 1;
+
+	// lazily derived state
+	mutable glm::quat Orientation;
+	mutable glm::vec3 Front;
+	mutable glm::vec3 Right;
+	mutable glm::vec3 Up;
+	mutable glm::mat4 View;
+	mutable glm::mat4 Projection;
+	mutable glm::mat4 ViewProjection;
+	mutable glm::mat4 DrawViewProjection;
+	mutable Frustum FrustumPlanes;
+	mutable unsigned int VectorsStamp = 0;
+	mutable unsigned int ViewStamp = 0;
+	mutable unsigned int ProjectionStamp = 0;
+	mutable unsigned int ViewProjectionStamp = 0;
+	mutable unsigned int DrawViewProjectionStamp = 0;
+	mutable unsigned int FrustumStamp = 0;
+
+	// rebuilds the orientation quaternion and the Front, Right and Up vectors from the Euler angles if they changed.
+	// Yaw is measured so that -90 degrees looks down -Z, which makes the default camera with a +Y WorldUp an identity
+	// rotation. Another WorldUp tilts that rest frame onto it first
+	void updateCameraVectors() const
+	{
+		if (VectorsStamp == OrientationVersion)
+			return;
+
+		const glm::vec3 worldUp = glm::normalize(WorldUp);
+		glm::quat rest(1.0f, 0.0f, 0.0f, 0.0f);
+		if (worldUp.y < 0.9999f)
+		{
+			const glm::vec3 tiltAxis = worldUp.y > -0.9999f ? glm::normalize(glm::cross(glm::vec3(0.0f, 1.0f, 0.0f), worldUp)) : glm::vec3(1.0f, 0.0f, 0.0f);
+			rest = glm::angleAxis(std::acos(std::max(-1.0f, worldUp.y)), tiltAxis);
+		}
+		const glm::quat yawRotation = glm::angleAxis(glm::radians(-(Yaw - YAW)), worldUp) * rest;
+		// pitch turns about the yawed right axis, cross(front, WorldUp), so it stays level with any up vector
+		const glm::vec3 yawedRight = glm::normalize(glm::cross(yawRotation * glm::vec3(0.0f, 0.0f, -1.0f), worldUp));
+		const glm::quat pitchRotation = glm::angleAxis(glm::radians(Pitch), yawedRight);
+		Orientation = glm::normalize(pitchRotation * yawRotation);
+
+		Front = Orientation * glm::vec3(0.0f, 0.0f, -1.0f);
+		Right = Orientation * glm::vec3(1.0f, 0.0f, 0.0f);
+		Up = Orientation * glm::vec3(0.0f, 1.0f, 0.0f);
+		VectorsStamp = OrientationVersion;
 	}
 };
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,170 @@
+#ifndef COMMAND_LIST_H
+#define COMMAND_LIST_H
+
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+// Packets a command list can hold
+enum Command_Type : uint32_t {
+	COMMAND_SET_PROGRAM,
+	COMMAND_BIND_MESH,
+	COMMAND_BIND_TEXTURE,
+	COMMAND_SET_UNIFORM_MAT4,
+	COMMAND_SET_UNIFORM_UINT,
+	COMMAND_DRAW_INDEXED,
+	COMMAND_DRAW_INDIRECT
+};
+
+
+// A recorded stream of bind, uniform and draw packets. It only stores plain handles and values, so any thread can record
+// one without a graphics context; the thread that owns the context plays it back with Execute.
+// Packets are packed into 32 bit words: a header word (type in the low 8 bits, payload words above) followed by the payload
+class CommandList
+{
+public:
+	// empties the list but keeps its memory, so recording the next frame does not allocate
+	void Reset()
+	{
+		Words.clear();
+		PacketCount = 0;
+		CurrentProgram = CurrentMesh = CurrentTextureUnit = CurrentTexture = NO_HANDLE;
+	}
+
+	void SetProgram(uint32_t program)
+	{
+		if (program == CurrentProgram)
+			return;
+		CurrentProgram = program;
+		writeHeader(COMMAND_SET_PROGRAM, 1);
+		Words.push_back(program);
+	}
+
+	// mesh is the handle the backend binds to draw it (a vertex array object for GL)
+	void BindMesh(uint32_t mesh)
+	{
+		if (mesh == CurrentMesh)
+			return;
+		CurrentMesh = mesh;
+		writeHeader(COMMAND_BIND_MESH, 1);
+		Words.push_back(mesh);
+	}
+
+	// texture is the backend's handle for it (a GL texture name), bound to texture unit unit
+	void BindTexture(uint32_t unit, uint32_t texture)
+	{
+		if (unit == CurrentTextureUnit && texture == CurrentTexture)
+			return;
+		CurrentTextureUnit = unit;
+		CurrentTexture = texture;
+		writeHeader(COMMAND_BIND_TEXTURE, 2);
+		Words.push_back(unit);
+		Words.push_back(texture);
+	}
+
+	void SetUniform(int32_t location, const glm::mat4& value)
+	{
+		writeHeader(COMMAND_SET_UNIFORM_MAT4, 17);
+		const size_t at = Words.size();
+		Words.resize(at + 17);
+		std::memcpy(&Words[at], &location, sizeof(location));
+		std::memcpy(&Words[at + 1], glm::value_ptr(value), 16 * sizeof(float));
+	}
+
+	void SetUniform(int32_t location, uint32_t value)
+	{
+		writeHeader(COMMAND_SET_UNIFORM_UINT, 2);
+		Words.push_back(uint32_t(location));
+		Words.push_back(value);
+	}
+
+	// baseVertex is added to every index, for meshes that share their buffers with others
+	void DrawIndexed(uint32_t indexCount, uint32_t firstIndex = 0, int32_t baseVertex = 0)
+	{
+		writeHeader(COMMAND_DRAW_INDEXED, 3);
+		Words.push_back(indexCount);
+		Words.push_back(firstIndex);
+		Words.push_back(uint32_t(baseVertex));
+	}
+
+	// commandCount indexed draws read from buffer, the backend's handle for an array of indirect draw commands, starting
+	// with command firstCommand
+	void DrawIndirect(uint32_t buffer, uint32_t firstCommand, uint32_t commandCount)
+	{
+		writeHeader(COMMAND_DRAW_INDIRECT, 3);
+		Words.push_back(buffer);
+		Words.push_back(firstCommand);
+		Words.push_back(commandCount);
+	}
+
+	// decodes every packet in order and hands it to the backend, which provides SetProgram(uint32_t), BindMesh(uint32_t),
+	// BindTexture(uint32_t, uint32_t), SetUniform(int32_t, const float*), SetUniform(int32_t, uint32_t),
+	// DrawIndexed(uint32_t, uint32_t, int32_t) and DrawIndirect(uint32_t, uint32_t, uint32_t)
+	template <typename Backend>
+	void Execute(Backend& backend) const
+	{
+		const uint32_t* word = Words.data();
+		const uint32_t* end = word + Words.size();
+		while (word < end)
+		{
+			const uint32_t header = *word++;
+			switch (header & 0xff)
+			{
+			case COMMAND_SET_PROGRAM:
+				backend.SetProgram(word[0]);
+				break;
+			case COMMAND_BIND_MESH:
+				backend.BindMesh(word[0]);
+				break;
+			case COMMAND_BIND_TEXTURE:
+				backend.BindTexture(word[0], word[1]);
+				break;
+			case COMMAND_SET_UNIFORM_MAT4:
+			{
+				int32_t location;
+				float matrix[16];
+				std::memcpy(&location, word, sizeof(location));
+				std::memcpy(matrix, word + 1, sizeof(matrix));
+				backend.SetUniform(location, matrix);
+				break;
+			}
+			case COMMAND_SET_UNIFORM_UINT:
+				backend.SetUniform(int32_t(word[0]), word[1]);
+				break;
+			case COMMAND_DRAW_INDEXED:
+				backend.DrawIndexed(word[0], word[1], int32_t(word[2]));
+				break;
+			case COMMAND_DRAW_INDIRECT:
+				backend.DrawIndirect(word[0], word[1], word[2]);
+				break;
+			}
+			word += header >> 8;
+		}
+	}
+
+	bool IsEmpty() const { return Words.empty(); }
+	size_t GetPacketCount() const { return PacketCount; }
+	size_t GetSizeInBytes() const { return Words.size() * sizeof(uint32_t); }
+
+private:
+	static const uint32_t NO_HANDLE = 0xffffffffu;
+
+	std::vector<uint32_t> Words;
+	size_t PacketCount = 0;
+	// what the list has bound so far, so repeated binds are not recorded
+	uint32_t CurrentProgram = NO_HANDLE;
+	uint32_t CurrentMesh = NO_HANDLE;
+	uint32_t CurrentTextureUnit = NO_HANDLE;
+	uint32_t CurrentTexture = NO_HANDLE;
+
+	void writeHeader(Command_Type type, uint32_t payloadWords)
+	{
+		Words.push_back(uint32_t(type) | (payloadWords << 8));
+		PacketCount++;
+	}
+};
+#endif
@@ -0,0 +1,106 @@
+#ifndef DYNAMIC_RESOLUTION_H
+#define DYNAMIC_RESOLUTION_H
+
+
+#include <algorithm>
+#include <cmath>
+
+// Defaults: a 60 Hz frame, and a scene rendered at between half and full window resolution on each axis
+const float DYNAMIC_RESOLUTION_TARGET_MS = 1000.0f / 60.0f;
+const float DYNAMIC_RESOLUTION_MIN_SCALE = 0.5f;
+const float DYNAMIC_RESOLUTION_MAX_SCALE = 1.0f;
+// scales are multiples of this, so the render size only changes in visible steps and not on every frame
+const float DYNAMIC_RESOLUTION_STEP = 1.0f / 32.0f;
+// below this share of the target the GPU has room to spare and the scale goes up again
+const double DYNAMIC_RESOLUTION_HEADROOM = 0.8;
+// measurements left out after a change, since the GPU times still in flight were taken at the old scale, and after a
+// Reset, since the first frames pay for shaders and buffers used for the first time
+const int DYNAMIC_RESOLUTION_SETTLE = 4;
+
+
+// Picks the render scale (per axis) from measured GPU frame times so the GPU holds a target frame time. GPU time follows
+// the number of pixels shaded, the square of the scale, so the scale moves by the square root of how far the smoothed
+// time is from the target. Between HEADROOM and 100% of the target nothing changes, which keeps measurement noise from
+// making the resolution flicker; over the target it drops at once, under the headroom it climbs back a step at a time
+class ResolutionController
+{
+public:
+	ResolutionController(float targetMs = DYNAMIC_RESOLUTION_TARGET_MS, float minScale = DYNAMIC_RESOLUTION_MIN_SCALE,
+		float maxScale = DYNAMIC_RESOLUTION_MAX_SCALE) : TargetMs(targetMs)
+	{
+		SetBounds(minScale, maxScale);
+		Scale = MaxScale;
+	}
+
+	// forgets the measurements, for when the controller starts (again) on a new workload. The scale is kept
+	void Reset()
+	{
+		Samples = 0;
+		Settle = DYNAMIC_RESOLUTION_SETTLE;
+	}
+
+	void SetTarget(float milliseconds) { TargetMs = std::max(0.1f, milliseconds); }
+
+	// the scale is clamped into the new bounds right away
+	void SetBounds(float minScale, float maxScale)
+	{
+		MinScale = std::max(DYNAMIC_RESOLUTION_STEP, std::min(minScale, maxScale));
+		MaxScale = std::max(MinScale, maxScale);
+		Scale = std::min(MaxScale, std::max(MinScale, Scale));
+	}
+
+	// takes one measured GPU frame time and returns the scale to render the next frames at
+	float Update(double gpuMilliseconds)
+	{
+		if (Settle > 0)
+		{
+			--Settle;
+			return Scale;
+		}
+		SmoothedMs = Samples == 0 ? gpuMilliseconds : SmoothedMs + (gpuMilliseconds - SmoothedMs) * 0.25;
+		++Samples;
+
+		const double load = SmoothedMs / double(TargetMs);
+		if (load > 1.0 || load < DYNAMIC_RESOLUTION_HEADROOM)
+		{
+			// aim for the middle of the dead band, and never move by more than a quarter at once
+			const double aim = (1.0 + DYNAMIC_RESOLUTION_HEADROOM) * 0.5;
+			double wanted = double(Scale) * std::sqrt(aim / std::max(load, 1e-6));
+			wanted = std::min(double(Scale) * 1.25, std::max(double(Scale) * 0.75, wanted));
+			float next = std::round(float(wanted) / DYNAMIC_RESOLUTION_STEP) * DYNAMIC_RESOLUTION_STEP;
+			if (load > 1.0)
+				next = std::min(next, Scale - DYNAMIC_RESOLUTION_STEP);
+			else
+				next = std::max(next, Scale + DYNAMIC_RESOLUTION_STEP);
+			next = std::min(MaxScale, std::max(MinScale, next));
+
+			if (next != Scale)
+			{
+				// expect the time the new pixel count will take until real measurements at it arrive
+				SmoothedMs *= double(next / Scale) * double(next / Scale);
+				Scale = next;
+				Settle = DYNAMIC_RESOLUTION_SETTLE;
+				++Changes;
+			}
+		}
+		return Scale;
+	}
+
+	float GetScale() const { return Scale; }
+	float GetTargetMs() const { return TargetMs; }
+	float GetMinScale() const { return MinScale; }
+	float GetMaxScale() const { return MaxScale; }
+	double GetSmoothedMs() const { return SmoothedMs; }
+	int GetChanges() const { return Changes; }
+
+private:
+	float TargetMs;
+	float MinScale = DYNAMIC_RESOLUTION_MIN_SCALE;
+	float MaxScale = DYNAMIC_RESOLUTION_MAX_SCALE;
+	float Scale = 1.0f;
+	double SmoothedMs = 0.0;
+	int Samples = 0;
+	int Settle = DYNAMIC_RESOLUTION_SETTLE;
+	int Changes = 0;
+};
+#endif
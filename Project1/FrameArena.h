@@ -0,0 +1,144 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "JobSystem.h"
+
+const size_t FRAME_ARENA_SIZE = 256 * 1024;
+
+
+// Linear allocator for data that only lives until the end of the frame: Allocate bumps an offset and Reset takes it
+// back to zero, so nothing is freed one by one. A frame that needs more than the arena holds spills to the heap, and
+// the next Reset grows the arena to that frame's peak so the spill does not happen again
+class FrameArena
+{
+public:
+	explicit FrameArena(size_t capacity = FRAME_ARENA_SIZE) : Capacity(capacity)
+	{
+		Memory.reset(new unsigned char[Capacity]);
+	}
+
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+
+	// alignment must be a power of two
+	void* Allocate(size_t bytes, size_t alignment = alignof(std::max_align_t))
+	{
+		const uintptr_t base = reinterpret_cast<uintptr_t>(Memory.get());
+		const size_t start = size_t(((base + Offset + alignment - 1) & ~uintptr_t(alignment - 1)) - base);
+		if (start + bytes <= Capacity)
+		{
+			Offset = start + bytes;
+			Peak = std::max(Peak, Offset);
+			return Memory.get() + start;
+		}
+
+		// out of room: this frame falls back to the heap
+		Spilled += bytes + alignment;
+		Peak = std::max(Peak, Offset + Spilled);
+		Spills.push_back(std::unique_ptr<unsigned char[]>(new unsigned char[bytes + alignment]));
+		const uintptr_t spill = reinterpret_cast<uintptr_t>(Spills.back().get());
+		return reinterpret_cast<void*>((spill + alignment - 1) & ~uintptr_t(alignment - 1));
+	}
+
+	// uninitialized room for count objects; only for types that need no destructor
+	template <typename T>
+	T* AllocateArray(size_t count)
+	{
+		return static_cast<T*>(Allocate(count * sizeof(T), alignof(T)));
+	}
+
+	// forgets everything allocated since the last Reset. Nothing from the previous frame may be used after this
+	void Reset()
+	{
+		if (!Spills.empty())
+		{
+			Capacity = std::max(Capacity * 2, Offset + Spilled);
+			Memory.reset(new unsigned char[Capacity]);
+			Spills.clear();
+			++GrowCount;
+		}
+		Offset = 0;
+		Spilled = 0;
+	}
+
+	size_t GetUsed() const { return Offset + Spilled; }
+	size_t GetPeak() const { return Peak; }
+	size_t GetCapacity() const { return Capacity; }
+	int GetGrowCount() const { return GrowCount; }
+
+private:
+	std::unique_ptr<unsigned char[]> Memory;
+	size_t Capacity;
+	size_t Offset = 0;
+	size_t Peak = 0;
+	size_t Spilled = 0;
+	int GrowCount = 0;
+	std::vector<std::unique_ptr<unsigned char[]>> Spills;
+};
+
+
+// Lets standard containers take their memory from a FrameArena. Freeing is a no-op, so reserve up front: a vector
+// that grows leaves its old buffers behind in the arena until the next Reset
+template <typename T>
+class ArenaAllocator
+{
+public:
+	using value_type = T;
+
+	explicit ArenaAllocator(FrameArena& arena) : Arena(&arena) {}
+	template <typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) : Arena(other.GetArena()) {}
+
+	T* allocate(size_t count) { return Arena->AllocateArray<T>(count); }
+	void deallocate(T*, size_t) {}
+
+	FrameArena* GetArena() const { return Arena; }
+
+	template <typename U>
+	bool operator==(const ArenaAllocator<U>& other) const { return Arena == other.GetArena(); }
+	template <typename U>
+	bool operator!=(const ArenaAllocator<U>& other) const { return Arena != other.GetArena(); }
+
+private:
+	FrameArena* Arena;
+};
+
+template <typename T>
+using FrameVector = std::vector<T, ArenaAllocator<T>>;
+
+
+// One FrameArena per thread of a job system, so jobs allocate without locking or sharing cache lines. Arena 0 belongs
+// to the thread that waits on the jobs (the render thread); the workers use 1..N
+class FrameArenas
+{
+public:
+	FrameArenas(const JobSystem& jobs, size_t capacity = FRAME_ARENA_SIZE) : Jobs(jobs)
+	{
+		for (int i = 0; i < jobs.GetThreadCount(); ++i)
+			Arenas.push_back(std::unique_ptr<FrameArena>(new FrameArena(capacity)));
+	}
+
+	// the calling thread's arena
+	FrameArena& Get() { return *Arenas[Jobs.GetThreadIndex()]; }
+	FrameArena& Get(int thread) { return *Arenas[thread]; }
+	int GetCount() const { return int(Arenas.size()); }
+
+	// call between frames, when no jobs are running
+	void Reset()
+	{
+		for (std::unique_ptr<FrameArena>& arena : Arenas)
+			arena->Reset();
+	}
+
+private:
+	const JobSystem& Jobs;
+	std::vector<std::unique_ptr<FrameArena>> Arenas;
+};
+#endif
@@ -0,0 +1,264 @@
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "FrameEncoder.h"
+#include "GpuMemory.h"
+
+// Frames read back or being written at once. A frame that finds the next slot still busy, because the writer is that
+// far behind, is dropped rather than waited for
+const int FRAME_CAPTURE_SLOTS = 4;
+
+// Counts since Start
+struct FrameCaptureStats
+{
+	uint32_t Captured = 0;          // frames read back
+	uint32_t Written = 0;
+	uint32_t Dropped = 0;           // frames that found every slot busy
+	uint32_t Failed = 0;            // frames the writer could not write
+	uint64_t Bytes = 0;             // written
+	double WriteMs = 0.0;           // mean writer thread time a frame, encoding and writing
+};
+
+
+// Captures the frames drawn to the window without stalling the render thread. Capture copies the back buffer into one
+// of a ring of pixel pack buffers with glReadPixels and fences it; a later Capture hands the buffer to a writer thread
+// once the fence says the copy is done. The buffers are mapped persistently, so the writer reads the pixels where the
+// copy left them, encodes them (FrameEncoder.h) and writes them, and the render thread only queues GL commands. Frames
+// are written in the order they were captured
+class FrameCapture
+{
+public:
+	// path is the Y4M file, which may be a named pipe, or the start of the PNG file names, which end in the frame
+	// number. Frames are width by height from the bottom left of the window. Returns false, and prints why, if the
+	// output cannot be opened
+	bool Start(const std::string& path, Capture_Format format, int width, int height, int framesPerSecond)
+	{
+		if (Capturing)
+			return false;
+		Path = path;
+		Format = format;
+		Width = width;
+		Height = height;
+		Name.resize(path.size() + 16);
+
+		// the stream's own buffer would be allocated again for every PNG file; frames are written whole anyway
+		File.rdbuf()->pubsetbuf(FileBuffer, sizeof(FileBuffer));
+		if (Format == CAPTURE_Y4M)
+		{
+			File.open(Path, std::ios::binary | std::ios::trunc);
+			const std::vector<uint8_t>& header = Y4m.GetHeader(Width, Height, framesPerSecond);
+			if (!File.write(reinterpret_cast<const char*>(header.data()), header.size()))
+			{
+				std::cout << "ERROR::CAPTURE::" << Path << "::could not open" << std::endl;
+				File.close();
+				return false;
+			}
+		}
+
+		const GLsizeiptr bytes = GLsizeiptr(Width) * Height * 4;
+		const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		for (Slot& slot : Slots)
+		{
+			glGenBuffers(1, &slot.Buffer);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.Buffer);
+			UBufferStorage(GL_PIXEL_PACK_BUFFER, slot.Buffer, bytes, nullptr, flags, "frame capture");
+			slot.Pixels = static_cast<const uint8_t*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, flags));
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		Stats = FrameCaptureStats();
+		WriteSeconds = 0.0;
+		Read = Handed = Written = 0;
+		Quit = false;
+		Writer = std::thread(&FrameCapture::writeLoop, this);
+		Capturing = true;
+		return true;
+	}
+
+	// waits for the frames captured so far to be written
+	void Stop()
+	{
+		if (!Capturing)
+			return;
+		handOver(true);
+		{
+			std::lock_guard<std::mutex> lock(WriteMutex);
+			Quit = true;
+		}
+		WriteCondition.notify_one();
+		if (Writer.joinable())
+			Writer.join();
+
+		for (Slot& slot : Slots)
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.Buffer);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			UDeleteBuffers(1, &slot.Buffer);
+			slot.Buffer = 0;
+			slot.Pixels = nullptr;
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		File.close();
+		Capturing = false;
+	}
+
+	bool IsCapturing() const { return Capturing; }
+	Capture_Format GetFormat() const { return Format; }
+	const std::string& GetPath() const { return Path; }
+
+	// call once the frame is complete in the back buffer, before it is swapped
+	void Capture()
+	{
+		if (!Capturing)
+			return;
+		handOver(false);
+		{
+			std::lock_guard<std::mutex> lock(WriteMutex);
+			if (Read - Written == FRAME_CAPTURE_SLOTS)
+			{
+				++Stats.Dropped;
+				return;
+			}
+		}
+
+		Slot& slot = Slots[Read % FRAME_CAPTURE_SLOTS];
+		GLint previous = 0;
+		glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previous);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+		glReadBuffer(GL_BACK);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.Buffer);
+		glReadPixels(0, 0, Width, Height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		slot.Fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, GLuint(previous));
+		++Read;
+	}
+
+	FrameCaptureStats GetStats()
+	{
+		std::lock_guard<std::mutex> lock(WriteMutex);
+		FrameCaptureStats stats = Stats;
+		stats.Captured = Read;
+		stats.WriteMs = Written > 0 ? WriteSeconds * 1000.0 / Written : 0.0;
+		return stats;
+	}
+
+private:
+	struct Slot
+	{
+		GLuint Buffer = 0;
+		const uint8_t* Pixels = nullptr;    // mapped for as long as the capture runs
+		GLsync Fence = 0;
+	};
+
+	bool Capturing = false;
+	std::string Path;
+	Capture_Format Format = CAPTURE_PNG;
+	int Width = 0;
+	int Height = 0;
+	Slot Slots[FRAME_CAPTURE_SLOTS];
+	// frames since Start: Written <= Handed <= Read. Frame n uses slot n % FRAME_CAPTURE_SLOTS; the ones from Handed
+	// are waiting for their copy, those from Written for the writer
+	uint32_t Read = 0;
+	uint32_t Handed = 0;
+	uint32_t Written = 0;
+
+	// only touched by the writer thread while it runs
+	std::ofstream File;
+	char FileBuffer[4096];
+	std::vector<char> Name;
+	PngEncoder Png;
+	Y4mEncoder Y4m;
+
+	std::thread Writer;
+	std::mutex WriteMutex;
+	std::condition_variable WriteCondition;
+	FrameCaptureStats Stats;
+	double WriteSeconds = 0.0;
+	bool Quit = false;
+
+	// gives the writer the frames whose copies are done, in order; wait blocks until all of them are
+	void handOver(bool wait)
+	{
+		uint32_t handed = Handed;
+		while (handed < Read)
+		{
+			Slot& slot = Slots[handed % FRAME_CAPTURE_SLOTS];
+			const GLenum result = glClientWaitSync(slot.Fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? 100000000 : 0);
+			if (result == GL_TIMEOUT_EXPIRED)
+			{
+				if (wait)
+					continue;
+				break;
+			}
+			// GL_WAIT_FAILED hands the frame over too, or it would be waited on forever
+			glDeleteSync(slot.Fence);
+			slot.Fence = 0;
+			++handed;
+		}
+		if (handed == Handed)
+			return;
+		{
+			std::lock_guard<std::mutex> lock(WriteMutex);
+			Handed = handed;
+		}
+		WriteCondition.notify_one();
+	}
+
+	void writeLoop()
+	{
+		for (;;)
+		{
+			uint32_t frame;
+			{
+				std::unique_lock<std::mutex> lock(WriteMutex);
+				WriteCondition.wait(lock, [this]() { return Quit || Written < Handed; });
+				// Stop hands every frame over before it quits
+				if (Written == Handed)
+					return;
+				frame = Written;
+			}
+
+			const auto start = std::chrono::steady_clock::now();
+			const std::vector<uint8_t>& bytes = Format == CAPTURE_PNG ? Png.Encode(Slots[frame % FRAME_CAPTURE_SLOTS].Pixels, Width, Height)
+				: Y4m.Encode(Slots[frame % FRAME_CAPTURE_SLOTS].Pixels, Width, Height);
+			bool ok;
+			if (Format == CAPTURE_PNG)
+			{
+				snprintf(Name.data(), Name.size(), "%s%05u.png", Path.c_str(), frame);
+				File.open(Name.data(), std::ios::binary | std::ios::trunc);
+				ok = bool(File.write(reinterpret_cast<const char*>(bytes.data()), bytes.size()));
+				File.close();
+			}
+			else
+				ok = bool(File.write(reinterpret_cast<const char*>(bytes.data()), bytes.size()));
+			const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+			std::lock_guard<std::mutex> lock(WriteMutex);
+			if (ok)
+			{
+				++Stats.Written;
+				Stats.Bytes += bytes.size();
+			}
+			else if (Stats.Failed++ == 0)
+				std::cout << "ERROR::CAPTURE::" << (Format == CAPTURE_PNG ? Name.data() : Path.c_str()) << "::could not write" << std::endl;
+			WriteSeconds += seconds;
+			++Written;
+		}
+	}
+};
+#endif
@@ -0,0 +1,360 @@
+#ifndef FRAME_ENCODER_H
+#define FRAME_ENCODER_H
+
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// Frames come in as glReadPixels gives them back: RGBA8, bottom row first, rows packed. Both encoders flip them and
+// drop the alpha, and keep their buffers from one frame to the next so a steady capture does not allocate
+enum Capture_Format {
+	CAPTURE_PNG,        // one PNG file per frame
+	CAPTURE_Y4M         // one raw YUV 4:2:0 stream, which video tools read from a file or a named pipe
+};
+
+
+// Writes PNG files fast enough to keep up with a frame stream, at the cost of size: every row is filtered with Up (the
+// difference to the row above), which turns flat and smoothly shaded areas into runs of zeros or of one repeated pixel,
+// and the deflate stream has one fixed Huffman block whose only matches are those runs (distance 1 or 3). No zlib
+class PngEncoder
+{
+public:
+	PngEncoder()
+	{
+		for (uint32_t n = 0; n < 256; ++n)
+		{
+			uint32_t c = n;
+			for (int k = 0; k < 8; ++k)
+				c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			CrcTable[0][n] = c;
+		}
+		// slicing by four: table k is the CRC of a byte followed by k zero bytes
+		for (uint32_t n = 0; n < 256; ++n)
+			for (int k = 1; k < 4; ++k)
+				CrcTable[k][n] = (CrcTable[k - 1][n] >> 8) ^ CrcTable[0][CrcTable[k - 1][n] & 0xff];
+
+		// fixed Huffman codes (RFC 1951 3.2.6), bit reversed because deflate sends codes from their top bit
+		for (uint32_t symbol = 0; symbol < 288; ++symbol)
+		{
+			uint32_t code, bits;
+			if (symbol < 144)
+				code = 0x30 + symbol, bits = 8;
+			else if (symbol < 256)
+				code = 0x190 + symbol - 144, bits = 9;
+			else if (symbol < 280)
+				code = symbol - 256, bits = 7;
+			else
+				code = 0xc0 + symbol - 280, bits = 8;
+			Literals[symbol] = { reverse(code, bits), bits };
+		}
+
+		// every match length as its length symbol followed by the symbol's extra bits
+		static const uint16_t bases[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+		static const uint8_t extras[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+		for (uint32_t length = 3; length <= 258; ++length)
+		{
+			int s = 28;
+			while (bases[s] > length)
+				--s;
+			const Code& symbol = Literals[257 + s];
+			Lengths[length] = { symbol.Bits | ((length - bases[s]) << symbol.Count), symbol.Count + extras[s] };
+		}
+	}
+
+	// returns the whole file; valid until the next Encode
+	const std::vector<uint8_t>& Encode(const uint8_t* rgba, int width, int height)
+	{
+		const size_t rowBytes = size_t(width) * 3 + 1;
+		const size_t filteredBytes = rowBytes * size_t(height);
+		Filtered.resize(filteredBytes);
+		filter(rgba, width, height);
+
+		// signature, IHDR, then IDAT, whose length is known only once it is written. Sized for all literals
+		const size_t idatCapacity = 2 + filteredBytes * 9 / 8 + 16 + 4;
+		Bytes.resize(8 + 25 + 8 + idatCapacity + 4 + 12);
+		uint8_t* out = Bytes.data();
+		static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+		memcpy(out, signature, 8);
+		uint8_t header[13];
+		putBigEndian(header, uint32_t(width));
+		putBigEndian(header + 4, uint32_t(height));
+		header[8] = 8;          // bits per channel
+		header[9] = 2;          // RGB
+		header[10] = header[11] = header[12] = 0;
+		size_t size = 8;
+		size = writeChunk(size, "IHDR", header, 13);
+
+		uint8_t* idat = out + size + 8;
+		idat[0] = 0x78;         // deflate with a 32K window, no dictionary
+		idat[1] = 0x01;
+		size_t idatBytes = 2 + deflate(idat + 2);
+		putBigEndian(idat + idatBytes, adler32(Filtered.data(), filteredBytes));
+		idatBytes += 4;
+		size = finishChunk(size, "IDAT", idatBytes);
+		size = writeChunk(size, "IEND", nullptr, 0);
+		Bytes.resize(size);
+		return Bytes;
+	}
+
+private:
+	struct Code
+	{
+		uint32_t Bits;      // sent from the lowest
+		uint32_t Count;
+	};
+
+	uint32_t CrcTable[4][256];
+	Code Literals[288];
+	Code Lengths[259];
+	std::vector<uint8_t> Filtered;
+	std::vector<uint8_t> Bytes;
+
+	static uint32_t reverse(uint32_t code, uint32_t bits)
+	{
+		uint32_t reversed = 0;
+		for (uint32_t i = 0; i < bits; ++i)
+			reversed |= ((code >> i) & 1) << (bits - 1 - i);
+		return reversed;
+	}
+
+	static void putBigEndian(uint8_t* out, uint32_t value)
+	{
+		out[0] = uint8_t(value >> 24);
+		out[1] = uint8_t(value >> 16);
+		out[2] = uint8_t(value >> 8);
+		out[3] = uint8_t(value);
+	}
+
+	// the image top row first, each row a filter type byte (2, Up) and the RGB differences to the row above it
+	void filter(const uint8_t* rgba, int width, int height)
+	{
+		const size_t rowBytes = size_t(width) * 3 + 1;
+		for (int y = 0; y < height; ++y)
+		{
+			const uint8_t* row = rgba + size_t(height - 1 - y) * width * 4;
+			const uint8_t* above = y > 0 ? row + size_t(width) * 4 : nullptr;
+			uint8_t* out = Filtered.data() + rowBytes * y;
+			*out++ = 2;
+			if (above == nullptr)
+			{
+				for (int x = 0; x < width; ++x, out += 3)
+				{
+					out[0] = row[x * 4];
+					out[1] = row[x * 4 + 1];
+					out[2] = row[x * 4 + 2];
+				}
+				continue;
+			}
+			for (int x = 0; x < width; ++x, out += 3)
+			{
+				out[0] = uint8_t(row[x * 4] - above[x * 4]);
+				out[1] = uint8_t(row[x * 4 + 1] - above[x * 4 + 1]);
+				out[2] = uint8_t(row[x * 4 + 2] - above[x * 4 + 2]);
+			}
+		}
+	}
+
+	// one final fixed Huffman block over Filtered; returns the bytes written
+	size_t deflate(uint8_t* out) const
+	{
+		const uint8_t* data = Filtered.data();
+		const size_t count = Filtered.size();
+		uint8_t* start = out;
+		uint64_t bits = 0;
+		uint32_t used = 0;
+		const auto put = [&bits, &used, &out](uint32_t code, uint32_t length)
+		{
+			bits |= uint64_t(code) << used;
+			used += length;
+			if (used >= 32)
+			{
+				out[0] = uint8_t(bits);
+				out[1] = uint8_t(bits >> 8);
+				out[2] = uint8_t(bits >> 16);
+				out[3] = uint8_t(bits >> 24);
+				out += 4;
+				bits >>= 32;
+				used -= 32;
+			}
+		};
+
+		put(1, 1);              // final block
+		put(1, 2);              // fixed Huffman codes
+		size_t i = 0;
+		while (i < count)
+		{
+			const uint8_t value = data[i];
+			// most bytes of a detailed image start no run, so they are sent before looking for one
+			if (i < 3 || (value != data[i - 1] && value != data[i - 3]))
+			{
+				put(Literals[value].Bits, Literals[value].Count);
+				++i;
+				continue;
+			}
+
+			// a run of one byte, else of one pixel, compared eight bytes at a time
+			const uint32_t distance = value == data[i - 1] ? 1 : 3;
+			const size_t limit = std::min<size_t>(258, count - i);
+			size_t run = 0;
+			while (run + 8 <= limit)
+			{
+				uint64_t next, back;
+				memcpy(&next, data + i + run, 8);
+				memcpy(&back, data + i + run - distance, 8);
+				if (next != back)
+					break;
+				run += 8;
+			}
+			while (run < limit && data[i + run] == data[i + run - distance])
+				++run;
+
+			if (run >= 3)
+			{
+				put(Lengths[run].Bits, Lengths[run].Count);
+				// distance codes are 5 bits; 1 and 3 are codes 0 and 2, without extra bits
+				put(distance == 1 ? 0 : reverse(2, 5), 5);
+				i += run;
+			}
+			else
+			{
+				put(Literals[value].Bits, Literals[value].Count);
+				++i;
+			}
+		}
+		put(Literals[256].Bits, Literals[256].Count);
+		while (used > 0)
+		{
+			*out++ = uint8_t(bits);
+			bits >>= 8;
+			used = used > 8 ? used - 8 : 0;
+		}
+		return size_t(out - start);
+	}
+
+	static uint32_t adler32(const uint8_t* data, size_t count)
+	{
+		uint32_t a = 1, b = 0;
+		while (count > 0)
+		{
+			// the most bytes before b can overflow 32 bits
+			const size_t block = std::min<size_t>(count, 5552);
+			for (size_t i = 0; i < block; ++i)
+			{
+				a += data[i];
+				b += a;
+			}
+			a %= 65521;
+			b %= 65521;
+			data += block;
+			count -= block;
+		}
+		return (b << 16) | a;
+	}
+
+	uint32_t crc32(const uint8_t* data, size_t count) const
+	{
+		uint32_t crc = 0xffffffffu;
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			crc ^= uint32_t(data[i]) | uint32_t(data[i + 1]) << 8 | uint32_t(data[i + 2]) << 16 | uint32_t(data[i + 3]) << 24;
+			crc = CrcTable[3][crc & 0xff] ^ CrcTable[2][(crc >> 8) & 0xff] ^ CrcTable[1][(crc >> 16) & 0xff] ^ CrcTable[0][crc >> 24];
+		}
+		for (; i < count; ++i)
+			crc = CrcTable[0][(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+		return crc ^ 0xffffffffu;
+	}
+
+	// writes a chunk at offset, copying data; returns the offset after it
+	size_t writeChunk(size_t offset, const char* type, const uint8_t* data, size_t count)
+	{
+		if (count > 0)
+			memcpy(Bytes.data() + offset + 8, data, count);
+		return finishChunk(offset, type, count);
+	}
+
+	// fills in the length, type and CRC of a chunk whose count bytes of data are already in place
+	size_t finishChunk(size_t offset, const char* type, size_t count)
+	{
+		uint8_t* chunk = Bytes.data() + offset;
+		putBigEndian(chunk, uint32_t(count));
+		memcpy(chunk + 4, type, 4);
+		putBigEndian(chunk + 8 + count, crc32(chunk + 4, count + 4));
+		return offset + 12 + count;
+	}
+};
+
+
+// Converts frames to the raw 4:2:0 YUV of a YUV4MPEG2 stream: BT.601 limited range, each chroma sample the average of
+// a 2x2 block (JPEG siting). Odd sizes repeat the last column or row
+class Y4mEncoder
+{
+public:
+	// the stream header, written once before the frames
+	const std::vector<uint8_t>& GetHeader(int width, int height, int framesPerSecond)
+	{
+		char header[96];
+		const int length = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, framesPerSecond);
+		Bytes.assign(header, header + length);
+		return Bytes;
+	}
+
+	// one frame, "FRAME" and its Y, U and V planes; valid until the next call
+	const std::vector<uint8_t>& Encode(const uint8_t* rgba, int width, int height)
+	{
+		const int chromaWidth = (width + 1) / 2;
+		const int chromaHeight = (height + 1) / 2;
+		const size_t lumaBytes = size_t(width) * height;
+		const size_t chromaBytes = size_t(chromaWidth) * chromaHeight;
+		Bytes.resize(6 + lumaBytes + chromaBytes * 2);
+		memcpy(Bytes.data(), "FRAME\n", 6);
+		uint8_t* luma = Bytes.data() + 6;
+		uint8_t* blue = luma + lumaBytes;
+		uint8_t* red = blue + chromaBytes;
+
+		for (int cy = 0; cy < chromaHeight; ++cy)
+		{
+			// image rows 2cy and 2cy+1, which are rows from the bottom of the frame
+			const int top = 2 * cy;
+			const int bottom = std::min(top + 1, height - 1);
+			const uint8_t* row0 = rgba + size_t(height - 1 - top) * width * 4;
+			const uint8_t* row1 = rgba + size_t(height - 1 - bottom) * width * 4;
+			uint8_t* luma0 = luma + size_t(top) * width;
+			uint8_t* luma1 = luma + size_t(bottom) * width;
+			for (int cx = 0; cx < chromaWidth; ++cx)
+			{
+				const int left = 2 * cx;
+				const int right = std::min(left + 1, width - 1);
+				const uint8_t* p[4] = { row0 + left * 4, row0 + right * 4, row1 + left * 4, row1 + right * 4 };
+				int r = 0, g = 0, b = 0;
+				for (int i = 0; i < 4; ++i)
+				{
+					r += p[i][0];
+					g += p[i][1];
+					b += p[i][2];
+				}
+				// the second row and column are written last, so a repeated edge pixel ends up with its own value
+				luma0[left] = toLuma(p[0]);
+				luma0[right] = toLuma(p[1]);
+				luma1[left] = toLuma(p[2]);
+				luma1[right] = toLuma(p[3]);
+				// sums of four, so the fixed point scale has two more bits
+				blue[size_t(cy) * chromaWidth + cx] = uint8_t(((-38 * r - 74 * g + 112 * b + 512) >> 10) + 128);
+				red[size_t(cy) * chromaWidth + cx] = uint8_t(((112 * r - 94 * g - 18 * b + 512) >> 10) + 128);
+			}
+		}
+		return Bytes;
+	}
+
+private:
+	std::vector<uint8_t> Bytes;
+
+	static uint8_t toLuma(const uint8_t* p)
+	{
+		return uint8_t(((66 * p[0] + 129 * p[1] + 25 * p[2] + 128) >> 8) + 16);
+	}
+};
+#endif
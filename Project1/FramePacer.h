@@ -0,0 +1,255 @@
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+#include <GL/glew.h>
+
+// Most frames the pacer lets the CPU run ahead of the GPU, and the default. Two keeps the GPU fed while the CPU builds
+// the next frame; every frame past that only adds a frame time of latency
+const int FRAME_PACER_MAX_FRAMES = 4;
+const int FRAME_PACER_DEFAULT_FRAMES = 2;
+// Completed frames the latency percentiles are taken over
+const int FRAME_PACER_HISTORY = 256;
+// Frames between two readings of the GPU clock against the CPU clock
+const int FRAME_PACER_CALIBRATE = 240;
+// Longest single glClientWaitSync; the wait loops until the fence is signaled
+const GLuint64 FRAME_PACER_TIMEOUT_NS = 100000000;
+
+// Latencies over the last FRAME_PACER_HISTORY completed frames, in milliseconds
+struct FramePacerStats
+{
+	int Frames = 0;                     // completed frames the numbers below are taken from
+	int MaxFramesInFlight = 0;
+	bool LowLatency = false;
+	double InputToSubmitMs = 0.0;       // median, input sampled to the frame handed to the driver
+	double LatencyP50Ms = 0.0;          // input sampled to the GPU done with the frame
+	double LatencyP95Ms = 0.0;
+	double LatencyP99Ms = 0.0;
+	double LatencyMaxMs = 0.0;
+	int EventFrames = 0;                // frames that had at least one window event
+	double EventLatencyP50Ms = 0.0;     // oldest event of the frame to the GPU done with it
+	double EventLatencyP99Ms = 0.0;
+	double WaitMs = 0.0;                // mean CPU time per frame spent blocked on fences
+};
+
+
+// Caps how many frames the CPU may queue ahead of the GPU with a fence after each frame, and measures how old the
+// input is by the time the GPU has finished drawing with it. A frame is stamped when its input is sampled, when it is
+// submitted and, with a GL_TIMESTAMP query ahead of its fence, when the GPU completes it; the GPU clock is mapped onto
+// the CPU clock by reading both now and then. Scanout follows GPU completion by up to one refresh, which GL cannot see.
+//
+// Normal mode samples input first and waits for a free frame slot right before rendering, so with the GPU as the
+// bottleneck the input ages in that wait. Low latency mode instead waits for the GPU to finish every frame before
+// input is sampled: the GPU idles while the CPU builds the next frame, but the input is as fresh as it can be
+class FramePacer
+{
+public:
+	typedef double (*Clock)();          // seconds, on the same clock as the event times passed to BeginRender
+
+	void Create(Clock clock = steadySeconds)
+	{
+		Now = clock;
+		glGenQueries(FRAME_PACER_MAX_FRAMES, Queries);
+		calibrate();
+	}
+
+	void Destroy()
+	{
+		for (int i = 0; i < InFlight; ++i)
+			glDeleteSync(Frames[(Oldest + i) % FRAME_PACER_MAX_FRAMES].Fence);
+		InFlight = 0;
+		glDeleteQueries(FRAME_PACER_MAX_FRAMES, Queries);
+	}
+
+	void SetMaxFramesInFlight(int frames) { MaxFrames = std::min(FRAME_PACER_MAX_FRAMES, std::max(1, frames)); }
+	void SetLowLatency(bool lowLatency) { LowLatency = lowLatency; }
+	int GetMaxFramesInFlight() const { return MaxFrames; }
+	bool IsLowLatency() const { return LowLatency; }
+
+	// call right before input is sampled
+	void BeginInput()
+	{
+		retire(LowLatency ? 0 : InFlight);
+		InputTime = Now();
+	}
+
+	// call once the input is processed, right before the frame's GL commands; this is what frees a slot for the frame.
+	// oldestEventTime is when the first window event this frame used arrived, or 0 if there was none
+	void BeginRender(double oldestEventTime)
+	{
+		retire(MaxFrames - 1);
+		EventTime = oldestEventTime;
+	}
+
+	// call after the buffers were swapped
+	void EndFrame()
+	{
+		if (++SinceCalibration >= FRAME_PACER_CALIBRATE)
+			calibrate();
+
+		const int slot = (Oldest + InFlight) % FRAME_PACER_MAX_FRAMES;
+		glQueryCounter(Queries[slot], GL_TIMESTAMP);
+		Frame& frame = Frames[slot];
+		frame.Fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		frame.Input = InputTime;
+		frame.Event = EventTime;
+		frame.Submit = Now();
+		frame.Wait = WaitTime;
+		WaitTime = 0.0;
+		++InFlight;
+		retire(InFlight);
+	}
+
+	// forgets the measured frames, e.g. after switching modes
+	void ResetStats()
+	{
+		Recorded = 0;
+		Written = 0;
+	}
+
+	// percentiles over the recorded frames
+	const FramePacerStats& GetStats()
+	{
+		Stats = FramePacerStats();
+		Stats.MaxFramesInFlight = MaxFrames;
+		Stats.LowLatency = LowLatency;
+		Stats.Frames = Recorded;
+		if (Recorded == 0)
+			return Stats;
+
+		int events = 0;
+		double wait = 0.0;
+		for (int i = 0; i < Recorded; ++i)
+		{
+			Scratch[i] = History[i].Latency;
+			if (History[i].EventLatency >= 0.0f)
+				EventScratch[events++] = History[i].EventLatency;
+			wait += History[i].Wait;
+		}
+		Stats.LatencyP50Ms = percentile(Scratch, Recorded, 0.50);
+		Stats.LatencyP95Ms = percentile(Scratch, Recorded, 0.95);
+		Stats.LatencyP99Ms = percentile(Scratch, Recorded, 0.99);
+		Stats.LatencyMaxMs = percentile(Scratch, Recorded, 1.0);
+		Stats.EventFrames = events;
+		if (events > 0)
+		{
+			Stats.EventLatencyP50Ms = percentile(EventScratch, events, 0.50);
+			Stats.EventLatencyP99Ms = percentile(EventScratch, events, 0.99);
+		}
+		for (int i = 0; i < Recorded; ++i)
+			Scratch[i] = History[i].InputToSubmit;
+		Stats.InputToSubmitMs = percentile(Scratch, Recorded, 0.50);
+		Stats.WaitMs = wait / Recorded;
+		return Stats;
+	}
+
+private:
+	struct Frame
+	{
+		GLsync Fence;
+		double Input;
+		double Event;
+		double Submit;
+		double Wait;
+	};
+
+	struct Sample
+	{
+		float Latency;
+		float EventLatency;     // negative without an event
+		float InputToSubmit;
+		float Wait;
+	};
+
+	Clock Now = steadySeconds;
+	GLuint Queries[FRAME_PACER_MAX_FRAMES] = {};
+	Frame Frames[FRAME_PACER_MAX_FRAMES] = {};
+	int Oldest = 0;
+	int InFlight = 0;
+	int MaxFrames = FRAME_PACER_DEFAULT_FRAMES;
+	bool LowLatency = false;
+
+	double InputTime = 0.0;
+	double EventTime = 0.0;
+	double WaitTime = 0.0;             // blocked so far in the frame being built
+	double GpuToCpu = 0.0;             // added to a GPU timestamp in seconds gives CPU clock seconds
+	int SinceCalibration = 0;
+
+	Sample History[FRAME_PACER_HISTORY] = {};
+	int Recorded = 0;
+	int Written = 0;
+	float Scratch[FRAME_PACER_HISTORY] = {};
+	float EventScratch[FRAME_PACER_HISTORY] = {};
+	FramePacerStats Stats;
+
+	static double steadySeconds()
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	void calibrate()
+	{
+		GLint64 gpu = 0;
+		glGetInteger64v(GL_TIMESTAMP, &gpu);
+		GpuToCpu = Now() - double(gpu) * 1e-9;
+		SinceCalibration = 0;
+	}
+
+	// waits until at most limit frames are in flight, then collects the others that have already finished
+	void retire(int limit)
+	{
+		while (InFlight > 0)
+		{
+			Frame& frame = Frames[Oldest];
+			GLenum result;
+			if (InFlight > limit)
+			{
+				const double start = Now();
+				result = glClientWaitSync(frame.Fence, GL_SYNC_FLUSH_COMMANDS_BIT, FRAME_PACER_TIMEOUT_NS);
+				WaitTime += Now() - start;
+				if (result == GL_TIMEOUT_EXPIRED)
+					continue;
+			}
+			else
+			{
+				result = glClientWaitSync(frame.Fence, 0, 0);
+				if (result == GL_TIMEOUT_EXPIRED)
+					break;
+			}
+			// GL_WAIT_FAILED too ends the frame, or it would be waited on forever
+			record(frame, Oldest);
+			glDeleteSync(frame.Fence);
+			Oldest = (Oldest + 1) % FRAME_PACER_MAX_FRAMES;
+			--InFlight;
+		}
+	}
+
+	void record(const Frame& frame, int slot)
+	{
+		// the timestamp was queued ahead of the fence, so it is there once the fence is signaled
+		GLuint64 gpu = 0;
+		glGetQueryObjectui64v(Queries[slot], GL_QUERY_RESULT, &gpu);
+		const double done = std::max(frame.Input, double(gpu) * 1e-9 + GpuToCpu);
+
+		Sample& sample = History[Written];
+		sample.Latency = float((done - frame.Input) * 1000.0);
+		sample.EventLatency = frame.Event > 0.0 ? float((done - std::min(frame.Event, frame.Input)) * 1000.0) : -1.0f;
+		sample.InputToSubmit = float((frame.Submit - frame.Input) * 1000.0);
+		sample.Wait = float(frame.Wait * 1000.0);
+		Written = (Written + 1) % FRAME_PACER_HISTORY;
+		Recorded = std::min(Recorded + 1, FRAME_PACER_HISTORY);
+	}
+
+	// the value below which the given share of values lies; reorders values
+	static double percentile(float* values, int count, double share)
+	{
+		const int index = std::min(count - 1, int(share * count));
+		std::nth_element(values, values + index, values + count);
+		return values[index];
+	}
+};
+#endif
@@ -0,0 +1,109 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+
+#include <glm/glm.hpp>
+
+// Indices into Frustum::Planes
+enum Frustum_Plane {
+	PLANE_LEFT,
+	PLANE_RIGHT,
+	PLANE_BOTTOM,
+	PLANE_TOP,
+	PLANE_NEAR,
+	PLANE_FAR
+};
+
+// Result of testing a volume against all six planes
+enum Frustum_Test {
+	FRUSTUM_OUTSIDE,
+	FRUSTUM_INTERSECTS,
+	FRUSTUM_INSIDE
+};
+
+
+// The six clip planes of a view-projection matrix. Each plane is stored as (normal, distance) with the normal pointing into the frustum
+struct Frustum
+{
+	glm::vec4 Planes[6];
+
+	// extracts the planes from a combined view-projection matrix (Gribb/Hartmann method)
+	static Frustum FromMatrix(const glm::mat4& m)
+	{
+		// glm matrices are column major, so gather the rows first
+		const glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+		const glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+		const glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+		const glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+		Frustum frustum;
+		frustum.Planes[PLANE_LEFT] = row3 + row0;
+		frustum.Planes[PLANE_RIGHT] = row3 - row0;
+		frustum.Planes[PLANE_BOTTOM] = row3 + row1;
+		frustum.Planes[PLANE_TOP] = row3 - row1;
+		frustum.Planes[PLANE_NEAR] = row3 + row2;
+		frustum.Planes[PLANE_FAR] = row3 - row2;
+
+		for (int i = 0; i < 6; ++i)
+		{
+			glm::vec4& plane = frustum.Planes[i];
+			const float length = glm::length(glm::vec3(plane));
+			// an infinite far plane comes out as all zeros; make it a plane nothing is ever behind
+			if (length < 1e-6f)
+				plane = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+			else
+				plane = plane / length;
+		}
+		return frustum;
+	}
+
+	// returns false only if the box is completely outside one of the planes
+	bool IntersectsAabb(const glm::vec3& boxMin, const glm::vec3& boxMax) const
+	{
+		for (int i = 0; i < 6; ++i)
+		{
+			const glm::vec4& plane = Planes[i];
+			// test the corner furthest along the plane normal
+			const glm::vec3 corner(plane.x > 0.0f ? boxMax.x : boxMin.x,
+				plane.y > 0.0f ? boxMax.y : boxMin.y,
+				plane.z > 0.0f ? boxMax.z : boxMin.z);
+			if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f)
+				return false;
+		}
+		return true;
+	}
+
+	// like IntersectsAabb, but also tells apart boxes that are completely inside so hierarchies can stop testing below them
+	Frustum_Test ClassifyAabb(const glm::vec3& boxMin, const glm::vec3& boxMax) const
+	{
+		Frustum_Test result = FRUSTUM_INSIDE;
+		for (int i = 0; i < 6; ++i)
+		{
+			const glm::vec4& plane = Planes[i];
+			const glm::vec3 normal(plane);
+			const glm::vec3 furthest(plane.x > 0.0f ? boxMax.x : boxMin.x,
+				plane.y > 0.0f ? boxMax.y : boxMin.y,
+				plane.z > 0.0f ? boxMax.z : boxMin.z);
+			if (glm::dot(normal, furthest) + plane.w < 0.0f)
+				return FRUSTUM_OUTSIDE;
+			const glm::vec3 nearest(plane.x > 0.0f ? boxMin.x : boxMax.x,
+				plane.y > 0.0f ? boxMin.y : boxMax.y,
+				plane.z > 0.0f ? boxMin.z : boxMax.z);
+			if (glm::dot(normal, nearest) + plane.w < 0.0f)
+				result = FRUSTUM_INTERSECTS;
+		}
+		return result;
+	}
+
+	// returns false only if the sphere is completely outside one of the planes
+	bool IntersectsSphere(const glm::vec3& center, float radius) const
+	{
+		for (int i = 0; i < 6; ++i)
+		{
+			if (glm::dot(glm::vec3(Planes[i]), center) + Planes[i].w < -radius)
+				return false;
+		}
+		return true;
+	}
+};
+#endif
@@ -0,0 +1,200 @@
+#ifndef GPU_CULLING_H
+#define GPU_CULLING_H
+
+
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Frustum.h"
+#include "GpuMemory.h"
+#include "Shader.h"
+
+// One object as the culling and vertex shaders read it (std430 layout)
+struct GpuObject
+{
+	glm::mat4 Model;
+	glm::vec4 BoundsMin;    // world space box; w holds the draw group the object belongs to
+	glm::vec4 BoundsMax;    // w is free for the drawing shader (proj1 keeps the first material of the object there)
+};
+
+// Layout glDrawElementsIndirect reads from GL_DRAW_INDIRECT_BUFFER
+struct DrawElementsIndirectCommand
+{
+	GLuint Count;
+	GLuint InstanceCount;
+	GLuint FirstIndex;
+	GLint BaseVertex;
+	GLuint BaseInstance;
+};
+
+// The indices a draw group renders, in the index buffer of the VAO bound for it
+struct GpuDrawRange
+{
+	GLuint IndexCount;
+	GLuint FirstIndex;
+	GLint BaseVertex;
+};
+
+// Shader storage binding points, shared with the vertex shader that draws the survivors
+const GLuint GPU_CULL_OBJECT_BINDING = 0;
+const GLuint GPU_CULL_VISIBLE_BINDING = 1;
+const GLuint GPU_CULL_COMMAND_BINDING = 2;
+const GLuint GPU_CULL_WORKGROUP_SIZE = 64;
+
+// Tests one object per invocation against the frustum. Survivors bump their group's instance count with an atomic
+// and write their index into the group's slice of the visible list, so each group's draw command ends up holding exactly
+// its visible instances. Only core GL 4.3 features are used, so it also runs on llvmpipe
+const char* const gpuCullComputeShaderSource = "#version 430 core\n"
+"layout (local_size_x = 64) in;\n"
+
+"struct Object { mat4 model; vec4 boundsMin; vec4 boundsMax; };\n"
+"struct DrawCommand { uint count; uint instanceCount; uint firstIndex; int baseVertex; uint baseInstance; };\n"
+
+"layout (std430, binding = 0) readonly buffer Objects { Object objects[]; };\n"
+"layout (std430, binding = 1) writeonly buffer Visible { uint visible[]; };\n"
+"layout (std430, binding = 2) buffer Commands { DrawCommand commands[]; };\n"
+
+"uniform vec4 planes[6];\n"
+"uniform uint objectCount;\n"
+
+"void main()\n"
+"{\n"
+"   uint index = gl_GlobalInvocationID.x;\n"
+"   if (index >= objectCount)\n"
+"       return;\n"
+"   vec3 boundsMin = objects[index].boundsMin.xyz;\n"
+"   vec3 boundsMax = objects[index].boundsMax.xyz;\n"
+"   for (int i = 0; i < 6; ++i)\n"
+"   {\n"
+"       vec3 corner = mix(boundsMin, boundsMax, greaterThan(planes[i].xyz, vec3(0.0)));\n"
+"       if (dot(planes[i].xyz, corner) + planes[i].w < 0.0)\n"
+"           return;\n"
+"   }\n"
+"   uint group = uint(objects[index].boundsMin.w);\n"
+"   uint slot = atomicAdd(commands[group].instanceCount, 1u);\n"
+"   visible[commands[group].baseInstance + slot] = index;\n"
+"}\n\0";
+
+
+// GPU-driven visibility: object data lives in shader storage buffers, a compute pass culls it and fills
+// one indirect draw command per draw group. Drawing reads the commands straight from the buffer, so the CPU
+// never reads back how many objects survived
+class GpuCuller
+{
+public:
+	bool Create()
+	{
+		if (!UCreateComputeProgram(gpuCullComputeShaderSource, ProgramId, "gpu culling"))
+			return false;
+		PlanesLocation = glGetUniformLocation(ProgramId, "planes");
+		ObjectCountLocation = glGetUniformLocation(ProgramId, "objectCount");
+
+		glGenBuffers(1, &ObjectBuffer);
+		glGenBuffers(1, &VisibleBuffer);
+		glGenBuffers(1, &CommandBuffer);
+		return true;
+	}
+
+	void Destroy()
+	{
+		UDeleteProgram(ProgramId);
+		UDeleteBuffers(1, &ObjectBuffer);
+		UDeleteBuffers(1, &VisibleBuffer);
+		UDeleteBuffers(1, &CommandBuffer);
+		ProgramId = ObjectBuffer = VisibleBuffer = CommandBuffer = 0;
+	}
+
+	// uploads the scene. groupRanges[g] is where the indices of the mesh draw group g renders are; every object's BoundsMin.w
+	// names its group
+	void SetObjects(const std::vector<GpuObject>& objects, const std::vector<GpuDrawRange>& groupRanges)
+	{
+		ObjectCount = GLuint(objects.size());
+
+		// each group gets a slice of the visible list big enough for all of its objects
+		Commands.assign(groupRanges.size(), DrawElementsIndirectCommand());
+		std::vector<GLuint> groupSizes(groupRanges.size(), 0);
+		for (const GpuObject& object : objects)
+			groupSizes[GLuint(object.BoundsMin.w)]++;
+		GLuint offset = 0;
+		for (size_t g = 0; g < Commands.size(); ++g)
+		{
+			Commands[g].Count = groupRanges[g].IndexCount;
+			Commands[g].InstanceCount = 0;
+			Commands[g].FirstIndex = groupRanges[g].FirstIndex;
+			Commands[g].BaseVertex = groupRanges[g].BaseVertex;
+			Commands[g].BaseInstance = offset;
+			offset += groupSizes[g];
+		}
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, ObjectBuffer);
+		UBufferData(GL_SHADER_STORAGE_BUFFER, ObjectBuffer, objects.size() * sizeof(GpuObject), objects.data(), GL_DYNAMIC_DRAW, "gpu culling");
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, VisibleBuffer);
+		UBufferData(GL_SHADER_STORAGE_BUFFER, VisibleBuffer, (objects.empty() ? 1 : objects.size()) * sizeof(GLuint), NULL, GL_DYNAMIC_COPY, "gpu culling");
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, CommandBuffer);
+		UBufferData(GL_SHADER_STORAGE_BUFFER, CommandBuffer, Commands.size() * sizeof(DrawElementsIndirectCommand), Commands.data(), GL_DYNAMIC_DRAW, "gpu culling");
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	// re-uploads transforms and bounds after objects moved. The object count and groups must not change
+	void UpdateObjects(const std::vector<GpuObject>& objects)
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, ObjectBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, objects.size() * sizeof(GpuObject), objects.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	// resets the instance counts and runs the culling pass. The results stay on the GPU
+	void Cull(const Frustum& frustum)
+	{
+		if (ObjectCount == 0)
+			return;
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, CommandBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, Commands.size() * sizeof(DrawElementsIndirectCommand), Commands.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		glUseProgram(ProgramId);
+		glUniform4fv(PlanesLocation, 6, &frustum.Planes[0].x);
+		glUniform1ui(ObjectCountLocation, ObjectCount);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GPU_CULL_OBJECT_BINDING, ObjectBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GPU_CULL_VISIBLE_BINDING, VisibleBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GPU_CULL_COMMAND_BINDING, CommandBuffer);
+		glDispatchCompute((ObjectCount + GPU_CULL_WORKGROUP_SIZE - 1) / GPU_CULL_WORKGROUP_SIZE, 1, 1);
+
+		// the draws read the commands as indirect parameters and the visible list from the vertex shader
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+
+	// binds the buffers the drawing vertex shader reads. Call once before the DrawGroup calls
+	void BindForDraw() const
+	{
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GPU_CULL_OBJECT_BINDING, ObjectBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GPU_CULL_VISIBLE_BINDING, VisibleBuffer);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, CommandBuffer);
+	}
+
+	// draws the visible instances of one group with its mesh VAO bound. groupOffsetLocation is the vertex shader
+	// uniform that holds the start of the group's slice of the visible list
+	void DrawGroup(GLuint group, GLint groupOffsetLocation) const
+	{
+		glUniform1ui(groupOffsetLocation, Commands[group].BaseInstance);
+		glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_SHORT, (const void*)(group * sizeof(DrawElementsIndirectCommand)));
+	}
+
+	GLuint GetObjectCount() const { return ObjectCount; }
+	GLuint GetGroupCount() const { return GLuint(Commands.size()); }
+	GLuint GetCommandBuffer() const { return CommandBuffer; }
+
+private:
+	GLuint ProgramId = 0;
+	GLint PlanesLocation = -1;
+	GLint ObjectCountLocation = -1;
+	GLuint ObjectBuffer = 0;
+	GLuint VisibleBuffer = 0;
+	GLuint CommandBuffer = 0;
+	GLuint ObjectCount = 0;
+	std::vector<DrawElementsIndirectCommand> Commands;    // the reset state uploaded before every pass
+};
+#endif
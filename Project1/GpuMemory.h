@@ -0,0 +1,298 @@
+#ifndef GPU_MEMORY_H
+#define GPU_MEMORY_H
+
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+#include <GL/glew.h>
+
+// Kinds of GPU memory the tracker tells apart
+enum Gpu_Resource {
+	GPU_BUFFER,
+	GPU_TEXTURE,
+	GPU_RENDERBUFFER,
+	GPU_PROGRAM,
+	GPU_RESOURCE_COUNT
+};
+
+const char* const GPU_RESOURCE_NAMES[GPU_RESOURCE_COUNT] = { "buffers", "textures", "renderbuffers", "programs" };
+
+struct GpuMemoryCategory
+{
+	uint64_t Bytes = 0;
+	uint64_t PeakBytes = 0;
+	uint32_t Count = 0;
+	uint32_t PeakCount = 0;
+};
+
+// Everything live under one owner tag
+struct GpuMemoryOwner
+{
+	const char* Tag;
+	uint64_t Bytes = 0;
+	uint64_t PeakBytes = 0;
+	uint32_t Count = 0;
+};
+
+// What the driver says about video memory, from GL_NVX_gpu_memory_info or GL_ATI_meminfo. Sizes the extension does not
+// report are 0
+struct GpuDriverMemory
+{
+	const char* Source = "";
+	uint64_t TotalBytes = 0;
+	uint64_t DedicatedBytes = 0;
+	uint64_t FreeBytes = 0;
+	uint32_t Evictions = 0;
+};
+
+
+// Records the bytes of every GL buffer, texture, renderbuffer and program by kind and by owner tag, with peaks, so live
+// totals can be reported at any time and whatever is still alive at shutdown is reported as a leak. Allocations are
+// recorded by the U* wrappers below, which stand in for the GL calls that create, respecify and delete storage.
+// Owner tags must be string literals (they are kept by pointer). GL thread only, like the calls it wraps
+class GpuMemoryTracker
+{
+public:
+	// records storage for an object, replacing what was recorded for it before (glBufferData respecifies in place)
+	void Track(Gpu_Resource type, GLuint id, uint64_t bytes, const char* owner)
+	{
+		if (id == 0)
+			return;
+		Entry& entry = Live[key(type, id)];
+		if (entry.Owner != NO_OWNER)
+			remove(type, entry);
+		entry.Bytes = bytes;
+		entry.Owner = ownerIndex(owner);
+		add(type, entry);
+	}
+
+	// forgets an object about to be deleted; objects that never had storage are ignored
+	void Release(Gpu_Resource type, GLuint id)
+	{
+		const auto found = Live.find(key(type, id));
+		if (found == Live.end())
+			return;
+		remove(type, found->second);
+		Live.erase(found);
+	}
+
+	const GpuMemoryCategory& GetCategory(Gpu_Resource type) const { return Categories[type]; }
+	const std::vector<GpuMemoryOwner>& GetOwners() const { return Owners; }
+	uint64_t GetTotalBytes() const { return TotalBytes; }
+	uint64_t GetPeakTotalBytes() const { return PeakTotalBytes; }
+
+	// asks the driver how much video memory there is and how much is left. False when neither extension is exposed
+	bool QueryDriver(GpuDriverMemory& memory) const
+	{
+		memory = GpuDriverMemory();
+		if (GLEW_NVX_gpu_memory_info)
+		{
+			// all in KB
+			GLint total = 0, dedicated = 0, available = 0, evictions = 0;
+			glGetIntegerv(GL_GPU_MEMORY_INFO_TOTAL_AVAILABLE_MEMORY_NVX, &total);
+			glGetIntegerv(GL_GPU_MEMORY_INFO_DEDICATED_VIDMEM_NVX, &dedicated);
+			glGetIntegerv(GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX, &available);
+			glGetIntegerv(GL_GPU_MEMORY_INFO_EVICTION_COUNT_NVX, &evictions);
+			memory.Source = "GL_NVX_gpu_memory_info";
+			memory.TotalBytes = uint64_t(total) * 1024;
+			memory.DedicatedBytes = uint64_t(dedicated) * 1024;
+			memory.FreeBytes = uint64_t(available) * 1024;
+			memory.Evictions = uint32_t(evictions);
+			return true;
+		}
+		if (GLEW_ATI_meminfo)
+		{
+			// free KB of the pool, largest free block, then the same for auxiliary (system) memory
+			GLint texture[4] = {}, vbo[4] = {};
+			glGetIntegerv(GL_TEXTURE_FREE_MEMORY_ATI, texture);
+			glGetIntegerv(GL_VBO_FREE_MEMORY_ATI, vbo);
+			memory.Source = "GL_ATI_meminfo";
+			memory.FreeBytes = uint64_t(std::min(texture[0], vbo[0])) * 1024;
+			return true;
+		}
+		return false;
+	}
+
+	// prints every object still alive, by owner; returns how many there were
+	uint32_t ReportLeaks() const
+	{
+		for (const std::pair<const uint64_t, Entry>& live : Live)
+		{
+			const Gpu_Resource type = Gpu_Resource(live.first >> 32);
+			std::cout << "ERROR::GPU_MEMORY::LEAK " << Owners[live.second.Owner].Tag << " " << GPU_RESOURCE_NAMES[type] << " object "
+				<< uint32_t(live.first) << ", " << live.second.Bytes << " bytes" << std::endl;
+		}
+		return uint32_t(Live.size());
+	}
+
+private:
+	static const uint32_t NO_OWNER = 0xffffffffu;
+
+	struct Entry
+	{
+		uint64_t Bytes = 0;
+		uint32_t Owner = NO_OWNER;
+	};
+
+	std::unordered_map<uint64_t, Entry> Live;
+	std::vector<GpuMemoryOwner> Owners;
+	GpuMemoryCategory Categories[GPU_RESOURCE_COUNT];
+	uint64_t TotalBytes = 0;
+	uint64_t PeakTotalBytes = 0;
+
+	static uint64_t key(Gpu_Resource type, GLuint id) { return (uint64_t(type) << 32) | id; }
+
+	// tags are literals, but the same text may come from different translation units, so they are compared by content
+	uint32_t ownerIndex(const char* tag)
+	{
+		for (uint32_t o = 0; o < uint32_t(Owners.size()); ++o)
+		{
+			if (Owners[o].Tag == tag || std::strcmp(Owners[o].Tag, tag) == 0)
+				return o;
+		}
+		GpuMemoryOwner owner;
+		owner.Tag = tag;
+		Owners.push_back(owner);
+		return uint32_t(Owners.size() - 1);
+	}
+
+	void add(Gpu_Resource type, const Entry& entry)
+	{
+		GpuMemoryCategory& category = Categories[type];
+		category.Bytes += entry.Bytes;
+		category.Count++;
+		category.PeakBytes = std::max(category.PeakBytes, category.Bytes);
+		category.PeakCount = std::max(category.PeakCount, category.Count);
+		GpuMemoryOwner& owner = Owners[entry.Owner];
+		owner.Bytes += entry.Bytes;
+		owner.Count++;
+		owner.PeakBytes = std::max(owner.PeakBytes, owner.Bytes);
+		TotalBytes += entry.Bytes;
+		PeakTotalBytes = std::max(PeakTotalBytes, TotalBytes);
+	}
+
+	void remove(Gpu_Resource type, const Entry& entry)
+	{
+		Categories[type].Bytes -= entry.Bytes;
+		Categories[type].Count--;
+		Owners[entry.Owner].Bytes -= entry.Bytes;
+		Owners[entry.Owner].Count--;
+		TotalBytes -= entry.Bytes;
+	}
+};
+
+// The process wide tracker; every module's GL storage goes through it
+inline GpuMemoryTracker gGpuMemory;
+
+
+// Bytes of a 2D image chain in the formats this program creates: block compressed formats take 8 or 16 bytes per 4x4
+// block, everything else is counted by its texel size
+inline uint64_t UGpuImageBytes(GLenum format, GLsizei width, GLsizei height, GLsizei levels)
+{
+	uint32_t blockBytes = 0, texelBytes = 4;
+	switch (format)
+	{
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RED_RGTC1: case GL_COMPRESSED_RGB8_ETC2: case GL_COMPRESSED_SRGB8_ETC2:
+		blockBytes = 8;
+		break;
+	case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT: case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT:
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+	case GL_COMPRESSED_RG_RGTC2: case GL_COMPRESSED_RGBA_BPTC_UNORM: case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+	case GL_COMPRESSED_RGBA8_ETC2_EAC: case GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC:
+		blockBytes = 16;
+		break;
+	case GL_R8:
+		texelBytes = 1;
+		break;
+	case GL_RG8: case GL_R16F:
+		texelBytes = 2;
+		break;
+	case GL_RGBA16F: case GL_RG32F:
+		texelBytes = 8;
+		break;
+	case GL_RGBA32F:
+		texelBytes = 16;
+		break;
+	default:    // RGBA8, sRGB, R32F, 24 and 32 bit depth
+		break;
+	}
+
+	uint64_t bytes = 0;
+	for (GLsizei level = 0; level < levels; ++level)
+	{
+		const uint64_t w = uint64_t(std::max(1, width >> level)), h = uint64_t(std::max(1, height >> level));
+		bytes += blockBytes != 0 ? ((w + 3) / 4) * ((h + 3) / 4) * blockBytes : w * h * texelBytes;
+	}
+	return bytes;
+}
+
+// glBufferData on the buffer bound to target, which must be buffer
+inline void UBufferData(GLenum target, GLuint buffer, GLsizeiptr bytes, const void* data, GLenum usage, const char* owner)
+{
+	glBufferData(target, bytes, data, usage);
+	gGpuMemory.Track(GPU_BUFFER, buffer, uint64_t(bytes), owner);
+}
+
+// immutable storage (glBufferStorage, GL 4.4) for the buffer bound to target, which must be buffer
+inline void UBufferStorage(GLenum target, GLuint buffer, GLsizeiptr bytes, const void* data, GLbitfield flags, const char* owner)
+{
+	glBufferStorage(target, bytes, data, flags);
+	gGpuMemory.Track(GPU_BUFFER, buffer, uint64_t(bytes), owner);
+}
+
+inline void UDeleteBuffers(GLsizei count, const GLuint* buffers)
+{
+	for (GLsizei b = 0; b < count; ++b)
+		gGpuMemory.Release(GPU_BUFFER, buffers[b]);
+	glDeleteBuffers(count, buffers);
+}
+
+// glTexStorage2D on the 2D texture bound to GL_TEXTURE_2D, which must be texture
+inline void UTexStorage2D(GLuint texture, GLsizei levels, GLenum format, GLsizei width, GLsizei height, const char* owner)
+{
+	glTexStorage2D(GL_TEXTURE_2D, levels, format, width, height);
+	gGpuMemory.Track(GPU_TEXTURE, texture, UGpuImageBytes(format, width, height, levels), owner);
+}
+
+inline void UDeleteTextures(GLsizei count, const GLuint* textures)
+{
+	for (GLsizei t = 0; t < count; ++t)
+		gGpuMemory.Release(GPU_TEXTURE, textures[t]);
+	glDeleteTextures(count, textures);
+}
+
+// glRenderbufferStorage on the bound renderbuffer, which must be renderbuffer
+inline void URenderbufferStorage(GLuint renderbuffer, GLenum format, GLsizei width, GLsizei height, const char* owner)
+{
+	glRenderbufferStorage(GL_RENDERBUFFER, format, width, height);
+	gGpuMemory.Track(GPU_RENDERBUFFER, renderbuffer, UGpuImageBytes(format, width, height, 1), owner);
+}
+
+inline void UDeleteRenderbuffers(GLsizei count, const GLuint* renderbuffers)
+{
+	for (GLsizei r = 0; r < count; ++r)
+		gGpuMemory.Release(GPU_RENDERBUFFER, renderbuffers[r]);
+	glDeleteRenderbuffers(count, renderbuffers);
+}
+
+// records a linked program, sized by its binary (GL 4.1) as the closest thing GL reports to the code it keeps
+inline void UTrackProgram(GLuint program, const char* owner)
+{
+	GLint bytes = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &bytes);
+	gGpuMemory.Track(GPU_PROGRAM, program, uint64_t(std::max(0, bytes)), owner);
+}
+
+inline void UDeleteProgram(GLuint program)
+{
+	gGpuMemory.Release(GPU_PROGRAM, program);
+	glDeleteProgram(program);
+}
+#endif
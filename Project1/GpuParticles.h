@@ -0,0 +1,495 @@
+#ifndef GPU_PARTICLES_H
+#define GPU_PARTICLES_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "GpuMemory.h"
+#include "Particles.h"
+#include "Shader.h"
+
+// Shader storage binding points, after the ones the scene uses; the drawing vertex shader reads the first two and the
+// alive list
+const GLuint PARTICLE_POSITION_BINDING = 7;
+const GLuint PARTICLE_VELOCITY_BINDING = 8;
+const GLuint PARTICLE_ID_BINDING = 9;
+const GLuint PARTICLE_DEAD_BINDING = 10;
+const GLuint PARTICLE_ALIVE_BINDING = 11;
+const GLuint PARTICLE_COUNTER_BINDING = 12;
+// Simulation passes timed at once; the times come back a few frames late
+const int PARTICLE_TIMER_SLOTS = 3;
+
+// Layout glDrawArraysIndirect reads from GL_DRAW_INDIRECT_BUFFER
+struct DrawArraysIndirectCommand
+{
+	GLuint Count;
+	GLuint InstanceCount;
+	GLuint First;
+	GLuint BaseInstance;
+};
+
+// The counters the passes share, and the indirect arguments they fill for each other (std430 layout)
+struct GpuParticleCounters
+{
+	GLuint DeadCount;               // slots on the dead list
+	GLuint EmitBase;                // where the slots this step's spawns take start on the dead list
+	GLuint EmitCount;
+	GLuint AliveBase;               // where this step's spawns start on the next alive list
+	GLuint AliveCount[2];
+	GLuint SimulateArgs[3];         // glDispatchComputeIndirect
+	GLuint EmitArgs[3];
+	DrawArraysIndirectCommand Draw;
+};
+static_assert(sizeof(GpuParticleCounters) == 64, "the shaders declare the counters field by field");
+
+// Between the passes, on one invocation: before simulating, sizes the simulation to the living particles and empties
+// the next alive list; after, takes the spawns' slots off the end of the dead list and sizes the spawn pass and the draw
+const char* const particlePrepareComputeShaderSource = "#version 430 core\n"
+"layout (local_size_x = 1) in;\n"
+
+"layout (std430, binding = 12) buffer Counters { uint deadCount; uint emitBase; uint emitCount; uint aliveBase; uint aliveCount[2];\n"
+"   uint simulateArgs[3]; uint emitArgs[3]; uint drawArgs[4]; };\n"
+
+"uniform uint current;\n"
+"uniform uint phase;\n"
+"uniform uint requested;\n"
+
+"void main()\n"
+"{\n"
+"   uint next = 1u - current;\n"
+"   if (phase == 0u)\n"
+"   {\n"
+"       simulateArgs[0] = (aliveCount[current] + 63u) / 64u;\n"
+"       simulateArgs[1] = 1u;\n"
+"       simulateArgs[2] = 1u;\n"
+"       aliveCount[next] = 0u;\n"
+"       return;\n"
+"   }\n"
+"   uint spawned = min(requested, deadCount);\n"
+"   emitCount = spawned;\n"
+"   deadCount -= spawned;\n"
+"   emitBase = deadCount;\n"
+"   aliveBase = aliveCount[next];\n"
+"   aliveCount[next] += spawned;\n"
+"   emitArgs[0] = (spawned + 63u) / 64u;\n"
+"   emitArgs[1] = 1u;\n"
+"   emitArgs[2] = 1u;\n"
+"   drawArgs[0] = aliveCount[next];\n"
+"   drawArgs[1] = 1u;\n"
+"   drawArgs[2] = 0u;\n"
+"   drawArgs[3] = 0u;\n"
+"}\n\0";
+
+// One living particle per invocation, moved exactly as ParticleSimulator moves it. Survivors append themselves to the
+// next alive list and retirees to the dead list, which compacts both lists as it goes. Each workgroup counts its own in
+// shared memory first and reserves its run of both lists with one atomic on the global counters, rather than having
+// every invocation fight over them
+const char* const particleSimulateComputeShaderSource = "#version 430 core\n"
+"layout (local_size_x = 64) in;\n"
+
+"layout (std430, binding = 7) buffer Positions { vec4 positionAge[]; };\n"
+"layout (std430, binding = 8) buffer Velocities { vec4 velocityLife[]; };\n"
+"layout (std430, binding = 10) buffer Dead { uint dead[]; };\n"
+"layout (std430, binding = 11) buffer Alive { uint alive[]; };\n"
+"layout (std430, binding = 12) buffer Counters { uint deadCount; uint emitBase; uint emitCount; uint aliveBase; uint aliveCount[2];\n"
+"   uint simulateArgs[3]; uint emitArgs[3]; uint drawArgs[4]; };\n"
+
+"uniform uint current;\n"
+"uniform uint capacity;\n"
+"uniform float deltaTime;\n"
+"uniform float gravity;\n"
+"uniform float damping;\n"
+"uniform float ground;\n"
+"uniform float restitution;\n"
+
+"shared uint groupAlive;\n"
+"shared uint groupDead;\n"
+
+"void main()\n"
+"{\n"
+"   if (gl_LocalInvocationIndex == 0u)\n"
+"   {\n"
+"       groupAlive = 0u;\n"
+"       groupDead = 0u;\n"
+"   }\n"
+"   barrier();\n"
+
+"   uint next = 1u - current;\n"
+"   bool moving = gl_GlobalInvocationID.x < aliveCount[current];\n"
+"   uint particle = 0u;\n"
+"   bool lives = false;\n"
+"   uint slot = 0u;\n"
+"   if (moving)\n"
+"   {\n"
+"       particle = alive[current * capacity + gl_GlobalInvocationID.x];\n"
+"       vec4 p = positionAge[particle];\n"
+"       vec4 v = velocityLife[particle];\n"
+"       v.x = v.x * damping;\n"
+"       v.y = (v.y + gravity) * damping;\n"
+"       v.z = v.z * damping;\n"
+"       p.xyz = p.xyz + v.xyz * deltaTime;\n"
+"       if (p.y < ground)\n"
+"       {\n"
+"           p.y = ground + (ground - p.y);\n"
+"           v.y = v.y * -restitution;\n"
+"       }\n"
+"       p.w = p.w + deltaTime;\n"
+"       positionAge[particle] = p;\n"
+"       velocityLife[particle] = v;\n"
+"       lives = p.w < v.w;\n"
+"       slot = lives ? atomicAdd(groupAlive, 1u) : atomicAdd(groupDead, 1u);\n"
+"   }\n"
+"   barrier();\n"
+
+"   if (gl_LocalInvocationIndex == 0u)\n"
+"   {\n"
+"       groupAlive = atomicAdd(aliveCount[next], groupAlive);\n"
+"       groupDead = atomicAdd(deadCount, groupDead);\n"
+"   }\n"
+"   barrier();\n"
+
+"   if (!moving)\n"
+"       return;\n"
+"   if (lives)\n"
+"       alive[next * capacity + groupAlive + slot] = particle;\n"
+"   else\n"
+"       dead[groupDead + slot] = particle;\n"
+"}\n\0";
+
+// One spawn per invocation into a slot from the dead list, seeded by its id exactly as USpawnParticle seeds it
+const char* const particleEmitComputeShaderSource = "#version 430 core\n"
+"layout (local_size_x = 64) in;\n"
+
+"layout (std430, binding = 7) writeonly buffer Positions { vec4 positionAge[]; };\n"
+"layout (std430, binding = 8) writeonly buffer Velocities { vec4 velocityLife[]; };\n"
+"layout (std430, binding = 9) writeonly buffer Ids { uint ids[]; };\n"
+"layout (std430, binding = 10) readonly buffer Dead { uint dead[]; };\n"
+"layout (std430, binding = 11) buffer Alive { uint alive[]; };\n"
+"layout (std430, binding = 12) buffer Counters { uint deadCount; uint emitBase; uint emitCount; uint aliveBase; uint aliveCount[2];\n"
+"   uint simulateArgs[3]; uint emitArgs[3]; uint drawArgs[4]; };\n"
+
+"uniform uint current;\n"
+"uniform uint capacity;\n"
+"uniform uint firstId;\n"
+"uniform uint emitterCount;\n"
+"uniform vec4 emitterPositionLife[8];\n"
+"uniform vec4 emitterVelocitySpread[8];\n"
+"uniform uint emitEnd[8];\n"
+
+"uint hash(uint x)\n"
+"{\n"
+"   uint state = x * 747796405u + 2891336453u;\n"
+"   uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;\n"
+"   return (word >> 22u) ^ word;\n"
+"}\n"
+
+"float random(uint h)\n"
+"{\n"
+"   return float(h >> 8u) * (1.0 / 16777216.0);\n"
+"}\n"
+
+"void main()\n"
+"{\n"
+"   uint n = gl_GlobalInvocationID.x;\n"
+"   if (n >= emitCount)\n"
+"       return;\n"
+"   uint e = 0u;\n"
+"   while (e + 1u < emitterCount && n >= emitEnd[e])\n"
+"       ++e;\n"
+"   uint id = firstId + n;\n"
+"   uint h0 = hash(id);\n"
+"   uint h1 = hash(h0);\n"
+"   uint h2 = hash(h1);\n"
+"   uint h3 = hash(h2);\n"
+"   vec4 launch = emitterVelocitySpread[e];\n"
+"   uint particle = dead[emitBase + n];\n"
+"   positionAge[particle] = vec4(emitterPositionLife[e].xyz, 0.0);\n"
+"   velocityLife[particle] = vec4(launch.xyz + (vec3(random(h0), random(h1), random(h2)) * 2.0 - 1.0) * launch.w,\n"
+"       emitterPositionLife[e].w * (0.5 + random(h3)));\n"
+"   ids[particle] = id;\n"
+"   alive[(1u - current) * capacity + aliveBase + n] = particle;\n"
+"}\n\0";
+
+
+// Particles simulated entirely on the GPU. Each particle is a slot in structure of arrays shader storage buffers (position
+// and age, velocity and life, id); a dead list holds the free slots and two alive lists the living ones, one read and
+// one written each step. A step is four compute passes: prepare sizes the simulation, simulate moves every living
+// particle and sorts it onto the next alive list or the dead list, prepare again hands the spawns their free slots,
+// and emit fills them. Every count stays on the GPU, read by the next pass as indirect dispatch or draw arguments, so
+// the CPU never waits to learn how many particles there are. Drawing pulls each particle's point from the buffers
+// by gl_VertexID through the alive list, with no vertex buffer at all. Only core GL 4.3 features are used, so it also
+// runs on llvmpipe
+class GpuParticleSystem
+{
+public:
+	// returns false when a shader does not compile
+	bool Create(uint32_t capacity)
+	{
+		if (!UCreateComputeProgram(particlePrepareComputeShaderSource, PrepareProgram, "particles")
+			|| !UCreateComputeProgram(particleSimulateComputeShaderSource, SimulateProgram, "particles")
+			|| !UCreateComputeProgram(particleEmitComputeShaderSource, EmitProgram, "particles"))
+			return false;
+		Capacity = capacity;
+		Current = 0;
+
+		glGenBuffers(1, &PositionBuffer);
+		glGenBuffers(1, &VelocityBuffer);
+		glGenBuffers(1, &IdBuffer);
+		glGenBuffers(1, &DeadBuffer);
+		glGenBuffers(1, &AliveBuffer);
+		glGenBuffers(1, &CounterBuffer);
+		const GLsizeiptr vectors = GLsizeiptr(capacity) * sizeof(glm::vec4);
+		const GLsizeiptr indices = GLsizeiptr(capacity) * sizeof(GLuint);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, PositionBuffer);
+		UBufferStorage(GL_SHADER_STORAGE_BUFFER, PositionBuffer, vectors, nullptr, 0, "particles");
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, VelocityBuffer);
+		UBufferStorage(GL_SHADER_STORAGE_BUFFER, VelocityBuffer, vectors, nullptr, 0, "particles");
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, IdBuffer);
+		UBufferStorage(GL_SHADER_STORAGE_BUFFER, IdBuffer, indices, nullptr, 0, "particles");
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, AliveBuffer);
+		UBufferStorage(GL_SHADER_STORAGE_BUFFER, AliveBuffer, indices * 2, nullptr, 0, "particles");
+
+		// every slot starts out free
+		std::vector<GLuint> slots(capacity);
+		for (uint32_t i = 0; i < capacity; ++i)
+			slots[i] = i;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, DeadBuffer);
+		UBufferStorage(GL_SHADER_STORAGE_BUFFER, DeadBuffer, indices, slots.data(), 0, "particles");
+		GpuParticleCounters counters = {};
+		counters.DeadCount = capacity;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, CounterBuffer);
+		UBufferStorage(GL_SHADER_STORAGE_BUFFER, CounterBuffer, sizeof(counters), &counters, 0, "particles");
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		// vertex pulling still needs a vertex array object bound to draw with
+		glGenVertexArrays(1, &EmptyVao);
+		glGenQueries(PARTICLE_TIMER_SLOTS * 2, Queries);
+		TimersPending = 0;
+		TimedSteps = 0;
+		TimedMs = 0.0;
+
+		PrepareCurrent = glGetUniformLocation(PrepareProgram, "current");
+		PreparePhase = glGetUniformLocation(PrepareProgram, "phase");
+		PrepareRequested = glGetUniformLocation(PrepareProgram, "requested");
+		SimulateCurrent = glGetUniformLocation(SimulateProgram, "current");
+		SimulateCapacity = glGetUniformLocation(SimulateProgram, "capacity");
+		SimulateDeltaTime = glGetUniformLocation(SimulateProgram, "deltaTime");
+		SimulateGravity = glGetUniformLocation(SimulateProgram, "gravity");
+		SimulateDamping = glGetUniformLocation(SimulateProgram, "damping");
+		SimulateGround = glGetUniformLocation(SimulateProgram, "ground");
+		SimulateRestitution = glGetUniformLocation(SimulateProgram, "restitution");
+		EmitCurrent = glGetUniformLocation(EmitProgram, "current");
+		EmitCapacity = glGetUniformLocation(EmitProgram, "capacity");
+		EmitFirstId = glGetUniformLocation(EmitProgram, "firstId");
+		EmitEmitterCount = glGetUniformLocation(EmitProgram, "emitterCount");
+		EmitPositionLife = glGetUniformLocation(EmitProgram, "emitterPositionLife");
+		EmitVelocitySpread = glGetUniformLocation(EmitProgram, "emitterVelocitySpread");
+		EmitEnd = glGetUniformLocation(EmitProgram, "emitEnd");
+		return true;
+	}
+
+	void Destroy()
+	{
+		UDeleteProgram(PrepareProgram);
+		UDeleteProgram(SimulateProgram);
+		UDeleteProgram(EmitProgram);
+		UDeleteBuffers(1, &PositionBuffer);
+		UDeleteBuffers(1, &VelocityBuffer);
+		UDeleteBuffers(1, &IdBuffer);
+		UDeleteBuffers(1, &DeadBuffer);
+		UDeleteBuffers(1, &AliveBuffer);
+		UDeleteBuffers(1, &CounterBuffer);
+		glDeleteVertexArrays(1, &EmptyVao);
+		glDeleteQueries(PARTICLE_TIMER_SLOTS * 2, Queries);
+		PrepareProgram = SimulateProgram = EmitProgram = 0;
+		PositionBuffer = VelocityBuffer = IdBuffer = DeadBuffer = AliveBuffer = CounterBuffer = EmptyVao = 0;
+		Capacity = 0;
+	}
+
+	// runs one step of the simulation. The results stay on the GPU
+	void Update(const ParticleStep& step)
+	{
+		const GLuint next = 1 - Current;
+		pollTimers();
+		const bool timed = TimersPending < PARTICLE_TIMER_SLOTS;
+		const int slot = (TimerOldest + TimersPending) % PARTICLE_TIMER_SLOTS;
+		if (timed)
+			glQueryCounter(Queries[slot * 2], GL_TIMESTAMP);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PARTICLE_POSITION_BINDING, PositionBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PARTICLE_VELOCITY_BINDING, VelocityBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PARTICLE_ID_BINDING, IdBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PARTICLE_DEAD_BINDING, DeadBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PARTICLE_ALIVE_BINDING, AliveBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PARTICLE_COUNTER_BINDING, CounterBuffer);
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, CounterBuffer);
+
+		glUseProgram(PrepareProgram);
+		glUniform1ui(PrepareCurrent, Current);
+		glUniform1ui(PreparePhase, 0);
+		glUniform1ui(PrepareRequested, step.GetEmitCount());
+		glDispatchCompute(1, 1, 1);
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+		glUseProgram(SimulateProgram);
+		glUniform1ui(SimulateCurrent, Current);
+		glUniform1ui(SimulateCapacity, Capacity);
+		glUniform1f(SimulateDeltaTime, step.DeltaTime);
+		glUniform1f(SimulateGravity, step.Gravity);
+		glUniform1f(SimulateDamping, step.Damping);
+		glUniform1f(SimulateGround, step.Ground);
+		glUniform1f(SimulateRestitution, PARTICLE_RESTITUTION);
+		glDispatchComputeIndirect(offsetof(GpuParticleCounters, SimulateArgs));
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		glUseProgram(PrepareProgram);
+		glUniform1ui(PreparePhase, 1);
+		glDispatchCompute(1, 1, 1);
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+		glUseProgram(EmitProgram);
+		glUniform1ui(EmitCurrent, Current);
+		glUniform1ui(EmitCapacity, Capacity);
+		glUniform1ui(EmitFirstId, step.FirstId);
+		glUniform1ui(EmitEmitterCount, step.EmitterCount);
+		glUniform4fv(EmitPositionLife, PARTICLE_MAX_EMITTERS, &step.EmitterPositionLife[0].x);
+		glUniform4fv(EmitVelocitySpread, PARTICLE_MAX_EMITTERS, &step.EmitterVelocitySpread[0].x);
+		glUniform1uiv(EmitEnd, PARTICLE_MAX_EMITTERS, step.EmitEnd);
+		glDispatchComputeIndirect(offsetof(GpuParticleCounters, EmitArgs));
+
+		// the draw reads the counters as indirect parameters and the particles from the vertex shader
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+		glUseProgram(0);
+		Current = next;
+
+		if (timed)
+		{
+			glQueryCounter(Queries[slot * 2 + 1], GL_TIMESTAMP);
+			++TimersPending;
+		}
+	}
+
+	// binds what the drawing vertex shader reads. aliveOffsetLocation is its uniform for where the living particles
+	// start in the alive buffer
+	void BindForDraw(GLint aliveOffsetLocation) const
+	{
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PARTICLE_POSITION_BINDING, PositionBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PARTICLE_VELOCITY_BINDING, VelocityBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PARTICLE_ALIVE_BINDING, AliveBuffer);
+		glUniform1ui(aliveOffsetLocation, Current * Capacity);
+	}
+
+	// draws a point for every living particle with the drawing program in use; vertex n is particle n of the alive list
+	void Draw() const
+	{
+		glBindVertexArray(EmptyVao);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, CounterBuffer);
+		glDrawArraysIndirect(GL_POINTS, (const void*)offsetof(GpuParticleCounters, Draw));
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		glBindVertexArray(0);
+	}
+
+	// copies the living particles into a simulator. Waits for the GPU, so it is only for checking the simulation
+	void ReadBack(ParticleSimulator& out)
+	{
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		GpuParticleCounters counters;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, CounterBuffer);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counters), &counters);
+		const GLuint count = counters.AliveCount[Current];
+		Slots.resize(count);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, AliveBuffer);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, GLintptr(Current) * Capacity * sizeof(GLuint), count * sizeof(GLuint), Slots.data());
+
+		// the whole buffers land at the front of the scratch, and the living particles are gathered after them in alive
+		// list order, densely, the way the simulator keeps them
+		Positions.resize(size_t(Capacity) + count);
+		Velocities.resize(size_t(Capacity) + count);
+		Ids.resize(size_t(Capacity) + count);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, PositionBuffer);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, Capacity * sizeof(glm::vec4), Positions.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, VelocityBuffer);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, Capacity * sizeof(glm::vec4), Velocities.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, IdBuffer);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, Capacity * sizeof(GLuint), Ids.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		for (GLuint i = 0; i < count; ++i)
+		{
+			const GLuint slot = Slots[i];
+			Positions[Capacity + i] = Positions[slot];
+			Velocities[Capacity + i] = Velocities[slot];
+			Ids[Capacity + i] = Ids[slot];
+		}
+		out.Load(count, Positions.data() + Capacity, Velocities.data() + Capacity, Ids.data() + Capacity);
+	}
+
+	// mean GPU time of the simulation steps timed since the last call, or a negative number when none came back
+	double TakeMeanStepMs()
+	{
+		pollTimers();
+		const double mean = TimedSteps > 0 ? TimedMs / TimedSteps : -1.0;
+		TimedSteps = 0;
+		TimedMs = 0.0;
+		return mean;
+	}
+
+	uint32_t GetCapacity() const { return Capacity; }
+
+private:
+	GLuint PrepareProgram = 0;
+	GLuint SimulateProgram = 0;
+	GLuint EmitProgram = 0;
+	GLint PrepareCurrent = -1, PreparePhase = -1, PrepareRequested = -1;
+	GLint SimulateCurrent = -1, SimulateCapacity = -1, SimulateDeltaTime = -1, SimulateGravity = -1, SimulateDamping = -1,
+		SimulateGround = -1, SimulateRestitution = -1;
+	GLint EmitCurrent = -1, EmitCapacity = -1, EmitFirstId = -1, EmitEmitterCount = -1, EmitPositionLife = -1, EmitVelocitySpread = -1,
+		EmitEnd = -1;
+
+	GLuint PositionBuffer = 0;
+	GLuint VelocityBuffer = 0;
+	GLuint IdBuffer = 0;
+	GLuint DeadBuffer = 0;
+	GLuint AliveBuffer = 0;         // two lists of Capacity slots
+	GLuint CounterBuffer = 0;       // GpuParticleCounters; also the indirect dispatch and draw buffer
+	GLuint EmptyVao = 0;
+	uint32_t Capacity = 0;
+	GLuint Current = 0;             // the alive list holding the particles
+
+	GLuint Queries[PARTICLE_TIMER_SLOTS * 2] = {};
+	int TimerOldest = 0;
+	int TimersPending = 0;
+	uint32_t TimedSteps = 0;
+	double TimedMs = 0.0;
+
+	// readback scratch, kept for the next check
+	std::vector<GLuint> Slots;
+	std::vector<glm::vec4> Positions;
+	std::vector<glm::vec4> Velocities;
+	std::vector<GLuint> Ids;
+
+	// collects the step timestamps that have arrived, without waiting for any
+	void pollTimers()
+	{
+		while (TimersPending > 0)
+		{
+			GLint available = 0;
+			glGetQueryObjectiv(Queries[TimerOldest * 2 + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				return;
+			GLuint64 start = 0, end = 0;
+			glGetQueryObjectui64v(Queries[TimerOldest * 2], GL_QUERY_RESULT, &start);
+			glGetQueryObjectui64v(Queries[TimerOldest * 2 + 1], GL_QUERY_RESULT, &end);
+			TimedMs += double(end - start) * 1e-6;
+			++TimedSteps;
+			TimerOldest = (TimerOldest + 1) % PARTICLE_TIMER_SLOTS;
+			--TimersPending;
+		}
+	}
+};
+#endif
@@ -0,0 +1,215 @@
+#ifndef GPU_PICKER_H
+#define GPU_PICKER_H
+
+
+#include <cstdint>
+#include <iostream>
+
+#include <GL/glew.h>
+
+#include "GpuMemory.h"
+
+// Picks in flight at once. The IDs of a pick are on the CPU a frame or two after it was drawn; a pick asked for while
+// every slot is still waiting has to be asked for again
+const int GPU_PICK_SLOTS = 3;
+// Pixels a side of the ID target. A pick takes the ID nearest the middle, so an object a few pixels off still counts
+const int GPU_PICK_REGION = 9;
+// The ID written where nothing was drawn; objects are written as their index plus one
+const uint32_t GPU_PICK_NONE = 0;
+
+// What a pick found, once its IDs came back
+struct GpuPickResult
+{
+	bool Hit = false;
+	uint32_t Object = 0;        // the caller's index for the ID nearest the middle of the region
+	uint32_t Tag = 0;           // what the caller passed to End
+	int FramesLate = 0;         // frames between End and the IDs being read
+	double GpuMs = 0.0;         // GPU time drawing the IDs
+};
+
+
+// Object picking on the GPU without a stall. The caller draws each candidate object's index plus one into a small
+// unsigned integer target between Begin and End, usually with Camera::GetPickMatrix so only the pixels around the
+// cursor are rasterized; End copies the IDs into a pixel pack buffer and fences it, and Poll maps the buffer only once
+// the fence says the copy is done. glReadPixels straight into client memory would wait for the GPU to finish
+// everything queued before it instead. Timestamps around the draws give the GPU time, which a GL_TIME_ELAPSED query
+// could not when another one (the frame's) is running
+class GpuPicker
+{
+public:
+	// returns false when the driver cannot render to an unsigned integer target
+	bool Create()
+	{
+		glGenFramebuffers(1, &Framebuffer);
+		glGenRenderbuffers(1, &Ids);
+		glGenRenderbuffers(1, &Depth);
+		glBindRenderbuffer(GL_RENDERBUFFER, Ids);
+		URenderbufferStorage(Ids, GL_R32UI, GPU_PICK_REGION, GPU_PICK_REGION, "picking");
+		glBindRenderbuffer(GL_RENDERBUFFER, Depth);
+		URenderbufferStorage(Depth, GL_DEPTH_COMPONENT24, GPU_PICK_REGION, GPU_PICK_REGION, "picking");
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		GLint previous = 0;
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+		glBindFramebuffer(GL_FRAMEBUFFER, Framebuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, Ids);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, Depth);
+		const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		glBindFramebuffer(GL_FRAMEBUFFER, GLuint(previous));
+
+		glGenBuffers(GPU_PICK_SLOTS, Buffers);
+		for (int i = 0; i < GPU_PICK_SLOTS; ++i)
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, Buffers[i]);
+			UBufferData(GL_PIXEL_PACK_BUFFER, Buffers[i], GPU_PICK_REGION * GPU_PICK_REGION * sizeof(GLuint), nullptr, GL_STREAM_READ, "picking");
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		glGenQueries(GPU_PICK_SLOTS * 2, Queries);
+
+		if (status != GL_FRAMEBUFFER_COMPLETE)
+		{
+			std::cout << "ERROR::FRAMEBUFFER::PICKING_INCOMPLETE " << std::hex << status << std::dec << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	void Destroy()
+	{
+		for (int i = 0; i < InFlight; ++i)
+			glDeleteSync(Slots[(Oldest + i) % GPU_PICK_SLOTS].Fence);
+		InFlight = 0;
+		glDeleteQueries(GPU_PICK_SLOTS * 2, Queries);
+		UDeleteBuffers(GPU_PICK_SLOTS, Buffers);
+		glDeleteFramebuffers(1, &Framebuffer);
+		UDeleteRenderbuffers(1, &Ids);
+		UDeleteRenderbuffers(1, &Depth);
+		Framebuffer = Ids = Depth = 0;
+	}
+
+	// binds the ID target, cleared to GPU_PICK_NONE and the far depth, with the depth test of the depth mode (reversed-Z
+	// keeps what is greater). Returns false, and binds nothing, while every slot is waiting for its IDs
+	bool Begin(bool reverseZ)
+	{
+		if (InFlight == GPU_PICK_SLOTS)
+			return false;
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING, &SavedFramebuffer);
+		glGetIntegerv(GL_VIEWPORT, SavedViewport);
+		glGetIntegerv(GL_DEPTH_FUNC, &SavedDepthFunc);
+		glGetBooleanv(GL_DEPTH_WRITEMASK, &SavedDepthMask);
+
+		const int slot = (Oldest + InFlight) % GPU_PICK_SLOTS;
+		glQueryCounter(Queries[slot * 2], GL_TIMESTAMP);
+		glBindFramebuffer(GL_FRAMEBUFFER, Framebuffer);
+		glViewport(0, 0, GPU_PICK_REGION, GPU_PICK_REGION);
+		glDepthFunc(reverseZ ? GL_GREATER : GL_LESS);
+		glDepthMask(GL_TRUE);
+		const GLuint none[4] = { GPU_PICK_NONE, 0, 0, 0 };
+		const GLfloat far = reverseZ ? 0.0f : 1.0f;
+		glClearBufferuiv(GL_COLOR, 0, none);
+		glClearBufferfv(GL_DEPTH, 0, &far);
+		return true;
+	}
+
+	// queues the copy of the IDs drawn since Begin and puts back what Begin changed. tag comes back with the result
+	void End(uint32_t tag)
+	{
+		const int slot = (Oldest + InFlight) % GPU_PICK_SLOTS;
+		glReadBuffer(GL_COLOR_ATTACHMENT0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, Buffers[slot]);
+		glReadPixels(0, 0, GPU_PICK_REGION, GPU_PICK_REGION, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		glQueryCounter(Queries[slot * 2 + 1], GL_TIMESTAMP);
+		Slots[slot].Fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		Slots[slot].Frame = Frame;
+		Slots[slot].Tag = tag;
+		++InFlight;
+
+		glBindFramebuffer(GL_FRAMEBUFFER, GLuint(SavedFramebuffer));
+		glViewport(SavedViewport[0], SavedViewport[1], SavedViewport[2], SavedViewport[3]);
+		glDepthFunc(GLenum(SavedDepthFunc));
+		glDepthMask(SavedDepthMask);
+	}
+
+	// call once a frame. Returns true with the oldest pick whose IDs have arrived, without waiting for any
+	bool Poll(GpuPickResult& result)
+	{
+		++Frame;
+		if (InFlight == 0)
+			return false;
+		Slot& slot = Slots[Oldest];
+		// GL_WAIT_FAILED ends the pick too, or it would be polled forever
+		if (glClientWaitSync(slot.Fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED)
+			return false;
+		glDeleteSync(slot.Fence);
+
+		result = GpuPickResult();
+		result.Tag = slot.Tag;
+		result.FramesLate = int(Frame - slot.Frame);
+		// both timestamps were queued ahead of the fence
+		GLuint64 start = 0, end = 0;
+		glGetQueryObjectui64v(Queries[Oldest * 2], GL_QUERY_RESULT, &start);
+		glGetQueryObjectui64v(Queries[Oldest * 2 + 1], GL_QUERY_RESULT, &end);
+		result.GpuMs = double(end - start) * 1e-6;
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, Buffers[Oldest]);
+		const GLuint* ids = static_cast<const GLuint*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, GPU_PICK_REGION * GPU_PICK_REGION * sizeof(GLuint), GL_MAP_READ_BIT));
+		if (ids)
+		{
+			const int nearest = FindNearest(ids, GPU_PICK_REGION);
+			result.Hit = nearest >= 0;
+			result.Object = result.Hit ? ids[nearest] - 1 : 0;
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		Oldest = (Oldest + 1) % GPU_PICK_SLOTS;
+		--InFlight;
+		return true;
+	}
+
+	int GetInFlight() const { return InFlight; }
+
+	// the pixel with an ID nearest the middle of a size by size region, or -1 when nothing was drawn in it
+	static int FindNearest(const GLuint* ids, int size)
+	{
+		const int middle = size / 2;
+		int nearest = -1, nearestDistance = 0;
+		for (int y = 0; y < size; ++y)
+		{
+			for (int x = 0; x < size; ++x)
+			{
+				const int distance = (x - middle) * (x - middle) + (y - middle) * (y - middle);
+				if (ids[y * size + x] != GPU_PICK_NONE && (nearest < 0 || distance < nearestDistance))
+				{
+					nearest = y * size + x;
+					nearestDistance = distance;
+				}
+			}
+		}
+		return nearest;
+	}
+
+private:
+	struct Slot
+	{
+		GLsync Fence = 0;
+		uint64_t Frame = 0;
+		uint32_t Tag = 0;
+	};
+
+	GLuint Framebuffer = 0;
+	GLuint Ids = 0;
+	GLuint Depth = 0;
+	GLuint Buffers[GPU_PICK_SLOTS] = {};
+	GLuint Queries[GPU_PICK_SLOTS * 2] = {};
+	Slot Slots[GPU_PICK_SLOTS];
+	int Oldest = 0;
+	int InFlight = 0;
+	uint64_t Frame = 0;
+	GLint SavedFramebuffer = 0;
+	GLint SavedViewport[4] = {};
+	GLint SavedDepthFunc = GL_LESS;
+	GLboolean SavedDepthMask = GL_TRUE;
+};
+#endif
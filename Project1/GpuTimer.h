@@ -0,0 +1,85 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+
+#include <GL/glew.h>
+
+// Queries in flight at once. The GPU runs a frame or two behind the CPU, so a result is usually read two or three frames
+// after it was asked for; with fewer queries than that Begin would have nothing free to time with
+const int GPU_TIMER_QUERIES = 4;
+
+
+// Measures how long the GPU spends on the commands between Begin and End, with GL_TIME_ELAPSED queries kept in a ring.
+// Nothing ever waits on the GPU: results are collected by Poll once they are available, and a frame whose query slot
+// is still busy is simply not timed. Only one GpuTimer can be between Begin and End at a time (a GL rule)
+class GpuTimer
+{
+public:
+	void Create()
+	{
+		glGenQueries(GPU_TIMER_QUERIES, Queries);
+		for (int i = 0; i < GPU_TIMER_QUERIES; ++i)
+			Pending[i] = false;
+	}
+
+	void Destroy()
+	{
+		glDeleteQueries(GPU_TIMER_QUERIES, Queries);
+	}
+
+	// starts timing, unless the next query has not come back yet
+	void Begin()
+	{
+		Active = !Pending[Next];
+		if (Active)
+			glBeginQuery(GL_TIME_ELAPSED, Queries[Next]);
+		else
+			++Skipped;
+	}
+
+	void End()
+	{
+		if (!Active)
+			return;
+		glEndQuery(GL_TIME_ELAPSED);
+		Pending[Next] = true;
+		Next = (Next + 1) % GPU_TIMER_QUERIES;
+		Active = false;
+	}
+
+	// reads every result that has arrived, oldest first. Returns true when there was at least one; milliseconds is the newest
+	bool Poll(double& milliseconds)
+	{
+		bool found = false;
+		for (int i = 0; i < GPU_TIMER_QUERIES; ++i)
+		{
+			const int slot = (Next + i) % GPU_TIMER_QUERIES;
+			if (!Pending[slot])
+				continue;
+			GLint available = 0;
+			glGetQueryObjectiv(Queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				break;
+			GLuint64 nanoseconds = 0;
+			glGetQueryObjectui64v(Queries[slot], GL_QUERY_RESULT, &nanoseconds);
+			Pending[slot] = false;
+			LastMs = double(nanoseconds) * 1e-6;
+			found = true;
+		}
+		milliseconds = LastMs;
+		return found;
+	}
+
+	double GetLastMs() const { return LastMs; }
+	// frames not timed because every query was still in flight
+	int GetSkipped() const { return Skipped; }
+
+private:
+	GLuint Queries[GPU_TIMER_QUERIES] = {};
+	bool Pending[GPU_TIMER_QUERIES] = {};
+	int Next = 0;
+	bool Active = false;
+	double LastMs = 0.0;
+	int Skipped = 0;
+};
+#endif
@@ -0,0 +1,132 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+
+#include <cstring>
+
+#include "SpscQueue.h"
+
+// Kinds of window events forwarded from the window (input) thread to the render thread
+enum Input_Event_Type {
+	INPUT_MOUSE_MOVE,
+	INPUT_SCROLL,
+	INPUT_KEY,
+	INPUT_MOUSE_BUTTON,
+	INPUT_RESIZE
+};
+
+// One window event, stamped on the thread that received it
+struct InputEvent
+{
+	Input_Event_Type Type;
+	double Time;    // glfwGetTime() when the event arrived
+	double X;       // mouse delta, scroll offset or framebuffer width
+	double Y;       // mouse delta, scroll offset or framebuffer height
+	int Key;        // GLFW key or mouse button code
+	int Action;     // GLFW_RELEASE (0), GLFW_PRESS (1) or GLFW_REPEAT (2)
+};
+
+const size_t INPUT_QUEUE_SIZE = 1024;
+const int INPUT_MAX_KEYS = 512;
+const int INPUT_MAX_BUTTONS = 8;
+
+typedef SpscQueue<InputEvent, INPUT_QUEUE_SIZE> InputQueue;
+
+
+// Everything that arrived since the previous frame folded into one set of values, so the
+// camera is updated once per frame no matter how many events the mouse produced
+struct InputFrame
+{
+	// accumulated this frame
+	float MouseX = 0.0f;
+	float MouseY = 0.0f;
+	float Scroll = 0.0f;
+	bool KeyPressed[INPUT_MAX_KEYS];    // went down this frame
+	bool ButtonPressed[INPUT_MAX_BUTTONS];
+	bool Resized = false;
+	int Width = 0;
+	int Height = 0;
+	int EventCount = 0;
+	int PressCount = 0;                 // keys and buttons that went down this frame
+	double OldestEventTime = 0.0;       // arrival time of the first event folded into this frame
+	// carried across frames
+	bool KeyDown[INPUT_MAX_KEYS];
+	bool ButtonDown[INPUT_MAX_BUTTONS];
+
+	InputFrame()
+	{
+		memset(KeyPressed, 0, sizeof(KeyPressed));
+		memset(ButtonPressed, 0, sizeof(ButtonPressed));
+		memset(KeyDown, 0, sizeof(KeyDown));
+		memset(ButtonDown, 0, sizeof(ButtonDown));
+	}
+
+	// pops every queued event and folds it in. Call on the render thread right before the frame uses the input
+	int Drain(InputQueue& queue)
+	{
+		MouseX = MouseY = Scroll = 0.0f;
+		memset(KeyPressed, 0, sizeof(KeyPressed));
+		memset(ButtonPressed, 0, sizeof(ButtonPressed));
+		Resized = false;
+		EventCount = 0;
+		PressCount = 0;
+		OldestEventTime = 0.0;
+
+		InputEvent event;
+		while (queue.Pop(event))
+			Apply(event);
+		return EventCount;
+	}
+
+	void Apply(const InputEvent& event)
+	{
+		if (EventCount++ == 0)
+			OldestEventTime = event.Time;
+
+		switch (event.Type)
+		{
+		case INPUT_MOUSE_MOVE:
+			MouseX += float(event.X);
+			MouseY += float(event.Y);
+			break;
+		case INPUT_SCROLL:
+			Scroll += float(event.Y);
+			break;
+		case INPUT_KEY:
+			if (event.Key >= 0 && event.Key < INPUT_MAX_KEYS)
+			{
+				const bool down = event.Action != 0;
+				if (down && !KeyDown[event.Key])
+				{
+					KeyPressed[event.Key] = true;
+					++PressCount;
+				}
+				KeyDown[event.Key] = down;
+			}
+			break;
+		case INPUT_MOUSE_BUTTON:
+			if (event.Key >= 0 && event.Key < INPUT_MAX_BUTTONS)
+			{
+				const bool down = event.Action != 0;
+				if (down && !ButtonDown[event.Key])
+				{
+					ButtonPressed[event.Key] = true;
+					++PressCount;
+				}
+				ButtonDown[event.Key] = down;
+			}
+			break;
+		case INPUT_RESIZE:
+			// only the final size matters
+			Resized = true;
+			Width = int(event.X);
+			Height = int(event.Y);
+			break;
+		}
+	}
+
+	bool IsKeyDown(int key) const { return key >= 0 && key < INPUT_MAX_KEYS && KeyDown[key]; }
+	bool WasKeyPressed(int key) const { return key >= 0 && key < INPUT_MAX_KEYS && KeyPressed[key]; }
+	bool WasButtonPressed(int button) const { return button >= 0 && button < INPUT_MAX_BUTTONS && ButtonPressed[button]; }
+};
+#endif
@@ -0,0 +1,358 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ObjectPool.h"
+
+// Starting size of every worker's job queue (a power of two). Queues double when a frame queues more
+const size_t JOB_QUEUE_SIZE = 256;
+
+class JobCounter;
+
+// One unit of work. Counter (if any) is decremented when it finishes
+struct Job
+{
+	std::function<void()> Function;
+	const char* Name;
+	JobCounter* Counter;
+};
+
+// A job held back by a dependency, in the counter's list until it is released
+struct ParkedJob
+{
+	Job Work;
+	ParkedJob* Next;
+};
+
+// Counts unfinished jobs. Waiting on it from JobSystem::Wait runs other jobs meanwhile, and jobs can be made to
+// depend on it so they are only queued once it drops to zero
+class JobCounter
+{
+public:
+	bool IsDone() const { return Value.load(std::memory_order_acquire) == 0; }
+
+private:
+	friend class JobSystem;
+	std::atomic<int> Value{ 0 };
+	std::mutex Mutex;
+	ParkedJob* Waiting = nullptr;   // jobs parked until Value reaches zero
+};
+
+// When and where a job ran, relative to the last BeginFrame
+struct JobTiming
+{
+	const char* Name;
+	int Thread;                 // 0 is any thread outside the pool (the render thread), workers are 1..N
+	double StartMs;
+	double DurationMs;
+};
+
+
+// Work-stealing scheduler. Every worker owns a deque: it pushes and pops at the back (newest first, still warm in cache)
+// while idle workers steal from the front of the others. Threads outside the pool share deque 0 and only run jobs while
+// they Wait, so the render thread lends a hand instead of blocking
+class JobSystem
+{
+public:
+	// workerCount < 0 starts one worker per core beside the calling thread
+	explicit JobSystem(int workerCount = -1)
+	{
+		if (workerCount < 0)
+			workerCount = std::max(0, int(std::thread::hardware_concurrency()) - 1);
+		for (int i = 0; i <= workerCount; ++i)
+		{
+			Queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+			Timings.push_back(std::unique_ptr<TimingList>(new TimingList()));
+		}
+		FrameStart = std::chrono::steady_clock::now();
+		for (int i = 1; i <= workerCount; ++i)
+			Workers.emplace_back(&JobSystem::workerLoop, this, i);
+	}
+
+	~JobSystem()
+	{
+		{
+			std::lock_guard<std::mutex> lock(SleepMutex);
+			Quit = true;
+		}
+		SleepCondition.notify_all();
+		for (std::thread& worker : Workers)
+			worker.join();
+	}
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	// queues a job. counter (optional) counts it as unfinished until it returns; dependency (optional) holds it back until
+	// that counter is done, so Run the jobs it counts first
+	void Run(const char* name, std::function<void()> function, JobCounter* counter = nullptr, JobCounter* dependency = nullptr)
+	{
+		Job job = { std::move(function), name, counter };
+		if (counter)
+			counter->Value.fetch_add(1, std::memory_order_relaxed);
+
+		if (dependency)
+		{
+			std::lock_guard<std::mutex> lock(dependency->Mutex);
+			if (!dependency->IsDone())
+			{
+				std::lock_guard<std::mutex> poolLock(ParkedMutex);
+				dependency->Waiting = Parked.Create(ParkedJob{ std::move(job), dependency->Waiting });
+				return;
+			}
+		}
+		push(std::move(job));
+	}
+
+	// returns once counter is done, running queued jobs on this thread until then
+	void Wait(JobCounter& counter)
+	{
+		const int thread = threadIndex();
+		while (!counter.IsDone())
+		{
+			Job job;
+			if (pop(thread, job))
+				execute(job, thread);
+			else
+				std::this_thread::yield();
+		}
+		// the last job may still be inside finish(); once it lets go of the lock the counter can be destroyed
+		std::lock_guard<std::mutex> lock(counter.Mutex);
+	}
+
+	// calls fn(begin, end) over [0, count) in batches of grain items (0 picks a few batches per thread) and waits for all of them
+	template <typename Fn>
+	void ParallelFor(const char* name, uint32_t count, uint32_t grain, const Fn& fn)
+	{
+		if (count == 0)
+			return;
+		if (grain == 0)
+			grain = std::max(1u, count / uint32_t(GetThreadCount() * 4));
+		if (count <= grain)
+		{
+			// not worth a trip through the queues
+			fn(0u, count);
+			return;
+		}
+
+		JobCounter counter;
+		for (uint32_t begin = 0; begin < count; begin += grain)
+		{
+			const uint32_t end = std::min(count, begin + grain);
+			Run(name, [&fn, begin, end]() { fn(begin, end); }, &counter);
+		}
+		Wait(counter);
+	}
+
+	// threads that run jobs: the workers plus the thread that waits
+	int GetThreadCount() const { return int(Workers.size()) + 1; }
+
+	// which of them the caller is: 1..N for the workers, 0 for any thread outside the pool
+	int GetThreadIndex() const { return threadIndex(); }
+
+	// per job timing costs two clock reads per job, so it is off unless asked for
+	void EnableTiming(bool enable) { TimingEnabled.store(enable); }
+	bool IsTimingEnabled() const { return TimingEnabled.load(); }
+
+	// starts a new timing window. Call between frames, when no jobs are running
+	void BeginFrame()
+	{
+		FrameStart = std::chrono::steady_clock::now();
+		for (std::unique_ptr<TimingList>& list : Timings)
+			list->Entries.clear();
+	}
+
+	// every job that finished since BeginFrame. Call when no jobs are running
+	std::vector<JobTiming> CollectTimings() const
+	{
+		std::vector<JobTiming> timings;
+		for (const std::unique_ptr<TimingList>& list : Timings)
+			timings.insert(timings.end(), list->Entries.begin(), list->Entries.end());
+		return timings;
+	}
+
+private:
+	// A double-ended ring of jobs. It only grows (doubling) when full, so once it is big enough for a frame's jobs pushing
+	// and popping no longer allocate, unlike a deque that frees and reallocates its blocks as it drains and refills
+	struct WorkQueue
+	{
+		std::mutex Mutex;
+		std::vector<Job> Ring = std::vector<Job>(JOB_QUEUE_SIZE);
+		size_t Head = 0;
+		size_t Count = 0;
+
+		void PushBack(Job&& job)
+		{
+			if (Count == Ring.size())
+			{
+				std::vector<Job> larger(Ring.size() * 2);
+				for (size_t i = 0; i < Count; ++i)
+					larger[i] = std::move(Ring[(Head + i) & (Ring.size() - 1)]);
+				Ring.swap(larger);
+				Head = 0;
+			}
+			Ring[(Head + Count++) & (Ring.size() - 1)] = std::move(job);
+		}
+
+		void PopBack(Job& job)
+		{
+			take(Ring[(Head + --Count) & (Ring.size() - 1)], job);
+		}
+
+		void PopFront(Job& job)
+		{
+			take(Ring[Head], job);
+			Head = (Head + 1) & (Ring.size() - 1);
+			--Count;
+		}
+
+		// leaves the slot empty, so whatever the job captured is released now rather than when the slot is reused
+		static void take(Job& slot, Job& job)
+		{
+			job = std::move(slot);
+			slot.Function = nullptr;
+		}
+	};
+
+	// written only by the thread it belongs to, padded so neighbours do not false-share
+	struct alignas(64) TimingList
+	{
+		std::vector<JobTiming> Entries;
+	};
+
+	std::vector<std::unique_ptr<WorkQueue>> Queues;
+	std::vector<std::unique_ptr<TimingList>> Timings;
+	std::vector<std::thread> Workers;
+	ObjectPool<ParkedJob> Parked;
+	std::mutex ParkedMutex;
+	std::atomic<int> Queued{ 0 };
+	std::mutex SleepMutex;
+	std::condition_variable SleepCondition;
+	bool Quit = false;
+	std::atomic<bool> TimingEnabled{ false };
+	std::chrono::steady_clock::time_point FrameStart;
+
+	// index of the calling thread's deque in this system; 0 for threads outside the pool
+	int threadIndex() const
+	{
+		return CurrentSystem == this ? CurrentIndex : 0;
+	}
+
+	static inline thread_local const JobSystem* CurrentSystem = nullptr;
+	static inline thread_local int CurrentIndex = 0;
+
+	void push(Job job)
+	{
+		WorkQueue& queue = *Queues[threadIndex()];
+		{
+			std::lock_guard<std::mutex> lock(queue.Mutex);
+			queue.PushBack(std::move(job));
+		}
+		Queued.fetch_add(1, std::memory_order_release);
+
+		// taking the lock orders this against a worker that is about to sleep, so the wake up is not lost
+		{
+			std::lock_guard<std::mutex> lock(SleepMutex);
+		}
+		SleepCondition.notify_one();
+	}
+
+	// own deque first (newest job), then steal the oldest job of the others
+	bool pop(int thread, Job& job)
+	{
+		if (Queued.load(std::memory_order_acquire) == 0)
+			return false;
+
+		const int count = int(Queues.size());
+		for (int i = 0; i < count; ++i)
+		{
+			WorkQueue& queue = *Queues[(thread + i) % count];
+			std::lock_guard<std::mutex> lock(queue.Mutex);
+			if (queue.Count == 0)
+				continue;
+			if (i == 0)
+				queue.PopBack(job);
+			else
+				queue.PopFront(job);
+			Queued.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+		return false;
+	}
+
+	void execute(Job& job, int thread)
+	{
+		if (TimingEnabled.load(std::memory_order_relaxed))
+		{
+			const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			job.Function();
+			const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+			Timings[thread]->Entries.push_back({ job.Name, thread,
+				std::chrono::duration<double, std::milli>(start - FrameStart).count(),
+				std::chrono::duration<double, std::milli>(end - start).count() });
+		}
+		else
+		{
+			job.Function();
+		}
+
+		if (job.Counter)
+			finish(*job.Counter);
+	}
+
+	// the last job of a counter releases everything that depended on it
+	void finish(JobCounter& counter)
+	{
+		ParkedJob* released;
+		{
+			std::lock_guard<std::mutex> lock(counter.Mutex);
+			if (counter.Value.fetch_sub(1, std::memory_order_acq_rel) != 1)
+				return;
+			released = counter.Waiting;
+			counter.Waiting = nullptr;
+		}
+		while (released)
+		{
+			ParkedJob* next = released->Next;
+			push(std::move(released->Work));
+			{
+				std::lock_guard<std::mutex> lock(ParkedMutex);
+				Parked.Destroy(released);
+			}
+			released = next;
+		}
+	}
+
+	void workerLoop(int index)
+	{
+		CurrentSystem = this;
+		CurrentIndex = index;
+		for (;;)
+		{
+			Job job;
+			if (pop(index, job))
+			{
+				execute(job, index);
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(SleepMutex);
+			SleepCondition.wait(lock, [this]() { return Quit || Queued.load(std::memory_order_acquire) > 0; });
+			if (Quit)
+				return;
+		}
+	}
+};
+
+#endif
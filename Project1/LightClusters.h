@@ -0,0 +1,326 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Bounds.h"
+#include "JobSystem.h"
+
+// Default cluster grid: screen tiles across and down, depth slices
+const int CLUSTER_COUNT_X = 16;
+const int CLUSTER_COUNT_Y = 9;
+const int CLUSTER_COUNT_Z = 24;
+
+// A point light. Its influence fades to zero at Radius
+struct PointLight
+{
+	glm::vec3 Position = glm::vec3(0.0f);
+	float Radius = 1.0f;
+	glm::vec3 Color = glm::vec3(1.0f);
+	float Intensity = 1.0f;
+};
+
+// What the shaders read at the start of the cluster buffer (std430 layout), followed by one ClusterRange per cluster
+struct ClusterHeader
+{
+	glm::mat4 View;
+	glm::uvec4 Counts;          // clusters in x, y, z; w is the light count
+	glm::vec4 Slicing;          // tile width and height in pixels; slice = log(view depth) * z + w
+	glm::vec4 Eye;              // camera position, w unused
+	glm::vec4 Ambient;          // light every surface gets regardless of the point lights
+};
+
+// The lights of one cluster: Count entries of the light index list starting at Offset
+struct ClusterRange
+{
+	uint32_t Offset;
+	uint32_t Count;
+};
+
+struct ClusterStats
+{
+	int Lights = 0;
+	int LightsInView = 0;
+	int Assignments = 0;        // light indices written over all clusters
+	int MaxPerCluster = 0;
+	double Milliseconds = 0.0;
+};
+
+
+// Clustered forward lighting, CPU side. The view frustum is cut into screen tiles and logarithmic depth slices (so near
+// clusters stay small in both perspective and orthographic views) and every light is listed in the clusters its sphere
+// touches, so a fragment only shades the handful of lights of its own cluster instead of all of them.
+// Assign fills the grid; the caller uploads the header, ranges and light indices for the shaders
+class ClusteredLighting
+{
+public:
+	ClusteredLighting(int countX = CLUSTER_COUNT_X, int countY = CLUSTER_COUNT_Y, int countZ = CLUSTER_COUNT_Z)
+		: CountX(countX), CountY(countY), CountZ(countZ)
+	{
+		Ranges.resize(size_t(CountX) * CountY * CountZ);
+		Fill.resize(Ranges.size());
+	}
+
+	// spreads the depth slices over the job system; without one everything runs on the calling thread
+	void SetJobSystem(JobSystem* jobs) { Jobs = jobs; }
+	void SetAmbient(const glm::vec3& ambient) { Header.Ambient = glm::vec4(ambient, 0.0f); }
+
+	// lists every light in the clusters it reaches. Clusters cover view depths nearDepth to farDepth; lights beyond are dropped
+	void Assign(const std::vector<PointLight>& lights, const glm::mat4& view, const glm::mat4& projection, int viewportWidth, int viewportHeight,
+		float nearDepth, float farDepth)
+	{
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		const bool perspective = projection[2][3] != 0.0f;
+		updateGrid(projection, viewportWidth, viewportHeight, nearDepth, farDepth);
+
+		Header.View = view;
+		Header.Counts = glm::uvec4(CountX, CountY, CountZ, uint32_t(lights.size()));
+		const glm::mat4 inverseView = glm::inverse(view);
+		Header.Eye = glm::vec4(glm::vec3(inverseView[3]), 0.0f);
+
+		// where every light lands in view space and which cluster block it can touch
+		Spans.clear();
+		Spans.reserve(lights.size());
+		for (uint32_t index = 0; index < lights.size(); ++index)
+		{
+			LightSpan span;
+			if (findSpan(lights[index], view, projection, perspective, span))
+			{
+				span.Light = index;
+				Spans.push_back(span);
+			}
+		}
+
+		// two passes, one job per slice so no two jobs write the same cluster: count the lights of every cluster, then
+		// write them at the offsets the counts give. Testing the spheres twice beats scratch buffers whose size follows how
+		// the lights fall between slices; the index list only follows the total and keeps twice the room it needed
+		runParallel("light clusters count", uint32_t(CountZ), 1, [this](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t slice = begin; slice < end; ++slice)
+				fillSlice(int(slice), false);
+		});
+
+		Stats = ClusterStats();
+		uint32_t total = 0;
+		for (ClusterRange& range : Ranges)
+		{
+			range.Offset = total;
+			total += range.Count;
+			Stats.MaxPerCluster = std::max(Stats.MaxPerCluster, int(range.Count));
+		}
+		Indices.clear();
+		if (Indices.capacity() < total)
+			Indices.reserve(2 * size_t(total));
+		Indices.resize(total);
+
+		runParallel("light clusters fill", uint32_t(CountZ), 1, [this](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t slice = begin; slice < end; ++slice)
+				fillSlice(int(slice), true);
+		});
+
+		Stats.Lights = int(lights.size());
+		Stats.LightsInView = int(Spans.size());
+		Stats.Assignments = int(Indices.size());
+		Stats.Milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// the cluster a fragment at window position (x, y) and view depth falls in, the same way the fragment shader finds it
+	uint32_t GetClusterIndex(float x, float y, float viewDepth) const
+	{
+		const int tileX = std::min(CountX - 1, std::max(0, int(x / Header.Slicing.x)));
+		const int tileY = std::min(CountY - 1, std::max(0, int(y / Header.Slicing.y)));
+		return uint32_t((sliceOf(viewDepth) * CountY + tileY) * CountX + tileX);
+	}
+
+	const ClusterRange& GetRange(uint32_t cluster) const { return Ranges[cluster]; }
+	const ClusterHeader& GetHeader() const { return Header; }
+	const std::vector<ClusterRange>& GetRanges() const { return Ranges; }
+	const std::vector<uint32_t>& GetLightIndices() const { return Indices; }
+	const ClusterStats& GetStats() const { return Stats; }
+	size_t GetClusterCount() const { return Ranges.size(); }
+
+private:
+	// a light in view space and the block of clusters its sphere overlaps
+	struct LightSpan
+	{
+		uint32_t Light;
+		glm::vec3 Center;
+		float Radius;
+		int MinX, MaxX, MinY, MaxY, MinZ, MaxZ;
+	};
+
+	int CountX, CountY, CountZ;
+	JobSystem* Jobs = nullptr;
+	ClusterHeader Header = ClusterHeader();
+	std::vector<Aabb> Bounds;               // view space box of every cluster
+	std::vector<ClusterRange> Ranges;
+	std::vector<uint32_t> Indices;
+	std::vector<LightSpan> Spans;
+	std::vector<uint32_t> Fill;             // lights written so far, per cluster
+	ClusterStats Stats;
+
+	// the cluster boxes only change with the projection, the viewport or the depth range
+	glm::mat4 GridProjection = glm::mat4(0.0f);
+	int GridWidth = 0, GridHeight = 0;
+	float GridNear = 0.0f, GridFar = 0.0f;
+
+	template <typename Fn>
+	void runParallel(const char* name, uint32_t count, uint32_t grain, const Fn& fn)
+	{
+		if (Jobs)
+			Jobs->ParallelFor(name, count, grain, fn);
+		else if (count > 0)
+			fn(0u, count);
+	}
+
+	int sliceOf(float viewDepth) const
+	{
+		const float slice = std::log(std::max(viewDepth, 1e-6f)) * Header.Slicing.z + Header.Slicing.w;
+		return std::min(CountZ - 1, std::max(0, int(std::floor(slice))));
+	}
+
+	// view depth where a slice begins
+	float sliceStart(int slice, float nearDepth, float farDepth) const
+	{
+		return nearDepth * std::pow(farDepth / nearDepth, float(slice) / float(CountZ));
+	}
+
+	void updateGrid(const glm::mat4& projection, int width, int height, float nearDepth, float farDepth)
+	{
+		if (projection == GridProjection && width == GridWidth && height == GridHeight && nearDepth == GridNear && farDepth == GridFar)
+			return;
+		GridProjection = projection;
+		GridWidth = width;
+		GridHeight = height;
+		GridNear = nearDepth;
+		GridFar = farDepth;
+
+		const float scale = float(CountZ) / std::log(farDepth / nearDepth);
+		const float bias = -std::log(nearDepth) * scale;
+		Header.Slicing = glm::vec4(float(width) / float(CountX), float(height) / float(CountY), scale, bias);
+
+		// a tile corner is a line through view space; any two depths inside the frustum pin it down
+		const glm::mat4 inverseProjection = glm::inverse(projection);
+		const auto unproject = [&inverseProjection](float x, float y, float z)
+		{
+			const glm::vec4 point = inverseProjection * glm::vec4(x, y, z, 1.0f);
+			return glm::vec3(point) / point.w;
+		};
+		const auto atDepth = [](const glm::vec3& a, const glm::vec3& b, float depth)
+		{
+			const float t = (depth + a.z) / (a.z - b.z);
+			return a + (b - a) * t;
+		};
+
+		Bounds.resize(Ranges.size());
+		for (int y = 0; y < CountY; ++y)
+		{
+			for (int x = 0; x < CountX; ++x)
+			{
+				glm::vec3 nearPoints[4], farPoints[4];
+				for (int corner = 0; corner < 4; ++corner)
+				{
+					const float ndcX = float(x + (corner & 1)) / float(CountX) * 2.0f - 1.0f;
+					const float ndcY = float(y + (corner >> 1)) / float(CountY) * 2.0f - 1.0f;
+					nearPoints[corner] = unproject(ndcX, ndcY, 0.5f);
+					farPoints[corner] = unproject(ndcX, ndcY, 0.9f);
+				}
+				for (int z = 0; z < CountZ; ++z)
+				{
+					Aabb& box = Bounds[(size_t(z) * CountY + y) * CountX + x];
+					box = Aabb();
+					const float depths[2] = { sliceStart(z, nearDepth, farDepth), sliceStart(z + 1, nearDepth, farDepth) };
+					for (int corner = 0; corner < 4; ++corner)
+					{
+						for (float depth : depths)
+							box.Grow(atDepth(nearPoints[corner], farPoints[corner], depth));
+					}
+				}
+			}
+		}
+	}
+
+	// the conservative block of clusters a light's sphere can reach; false if it is entirely outside the clustered range
+	bool findSpan(const PointLight& light, const glm::mat4& view, const glm::mat4& projection, bool perspective, LightSpan& span) const
+	{
+		span.Center = glm::vec3(view * glm::vec4(light.Position, 1.0f));
+		span.Radius = light.Radius;
+		const float depth = -span.Center.z;
+		if (depth + light.Radius < GridNear || depth - light.Radius > GridFar)
+			return false;
+		span.MinZ = sliceOf(std::max(GridNear, depth - light.Radius));
+		span.MaxZ = sliceOf(std::min(GridFar, depth + light.Radius));
+
+		// screen rectangle of the sphere's box; a sphere reaching behind the near plane can cover any tile
+		span.MinX = span.MinY = 0;
+		span.MaxX = CountX - 1;
+		span.MaxY = CountY - 1;
+		if (perspective && depth - light.Radius < GridNear)
+			return true;
+
+		glm::vec2 low(1.0f), high(-1.0f);
+		for (int corner = 0; corner < 8; ++corner)
+		{
+			const glm::vec3 offset((corner & 1) ? light.Radius : -light.Radius, (corner & 2) ? light.Radius : -light.Radius, (corner & 4) ? light.Radius : -light.Radius);
+			const glm::vec4 clip = projection * glm::vec4(span.Center + offset, 1.0f);
+			const glm::vec2 ndc = glm::vec2(clip) / clip.w;
+			low = glm::min(low, ndc);
+			high = glm::max(high, ndc);
+		}
+		if (high.x < -1.0f || high.y < -1.0f || low.x > 1.0f || low.y > 1.0f)
+			return false;
+		span.MinX = std::max(0, int((low.x * 0.5f + 0.5f) * CountX));
+		span.MaxX = std::min(CountX - 1, int((high.x * 0.5f + 0.5f) * CountX));
+		span.MinY = std::max(0, int((low.y * 0.5f + 0.5f) * CountY));
+		span.MaxY = std::min(CountY - 1, int((high.y * 0.5f + 0.5f) * CountY));
+		return true;
+	}
+
+	// tests every light's sphere against the cluster boxes of one slice it may touch. The counting pass only counts the
+	// lights of each cluster; the writing pass lists them, in light order, at the offsets the counts gave
+	void fillSlice(int slice, bool write)
+	{
+		ClusterRange* ranges = &Ranges[size_t(slice) * CountX * CountY];
+		uint32_t* fill = &Fill[size_t(slice) * CountX * CountY];
+		const Aabb* bounds = &Bounds[size_t(slice) * CountX * CountY];
+		const int clusters = CountX * CountY;
+
+		for (int cluster = 0; cluster < clusters; ++cluster)
+		{
+			if (write)
+				fill[cluster] = 0;
+			else
+				ranges[cluster].Count = 0;
+		}
+		for (const LightSpan& span : Spans)
+		{
+			if (slice < span.MinZ || slice > span.MaxZ)
+				continue;
+			for (int y = span.MinY; y <= span.MaxY; ++y)
+			{
+				for (int x = span.MinX; x <= span.MaxX; ++x)
+				{
+					const int cluster = y * CountX + x;
+					const glm::vec3 closest = glm::clamp(span.Center, bounds[cluster].Min, bounds[cluster].Max);
+					const glm::vec3 away = closest - span.Center;
+					if (glm::dot(away, away) > span.Radius * span.Radius)
+						continue;
+					if (write)
+						Indices[ranges[cluster].Offset + fill[cluster]++] = span.Light;
+					else
+						ranges[cluster].Count++;
+				}
+			}
+		}
+	}
+};
+#endif
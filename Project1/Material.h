@@ -0,0 +1,118 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "GpuMemory.h"
+
+// Shader storage binding point of the material table. The GPU culling buffers use 0 to 2
+const GLuint MATERIAL_BINDING = 3;
+const uint32_t NO_MATERIAL = 0xffffffffu;
+
+// One material as the shaders read it (std430 layout): the fields of an OBJ material packed into four vec4s.
+// Declared in GLSL as struct Material { vec4 ambient; vec4 diffuse; vec4 specular; vec4 params; }
+struct Material
+{
+	glm::vec4 Ambient = glm::vec4(0.0f);                        // Ka, w unused
+	glm::vec4 Diffuse = glm::vec4(1.0f);                        // Kd, w is the dissolve (d, opacity)
+	glm::vec4 Specular = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);     // Ks, w is the specular exponent (Ns)
+	glm::vec4 Params = glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);       // x optical density (Ni), y illumination model (illum)
+};
+
+// Converts an objl::Material, or anything with the same Ka/Kd/Ks/Ns/Ni/d/illum fields, so this header does not
+// depend on the OBJ loader
+template <typename ObjMaterial>
+Material UMaterialFromObj(const ObjMaterial& source)
+{
+	Material material;
+	material.Ambient = glm::vec4(source.Ka.X, source.Ka.Y, source.Ka.Z, 0.0f);
+	material.Diffuse = glm::vec4(source.Kd.X, source.Kd.Y, source.Kd.Z, source.d);
+	material.Specular = glm::vec4(source.Ks.X, source.Ks.Y, source.Ks.Z, source.Ns);
+	material.Params = glm::vec4(source.Ni, float(source.illum), 0.0f, 0.0f);
+	return material;
+}
+
+
+// Every material of the scene in one shader storage buffer. Vertices carry a material slot and draws a base index, and
+// the shaders read materials[base + slot], so meshes that only differ in their materials share one vertex buffer
+// (and one draw). A mesh with N slots takes a run of N consecutive materials, added with AddSet
+class MaterialTable
+{
+public:
+	void Create()
+	{
+		glGenBuffers(1, &Buffer);
+	}
+
+	void Destroy()
+	{
+		UDeleteBuffers(1, &Buffer);
+		Buffer = 0;
+	}
+
+	// returns the material's index in the table
+	uint32_t Add(const std::string& name, const Material& material)
+	{
+		Names.push_back(name);
+		Materials.push_back(material);
+		Dirty = true;
+		return uint32_t(Materials.size() - 1);
+	}
+
+	// adds materials for slots 0..N-1 of a mesh and returns the base index a draw passes to use them
+	uint32_t AddSet(const std::string& name, const std::vector<Material>& slots)
+	{
+		const uint32_t base = uint32_t(Materials.size());
+		for (size_t slot = 0; slot < slots.size(); ++slot)
+			Add(name + "[" + std::to_string(slot) + "]", slots[slot]);
+		return base;
+	}
+
+	uint32_t Find(const std::string& name) const
+	{
+		for (size_t i = 0; i < Names.size(); ++i)
+		{
+			if (Names[i] == name)
+				return uint32_t(i);
+		}
+		return NO_MATERIAL;
+	}
+
+	const Material& Get(uint32_t index) const { return Materials[index]; }
+	void Set(uint32_t index, const Material& material)
+	{
+		Materials[index] = material;
+		Dirty = true;
+	}
+
+	// copies the table to the GPU if anything changed since the last upload
+	void Upload()
+	{
+		if (!Dirty)
+			return;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, Buffer);
+		UBufferData(GL_SHADER_STORAGE_BUFFER, Buffer, (Materials.empty() ? 1 : Materials.size()) * sizeof(Material), Materials.empty() ? NULL : Materials.data(), GL_STATIC_DRAW, "materials");
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		Dirty = false;
+	}
+
+	void Bind() const
+	{
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIAL_BINDING, Buffer);
+	}
+
+	size_t GetCount() const { return Materials.size(); }
+
+private:
+	GLuint Buffer = 0;
+	std::vector<Material> Materials;
+	std::vector<std::string> Names;
+	bool Dirty = false;
+};
+#endif
@@ -0,0 +1,264 @@
+#ifndef MESH_CHUNKS_H
+#define MESH_CHUNKS_H
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Bounds.h"
+#include "Meshlets.h"
+
+// World space size of the grid cells a mesh is cut along, and the most vertices one chunk can address with 16 bit indices
+const float MESH_CHUNK_SIZE = 16.0f;
+const uint32_t MESH_CHUNK_VERTICES = 65536;
+const uint32_t MESH_CHUNK_VERSION = 2;
+// Bytes of the file header and of one chunk table entry: bounds, three counts and the offset
+const uint64_t MESH_CHUNK_HEADER_BYTES = 4 * sizeof(uint32_t);
+const uint64_t MESH_CHUNK_ENTRY_BYTES = 6 * sizeof(float) + 3 * sizeof(uint32_t) + sizeof(uint64_t);
+
+// Where one chunk lives in a chunk file
+struct MeshChunkInfo
+{
+	Aabb Bounds;
+	uint32_t VertexCount;
+	uint32_t IndexCount;
+	uint32_t MeshletCount;
+	uint64_t Offset;        // of the vertices; the 16 bit indices and then the meshlets follow them
+};
+
+// A chunk file as far as its table goes. The table is read up front; the geometry of each chunk is read on demand
+struct MeshChunkFile
+{
+	std::string Path;
+	uint32_t FloatsPerVertex = 0;
+	std::vector<MeshChunkInfo> Chunks;
+
+	uint64_t GetVertexBytes(uint32_t chunk) const { return uint64_t(Chunks[chunk].VertexCount) * FloatsPerVertex * sizeof(float); }
+	uint64_t GetIndexBytes(uint32_t chunk) const { return uint64_t(Chunks[chunk].IndexCount) * sizeof(uint16_t); }
+	uint64_t GetMeshletBytes(uint32_t chunk) const { return uint64_t(Chunks[chunk].MeshletCount) * sizeof(Meshlet); }
+	// bytes the chunk takes once uploaded; its meshlets stay in memory
+	uint64_t GetChunkBytes(uint32_t chunk) const { return GetVertexBytes(chunk) + GetIndexBytes(chunk); }
+};
+
+// One chunk's geometry in memory: interleaved float vertices whose first three floats are the position. Meshlets, if
+// built, index into Indices
+struct MeshChunk
+{
+	Aabb Bounds;
+	std::vector<float> Vertices;
+	std::vector<uint16_t> Indices;
+	std::vector<Meshlet> Meshlets;
+};
+
+
+inline bool UMeshChunkError(const std::string& path, const char* message)
+{
+	std::cout << "ERROR::MESH_CHUNKS::" << path << "::" << message << std::endl;
+	return false;
+}
+
+// Cuts a mesh with 32 bit indices into chunks: every triangle goes to the grid cell its centroid falls in, counted from
+// the lowest corner of the mesh, and each cell's triangles are re-indexed into a chunk of their own (more than one when
+// they reach MESH_CHUNK_VERTICES). Chunks come out ordered by cell, so the same mesh always gives the same file
+inline void USplitMeshIntoChunks(const float* vertices, uint32_t vertexCount, uint32_t floatsPerVertex, const uint32_t* indices, size_t indexCount,
+	float chunkSize, std::vector<MeshChunk>& chunks)
+{
+	chunks.clear();
+	const size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0)
+		return;
+
+	const auto position = [vertices, floatsPerVertex](uint32_t index)
+	{
+		const float* v = vertices + size_t(index) * floatsPerVertex;
+		return glm::vec3(v[0], v[1], v[2]);
+	};
+	Aabb bounds;
+	for (uint32_t v = 0; v < vertexCount; ++v)
+		bounds.Grow(position(v));
+
+	// 21 bits of cell per axis in one sortable key
+	std::vector<std::pair<uint64_t, uint32_t> > cells(triangleCount);
+	for (size_t t = 0; t < triangleCount; ++t)
+	{
+		const glm::vec3 centroid = (position(indices[t * 3]) + position(indices[t * 3 + 1]) + position(indices[t * 3 + 2])) / 3.0f;
+		const glm::vec3 cell = glm::floor((centroid - bounds.Min) / chunkSize);
+		const uint64_t x = uint64_t(std::min(cell.x, 2097151.0f)), y = uint64_t(std::min(cell.y, 2097151.0f)), z = uint64_t(std::min(cell.z, 2097151.0f));
+		cells[t] = { (x << 42) | (y << 21) | z, uint32_t(t) };
+	}
+	std::sort(cells.begin(), cells.end());
+
+	// remap[old vertex] is its index in the chunk being filled, valid while stamp[old vertex] is that chunk's number
+	std::vector<uint32_t> remap(vertexCount), stamp(vertexCount, ~0u);
+	uint64_t cellKey = ~0ull;
+	for (const std::pair<uint64_t, uint32_t>& entry : cells)
+	{
+		const uint32_t* corners = indices + size_t(entry.second) * 3;
+		uint32_t fresh = 0;
+		if (!chunks.empty())
+		{
+			for (int c = 0; c < 3; ++c)
+				fresh += stamp[corners[c]] != uint32_t(chunks.size() - 1) ? 1 : 0;
+		}
+		const bool full = !chunks.empty() && chunks.back().Vertices.size() / floatsPerVertex + fresh > MESH_CHUNK_VERTICES;
+		if (chunks.empty() || entry.first != cellKey || full)
+		{
+			chunks.push_back(MeshChunk());
+			cellKey = entry.first;
+		}
+
+		MeshChunk& chunk = chunks.back();
+		const uint32_t chunkNumber = uint32_t(chunks.size() - 1);
+		for (int c = 0; c < 3; ++c)
+		{
+			const uint32_t index = corners[c];
+			if (stamp[index] != chunkNumber)
+			{
+				stamp[index] = chunkNumber;
+				remap[index] = uint32_t(chunk.Vertices.size() / floatsPerVertex);
+				const float* source = vertices + size_t(index) * floatsPerVertex;
+				chunk.Vertices.insert(chunk.Vertices.end(), source, source + floatsPerVertex);
+				chunk.Bounds.Grow(position(index));
+			}
+			chunk.Indices.push_back(uint16_t(remap[index]));
+		}
+	}
+}
+
+// Splits every chunk into meshlets (Meshlets.h), reordering its indices to match
+inline void UBuildChunkMeshlets(uint32_t floatsPerVertex, std::vector<MeshChunk>& chunks)
+{
+	for (MeshChunk& chunk : chunks)
+		UBuildMeshlets(chunk.Vertices.data(), uint32_t(chunk.Vertices.size() / floatsPerVertex), floatsPerVertex, chunk.Indices, chunk.Meshlets);
+}
+
+// Writes the chunks as a chunk file: magic, version, floats per vertex and chunk count, the chunk table, then each
+// chunk's vertices, indices and meshlets. Prints why on failure
+inline bool UWriteMeshChunks(const std::string& path, uint32_t floatsPerVertex, const std::vector<MeshChunk>& chunks)
+{
+	std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+	if (!stream)
+		return UMeshChunkError(path, "could not be created");
+
+	const auto write = [&stream](const void* data, size_t bytes) { stream.write(static_cast<const char*>(data), std::streamsize(bytes)); };
+	const uint32_t header[4] = { 0x4B48434Du, MESH_CHUNK_VERSION, floatsPerVertex, uint32_t(chunks.size()) };   // "MCHK"
+	write(header, sizeof(header));
+
+	uint64_t offset = MESH_CHUNK_HEADER_BYTES + chunks.size() * MESH_CHUNK_ENTRY_BYTES;
+	for (const MeshChunk& chunk : chunks)
+	{
+		const uint32_t counts[3] = { uint32_t(chunk.Vertices.size() / floatsPerVertex), uint32_t(chunk.Indices.size()), uint32_t(chunk.Meshlets.size()) };
+		write(&chunk.Bounds.Min, 3 * sizeof(float));
+		write(&chunk.Bounds.Max, 3 * sizeof(float));
+		write(counts, sizeof(counts));
+		write(&offset, sizeof(offset));
+		offset += chunk.Vertices.size() * sizeof(float) + chunk.Indices.size() * sizeof(uint16_t) + chunk.Meshlets.size() * sizeof(Meshlet);
+	}
+	for (const MeshChunk& chunk : chunks)
+	{
+		write(chunk.Vertices.data(), chunk.Vertices.size() * sizeof(float));
+		write(chunk.Indices.data(), chunk.Indices.size() * sizeof(uint16_t));
+		write(chunk.Meshlets.data(), chunk.Meshlets.size() * sizeof(Meshlet));
+	}
+	if (!stream)
+		return UMeshChunkError(path, "could not be written");
+	return true;
+}
+
+// The version a chunk file was written with, or 0 when it is missing or not a chunk file
+inline uint32_t UReadMeshChunkVersion(const std::string& path)
+{
+	std::ifstream stream(path, std::ios::binary);
+	uint32_t header[2] = {};
+	if (!stream.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != 0x4B48434Du)
+		return 0;
+	return header[1];
+}
+
+// Reads the chunk table of a chunk file. Prints why on failure
+inline bool UReadMeshChunkTable(const std::string& path, MeshChunkFile& file)
+{
+	file = MeshChunkFile();
+	file.Path = path;
+
+	std::ifstream stream(path, std::ios::binary | std::ios::ate);
+	if (!stream)
+		return UMeshChunkError(path, "could not be read");
+	const uint64_t fileBytes = uint64_t(stream.tellg());
+	stream.seekg(0);
+
+	uint32_t header[4] = {};
+	if (!stream.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != 0x4B48434Du)
+		return UMeshChunkError(path, "not a chunk file");
+	if (header[1] != MESH_CHUNK_VERSION)
+		return UMeshChunkError(path, "unsupported version");
+	if (header[2] < 3)
+		return UMeshChunkError(path, "vertices without a position");
+
+	// the table has to fit in the file before it is sized from the count
+	const uint64_t tableEnd = MESH_CHUNK_HEADER_BYTES + uint64_t(header[3]) * MESH_CHUNK_ENTRY_BYTES;
+	if (tableEnd > fileBytes)
+		return UMeshChunkError(path, "chunk table larger than the file");
+
+	file.FloatsPerVertex = header[2];
+	file.Chunks.resize(header[3]);
+	for (uint32_t c = 0; c < header[3]; ++c)
+	{
+		MeshChunkInfo& info = file.Chunks[c];
+		stream.read(reinterpret_cast<char*>(&info.Bounds.Min), 3 * sizeof(float));
+		stream.read(reinterpret_cast<char*>(&info.Bounds.Max), 3 * sizeof(float));
+		stream.read(reinterpret_cast<char*>(&info.VertexCount), sizeof(uint32_t));
+		stream.read(reinterpret_cast<char*>(&info.IndexCount), sizeof(uint32_t));
+		stream.read(reinterpret_cast<char*>(&info.MeshletCount), sizeof(uint32_t));
+		stream.read(reinterpret_cast<char*>(&info.Offset), sizeof(uint64_t));
+		// the geometry lies between the table and the end of the file, and whole triangles need vertices to index
+		const uint64_t bytes = file.GetChunkBytes(c) + file.GetMeshletBytes(c);
+		if (!stream || info.VertexCount > MESH_CHUNK_VERTICES || info.IndexCount % 3 != 0 || (info.IndexCount > 0 && info.VertexCount == 0)
+			|| info.Offset < tableEnd || info.Offset > fileBytes || bytes > fileBytes - info.Offset)
+		{
+			file.Chunks.clear();
+			return UMeshChunkError(path, "corrupt chunk table");
+		}
+	}
+	return true;
+}
+
+// Reads the geometry of one chunk. The stream must be the file the table came from
+inline bool UReadMeshChunk(std::ifstream& stream, const MeshChunkFile& file, uint32_t chunk, MeshChunk& out)
+{
+	const MeshChunkInfo& info = file.Chunks[chunk];
+	out.Bounds = info.Bounds;
+	out.Vertices.resize(size_t(info.VertexCount) * file.FloatsPerVertex);
+	out.Indices.resize(info.IndexCount);
+	out.Meshlets.resize(info.MeshletCount);
+	stream.clear();
+	stream.seekg(std::streamoff(info.Offset));
+	stream.read(reinterpret_cast<char*>(out.Vertices.data()), std::streamsize(file.GetVertexBytes(chunk)));
+	stream.read(reinterpret_cast<char*>(out.Indices.data()), std::streamsize(file.GetIndexBytes(chunk)));
+	stream.read(reinterpret_cast<char*>(out.Meshlets.data()), std::streamsize(file.GetMeshletBytes(chunk)));
+	if (!stream)
+		return false;
+	// an index past the chunk's vertices would read another chunk's, or past the end of the buffer
+	for (uint16_t index : out.Indices)
+	{
+		if (index >= info.VertexCount)
+			return false;
+	}
+	// a meshlet reaching past the indices would draw from another chunk's
+	for (const Meshlet& meshlet : out.Meshlets)
+	{
+		if (uint64_t(meshlet.FirstIndex) + meshlet.IndexCount > info.IndexCount)
+			return false;
+	}
+	return true;
+}
+#endif
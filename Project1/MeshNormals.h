@@ -0,0 +1,413 @@
+#ifndef MESH_NORMALS_H
+#define MESH_NORMALS_H
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "JobSystem.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MESH_NORMALS_SSE2 1
+#endif
+
+// Pass as the UV offset of a mesh without texture coordinates; it gets normals but no tangents
+const uint32_t MESH_NO_UV = 0xffffffffu;
+// Faces meeting at a sharper angle than this, in degrees, keep separate normals along the edge they share
+const float MESH_DEFAULT_CREASE_ANGLE = 60.0f;
+
+// A mesh's vertices once it has a tangent space. Vertex v copies input vertex Source[v]; an input vertex on a crease, or
+// where mirrored UVs meet, is split into one vertex per normal and tangent it needs, so there can be more than there were
+struct TangentSpaceMesh
+{
+	std::vector<uint32_t> Source;
+	std::vector<uint32_t> Indices;      // the input's triangles in the same order, into these vertices
+	std::vector<glm::vec3> Normals;
+	std::vector<glm::vec4> Tangents;    // xyz along +u; the bitangent is cross(normal, xyz) * w. Empty without UVs
+};
+
+
+// Generates area weighted smooth normals with a crease angle, and tangents built the way MikkTSpace builds them: each
+// triangle's tangent follows +u with the sign of its UV winding, is projected onto the vertex normal and weighted by
+// the triangle's angle at the vertex, and corners whose UVs are mirrored get a tangent of their own.
+// Vertices at the same position share their normal, so UV seams do not show; creases are found per corner by which
+// of the faces around its position lie within the crease angle of its own face.
+// Work scales with the triangles times the faces around a vertex: faces are computed four at a time with SSE2, and
+// the per vertex passes gather from the faces around each vertex, so they split over the job system's threads
+// without anything shared being written. The scratch arrays are kept for the next mesh
+class TangentSpaceGenerator
+{
+public:
+	void SetJobSystem(JobSystem* jobs) { Jobs = jobs; }
+
+	// vertices are interleaved floats whose first three are the position; uvOffset is where the texture coordinates
+	// start in each vertex, or MESH_NO_UV. indices are triangles
+	void Generate(const float* vertices, uint32_t vertexCount, uint32_t floatsPerVertex, uint32_t uvOffset, const uint32_t* indices, size_t indexCount,
+		float creaseAngle, TangentSpaceMesh& out)
+	{
+		Vertices = vertices;
+		Stride = floatsPerVertex;
+		UvOffset = uvOffset;
+		Indices = indices;
+		TriangleCount = uint32_t(indexCount / 3);
+		CosCrease = std::cos(glm::radians(std::min(std::max(creaseAngle, 0.0f), 180.0f)));
+		out.Source.clear();
+		out.Normals.clear();
+		out.Tangents.clear();
+		out.Indices.resize(size_t(TriangleCount) * 3);
+		if (TriangleCount == 0)
+			return;
+
+		weldPositions(vertexCount);
+		Faces.resize(TriangleCount);
+		runParallel("mesh faces", TriangleCount, 16384, [this](uint32_t begin, uint32_t end) { computeFaces(begin, end); });
+
+		// the corners of each vertex, and the vertices at each position, as offsets into one array each. The faces around
+		// a position are then the faces of the corners of the vertices there
+		const uint32_t cornerCount = TriangleCount * 3;
+		CornerStart.assign(vertexCount + 1, 0);
+		MemberStart.assign(vertexCount + 1, 0);
+		for (uint32_t c = 0; c < cornerCount; ++c)
+			CornerStart[indices[c] + 1]++;
+		for (uint32_t v = 0; v < vertexCount; ++v)
+			MemberStart[PositionOf[v] + 1]++;
+		for (uint32_t v = 0; v < vertexCount; ++v)
+		{
+			CornerStart[v + 1] += CornerStart[v];
+			MemberStart[v + 1] += MemberStart[v];
+		}
+		CornerList.resize(cornerCount);
+		Members.resize(vertexCount);
+		Fill.assign(CornerStart.begin(), CornerStart.end() - 1);
+		for (uint32_t c = 0; c < cornerCount; ++c)
+			CornerList[Fill[indices[c]]++] = c;
+		Fill.assign(MemberStart.begin(), MemberStart.end() - 1);
+		for (uint32_t v = 0; v < vertexCount; ++v)
+			Members[Fill[PositionOf[v]]++] = v;
+
+		// which corners of each input vertex share a normal and UV winding; each such group becomes one vertex
+		Groups.resize(cornerCount);
+		VertexBase.resize(vertexCount + 1);
+		runParallel("mesh vertex groups", vertexCount, 8192, [this, &out](uint32_t begin, uint32_t end)
+		{
+			std::vector<glm::vec4> around;
+			for (uint32_t v = begin; v < end; ++v)
+				VertexBase[v + 1] = groupCorners(v, around, out.Indices.data());
+		});
+		VertexBase[0] = 0;
+		for (uint32_t v = 0; v < vertexCount; ++v)
+			VertexBase[v + 1] += VertexBase[v];
+
+		const uint32_t outputCount = VertexBase[vertexCount];
+		out.Source.resize(outputCount);
+		out.Normals.resize(outputCount);
+		if (UvOffset != MESH_NO_UV)
+			out.Tangents.resize(outputCount);
+		runParallel("mesh tangent space", vertexCount, 8192, [this, &out](uint32_t begin, uint32_t end)
+		{
+			std::vector<glm::vec3> tangents;
+			for (uint32_t v = begin; v < end; ++v)
+				writeVertex(v, tangents, out);
+		});
+	}
+
+private:
+	// what the passes need of a triangle: its normal scaled by twice its area, and MikkTSpace's per face tangent
+	struct Face
+	{
+		glm::vec3 Normal;
+		float Length;       // of Normal
+		glm::vec3 Tangent;  // unit, towards +u on the triangle; 0 when the UVs are degenerate
+		float Sign;         // 1 when the UVs wind the same way as the positions, -1 when mirrored
+	};
+	static_assert(sizeof(Face) == 32 && offsetof(Face, Length) == 12 && offsetof(Face, Sign) == 28, "faces are stored four floats at a time");
+
+	JobSystem* Jobs = nullptr;
+	const float* Vertices = nullptr;
+	const uint32_t* Indices = nullptr;
+	uint32_t Stride = 0;
+	uint32_t UvOffset = MESH_NO_UV;
+	uint32_t TriangleCount = 0;
+	float CosCrease = 0.0f;
+	std::vector<uint32_t> PositionOf;   // the lowest vertex with each vertex's position
+	std::vector<uint32_t> Table;
+	std::vector<Face> Faces;
+	std::vector<uint32_t> CornerStart, CornerList;  // by vertex
+	std::vector<uint32_t> MemberStart, Members;     // by PositionOf
+	std::vector<uint32_t> Fill;
+	std::vector<glm::vec4> Groups;      // a vertex's groups' summed normals and UV winding, from its first corner's slot on
+	std::vector<uint32_t> VertexBase;
+
+	template <typename Fn>
+	void runParallel(const char* name, uint32_t count, uint32_t grain, const Fn& fn)
+	{
+		if (Jobs)
+			Jobs->ParallelFor(name, count, grain, fn);
+		else if (count > 0)
+			fn(0u, count);
+	}
+
+	const float* vertex(uint32_t index) const { return Vertices + size_t(index) * Stride; }
+
+	// finds the vertices that share a position with an open addressed hash of the position's bits. -0 and 0 are one
+	void weldPositions(uint32_t vertexCount)
+	{
+		PositionOf.resize(vertexCount);
+		uint32_t capacity = 16;
+		while (capacity < vertexCount * 2u)
+			capacity *= 2;
+		Table.assign(capacity, ~0u);
+		const auto bits = [](float value)
+		{
+			value += 0.0f;
+			uint32_t b;
+			std::memcpy(&b, &value, sizeof(b));
+			return b;
+		};
+		for (uint32_t v = 0; v < vertexCount; ++v)
+		{
+			const float* p = vertex(v);
+			const uint32_t x = bits(p[0]), y = bits(p[1]), z = bits(p[2]);
+			uint32_t slot = ((x * 0x9E3779B1u) ^ (y * 0x85EBCA77u) ^ (z * 0xC2B2AE3Du)) & (capacity - 1);
+			for (;;)
+			{
+				const uint32_t other = Table[slot];
+				if (other == ~0u)
+				{
+					Table[slot] = v;
+					PositionOf[v] = v;
+					break;
+				}
+				const float* q = vertex(other);
+				if (bits(q[0]) == x && bits(q[1]) == y && bits(q[2]) == z)
+				{
+					PositionOf[v] = other;
+					break;
+				}
+				slot = (slot + 1) & (capacity - 1);
+			}
+		}
+	}
+
+	void computeFace(uint32_t t)
+	{
+		const float* p0 = vertex(Indices[t * 3]);
+		const float* p1 = vertex(Indices[t * 3 + 1]);
+		const float* p2 = vertex(Indices[t * 3 + 2]);
+		const glm::vec3 d1 = glm::vec3(p1[0], p1[1], p1[2]) - glm::vec3(p0[0], p0[1], p0[2]);
+		const glm::vec3 d2 = glm::vec3(p2[0], p2[1], p2[2]) - glm::vec3(p0[0], p0[1], p0[2]);
+		Face& face = Faces[t];
+		face.Normal = glm::cross(d1, d2);
+		face.Length = glm::length(face.Normal);
+		face.Tangent = glm::vec3(0.0f);
+		face.Sign = 1.0f;
+		if (UvOffset == MESH_NO_UV)
+			return;
+
+		const glm::vec2 t21 = glm::vec2(p1[UvOffset], p1[UvOffset + 1]) - glm::vec2(p0[UvOffset], p0[UvOffset + 1]);
+		const glm::vec2 t31 = glm::vec2(p2[UvOffset], p2[UvOffset + 1]) - glm::vec2(p0[UvOffset], p0[UvOffset + 1]);
+		const float area = t21.x * t31.y - t21.y * t31.x;
+		const glm::vec3 os = t31.y * d1 - t21.y * d2;
+		const float length = glm::length(os);
+		face.Sign = area > 0.0f ? 1.0f : -1.0f;
+		if (area != 0.0f && length > 0.0f)
+			face.Tangent = os * (face.Sign / length);
+	}
+
+	void computeFaces(uint32_t begin, uint32_t end)
+	{
+		uint32_t t = begin;
+#ifdef MESH_NORMALS_SSE2
+		const bool uvs = UvOffset != MESH_NO_UV;
+		for (; t + 4 <= end; t += 4)
+		{
+			// corner, then component, then the four triangles
+			alignas(16) float p[3][5][4];
+			for (int lane = 0; lane < 4; ++lane)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					const float* v = vertex(Indices[(t + lane) * 3 + c]);
+					p[c][0][lane] = v[0];
+					p[c][1][lane] = v[1];
+					p[c][2][lane] = v[2];
+					p[c][3][lane] = uvs ? v[UvOffset] : 0.0f;
+					p[c][4][lane] = uvs ? v[UvOffset + 1] : 0.0f;
+				}
+			}
+			__m128 d1[5], d2[5];
+			for (int k = 0; k < 5; ++k)
+			{
+				const __m128 origin = _mm_load_ps(p[0][k]);
+				d1[k] = _mm_sub_ps(_mm_load_ps(p[1][k]), origin);
+				d2[k] = _mm_sub_ps(_mm_load_ps(p[2][k]), origin);
+			}
+			__m128 nx = _mm_sub_ps(_mm_mul_ps(d1[1], d2[2]), _mm_mul_ps(d1[2], d2[1]));
+			__m128 ny = _mm_sub_ps(_mm_mul_ps(d1[2], d2[0]), _mm_mul_ps(d1[0], d2[2]));
+			__m128 nz = _mm_sub_ps(_mm_mul_ps(d1[0], d2[1]), _mm_mul_ps(d1[1], d2[0]));
+			__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz)));
+
+			// the u and v deltas are d1[3], d1[4] and d2[3], d2[4]
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 area = _mm_sub_ps(_mm_mul_ps(d1[3], d2[4]), _mm_mul_ps(d1[4], d2[3]));
+			__m128 tx = _mm_sub_ps(_mm_mul_ps(d2[4], d1[0]), _mm_mul_ps(d1[4], d2[0]));
+			__m128 ty = _mm_sub_ps(_mm_mul_ps(d2[4], d1[1]), _mm_mul_ps(d1[4], d2[1]));
+			__m128 tz = _mm_sub_ps(_mm_mul_ps(d2[4], d1[2]), _mm_mul_ps(d1[4], d2[2]));
+			const __m128 tangentLength = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, tx), _mm_mul_ps(ty, ty)), _mm_mul_ps(tz, tz)));
+			const __m128 positive = _mm_cmpgt_ps(area, zero);
+			__m128 sign = _mm_or_ps(_mm_and_ps(positive, _mm_set1_ps(1.0f)), _mm_andnot_ps(positive, _mm_set1_ps(-1.0f)));
+			// the division by a zero length is masked off with the degenerate UVs
+			const __m128 usable = _mm_and_ps(_mm_cmpneq_ps(area, zero), _mm_cmpgt_ps(tangentLength, zero));
+			const __m128 scale = _mm_and_ps(usable, _mm_div_ps(sign, tangentLength));
+			tx = _mm_mul_ps(tx, scale);
+			ty = _mm_mul_ps(ty, scale);
+			tz = _mm_mul_ps(tz, scale);
+
+			// four faces' rows of (normal, length) and (tangent, sign) each
+			_MM_TRANSPOSE4_PS(nx, ny, nz, length);
+			_MM_TRANSPOSE4_PS(tx, ty, tz, sign);
+			float* face = &Faces[t].Normal.x;
+			_mm_storeu_ps(face, nx);
+			_mm_storeu_ps(face + 4, tx);
+			_mm_storeu_ps(face + 8, ny);
+			_mm_storeu_ps(face + 12, ty);
+			_mm_storeu_ps(face + 16, nz);
+			_mm_storeu_ps(face + 20, tz);
+			_mm_storeu_ps(face + 24, length);
+			_mm_storeu_ps(face + 28, sign);
+		}
+#endif
+		for (; t < end; ++t)
+			computeFace(t);
+	}
+
+	// acos to within 7e-5 radians (Abramowitz and Stegun 4.4.45), which is plenty for weighting by angle
+	static float fastAcos(float x)
+	{
+		const float a = std::min(std::abs(x), 1.0f);
+		const float r = (((-0.0187293f * a + 0.0742610f) * a - 0.2121144f) * a + 1.5707288f) * std::sqrt(1.0f - a);
+		return x < 0.0f ? 3.14159265f - r : r;
+	}
+
+	// sorts the corners of vertex v into groups by normal and UV winding, gives each corner's index its group and returns
+	// how many there are. around is scratch for the faces at the vertex's position, gathered once for all its corners
+	uint32_t groupCorners(uint32_t v, std::vector<glm::vec4>& around, uint32_t* cornerGroups)
+	{
+		const uint32_t position = PositionOf[v];
+		around.clear();
+		for (uint32_t m = MemberStart[position]; m < MemberStart[position + 1]; ++m)
+		{
+			const uint32_t member = Members[m];
+			for (uint32_t c = CornerStart[member]; c < CornerStart[member + 1]; ++c)
+			{
+				const Face& face = Faces[CornerList[c] / 3];
+				around.push_back(glm::vec4(face.Normal, face.Length));
+			}
+		}
+		const bool smooth = CosCrease <= -1.0f;
+		glm::vec3 smoothNormal(0.0f);
+		if (smooth)
+		{
+			for (const glm::vec4& face : around)
+				smoothNormal += glm::vec3(face);
+		}
+
+		glm::vec4* groups = Groups.data() + CornerStart[v];
+		uint32_t count = 0;
+		for (uint32_t c = CornerStart[v]; c < CornerStart[v + 1]; ++c)
+		{
+			const uint32_t corner = CornerList[c];
+			const Face& own = Faces[corner / 3];
+			glm::vec3 normal = smoothNormal;
+			if (!smooth)
+			{
+				// the faces within the crease angle of this one, by the cosine of the angle between their normals
+				const float limit = CosCrease * own.Length;
+				for (const glm::vec4& face : around)
+				{
+					const glm::vec3 faceNormal(face);
+					if (glm::dot(own.Normal, faceNormal) >= limit * face.w)
+						normal += faceNormal;
+				}
+			}
+
+			const glm::vec4 group(normal, own.Sign);
+			uint32_t g = 0;
+			while (g < count && groups[g] != group)
+				++g;
+			if (g == count)
+				groups[count++] = group;
+			cornerGroups[corner] = g;
+		}
+		return count;
+	}
+
+	// the output vertices of input vertex v, and its corners' indices into them
+	void writeVertex(uint32_t v, std::vector<glm::vec3>& tangents, TangentSpaceMesh& out) const
+	{
+		const uint32_t base = VertexBase[v];
+		const uint32_t count = VertexBase[v + 1] - base;
+		const glm::vec4* groups = Groups.data() + CornerStart[v];
+		for (uint32_t g = 0; g < count; ++g)
+		{
+			const glm::vec3 normal(groups[g]);
+			const float length = glm::length(normal);
+			out.Source[base + g] = v;
+			out.Normals[base + g] = length > 0.0f ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+		}
+		if (UvOffset == MESH_NO_UV)
+		{
+			for (uint32_t c = CornerStart[v]; c < CornerStart[v + 1]; ++c)
+				out.Indices[CornerList[c]] += base;
+			return;
+		}
+
+		tangents.assign(count, glm::vec3(0.0f));
+		for (uint32_t c = CornerStart[v]; c < CornerStart[v + 1]; ++c)
+		{
+			const uint32_t corner = CornerList[c];
+			const uint32_t g = out.Indices[corner];
+			out.Indices[corner] = base + g;
+
+			// the face's tangent in the plane of the vertex normal, weighted by the triangle's angle at the corner there
+			const Face& face = Faces[corner / 3];
+			const glm::vec3 n = out.Normals[base + g];
+			const glm::vec3 tangent = face.Tangent - n * glm::dot(n, face.Tangent);
+			const float tangentLength = glm::length(tangent);
+			if (tangentLength <= 0.0f)
+				continue;
+			const uint32_t first = corner - corner % 3;
+			const float* here = vertex(Indices[corner]);
+			const float* next = vertex(Indices[first + (corner - first + 1) % 3]);
+			const float* previous = vertex(Indices[first + (corner - first + 2) % 3]);
+			glm::vec3 toNext = glm::vec3(next[0] - here[0], next[1] - here[1], next[2] - here[2]);
+			glm::vec3 toPrevious = glm::vec3(previous[0] - here[0], previous[1] - here[1], previous[2] - here[2]);
+			toNext -= n * glm::dot(n, toNext);
+			toPrevious -= n * glm::dot(n, toPrevious);
+			const float lengths = std::sqrt(glm::dot(toNext, toNext) * glm::dot(toPrevious, toPrevious));
+			const float angle = lengths > 0.0f ? fastAcos(glm::dot(toNext, toPrevious) / lengths) : 0.0f;
+			tangents[g] += tangent * (angle / tangentLength);
+		}
+
+		for (uint32_t g = 0; g < count; ++g)
+		{
+			// with no usable UVs around the vertex any tangent in the plane will do
+			const glm::vec3 n = out.Normals[base + g];
+			glm::vec3 tangent = tangents[g];
+			const float length = glm::length(tangent);
+			if (length > 0.0f)
+				tangent /= length;
+			else
+				tangent = glm::normalize(std::abs(n.x) < 0.9f ? glm::cross(n, glm::vec3(1.0f, 0.0f, 0.0f)) : glm::cross(n, glm::vec3(0.0f, 1.0f, 0.0f)));
+			out.Tangents[base + g] = glm::vec4(tangent, groups[g].w);
+		}
+	}
+};
+#endif
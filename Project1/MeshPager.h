@@ -0,0 +1,473 @@
+#ifndef MESH_PAGER_H
+#define MESH_PAGER_H
+
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <initializer_list>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "BufferHeap.h"
+#include "Frustum.h"
+#include "GpuCulling.h"
+#include "MeshChunks.h"
+
+typedef uint32_t MeshPageHandle;
+const MeshPageHandle NO_MESH_PAGE = 0xffffffffu;
+
+const uint64_t MESH_PAGER_DEFAULT_BUDGET = 64ull << 20;
+const uint64_t MESH_PAGER_DEFAULT_UPLOAD_PER_FRAME = 2ull << 20;
+// Reads queued at once; keeps the queue short enough that it never holds chunks the camera has long left behind
+const uint32_t MESH_PAGER_MAX_READS = 8;
+// How far ahead of a moving camera chunks are read, in seconds of its current velocity
+const float MESH_PAGER_LOOKAHEAD = 1.0f;
+// Bytes of resident chunks moved a frame to empty out an arena that evictions left sparse
+const uint64_t MESH_PAGER_DEFRAGMENT_PER_FRAME = 256ull << 10;
+
+struct MeshPagingStats
+{
+	uint64_t BudgetBytes = 0;
+	uint64_t ResidentBytes = 0;
+	uint64_t UploadedBytes = 0;         // during the last Update
+	uint64_t TotalUploadedBytes = 0;
+	uint32_t Chunks = 0;
+	uint32_t ResidentChunks = 0;
+	uint32_t VisibleChunks = 0;         // in view during the last Update, resident or not
+	uint32_t Misses = 0;                // of those, the ones that were not resident
+	uint32_t Prefetched = 0;            // chunks read only because the camera is heading their way, since Create
+	uint32_t Evictions = 0;             // since Create
+	uint32_t PendingReads = 0;
+	uint32_t Meshlets = 0;              // of the resident chunks in view during the last Update
+	uint32_t FrustumCulledMeshlets = 0; // of those, outside the frustum
+	uint32_t BackfacingMeshlets = 0;    // and facing away from the eye
+	uint32_t Commands = 0;              // indirect draws the rest took
+	uint64_t Triangles = 0;             // in those draws
+};
+
+// Indirect draws of the pager's command buffer, of resident chunks in view, that share one VAO
+struct PagedDraw
+{
+	GLuint Vao;
+	uint32_t FirstCommand;
+	uint32_t CommandCount;
+};
+
+
+// Pages the chunks of chunk files (MeshChunks.h) in and out of GPU memory. Only the chunk tables stay in memory; every
+// frame the chunks in the view frustum, and those in the frustum pushed ahead along the camera's velocity, are read by a
+// file thread, nearest first, and uploaded within a per frame budget. To stay under the memory budget the chunks that
+// were last in view longest ago are evicted, never one in view this frame. Resident chunks share the arenas of a
+// BufferHeap, which is defragmented a little each frame as evictions leave holes; the budget counts the chunks' own bytes.
+// The meshlets of the resident chunks in view are culled against the frustum and, by their normal cones, against the eye;
+// the ones left become indirect draw commands, one per run of meshlets that follow each other in the index buffer.
+// Everything except the file reads happens on the thread that owns the GL context
+class MeshPager
+{
+public:
+	// attributeSizes are the float counts of the vertex attributes in order, bound to locations 0, 1, ...
+	void Create(std::initializer_list<uint32_t> attributeSizes, uint64_t budgetBytes = MESH_PAGER_DEFAULT_BUDGET, uint64_t uploadBytesPerFrame = MESH_PAGER_DEFAULT_UPLOAD_PER_FRAME)
+	{
+		Stats = MeshPagingStats();
+		Stats.BudgetBytes = budgetBytes;
+		UploadBytesPerFrame = uploadBytesPerFrame;
+		FloatsPerVertex = 0;
+		for (uint32_t size : attributeSizes)
+			FloatsPerVertex += size;
+		// a few arenas to the budget, so the heap can give back the one evictions emptied most
+		Heap.Create(attributeSizes, "mesh pages", uint32_t(std::min<uint64_t>(budgetBytes / 4 + 1, BUFFER_HEAP_DEFAULT_ARENA)));
+		glGenBuffers(1, &CommandBuffer);
+		CommandCapacity = 0;
+		Frame = 0;
+		Quit = false;
+		Reader = std::thread(&MeshPager::readLoop, this);
+	}
+
+	void Destroy()
+	{
+		{
+			std::lock_guard<std::mutex> lock(ReadMutex);
+			Quit = true;
+		}
+		ReadCondition.notify_one();
+		if (Reader.joinable())
+			Reader.join();
+		for (Paged& chunk : Chunks)
+			release(chunk);
+		Heap.Destroy();
+		UDeleteBuffers(1, &CommandBuffer);
+		CommandBuffer = 0;
+		Chunks.clear();
+		Files.clear();
+		Staged.clear();
+		Pending.clear();
+		Done.clear();
+	}
+
+	// reads the chunk table of a file. Its chunks start paging in with the next Update they are in view for.
+	// Returns NO_MESH_PAGE, and prints why, if the file cannot be used
+	MeshPageHandle Add(const std::string& path)
+	{
+		MeshChunkFile file;
+		if (!UReadMeshChunkTable(path, file))
+			return NO_MESH_PAGE;
+		if (file.FloatsPerVertex != FloatsPerVertex)
+		{
+			UMeshChunkError(path, "vertex layout does not match the pager's");
+			return NO_MESH_PAGE;
+		}
+
+		const MeshPageHandle handle = MeshPageHandle(Files.size());
+		for (uint32_t c = 0; c < uint32_t(file.Chunks.size()); ++c)
+		{
+			Paged chunk;
+			chunk.File = handle;
+			chunk.Index = c;
+			chunk.Bounds = file.Chunks[c].Bounds;
+			chunk.Bytes = file.GetChunkBytes(c);
+			Chunks.push_back(chunk);
+		}
+		Files.push_back(std::move(file));
+		Stats.Chunks = uint32_t(Chunks.size());
+		return handle;
+	}
+
+	// once a frame: uploads finished reads within the per frame budget, finds the chunks in view, the ones to draw and the
+	// ones to read next, and queues those reads, evicting to make room for them. velocity is the camera's, in units per second
+	void Update(const Frustum& frustum, const glm::vec3& eye, const glm::vec3& velocity)
+	{
+		++Frame;
+		Stats.UploadedBytes = 0;
+		takeReads();
+		while (!Staged.empty() && Stats.UploadedBytes < UploadBytesPerFrame)
+		{
+			upload(Chunks[Staged.front()]);
+			Staged.pop_front();
+		}
+		// before the draws below take the chunks' ranges
+		Heap.Defragment(MESH_PAGER_DEFRAGMENT_PER_FRAME);
+
+		// the frustum moved to where the camera will be; its planes keep their normals
+		const glm::vec3 ahead = velocity * MESH_PAGER_LOOKAHEAD;
+		const bool moving = glm::dot(ahead, ahead) > 1e-6f;
+		Frustum predicted = frustum;
+		for (glm::vec4& plane : predicted.Planes)
+			plane.w -= glm::dot(glm::vec3(plane), ahead);
+
+		Visible.clear();
+		Commands.clear();
+		Wanted.clear();
+		Stats.VisibleChunks = 0;
+		Stats.Misses = 0;
+		Stats.Meshlets = Stats.FrustumCulledMeshlets = Stats.BackfacingMeshlets = 0;
+		Stats.Triangles = 0;
+		for (uint32_t c = 0; c < uint32_t(Chunks.size()); ++c)
+		{
+			Paged& chunk = Chunks[c];
+			const bool visible = frustum.IntersectsAabb(chunk.Bounds.Min, chunk.Bounds.Max);
+			const bool prefetch = !visible && moving && predicted.IntersectsAabb(chunk.Bounds.Min, chunk.Bounds.Max);
+			if (!visible && !prefetch)
+				continue;
+			chunk.LastUsed = Frame;
+			chunk.InView = visible;
+			if (visible)
+			{
+				Stats.VisibleChunks++;
+				if (chunk.State == PAGE_RESIDENT)
+					addDraws(chunk, frustum, eye);
+				else
+					Stats.Misses++;
+			}
+			if (chunk.State == PAGE_ABSENT)
+			{
+				const glm::vec3 offset = glm::max(glm::max(chunk.Bounds.Min - eye, eye - chunk.Bounds.Max), glm::vec3(0.0f));
+				Wanted.push_back({ c, (visible ? 0.0f : 1e9f) + glm::dot(offset, offset) });
+			}
+		}
+
+		// what is in view first, nearest first
+		std::sort(Wanted.begin(), Wanted.end(), [](const WantedChunk& a, const WantedChunk& b) { return a.Priority < b.Priority; });
+		for (const WantedChunk& wanted : Wanted)
+		{
+			if (Reads >= MESH_PAGER_MAX_READS)
+				break;
+			Paged& chunk = Chunks[wanted.Chunk];
+			if (!makeRoom(chunk.Bytes))
+				break;
+			if (!chunk.InView)
+				Stats.Prefetched++;
+			chunk.State = PAGE_READING;
+			ReservedBytes += chunk.Bytes;
+			Reads++;
+			queueRead(wanted.Chunk);
+		}
+
+		Stats.PendingReads = Reads + uint32_t(Staged.size());
+		Stats.Commands = uint32_t(Commands.size());
+		uploadCommands();
+	}
+
+	// the draws of the resident chunks in view at the last Update, into GetCommandBuffer
+	const std::vector<PagedDraw>& GetVisible() const { return Visible; }
+	GLuint GetCommandBuffer() const { return CommandBuffer; }
+
+	// with meshlet culling off every resident chunk in view is drawn whole
+	void SetMeshletCulling(bool enabled) { MeshletCulling = enabled; }
+	bool IsMeshletCulling() const { return MeshletCulling; }
+	const MeshPagingStats& GetStats() const { return Stats; }
+	const BufferHeapStats& GetHeapStats() { return Heap.GetStats(); }
+
+private:
+	enum Page_State {
+		PAGE_ABSENT,
+		PAGE_READING,
+		PAGE_STAGED,        // read, waiting for upload budget
+		PAGE_RESIDENT
+	};
+
+	struct Paged
+	{
+		MeshPageHandle File = 0;
+		uint32_t Index = 0;
+		Aabb Bounds;
+		uint64_t Bytes = 0;
+		Page_State State = PAGE_ABSENT;
+		uint64_t LastUsed = 0;      // last Update it was in view or ahead of the camera
+		bool InView = false;
+		BufferRangeHandle Range = NO_BUFFER_RANGE;
+		std::vector<Meshlet> Meshlets;  // while resident
+		MeshChunk Data;             // while staged
+	};
+
+	struct WantedChunk
+	{
+		uint32_t Chunk;
+		float Priority;
+	};
+
+	struct ReadResult
+	{
+		uint32_t Chunk;
+		bool Ok;
+		MeshChunk Data;
+	};
+
+	std::vector<MeshChunkFile> Files;
+	std::vector<Paged> Chunks;
+	std::vector<PagedDraw> Visible;
+	std::vector<DrawElementsIndirectCommand> Commands;
+	GLuint CommandBuffer = 0;
+	uint32_t CommandCapacity = 0;
+	bool MeshletCulling = true;
+	std::vector<WantedChunk> Wanted;
+	std::deque<uint32_t> Staged;
+	BufferHeap Heap;
+	MeshPagingStats Stats;
+	uint64_t UploadBytesPerFrame = MESH_PAGER_DEFAULT_UPLOAD_PER_FRAME;
+	uint64_t ReservedBytes = 0;     // of chunks read or staged but not uploaded yet
+	uint32_t Reads = 0;             // queued or being read
+	uint64_t Frame = 0;
+	uint32_t FloatsPerVertex = 0;
+
+	std::thread Reader;
+	std::mutex ReadMutex;
+	std::condition_variable ReadCondition;
+	std::deque<uint32_t> Pending;
+	std::vector<ReadResult> Done;
+	std::vector<ReadResult> Taken;
+	bool Quit = false;
+
+	// evicts the least recently used resident chunks until bytes more fit the budget. Chunks used this frame stay, so
+	// a view that needs more than the budget draws what fits rather than thrashing
+	bool makeRoom(uint64_t bytes)
+	{
+		while (Stats.ResidentBytes + ReservedBytes + bytes > Stats.BudgetBytes)
+		{
+			Paged* victim = nullptr;
+			for (Paged& chunk : Chunks)
+			{
+				if (chunk.State == PAGE_RESIDENT && chunk.LastUsed != Frame && (victim == nullptr || chunk.LastUsed < victim->LastUsed))
+					victim = &chunk;
+			}
+			if (victim == nullptr)
+				return false;
+			release(*victim);
+			Stats.Evictions++;
+		}
+		return true;
+	}
+
+	void upload(Paged& chunk)
+	{
+		const MeshChunk& data = chunk.Data;
+		chunk.Range = Heap.Allocate(data.Vertices.data(), uint32_t(data.Vertices.size() / FloatsPerVertex), data.Indices.data(), uint32_t(data.Indices.size()));
+		chunk.Meshlets = std::move(chunk.Data.Meshlets);
+		chunk.Data = MeshChunk();
+		ReservedBytes -= chunk.Bytes;
+		if (chunk.Range == NO_BUFFER_RANGE)
+		{
+			chunk.State = PAGE_ABSENT;
+			return;
+		}
+		chunk.State = PAGE_RESIDENT;
+		Stats.ResidentBytes += chunk.Bytes;
+		Stats.ResidentChunks++;
+		Stats.UploadedBytes += chunk.Bytes;
+		Stats.TotalUploadedBytes += chunk.Bytes;
+	}
+
+	// adds the commands for what is seen of a resident chunk, extending the last draw when it uses the same VAO
+	void addDraws(const Paged& chunk, const Frustum& frustum, const glm::vec3& eye)
+	{
+		const BufferRange& range = Heap.Get(chunk.Range);
+		const uint32_t firstCommand = uint32_t(Commands.size());
+		if (!MeshletCulling || chunk.Meshlets.empty())
+			addCommand(range, 0, range.IndexCount, firstCommand);
+		else
+		{
+			for (const Meshlet& meshlet : chunk.Meshlets)
+			{
+				Stats.Meshlets++;
+				if (!frustum.IntersectsAabb(meshlet.Bounds.Min, meshlet.Bounds.Max))
+					Stats.FrustumCulledMeshlets++;
+				else if (UIsMeshletBackfacing(meshlet, eye))
+					Stats.BackfacingMeshlets++;
+				else
+					addCommand(range, meshlet.FirstIndex, meshlet.IndexCount, firstCommand);
+			}
+		}
+
+		const uint32_t added = uint32_t(Commands.size()) - firstCommand;
+		if (added == 0)
+			return;
+		if (!Visible.empty() && Visible.back().Vao == range.Vao)
+			Visible.back().CommandCount += added;
+		else
+			Visible.push_back({ range.Vao, firstCommand, added });
+	}
+
+	// indices [firstIndex, firstIndex + indexCount) of a chunk; joins the last command when it is the chunk's and ends there
+	void addCommand(const BufferRange& range, uint32_t firstIndex, uint32_t indexCount, uint32_t chunkCommands)
+	{
+		Stats.Triangles += indexCount / 3;
+		if (Commands.size() > chunkCommands)
+		{
+			DrawElementsIndirectCommand& last = Commands.back();
+			if (last.FirstIndex + last.Count == range.FirstIndex + firstIndex)
+			{
+				last.Count += indexCount;
+				return;
+			}
+		}
+		Commands.push_back({ indexCount, 1, range.FirstIndex + firstIndex, range.BaseVertex, 0 });
+	}
+
+	void uploadCommands()
+	{
+		if (Commands.empty())
+			return;
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, CommandBuffer);
+		if (Commands.size() > CommandCapacity)
+		{
+			CommandCapacity = std::max(uint32_t(Commands.size()), CommandCapacity * 2);
+			UBufferData(GL_DRAW_INDIRECT_BUFFER, CommandBuffer, CommandCapacity * sizeof(DrawElementsIndirectCommand), NULL, GL_STREAM_DRAW, "mesh pages");
+		}
+		glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, Commands.size() * sizeof(DrawElementsIndirectCommand), Commands.data());
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	// frees a chunk's range of the heap, or its staged data
+	void release(Paged& chunk)
+	{
+		if (chunk.State == PAGE_RESIDENT)
+		{
+			Heap.Free(chunk.Range);
+			chunk.Range = NO_BUFFER_RANGE;
+			chunk.Meshlets = std::vector<Meshlet>();
+			Stats.ResidentBytes -= chunk.Bytes;
+			Stats.ResidentChunks--;
+		}
+		chunk.Data = MeshChunk();
+		chunk.State = PAGE_ABSENT;
+	}
+
+	void takeReads()
+	{
+		{
+			std::lock_guard<std::mutex> lock(ReadMutex);
+			Taken.swap(Done);
+		}
+		for (ReadResult& result : Taken)
+		{
+			Paged& chunk = Chunks[result.Chunk];
+			Reads--;
+			if (!result.Ok)
+			{
+				// left absent, so it is asked for again if it stays in view
+				ReservedBytes -= chunk.Bytes;
+				chunk.State = PAGE_ABSENT;
+				continue;
+			}
+			chunk.Data = std::move(result.Data);
+			chunk.State = PAGE_STAGED;
+			Staged.push_back(result.Chunk);
+		}
+		Taken.clear();
+	}
+
+	void queueRead(uint32_t chunk)
+	{
+		{
+			std::lock_guard<std::mutex> lock(ReadMutex);
+			Pending.push_back(chunk);
+		}
+		ReadCondition.notify_one();
+	}
+
+	// the file thread: one chunk at a time, in the order they were queued. Files and chunk tables only change before the
+	// first Update, so they are read here without the lock
+	void readLoop()
+	{
+		std::ifstream stream;
+		MeshPageHandle open = NO_MESH_PAGE;
+		for (;;)
+		{
+			uint32_t index;
+			{
+				std::unique_lock<std::mutex> lock(ReadMutex);
+				ReadCondition.wait(lock, [this]() { return Quit || !Pending.empty(); });
+				if (Quit)
+					return;
+				index = Pending.front();
+				Pending.pop_front();
+			}
+
+			const Paged& chunk = Chunks[index];
+			const MeshChunkFile& file = Files[chunk.File];
+			if (open != chunk.File)
+			{
+				stream.close();
+				stream.open(file.Path, std::ios::binary);
+				open = chunk.File;
+			}
+			ReadResult result;
+			result.Chunk = index;
+			result.Ok = bool(stream) && UReadMeshChunk(stream, file, chunk.Index, result.Data);
+			if (!result.Ok)
+				std::cout << "ERROR::MESH_CHUNKS::" << file.Path << "::could not read chunk " << chunk.Index << std::endl;
+
+			std::lock_guard<std::mutex> lock(ReadMutex);
+			Done.push_back(std::move(result));
+		}
+	}
+};
+#endif
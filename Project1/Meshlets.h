@@ -0,0 +1,176 @@
+#ifndef MESHLETS_H
+#define MESHLETS_H
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Bounds.h"
+
+// Limits of one meshlet, the sizes mesh shader pipelines favour; small enough that culling one skips little that is seen
+const uint32_t MESHLET_MAX_VERTICES = 64;
+const uint32_t MESHLET_MAX_TRIANGLES = 124;
+// Triangles whose normals spread wider than this (the cosine of the widest angle to the axis) give no usable cone
+const float MESHLET_MIN_CONE_SPREAD = 0.1f;
+
+// A run of triangles in its mesh's index buffer with what it takes to cull it: its bounds and bounding sphere, and the
+// cone around the normals of its triangles. A front face winds counter-clockwise, as GL's default
+struct Meshlet
+{
+	Aabb Bounds;
+	glm::vec3 Center;
+	float Radius;
+	glm::vec3 ConeAxis;
+	float ConeCutoff;       // sine of the cone's half angle; 1 when the normals spread too far to ever cull
+	uint32_t FirstIndex;
+	uint32_t IndexCount;
+};
+static_assert(sizeof(Meshlet) == 64, "meshlets are stored as they are in memory");
+
+// True when every triangle of the meshlet faces away from eye from anywhere in its bounding sphere, so none of it can
+// be seen when back faces are culled or hidden behind the surface in front of them
+inline bool UIsMeshletBackfacing(const Meshlet& meshlet, const glm::vec3& eye)
+{
+	const glm::vec3 toCenter = meshlet.Center - eye;
+	return glm::dot(toCenter, meshlet.ConeAxis) >= meshlet.ConeCutoff * glm::length(toCenter) + meshlet.Radius;
+}
+
+// Groups a mesh's triangles into meshlets of at most MESHLET_MAX_VERTICES vertices and MESHLET_MAX_TRIANGLES triangles,
+// reordering indices so each meshlet's triangles are contiguous. A meshlet grows from its first triangle by the
+// neighbour that adds the fewest new vertices, then the one nearest its centre, which keeps meshlets compact so their
+// bounds and cones stay tight. Vertices are interleaved floats whose first three are the position
+inline void UBuildMeshlets(const float* vertices, uint32_t vertexCount, uint32_t floatsPerVertex, std::vector<uint16_t>& indices, std::vector<Meshlet>& meshlets)
+{
+	meshlets.clear();
+	const uint32_t triangleCount = uint32_t(indices.size() / 3);
+	if (triangleCount == 0)
+		return;
+
+	const auto position = [vertices, floatsPerVertex](uint32_t index)
+	{
+		const float* v = vertices + size_t(index) * floatsPerVertex;
+		return glm::vec3(v[0], v[1], v[2]);
+	};
+
+	// the triangles around each vertex, as offsets into one array
+	std::vector<uint32_t> firstAround(vertexCount + 1, 0), around(indices.size());
+	for (uint16_t index : indices)
+		firstAround[index + 1]++;
+	for (uint32_t v = 0; v < vertexCount; ++v)
+		firstAround[v + 1] += firstAround[v];
+	std::vector<uint32_t> fill(firstAround.begin(), firstAround.end() - 1);
+	for (uint32_t t = 0; t < triangleCount; ++t)
+	{
+		for (int c = 0; c < 3; ++c)
+			around[fill[indices[t * 3 + c]]++] = t;
+	}
+
+	std::vector<glm::vec3> centroids(triangleCount), normals(triangleCount);
+	for (uint32_t t = 0; t < triangleCount; ++t)
+	{
+		const glm::vec3 a = position(indices[t * 3]), b = position(indices[t * 3 + 1]), c = position(indices[t * 3 + 2]);
+		centroids[t] = (a + b + c) / 3.0f;
+		const glm::vec3 normal = glm::cross(b - a, c - a);
+		const float length = glm::length(normal);
+		normals[t] = length > 0.0f ? normal / length : glm::vec3(0.0f);
+	}
+
+	std::vector<uint16_t> ordered;
+	ordered.reserve(indices.size());
+	std::vector<bool> used(triangleCount, false);
+	// stamp[v] is the number of the meshlet being built when v is already in it
+	std::vector<uint32_t> stamp(vertexCount, ~0u);
+	std::vector<uint32_t> candidates, members;
+	uint32_t seed = 0;
+	while (seed < triangleCount)
+	{
+		const uint32_t number = uint32_t(meshlets.size());
+		Meshlet meshlet;
+		meshlet.FirstIndex = uint32_t(ordered.size());
+		uint32_t vertexTotal = 0, triangles = 0;
+		glm::vec3 centroidSum(0.0f);
+		candidates.clear();
+		members.clear();
+
+		uint32_t next = seed;
+		while (next != ~0u)
+		{
+			used[next] = true;
+			members.push_back(next);
+			triangles++;
+			centroidSum += centroids[next];
+			for (int c = 0; c < 3; ++c)
+			{
+				const uint16_t index = indices[next * 3 + c];
+				ordered.push_back(index);
+				if (stamp[index] == number)
+					continue;
+				stamp[index] = number;
+				vertexTotal++;
+				meshlet.Bounds.Grow(position(index));
+				for (uint32_t a = firstAround[index]; a < firstAround[index + 1]; ++a)
+				{
+					if (!used[around[a]])
+						candidates.push_back(around[a]);
+				}
+			}
+			if (triangles == MESHLET_MAX_TRIANGLES)
+				break;
+
+			// the neighbour adding the fewest vertices that still fits, the nearest to the centre among those
+			const glm::vec3 centre = centroidSum / float(triangles);
+			next = ~0u;
+			uint32_t bestFresh = 4;
+			float bestDistance = 0.0f;
+			size_t kept = 0;
+			for (size_t i = 0; i < candidates.size(); ++i)
+			{
+				const uint32_t t = candidates[i];
+				if (used[t])
+					continue;
+				candidates[kept++] = t;
+				uint32_t fresh = 0;
+				for (int c = 0; c < 3; ++c)
+					fresh += stamp[indices[t * 3 + c]] != number ? 1 : 0;
+				if (vertexTotal + fresh > MESHLET_MAX_VERTICES)
+					continue;
+				const glm::vec3 offset = centroids[t] - centre;
+				const float distance = glm::dot(offset, offset);
+				if (fresh < bestFresh || (fresh == bestFresh && distance < bestDistance))
+				{
+					next = t;
+					bestFresh = fresh;
+					bestDistance = distance;
+				}
+			}
+			candidates.resize(kept);
+		}
+		meshlet.IndexCount = uint32_t(ordered.size()) - meshlet.FirstIndex;
+
+		// the bounding sphere around the box's centre, and the cone around the average normal
+		meshlet.Center = meshlet.Bounds.Center();
+		float radius = 0.0f;
+		glm::vec3 axis(0.0f);
+		for (uint32_t i = meshlet.FirstIndex; i < meshlet.FirstIndex + meshlet.IndexCount; ++i)
+			radius = std::max(radius, glm::length(position(ordered[i]) - meshlet.Center));
+		for (uint32_t t : members)
+			axis += normals[t];
+		meshlet.Radius = radius;
+		const float axisLength = glm::length(axis);
+		meshlet.ConeAxis = axisLength > 0.0f ? axis / axisLength : glm::vec3(0.0f, 1.0f, 0.0f);
+		float spread = 1.0f;
+		for (uint32_t t : members)
+			spread = std::min(spread, glm::dot(normals[t], meshlet.ConeAxis));
+		meshlet.ConeCutoff = spread <= MESHLET_MIN_CONE_SPREAD ? 1.0f : std::sqrt(1.0f - spread * spread);
+		meshlets.push_back(meshlet);
+
+		while (seed < triangleCount && used[seed])
+			++seed;
+	}
+	indices.swap(ordered);
+}
+#endif
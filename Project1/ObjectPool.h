@@ -0,0 +1,78 @@
+#ifndef OBJECT_POOL_H
+#define OBJECT_POOL_H
+
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Fixed size slots for objects that are created and destroyed over and over. Slots come in chunks of ChunkSize and a
+// destroyed object's slot goes on a free list for the next Create, so once the pool has grown to the most objects
+// alive at once it no longer touches the heap. Not thread safe; chunks are only released with the pool
+template <typename T, size_t ChunkSize = 64>
+class ObjectPool
+{
+public:
+	ObjectPool() = default;
+	ObjectPool(const ObjectPool&) = delete;
+	ObjectPool& operator=(const ObjectPool&) = delete;
+
+	// objects still alive are not destroyed, only their memory is released
+	~ObjectPool() = default;
+
+	template <typename... Args>
+	T* Create(Args&&... args)
+	{
+		if (!FreeList)
+			grow();
+		Slot* slot = FreeList;
+		FreeList = slot->Next;
+		++LiveCount;
+		return new (slot->Storage) T(std::forward<Args>(args)...);
+	}
+
+	// object must have come from this pool's Create
+	void Destroy(T* object)
+	{
+		object->~T();
+		Slot* slot = reinterpret_cast<Slot*>(object);
+		slot->Next = FreeList;
+		FreeList = slot;
+		--LiveCount;
+	}
+
+	// makes room for count objects alive at once, so the first frames do not grow the pool either
+	void Reserve(size_t count)
+	{
+		while (GetCapacity() < count)
+			grow();
+	}
+
+	size_t GetLiveCount() const { return LiveCount; }
+	size_t GetCapacity() const { return Chunks.size() * ChunkSize; }
+
+private:
+	union Slot
+	{
+		Slot* Next;
+		alignas(T) unsigned char Storage[sizeof(T)];
+	};
+
+	std::vector<std::unique_ptr<Slot[]>> Chunks;
+	Slot* FreeList = nullptr;
+	size_t LiveCount = 0;
+
+	void grow()
+	{
+		Chunks.push_back(std::unique_ptr<Slot[]>(new Slot[ChunkSize]));
+		Slot* chunk = Chunks.back().get();
+		for (size_t i = ChunkSize; i-- > 0;)
+		{
+			chunk[i].Next = FreeList;
+			FreeList = &chunk[i];
+		}
+	}
+};
+#endif
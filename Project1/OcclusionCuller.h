@@ -0,0 +1,336 @@
+#ifndef OCCLUSION_CULLER_H
+#define OCCLUSION_CULLER_H
+
+
+#include <algorithm>
+#include <cfloat>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Bounds.h"
+#include "JobSystem.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OCCLUSION_SSE2 1
+#endif
+
+// Default depth buffer size. Width must be a multiple of 4 (one SIMD register of pixels) and both sides a multiple of the tile size
+const int OCCLUSION_WIDTH = 256;
+const int OCCLUSION_HEIGHT = 128;
+const int OCCLUSION_TILE = 8;
+const double OCCLUSION_BUDGET_MS = 1.0;
+const uint32_t OCCLUSION_TEST_BATCH = 256;
+
+
+// A triangle mesh drawn into the depth buffer. Positions are in model space
+struct Occluder
+{
+	const glm::vec3* Positions;
+	const uint16_t* Indices;
+	uint32_t IndexCount;
+	glm::mat4 Model;
+};
+
+// What the last Cull did
+struct OcclusionStats
+{
+	int OccludersRasterized = 0;    // occluders every band finished within the budget
+	int OccludersSkipped = 0;       // occluders dropped because the budget ran out
+	int TrianglesRasterized = 0;
+	int Tested = 0;
+	int Rejected = 0;
+	double Milliseconds = 0.0;
+};
+
+
+// Software occlusion culler. A few large occluders are rasterized into a small float depth buffer (4 pixels per SSE2 step),
+// reduced to a hierarchical-Z of per tile maximum depths, and the screen rectangle of each occludee box is tested against it.
+// The buffer is split into horizontal bands so jobs rasterize without sharing pixels; occluders are drawn in the
+// order given and rasterization stops when the time budget is used up, which only ever makes the result less aggressive
+class OcclusionCuller
+{
+public:
+	OcclusionCuller(int width = OCCLUSION_WIDTH, int height = OCCLUSION_HEIGHT) : Width(width), Height(height)
+	{
+		TilesX = Width / OCCLUSION_TILE;
+		TilesY = Height / OCCLUSION_TILE;
+		Depth.assign(size_t(Width) * Height, 1.0f);
+		HiZ.assign(size_t(TilesX) * TilesY, 1.0f);
+		BandCount = 1;
+	}
+
+	void SetBudget(double milliseconds) { BudgetMs = milliseconds; }
+	// spreads rasterization and testing over the job system's threads, one band of the buffer per thread
+	void SetJobSystem(JobSystem* jobs)
+	{
+		Jobs = jobs;
+		SetBandCount(jobs ? jobs->GetThreadCount() : 1);
+	}
+	void SetBandCount(int bands) { BandCount = std::max(1, std::min(bands, TilesY)); }
+
+	// rasterizes the occluders (most important first) and clears visible[i] for every box hidden behind them.
+	// Entries of visible that are already 0 are not tested
+	void Cull(const glm::mat4& viewProjection, const std::vector<Occluder>& occluders, const std::vector<Aabb>& boxes, std::vector<uint8_t>& visible)
+	{
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		Stats = OcclusionStats();
+
+		Rasterize(viewProjection, occluders, start);
+
+		// test the occludees in batches
+		std::atomic<int> tested(0), rejected(0);
+		runParallel("occlusion test", uint32_t(boxes.size()), OCCLUSION_TEST_BATCH, [&](uint32_t begin, uint32_t end)
+		{
+			int batchTested = 0, batchRejected = 0;
+			for (uint32_t i = begin; i < end; ++i)
+			{
+				if (!visible[i])
+					continue;
+				batchTested++;
+				if (IsOccluded(viewProjection, boxes[i]))
+				{
+					visible[i] = 0;
+					batchRejected++;
+				}
+			}
+			tested += batchTested;
+			rejected += batchRejected;
+		});
+		Stats.Tested = tested;
+		Stats.Rejected = rejected;
+
+		Stats.Milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// fills the depth buffer and hierarchical-Z. start is when the frame's budget began
+	void Rasterize(const glm::mat4& viewProjection, const std::vector<Occluder>& occluders, std::chrono::steady_clock::time_point start)
+	{
+		const int bands = BandCount;
+		std::vector<int>& completed = Completed;
+		completed.assign(bands, 0);
+		runParallel("occlusion raster", uint32_t(bands), 1, [&](uint32_t begin, uint32_t end)
+		{
+			for (int band = int(begin); band < int(end); ++band)
+			{
+				// whole tile rows per band so the hierarchical-Z can be built by the same job
+				const int tileRow0 = TilesY * band / bands;
+				const int tileRow1 = TilesY * (band + 1) / bands;
+				const int y0 = tileRow0 * OCCLUSION_TILE;
+				const int y1 = tileRow1 * OCCLUSION_TILE;
+				std::fill(Depth.begin() + size_t(y0) * Width, Depth.begin() + size_t(y1) * Width, 1.0f);
+
+				for (size_t o = 0; o < occluders.size(); ++o)
+				{
+					if (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() > BudgetMs)
+						break;
+					rasterizeOccluder(viewProjection * occluders[o].Model, occluders[o], y0, y1);
+					completed[band]++;
+				}
+				buildHiZ(tileRow0, tileRow1);
+			}
+		});
+
+		Stats.OccludersRasterized = *std::min_element(completed.begin(), completed.end());
+		Stats.OccludersSkipped = int(occluders.size()) - Stats.OccludersRasterized;
+		Stats.TrianglesRasterized = 0;
+		for (int o = 0; o < Stats.OccludersRasterized; ++o)
+			Stats.TrianglesRasterized += int(occluders[o].IndexCount / 3);
+	}
+
+	// true if the whole box is behind the rasterized occluders. Boxes that cross the near plane are never occluded
+	bool IsOccluded(const glm::mat4& viewProjection, const Aabb& box) const
+	{
+		float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, minZ = FLT_MAX;
+		for (int corner = 0; corner < 8; ++corner)
+		{
+			const glm::vec4 clip = viewProjection * glm::vec4(corner & 1 ? box.Max.x : box.Min.x,
+				corner & 2 ? box.Max.y : box.Min.y,
+				corner & 4 ? box.Max.z : box.Min.z, 1.0f);
+			if (clip.w <= 1e-5f)
+				return false;
+			const float x = clip.x / clip.w, y = clip.y / clip.w, z = clip.z / clip.w;
+			minX = std::min(minX, x); maxX = std::max(maxX, x);
+			minY = std::min(minY, y); maxY = std::max(maxY, y);
+			minZ = std::min(minZ, z);
+		}
+		// only the part on screen can be seen; a box entirely off it is left to frustum culling
+		minX = std::max(minX, -1.0f); maxX = std::min(maxX, 1.0f);
+		minY = std::max(minY, -1.0f); maxY = std::min(maxY, 1.0f);
+		if (minX > maxX || minY > maxY)
+			return false;
+
+		const float nearestDepth = minZ * 0.5f + 0.5f;
+		const int tx0 = int((minX * 0.5f + 0.5f) * Width) / OCCLUSION_TILE;
+		const int tx1 = std::min(TilesX - 1, int((maxX * 0.5f + 0.5f) * Width) / OCCLUSION_TILE);
+		const int ty0 = int((minY * 0.5f + 0.5f) * Height) / OCCLUSION_TILE;
+		const int ty1 = std::min(TilesY - 1, int((maxY * 0.5f + 0.5f) * Height) / OCCLUSION_TILE);
+		for (int ty = ty0; ty <= ty1; ++ty)
+		{
+			for (int tx = tx0; tx <= tx1; ++tx)
+			{
+				// the furthest occluder depth in the tile is still behind the box's nearest point: something may show through
+				if (nearestDepth <= HiZ[size_t(ty) * TilesX + tx])
+					return false;
+			}
+		}
+		return true;
+	}
+
+	const OcclusionStats& GetStats() const { return Stats; }
+	const std::vector<float>& GetDepth() const { return Depth; }
+	int GetWidth() const { return Width; }
+	int GetHeight() const { return Height; }
+
+private:
+	int Width;
+	int Height;
+	int TilesX;
+	int TilesY;
+	int BandCount;
+	JobSystem* Jobs = nullptr;
+	double BudgetMs = OCCLUSION_BUDGET_MS;
+	std::vector<float> Depth;   // window space depth, 1 is the far plane
+	std::vector<float> HiZ;     // furthest depth of every tile
+	std::vector<int> Completed; // occluders each band finished, kept so Cull does not allocate
+	OcclusionStats Stats;
+
+	// fn(begin, end) over [0, count) on the job system, or inline without one
+	template <typename Fn>
+	void runParallel(const char* name, uint32_t count, uint32_t grain, const Fn& fn)
+	{
+		if (Jobs)
+			Jobs->ParallelFor(name, count, grain, fn);
+		else if (count > 0)
+			fn(0u, count);
+	}
+
+	// clips every triangle against the near plane and rasterizes the rows [y0, y1) of it
+	void rasterizeOccluder(const glm::mat4& mvp, const Occluder& occluder, int y0, int y1)
+	{
+		for (uint32_t i = 0; i + 2 < occluder.IndexCount; i += 3)
+		{
+			glm::vec4 polygon[4];
+			glm::vec4 input[3];
+			for (int v = 0; v < 3; ++v)
+				input[v] = mvp * glm::vec4(occluder.Positions[occluder.Indices[i + v]], 1.0f);
+
+			// keep the part in front of the near plane (z >= -w in GL clip space)
+			int count = 0;
+			for (int v = 0; v < 3; ++v)
+			{
+				const glm::vec4& a = input[v];
+				const glm::vec4& b = input[(v + 1) % 3];
+				const float da = a.z + a.w;
+				const float db = b.z + b.w;
+				if (da >= 0.0f)
+					polygon[count++] = a;
+				if ((da >= 0.0f) != (db >= 0.0f))
+					polygon[count++] = a + (b - a) * (da / (da - db));
+			}
+			if (count < 3)
+				continue;
+
+			glm::vec3 screen[4];
+			for (int v = 0; v < count; ++v)
+			{
+				const float invW = 1.0f / polygon[v].w;
+				screen[v] = glm::vec3((polygon[v].x * invW * 0.5f + 0.5f) * Width,
+					(polygon[v].y * invW * 0.5f + 0.5f) * Height,
+					polygon[v].z * invW * 0.5f + 0.5f);
+			}
+			rasterizeTriangle(screen[0], screen[1], screen[2], y0, y1);
+			if (count == 4)
+				rasterizeTriangle(screen[0], screen[2], screen[3], y0, y1);
+		}
+	}
+
+	void rasterizeTriangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, int y0, int y1)
+	{
+		float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+		if (area == 0.0f)
+			return;
+		// both windings are occluders; make the edge functions positive inside
+		if (area < 0.0f)
+		{
+			std::swap(v1, v2);
+			area = -area;
+		}
+
+		const int minX = std::max(0, int(std::floor(std::min(v0.x, std::min(v1.x, v2.x)))));
+		const int maxX = std::min(Width - 1, int(std::ceil(std::max(v0.x, std::max(v1.x, v2.x)))));
+		const int minY = std::max(y0, int(std::floor(std::min(v0.y, std::min(v1.y, v2.y)))));
+		const int maxY = std::min(y1 - 1, int(std::ceil(std::max(v0.y, std::max(v1.y, v2.y)))));
+		if (minX > maxX || minY > maxY)
+			return;
+
+		// edge i is opposite vertex i: e(x, y) = a * x + b * y + c
+		const float a0 = v1.y - v2.y, b0 = v2.x - v1.x, c0 = v1.x * v2.y - v2.x * v1.y;
+		const float a1 = v2.y - v0.y, b1 = v0.x - v2.x, c1 = v2.x * v0.y - v0.x * v2.y;
+		const float a2 = v0.y - v1.y, b2 = v1.x - v0.x, c2 = v0.x * v1.y - v1.x * v0.y;
+		// depth is linear in screen space: z = zx * x + zy * y + zc
+		const float invArea = 1.0f / area;
+		const float zx = (a0 * v0.z + a1 * v1.z + a2 * v2.z) * invArea;
+		const float zy = (b0 * v0.z + b1 * v1.z + b2 * v2.z) * invArea;
+		const float zc = (c0 * v0.z + c1 * v1.z + c2 * v2.z) * invArea;
+
+		// start on a multiple of 4 so whole SIMD groups stay inside the row
+		const int startX = minX & ~3;
+		for (int y = minY; y <= maxY; ++y)
+		{
+			const float py = float(y) + 0.5f;
+			float* row = &Depth[size_t(y) * Width];
+#ifdef OCCLUSION_SSE2
+			const __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+			const __m128 zero = _mm_setzero_ps();
+			for (int x = startX; x <= maxX; x += 4)
+			{
+				const __m128 px = _mm_add_ps(_mm_set1_ps(float(x)), offsets);
+				const __m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a0), px), _mm_set1_ps(b0 * py + c0));
+				const __m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a1), px), _mm_set1_ps(b1 * py + c1));
+				const __m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a2), px), _mm_set1_ps(b2 * py + c2));
+				const __m128 inside = _mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_and_ps(_mm_cmpge_ps(e1, zero), _mm_cmpge_ps(e2, zero)));
+				if (_mm_movemask_ps(inside) == 0)
+					continue;
+				const __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(zx), px), _mm_set1_ps(zy * py + zc));
+				const __m128 old = _mm_loadu_ps(row + x);
+				const __m128 nearer = _mm_min_ps(old, z);
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+			}
+#else
+			for (int x = startX; x <= maxX; ++x)
+			{
+				const float px = float(x) + 0.5f;
+				if (a0 * px + b0 * py + c0 < 0.0f || a1 * px + b1 * py + c1 < 0.0f || a2 * px + b2 * py + c2 < 0.0f)
+					continue;
+				const float z = zx * px + zy * py + zc;
+				if (z < row[x])
+					row[x] = z;
+			}
+#endif
+		}
+	}
+
+	void buildHiZ(int tileRow0, int tileRow1)
+	{
+		for (int ty = tileRow0; ty < tileRow1; ++ty)
+		{
+			for (int tx = 0; tx < TilesX; ++tx)
+			{
+				float furthest = 0.0f;
+				for (int y = 0; y < OCCLUSION_TILE; ++y)
+				{
+					const float* row = &Depth[size_t(ty * OCCLUSION_TILE + y) * Width + tx * OCCLUSION_TILE];
+					for (int x = 0; x < OCCLUSION_TILE; ++x)
+						furthest = std::max(furthest, row[x]);
+				}
+				HiZ[size_t(ty) * TilesX + tx] = furthest;
+			}
+		}
+	}
+};
+#endif
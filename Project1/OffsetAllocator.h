@@ -0,0 +1,276 @@
+#ifndef OFFSET_ALLOCATOR_H
+#define OFFSET_ALLOCATOR_H
+
+
+#include <cstdint>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Index of the lowest and the highest set bit; the value must not be 0
+inline uint32_t ULowestBit(uint32_t value)
+{
+#ifdef _MSC_VER
+	unsigned long bit;
+	_BitScanForward(&bit, value);
+	return uint32_t(bit);
+#else
+	return uint32_t(__builtin_ctz(value));
+#endif
+}
+
+inline uint32_t UHighestBit(uint32_t value)
+{
+#ifdef _MSC_VER
+	unsigned long bit;
+	_BitScanReverse(&bit, value);
+	return uint32_t(bit);
+#else
+	return 31u - uint32_t(__builtin_clz(value));
+#endif
+}
+
+// Each power of two size class is split into 2^OFFSET_ALLOCATOR_SUBDIVISION_BITS bins
+const uint32_t OFFSET_ALLOCATOR_SUBDIVISION_BITS = 3;
+const uint32_t OFFSET_ALLOCATOR_BINS = 32 << OFFSET_ALLOCATOR_SUBDIVISION_BITS;
+
+
+// Hands out ranges of a linear space (a GPU buffer, in bytes) with the two level segregated fit scheme (TLSF): free
+// blocks sit in bins by size, a bitmap per level finds the smallest non-empty bin that fits in constant time, and a freed
+// block merges with its free neighbours at once. A block found this way is at least the size asked for but may be up to
+// one bin larger; the rest is split off and stays free. Only when no bin above has a block is the bin of the size itself
+// searched block by block, so a block that fits exactly is still found. Sizes must be below 2^31. Not thread safe
+class OffsetAllocator
+{
+public:
+	static const uint32_t NO_SPACE = 0xffffffffu;
+
+	// what Allocate returned; Node identifies the block to Free
+	struct Allocation
+	{
+		uint32_t Offset = NO_SPACE;
+		uint32_t Node = NO_SPACE;
+
+		bool IsValid() const { return Offset != NO_SPACE; }
+	};
+
+	// forgets every allocation and makes [0, size) one free block
+	void Reset(uint32_t size)
+	{
+		Size = size;
+		Nodes.clear();
+		FreeNodes.clear();
+		LevelBitmap = 0;
+		for (uint32_t& bitmap : BinBitmaps)
+			bitmap = 0;
+		for (uint32_t& head : BinHeads)
+			head = NO_SPACE;
+		FreeBytes = 0;
+		Allocations = 0;
+		if (size > 0)
+			insertFree(newNode(0, size, NO_SPACE, NO_SPACE));
+	}
+
+	// returns an invalid allocation when no free block is large enough
+	Allocation Allocate(uint32_t size)
+	{
+		Allocation allocation;
+		if (size == 0 || size > FreeBytes)
+			return allocation;
+
+		// round up to the start of the next bin, so any block in the bin found is large enough
+		const uint32_t rounded = size < (1u << OFFSET_ALLOCATOR_SUBDIVISION_BITS) ? size
+			: size + (1u << (UHighestBit(size) - OFFSET_ALLOCATOR_SUBDIVISION_BITS)) - 1;
+		const uint32_t bin = rounded < size ? NO_SPACE : findBin(binOf(rounded));
+		uint32_t node = bin == NO_SPACE ? NO_SPACE : BinHeads[bin];
+		if (node == NO_SPACE)
+		{
+			// the bin of size itself may still hold a block that is large enough, such as one of exactly size; its blocks
+			// are only told apart by looking at each
+			for (uint32_t candidate = BinHeads[binOf(size)]; candidate != NO_SPACE; candidate = Nodes[candidate].NextFree)
+			{
+				if (Nodes[candidate].Size >= size)
+				{
+					node = candidate;
+					break;
+				}
+			}
+			if (node == NO_SPACE)
+				return allocation;
+		}
+
+		removeFree(node);
+		Node& block = Nodes[node];
+		if (block.Size > size)
+		{
+			// the tail stays free as a block of its own
+			const uint32_t tail = newNode(Nodes[node].Offset + size, Nodes[node].Size - size, node, Nodes[node].Next);
+			Node& split = Nodes[node];
+			if (split.Next != NO_SPACE)
+				Nodes[split.Next].Previous = tail;
+			split.Next = tail;
+			split.Size = size;
+			insertFree(tail);
+		}
+		Nodes[node].Used = true;
+		Allocations++;
+		allocation.Offset = Nodes[node].Offset;
+		allocation.Node = node;
+		return allocation;
+	}
+
+	void Free(const Allocation& allocation)
+	{
+		if (!allocation.IsValid())
+			return;
+		uint32_t node = allocation.Node;
+		Nodes[node].Used = false;
+		Allocations--;
+
+		// merge with the free neighbours on either side
+		const uint32_t previous = Nodes[node].Previous;
+		if (previous != NO_SPACE && !Nodes[previous].Used)
+		{
+			removeFree(previous);
+			absorbNext(previous);
+			node = previous;
+		}
+		const uint32_t next = Nodes[node].Next;
+		if (next != NO_SPACE && !Nodes[next].Used)
+		{
+			removeFree(next);
+			absorbNext(node);
+		}
+		insertFree(node);
+	}
+
+	// the size the allocation was given, which is what it asked for
+	uint32_t GetSize(const Allocation& allocation) const { return Nodes[allocation.Node].Size; }
+	uint32_t GetCapacity() const { return Size; }
+	uint32_t GetFreeBytes() const { return FreeBytes; }
+	uint32_t GetAllocationCount() const { return Allocations; }
+
+	// the largest block Allocate is sure to succeed with
+	uint32_t GetLargestFree() const
+	{
+		if (LevelBitmap == 0)
+			return 0;
+		const uint32_t level = UHighestBit(LevelBitmap);
+		const uint32_t bin = (level << OFFSET_ALLOCATOR_SUBDIVISION_BITS) + UHighestBit(BinBitmaps[level]);
+		uint32_t largest = 0;
+		for (uint32_t node = BinHeads[bin]; node != NO_SPACE; node = Nodes[node].NextFree)
+			largest = Nodes[node].Size > largest ? Nodes[node].Size : largest;
+		return largest;
+	}
+
+private:
+	// a block, free or used, in a list ordered by offset; free ones are also in their bin's list
+	struct Node
+	{
+		uint32_t Offset;
+		uint32_t Size;
+		uint32_t Previous;
+		uint32_t Next;
+		uint32_t PreviousFree;
+		uint32_t NextFree;
+		bool Used;
+	};
+
+	std::vector<Node> Nodes;
+	std::vector<uint32_t> FreeNodes;    // unused entries of Nodes
+	uint32_t LevelBitmap = 0;           // bit per size class with any non-empty bin
+	uint32_t BinBitmaps[32] = {};       // bit per non-empty bin of a size class
+	uint32_t BinHeads[OFFSET_ALLOCATOR_BINS];
+	uint32_t Size = 0;
+	uint32_t FreeBytes = 0;
+	uint32_t Allocations = 0;
+
+	// sizes below 2^SUBDIVISION_BITS get a bin each; above, the size class is the highest bit and the bin within it the
+	// next SUBDIVISION_BITS bits
+	static uint32_t binOf(uint32_t size)
+	{
+		const uint32_t linear = 1u << OFFSET_ALLOCATOR_SUBDIVISION_BITS;
+		if (size < linear)
+			return size;
+		const uint32_t highest = UHighestBit(size);
+		const uint32_t level = highest - OFFSET_ALLOCATOR_SUBDIVISION_BITS + 1;
+		const uint32_t sub = (size >> (highest - OFFSET_ALLOCATOR_SUBDIVISION_BITS)) - linear;
+		return (level << OFFSET_ALLOCATOR_SUBDIVISION_BITS) + sub;
+	}
+
+	// the first non-empty bin at or above bin
+	uint32_t findBin(uint32_t bin) const
+	{
+		const uint32_t level = bin >> OFFSET_ALLOCATOR_SUBDIVISION_BITS;
+		const uint32_t sub = bin & ((1u << OFFSET_ALLOCATOR_SUBDIVISION_BITS) - 1);
+		const uint32_t inLevel = BinBitmaps[level] & (~0u << sub);
+		if (inLevel != 0)
+			return (level << OFFSET_ALLOCATOR_SUBDIVISION_BITS) + ULowestBit(inLevel);
+		const uint32_t above = level + 1 < 32 ? LevelBitmap & (~0u << (level + 1)) : 0;
+		if (above == 0)
+			return NO_SPACE;
+		const uint32_t found = ULowestBit(above);
+		return (found << OFFSET_ALLOCATOR_SUBDIVISION_BITS) + ULowestBit(BinBitmaps[found]);
+	}
+
+	uint32_t newNode(uint32_t offset, uint32_t size, uint32_t previous, uint32_t next)
+	{
+		const Node node = { offset, size, previous, next, NO_SPACE, NO_SPACE, false };
+		if (!FreeNodes.empty())
+		{
+			const uint32_t index = FreeNodes.back();
+			FreeNodes.pop_back();
+			Nodes[index] = node;
+			return index;
+		}
+		Nodes.push_back(node);
+		return uint32_t(Nodes.size() - 1);
+	}
+
+	void insertFree(uint32_t node)
+	{
+		const uint32_t bin = binOf(Nodes[node].Size);
+		Nodes[node].PreviousFree = NO_SPACE;
+		Nodes[node].NextFree = BinHeads[bin];
+		if (BinHeads[bin] != NO_SPACE)
+			Nodes[BinHeads[bin]].PreviousFree = node;
+		BinHeads[bin] = node;
+		BinBitmaps[bin >> OFFSET_ALLOCATOR_SUBDIVISION_BITS] |= 1u << (bin & ((1u << OFFSET_ALLOCATOR_SUBDIVISION_BITS) - 1));
+		LevelBitmap |= 1u << (bin >> OFFSET_ALLOCATOR_SUBDIVISION_BITS);
+		FreeBytes += Nodes[node].Size;
+	}
+
+	void removeFree(uint32_t node)
+	{
+		const Node& block = Nodes[node];
+		const uint32_t bin = binOf(block.Size);
+		if (block.PreviousFree != NO_SPACE)
+			Nodes[block.PreviousFree].NextFree = block.NextFree;
+		else
+			BinHeads[bin] = block.NextFree;
+		if (block.NextFree != NO_SPACE)
+			Nodes[block.NextFree].PreviousFree = block.PreviousFree;
+		if (BinHeads[bin] == NO_SPACE)
+		{
+			const uint32_t level = bin >> OFFSET_ALLOCATOR_SUBDIVISION_BITS;
+			BinBitmaps[level] &= ~(1u << (bin & ((1u << OFFSET_ALLOCATOR_SUBDIVISION_BITS) - 1)));
+			if (BinBitmaps[level] == 0)
+				LevelBitmap &= ~(1u << level);
+		}
+		FreeBytes -= block.Size;
+	}
+
+	// folds the block after node into it and recycles the follower's entry
+	void absorbNext(uint32_t node)
+	{
+		const uint32_t next = Nodes[node].Next;
+		Nodes[node].Size += Nodes[next].Size;
+		Nodes[node].Next = Nodes[next].Next;
+		if (Nodes[next].Next != NO_SPACE)
+			Nodes[Nodes[next].Next].Previous = node;
+		FreeNodes.push_back(next);
+	}
+};
+#endif
@@ -0,0 +1,338 @@
+#ifndef PARTICLES_H
+#define PARTICLES_H
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "JobSystem.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PARTICLES_SSE2 1
+#endif
+
+// Emitters one step spawns from
+const int PARTICLE_MAX_EMITTERS = 8;
+// Acceleration along y, in units a second squared
+const float PARTICLE_GRAVITY = -9.81f;
+// Fraction of its speed a particle loses to the air in a second, and the fraction of its vertical speed a bounce keeps
+const float PARTICLE_DRAG = 0.2f;
+const float PARTICLE_RESTITUTION = 0.5f;
+// Particles a job of the CPU simulation updates; a multiple of the SIMD width, so only the last batch has a scalar tail
+const uint32_t PARTICLE_BATCH = 16384;
+
+// A fountain. Each particle starts at Position with Velocity plus up to Spread along each axis, and lives between half
+// and one and a half times Life
+struct ParticleEmitter
+{
+	glm::vec3 Position;
+	float Life;                 // mean seconds
+	glm::vec3 Velocity;
+	float Spread;
+	float Rate;                 // particles a second
+	float Carry = 0.0f;         // the part of a particle owed from earlier steps
+};
+
+// One simulation step, run the same way on the GPU (GpuParticles.h) and the CPU: every particle moves by DeltaTime, the
+// ones past their life retire, then the particles the emitters asked for spawn while there is room. Spawn n of the
+// step, counting over the emitters in order, comes from the first emitter whose EmitEnd is above n and gets the id
+// FirstId + n, which seeds all of its randomness, so both simulations spawn exactly the same particles
+struct ParticleStep
+{
+	float DeltaTime = 0.0f;
+	float Gravity = 0.0f;       // change of the vertical velocity over the step
+	float Damping = 1.0f;       // what drag leaves of the velocity over the step
+	float Ground = 0.0f;        // height of the plane particles bounce off
+	uint32_t FirstId = 0;
+	uint32_t EmitterCount = 0;
+	glm::vec4 EmitterPositionLife[PARTICLE_MAX_EMITTERS];
+	glm::vec4 EmitterVelocitySpread[PARTICLE_MAX_EMITTERS];
+	uint32_t EmitEnd[PARTICLE_MAX_EMITTERS];
+
+	uint32_t GetEmitCount() const { return EmitterCount > 0 ? EmitEnd[EmitterCount - 1] : 0; }
+};
+
+// How a simulation compares with a reference one, particles being matched by id
+struct ParticleComparison
+{
+	uint32_t Matched = 0;
+	uint32_t Missing = 0;           // in the reference only
+	uint32_t Extra = 0;             // in the compared simulation only
+	uint32_t AgeMismatches = 0;     // matched particles of different ages
+	float MaxPositionError = 0.0f;
+	float MaxVelocityError = 0.0f;
+};
+
+// The PCG hash (Jarzynski and Olano, "Hash Functions for GPU Rendering"); the GLSL in GpuParticles.h is the same
+inline uint32_t UParticleHash(uint32_t x)
+{
+	const uint32_t state = x * 747796405u + 2891336453u;
+	const uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+// [0, 1) from the top 24 bits of a hash, which a float holds exactly
+inline float UParticleRandom(uint32_t hash)
+{
+	return float(hash >> 8) * (1.0f / 16777216.0f);
+}
+
+// Builds the step that advances the emitters by deltaTime: each spawns the whole particles its rate has earned since
+// the last step, and nextId moves past the ids they get whether or not the simulation finds room for them
+inline void UScheduleParticles(ParticleEmitter* emitters, uint32_t emitterCount, float deltaTime, float ground, uint32_t& nextId, ParticleStep& step)
+{
+	step.DeltaTime = deltaTime;
+	step.Gravity = PARTICLE_GRAVITY * deltaTime;
+	step.Damping = 1.0f / (1.0f + PARTICLE_DRAG * deltaTime);
+	step.Ground = ground;
+	step.FirstId = nextId;
+	step.EmitterCount = std::min(emitterCount, uint32_t(PARTICLE_MAX_EMITTERS));
+	uint32_t count = 0;
+	for (uint32_t e = 0; e < step.EmitterCount; ++e)
+	{
+		ParticleEmitter& emitter = emitters[e];
+		const float owed = emitter.Carry + emitter.Rate * deltaTime;
+		const float whole = std::floor(owed);
+		emitter.Carry = owed - whole;
+		count += uint32_t(whole);
+		step.EmitterPositionLife[e] = glm::vec4(emitter.Position, emitter.Life);
+		step.EmitterVelocitySpread[e] = glm::vec4(emitter.Velocity, emitter.Spread);
+		step.EmitEnd[e] = count;
+	}
+	nextId += count;
+}
+
+// Spawn n of the step
+inline void USpawnParticle(const ParticleStep& step, uint32_t n, glm::vec4& positionAge, glm::vec4& velocityLife, uint32_t& id)
+{
+	uint32_t e = 0;
+	while (e + 1 < step.EmitterCount && n >= step.EmitEnd[e])
+		++e;
+	id = step.FirstId + n;
+	const uint32_t h0 = UParticleHash(id);
+	const uint32_t h1 = UParticleHash(h0);
+	const uint32_t h2 = UParticleHash(h1);
+	const uint32_t h3 = UParticleHash(h2);
+	const glm::vec4& launch = step.EmitterVelocitySpread[e];
+	positionAge = glm::vec4(glm::vec3(step.EmitterPositionLife[e]), 0.0f);
+	velocityLife.x = launch.x + (UParticleRandom(h0) * 2.0f - 1.0f) * launch.w;
+	velocityLife.y = launch.y + (UParticleRandom(h1) * 2.0f - 1.0f) * launch.w;
+	velocityLife.z = launch.z + (UParticleRandom(h2) * 2.0f - 1.0f) * launch.w;
+	velocityLife.w = step.EmitterPositionLife[e].w * (0.5f + UParticleRandom(h3));
+}
+
+
+// The CPU reference simulation. Particles are kept densely as a structure of arrays, so the update runs four particles
+// an SSE2 step over contiguous floats and splits over the job system's threads in batches. Retired particles are
+// replaced by the last living one, which moves one particle per retirement rather than shifting all that follow; the
+// order of the particles is not part of the result, only their ids are
+class ParticleSimulator
+{
+public:
+	void SetJobSystem(JobSystem* jobs) { Jobs = jobs; }
+
+	// drops every particle; at most capacity live at once
+	void Create(uint32_t capacity)
+	{
+		Capacity = capacity;
+		Count = 0;
+		for (std::vector<float>* values : { &PositionX, &PositionY, &PositionZ, &VelocityX, &VelocityY, &VelocityZ, &Age, &Life })
+			values->resize(capacity);
+		Ids.resize(capacity);
+	}
+
+	// replaces the particles with count others, positionAge and velocityLife being laid out as the GPU keeps them.
+	// Those past the capacity are left out
+	void Load(uint32_t count, const glm::vec4* positionAge, const glm::vec4* velocityLife, const uint32_t* ids)
+	{
+		Count = std::min(count, Capacity);
+		for (uint32_t i = 0; i < Count; ++i)
+		{
+			PositionX[i] = positionAge[i].x;
+			PositionY[i] = positionAge[i].y;
+			PositionZ[i] = positionAge[i].z;
+			Age[i] = positionAge[i].w;
+			VelocityX[i] = velocityLife[i].x;
+			VelocityY[i] = velocityLife[i].y;
+			VelocityZ[i] = velocityLife[i].z;
+			Life[i] = velocityLife[i].w;
+			Ids[i] = ids[i];
+		}
+	}
+
+	void Step(const ParticleStep& step)
+	{
+		runParallel("particle update", Count, PARTICLE_BATCH, [this, &step](uint32_t begin, uint32_t end) { update(step, begin, end); });
+		retire();
+
+		const uint32_t spawned = std::min(step.GetEmitCount(), Capacity - Count);
+		for (uint32_t n = 0; n < spawned; ++n)
+		{
+			glm::vec4 positionAge, velocityLife;
+			const uint32_t i = Count + n;
+			USpawnParticle(step, n, positionAge, velocityLife, Ids[i]);
+			PositionX[i] = positionAge.x;
+			PositionY[i] = positionAge.y;
+			PositionZ[i] = positionAge.z;
+			Age[i] = positionAge.w;
+			VelocityX[i] = velocityLife.x;
+			VelocityY[i] = velocityLife.y;
+			VelocityZ[i] = velocityLife.z;
+			Life[i] = velocityLife.w;
+		}
+		Count += spawned;
+	}
+
+	uint32_t GetCount() const { return Count; }
+	uint32_t GetCapacity() const { return Capacity; }
+	uint32_t GetId(uint32_t i) const { return Ids[i]; }
+	glm::vec3 GetPosition(uint32_t i) const { return glm::vec3(PositionX[i], PositionY[i], PositionZ[i]); }
+	glm::vec3 GetVelocity(uint32_t i) const { return glm::vec3(VelocityX[i], VelocityY[i], VelocityZ[i]); }
+	float GetAge(uint32_t i) const { return Age[i]; }
+	float GetLife(uint32_t i) const { return Life[i]; }
+
+private:
+	JobSystem* Jobs = nullptr;
+	uint32_t Capacity = 0;
+	uint32_t Count = 0;
+	std::vector<float> PositionX, PositionY, PositionZ;
+	std::vector<float> VelocityX, VelocityY, VelocityZ;
+	std::vector<float> Age, Life;
+	std::vector<uint32_t> Ids;
+
+	template <typename Fn>
+	void runParallel(const char* name, uint32_t count, uint32_t grain, const Fn& fn)
+	{
+		if (Jobs)
+			Jobs->ParallelFor(name, count, grain, fn);
+		else if (count > 0)
+			fn(0u, count);
+	}
+
+	// velocity, then position, then the bounce off the ground, in the order the compute shader takes them
+	void update(const ParticleStep& step, uint32_t begin, uint32_t end)
+	{
+		uint32_t i = begin;
+#ifdef PARTICLES_SSE2
+		const __m128 dt = _mm_set1_ps(step.DeltaTime);
+		const __m128 gravity = _mm_set1_ps(step.Gravity);
+		const __m128 damping = _mm_set1_ps(step.Damping);
+		const __m128 ground = _mm_set1_ps(step.Ground);
+		const __m128 restitution = _mm_set1_ps(-PARTICLE_RESTITUTION);
+		for (; i + 4 <= end; i += 4)
+		{
+			const __m128 vx = _mm_mul_ps(_mm_loadu_ps(&VelocityX[i]), damping);
+			__m128 vy = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(&VelocityY[i]), gravity), damping);
+			const __m128 vz = _mm_mul_ps(_mm_loadu_ps(&VelocityZ[i]), damping);
+			const __m128 px = _mm_add_ps(_mm_loadu_ps(&PositionX[i]), _mm_mul_ps(vx, dt));
+			__m128 py = _mm_add_ps(_mm_loadu_ps(&PositionY[i]), _mm_mul_ps(vy, dt));
+			const __m128 pz = _mm_add_ps(_mm_loadu_ps(&PositionZ[i]), _mm_mul_ps(vz, dt));
+
+			const __m128 below = _mm_cmplt_ps(py, ground);
+			const __m128 bouncedY = _mm_add_ps(ground, _mm_sub_ps(ground, py));
+			const __m128 bouncedVy = _mm_mul_ps(vy, restitution);
+			py = _mm_or_ps(_mm_and_ps(below, bouncedY), _mm_andnot_ps(below, py));
+			vy = _mm_or_ps(_mm_and_ps(below, bouncedVy), _mm_andnot_ps(below, vy));
+
+			_mm_storeu_ps(&VelocityX[i], vx);
+			_mm_storeu_ps(&VelocityY[i], vy);
+			_mm_storeu_ps(&VelocityZ[i], vz);
+			_mm_storeu_ps(&PositionX[i], px);
+			_mm_storeu_ps(&PositionY[i], py);
+			_mm_storeu_ps(&PositionZ[i], pz);
+			_mm_storeu_ps(&Age[i], _mm_add_ps(_mm_loadu_ps(&Age[i]), dt));
+		}
+#endif
+		for (; i < end; ++i)
+		{
+			VelocityX[i] = VelocityX[i] * step.Damping;
+			VelocityY[i] = (VelocityY[i] + step.Gravity) * step.Damping;
+			VelocityZ[i] = VelocityZ[i] * step.Damping;
+			PositionX[i] = PositionX[i] + VelocityX[i] * step.DeltaTime;
+			PositionY[i] = PositionY[i] + VelocityY[i] * step.DeltaTime;
+			PositionZ[i] = PositionZ[i] + VelocityZ[i] * step.DeltaTime;
+			if (PositionY[i] < step.Ground)
+			{
+				PositionY[i] = step.Ground + (step.Ground - PositionY[i]);
+				VelocityY[i] = VelocityY[i] * -PARTICLE_RESTITUTION;
+			}
+			Age[i] = Age[i] + step.DeltaTime;
+		}
+	}
+
+	// a particle lives while its age is below its life
+	void retire()
+	{
+		uint32_t i = 0, count = Count;
+		while (i < count)
+		{
+			if (Age[i] < Life[i])
+			{
+				++i;
+				continue;
+			}
+			// the last particle takes the place and is looked at next, as it may have retired too
+			--count;
+			PositionX[i] = PositionX[count];
+			PositionY[i] = PositionY[count];
+			PositionZ[i] = PositionZ[count];
+			VelocityX[i] = VelocityX[count];
+			VelocityY[i] = VelocityY[count];
+			VelocityZ[i] = VelocityZ[count];
+			Age[i] = Age[count];
+			Life[i] = Life[count];
+			Ids[i] = Ids[count];
+		}
+		Count = count;
+	}
+};
+
+// Matches the particles of two simulations by id and measures how far the compared one strayed from the reference.
+// Both are expected to have stepped from the same state; floating point contraction on the GPU alone keeps them from
+// agreeing to the bit
+inline ParticleComparison UCompareParticles(const ParticleSimulator& reference, const ParticleSimulator& compared)
+{
+	const auto sortedById = [](const ParticleSimulator& simulation)
+	{
+		std::vector<uint32_t> order(simulation.GetCount());
+		for (uint32_t i = 0; i < simulation.GetCount(); ++i)
+			order[i] = i;
+		std::sort(order.begin(), order.end(), [&simulation](uint32_t a, uint32_t b) { return simulation.GetId(a) < simulation.GetId(b); });
+		return order;
+	};
+	const std::vector<uint32_t> expected = sortedById(reference), actual = sortedById(compared);
+
+	ParticleComparison result;
+	size_t e = 0, a = 0;
+	while (e < expected.size() || a < actual.size())
+	{
+		const uint32_t expectedId = e < expected.size() ? reference.GetId(expected[e]) : UINT32_MAX;
+		const uint32_t actualId = a < actual.size() ? compared.GetId(actual[a]) : UINT32_MAX;
+		if (a == actual.size() || (e < expected.size() && expectedId < actualId))
+		{
+			++result.Missing;
+			++e;
+		}
+		else if (e == expected.size() || actualId < expectedId)
+		{
+			++result.Extra;
+			++a;
+		}
+		else
+		{
+			++result.Matched;
+			const uint32_t i = expected[e++], j = actual[a++];
+			if (reference.GetAge(i) != compared.GetAge(j))
+				++result.AgeMismatches;
+			result.MaxPositionError = std::max(result.MaxPositionError, glm::length(reference.GetPosition(i) - compared.GetPosition(j)));
+			result.MaxVelocityError = std::max(result.MaxVelocityError, glm::length(reference.GetVelocity(i) - compared.GetVelocity(j)));
+		}
+	}
+	return result;
+}
+#endif
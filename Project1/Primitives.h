@@ -0,0 +1,337 @@
+#ifndef PRIMITIVES_H
+#define PRIMITIVES_H
+
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Procedural meshes built at compile time. Every Make* function is constexpr, so
+//     constexpr PrimitiveMesh<24, 36> cube = MakeCube();
+// puts the vertices and indices in read-only data: nothing is generated at startup and GL can upload straight from
+// there. Triangles wind counter-clockwise seen from outside (GL's default front face).
+// Sizes match the hand-made meshes they replace: the cube spans -1..1, the pyramid has a 1 x 1 base on y = 0 and its
+// apex at y = 1, the sphere has radius 1, the cylinder radius 1 from y = -1 to 1 and the plane spans -1..1 in x and z
+// Very fine spheres or planes can run into the compiler's constexpr step limit (MSVC /constexpr:steps, clang
+// -fconstexpr-steps); generate those at runtime instead, the functions work there too
+
+// Every primitive vertex carries all attributes; Interleave keeps only the ones a vertex layout needs
+struct PrimitiveVertex
+{
+	float Position[3] = {};
+	float Normal[3] = {};
+	float Uv[2] = {};
+};
+
+template <size_t VertexCount, size_t IndexCount>
+struct PrimitiveMesh
+{
+	static_assert(VertexCount <= 65536, "primitive indices are 16 bit");
+
+	std::array<PrimitiveVertex, VertexCount> Vertices = {};
+	std::array<uint16_t, IndexCount> Indices = {};
+
+	static constexpr size_t GetVertexCount() { return VertexCount; }
+	static constexpr size_t GetIndexCount() { return IndexCount; }
+};
+
+// Attributes Interleave writes for each vertex, in this order
+enum Primitive_Attribute : unsigned {
+	PRIMITIVE_POSITION = 1,
+	PRIMITIVE_NORMAL = 2,
+	PRIMITIVE_UV = 4
+};
+
+constexpr size_t PrimitiveFloats(unsigned attributes)
+{
+	return ((attributes & PRIMITIVE_POSITION) ? 3 : 0) + ((attributes & PRIMITIVE_NORMAL) ? 3 : 0) + ((attributes & PRIMITIVE_UV) ? 2 : 0);
+}
+
+
+// std::sin and std::sqrt are not constexpr, so the generators use these
+namespace PrimitiveMath
+{
+	constexpr double PI = 3.14159265358979323846;
+
+	constexpr double Sin(double x)
+	{
+		// into [-pi, pi], where 13 terms of the series are exact to double precision
+		const double turns = x / (2.0 * PI);
+		const long long whole = (long long)(turns < 0.0 ? turns - 0.5 : turns + 0.5);
+		x -= double(whole) * 2.0 * PI;
+		double term = x, sum = x;
+		for (int n = 1; n < 13; ++n)
+		{
+			term *= -x * x / double((2 * n) * (2 * n + 1));
+			sum += term;
+		}
+		return sum;
+	}
+
+	constexpr double Cos(double x)
+	{
+		return Sin(x + PI * 0.5);
+	}
+
+	constexpr double Sqrt(double x)
+	{
+		if (x <= 0.0)
+			return 0.0;
+		double guess = x < 1.0 ? 1.0 : x;
+		for (int i = 0; i < 64; ++i)
+		{
+			const double next = 0.5 * (guess + x / guess);
+			if (next == guess)
+				break;
+			guess = next;
+		}
+		return guess;
+	}
+}
+
+
+constexpr PrimitiveVertex MakePrimitiveVertex(double x, double y, double z, double nx, double ny, double nz, double u, double v)
+{
+	PrimitiveVertex vertex;
+	vertex.Position[0] = float(x);
+	vertex.Position[1] = float(y);
+	vertex.Position[2] = float(z);
+	vertex.Normal[0] = float(nx);
+	vertex.Normal[1] = float(ny);
+	vertex.Normal[2] = float(nz);
+	vertex.Uv[0] = float(u);
+	vertex.Uv[1] = float(v);
+	return vertex;
+}
+
+// Four vertices per face so every face has its own normal and a full 0..1 UV square
+constexpr PrimitiveMesh<24, 36> MakeCube()
+{
+	// normal, then the two in-face axes u and v with cross(u, v) == normal
+	const double faces[6][9] = {
+		{  1, 0, 0,    0, 0, -1,   0, 1, 0 },
+		{ -1, 0, 0,    0, 0, 1,    0, 1, 0 },
+		{  0, 1, 0,    1, 0, 0,    0, 0, -1 },
+		{  0, -1, 0,   1, 0, 0,    0, 0, 1 },
+		{  0, 0, 1,    1, 0, 0,    0, 1, 0 },
+		{  0, 0, -1,  -1, 0, 0,    0, 1, 0 }
+	};
+	const double corners[4][2] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 } };
+
+	PrimitiveMesh<24, 36> mesh;
+	for (int face = 0; face < 6; ++face)
+	{
+		const double* f = faces[face];
+		for (int corner = 0; corner < 4; ++corner)
+		{
+			const double a = corners[corner][0], b = corners[corner][1];
+			mesh.Vertices[face * 4 + corner] = MakePrimitiveVertex(
+				f[0] + a * f[3] + b * f[6], f[1] + a * f[4] + b * f[7], f[2] + a * f[5] + b * f[8],
+				f[0], f[1], f[2], (a + 1.0) * 0.5, (b + 1.0) * 0.5);
+		}
+		const uint16_t base = uint16_t(face * 4);
+		const uint16_t quad[6] = { 0, 1, 2, 0, 2, 3 };
+		for (int i = 0; i < 6; ++i)
+			mesh.Indices[face * 6 + i] = uint16_t(base + quad[i]);
+	}
+	return mesh;
+}
+
+// Square base and four triangular sides, each with its own vertices for flat normals
+constexpr PrimitiveMesh<16, 18> MakePyramid()
+{
+	PrimitiveMesh<16, 18> mesh;
+	const double base[4][2] = { { -0.5, -0.5 }, { 0.5, -0.5 }, { 0.5, 0.5 }, { -0.5, 0.5 } };
+
+	// the base faces down, so it winds clockwise seen from above
+	for (int corner = 0; corner < 4; ++corner)
+		mesh.Vertices[corner] = MakePrimitiveVertex(base[corner][0], 0, base[corner][1], 0, -1, 0, base[corner][0] + 0.5, base[corner][1] + 0.5);
+	const uint16_t bottom[6] = { 0, 1, 2, 0, 2, 3 };
+	for (int i = 0; i < 6; ++i)
+		mesh.Indices[i] = bottom[i];
+
+	for (int side = 0; side < 4; ++side)
+	{
+		// corners taken in the opposite order to the base, so the sides wind counter-clockwise from outside
+		const double* a = base[(side + 1) % 4];
+		const double* b = base[side];
+		// cross(b - a, apex - a) for the apex at (0, 1, 0)
+		const double ex = b[0] - a[0], ez = b[1] - a[1];
+		const double fx = -a[0], fy = 1.0, fz = -a[1];
+		double nx = -ez * fy, ny = ez * fx - ex * fz, nz = ex * fy;
+		const double length = PrimitiveMath::Sqrt(nx * nx + ny * ny + nz * nz);
+		nx /= length;
+		ny /= length;
+		nz /= length;
+
+		const int first = 4 + side * 3;
+		mesh.Vertices[first] = MakePrimitiveVertex(a[0], 0, a[1], nx, ny, nz, 0, 0);
+		mesh.Vertices[first + 1] = MakePrimitiveVertex(b[0], 0, b[1], nx, ny, nz, 1, 0);
+		mesh.Vertices[first + 2] = MakePrimitiveVertex(0, 1, 0, nx, ny, nz, 0.5, 1);
+		for (int i = 0; i < 3; ++i)
+			mesh.Indices[6 + side * 3 + i] = uint16_t(first + i);
+	}
+	return mesh;
+}
+
+// Latitude and longitude grid. The seam column is duplicated so UVs wrap cleanly; the pole rows collapse to a point
+template <int Slices, int Stacks>
+constexpr PrimitiveMesh<(Slices + 1) * (Stacks + 1), Slices * Stacks * 6> MakeSphere()
+{
+	static_assert(Slices >= 3 && Stacks >= 2, "a sphere needs at least 3 slices and 2 stacks");
+	PrimitiveMesh<(Slices + 1) * (Stacks + 1), Slices * Stacks * 6> mesh;
+	for (int stack = 0; stack <= Stacks; ++stack)
+	{
+		const double polar = PrimitiveMath::PI * double(stack) / double(Stacks);
+		const double ring = PrimitiveMath::Sin(polar), y = PrimitiveMath::Cos(polar);
+		for (int slice = 0; slice <= Slices; ++slice)
+		{
+			const double azimuth = 2.0 * PrimitiveMath::PI * double(slice) / double(Slices);
+			const double x = ring * PrimitiveMath::Cos(azimuth), z = -ring * PrimitiveMath::Sin(azimuth);
+			mesh.Vertices[stack * (Slices + 1) + slice] = MakePrimitiveVertex(x, y, z, x, y, z,
+				double(slice) / double(Slices), 1.0 - double(stack) / double(Stacks));
+		}
+	}
+
+	size_t index = 0;
+	for (int stack = 0; stack < Stacks; ++stack)
+	{
+		for (int slice = 0; slice < Slices; ++slice)
+		{
+			const uint16_t upper = uint16_t(stack * (Slices + 1) + slice);
+			const uint16_t lower = uint16_t(upper + Slices + 1);
+			const uint16_t quad[6] = { upper, lower, uint16_t(lower + 1), upper, uint16_t(lower + 1), uint16_t(upper + 1) };
+			for (uint16_t corner : quad)
+				mesh.Indices[index++] = corner;
+		}
+	}
+	return mesh;
+}
+
+// Open tube plus two capped ends (each a fan around a centre vertex), with hard edges between the tube and the caps
+template <int Slices>
+constexpr PrimitiveMesh<(Slices + 1) * 2 + (Slices + 2) * 2, Slices * 12> MakeCylinder()
+{
+	static_assert(Slices >= 3, "a cylinder needs at least 3 slices");
+	PrimitiveMesh<(Slices + 1) * 2 + (Slices + 2) * 2, Slices * 12> mesh;
+
+	// the tube: a bottom and a top vertex per slice, the seam duplicated
+	for (int slice = 0; slice <= Slices; ++slice)
+	{
+		const double azimuth = 2.0 * PrimitiveMath::PI * double(slice) / double(Slices);
+		const double x = PrimitiveMath::Cos(azimuth), z = -PrimitiveMath::Sin(azimuth);
+		const double u = double(slice) / double(Slices);
+		mesh.Vertices[slice * 2] = MakePrimitiveVertex(x, -1, z, x, 0, z, u, 0);
+		mesh.Vertices[slice * 2 + 1] = MakePrimitiveVertex(x, 1, z, x, 0, z, u, 1);
+	}
+
+	size_t index = 0;
+	for (int slice = 0; slice < Slices; ++slice)
+	{
+		const uint16_t bottom = uint16_t(slice * 2);
+		const uint16_t quad[6] = { bottom, uint16_t(bottom + 2), uint16_t(bottom + 3), bottom, uint16_t(bottom + 3), uint16_t(bottom + 1) };
+		for (uint16_t corner : quad)
+			mesh.Indices[index++] = corner;
+	}
+
+	// the caps: centre first, then the rim, UVs mapped from above
+	for (int cap = 0; cap < 2; ++cap)
+	{
+		const double y = cap == 0 ? -1.0 : 1.0;
+		const uint16_t centre = uint16_t((Slices + 1) * 2 + cap * (Slices + 2));
+		mesh.Vertices[centre] = MakePrimitiveVertex(0, y, 0, 0, y, 0, 0.5, 0.5);
+		for (int slice = 0; slice <= Slices; ++slice)
+		{
+			const double azimuth = 2.0 * PrimitiveMath::PI * double(slice) / double(Slices);
+			const double x = PrimitiveMath::Cos(azimuth), z = -PrimitiveMath::Sin(azimuth);
+			mesh.Vertices[centre + 1 + slice] = MakePrimitiveVertex(x, y, z, 0, y, 0, x * 0.5 + 0.5, z * 0.5 + 0.5);
+		}
+		for (int slice = 0; slice < Slices; ++slice)
+		{
+			const uint16_t rim = uint16_t(centre + 1 + slice);
+			// the rim runs counter-clockwise seen from above, which is the top cap's front
+			mesh.Indices[index++] = centre;
+			mesh.Indices[index++] = cap == 0 ? uint16_t(rim + 1) : rim;
+			mesh.Indices[index++] = cap == 0 ? rim : uint16_t(rim + 1);
+		}
+	}
+	return mesh;
+}
+
+// Flat grid of Divisions x Divisions quads on y = 0, facing up
+template <int Divisions>
+constexpr PrimitiveMesh<(Divisions + 1) * (Divisions + 1), Divisions * Divisions * 6> MakePlane()
+{
+	static_assert(Divisions >= 1, "a plane needs at least one division");
+	PrimitiveMesh<(Divisions + 1) * (Divisions + 1), Divisions * Divisions * 6> mesh;
+	for (int row = 0; row <= Divisions; ++row)
+	{
+		for (int column = 0; column <= Divisions; ++column)
+		{
+			const double u = double(column) / double(Divisions), v = double(row) / double(Divisions);
+			mesh.Vertices[row * (Divisions + 1) + column] = MakePrimitiveVertex(u * 2.0 - 1.0, 0, 1.0 - v * 2.0, 0, 1, 0, u, v);
+		}
+	}
+
+	size_t index = 0;
+	for (int row = 0; row < Divisions; ++row)
+	{
+		for (int column = 0; column < Divisions; ++column)
+		{
+			const uint16_t front = uint16_t(row * (Divisions + 1) + column);
+			const uint16_t back = uint16_t(front + Divisions + 1);
+			const uint16_t quad[6] = { front, uint16_t(front + 1), uint16_t(back + 1), front, uint16_t(back + 1), back };
+			for (uint16_t corner : quad)
+				mesh.Indices[index++] = corner;
+		}
+	}
+	return mesh;
+}
+
+
+// Packs the chosen attributes of every vertex into one float array, ready for glBufferData
+template <unsigned Attributes, size_t VertexCount, size_t IndexCount>
+constexpr std::array<float, VertexCount * PrimitiveFloats(Attributes)> Interleave(const PrimitiveMesh<VertexCount, IndexCount>& mesh)
+{
+	std::array<float, VertexCount * PrimitiveFloats(Attributes)> floats = {};
+	size_t at = 0;
+	for (const PrimitiveVertex& vertex : mesh.Vertices)
+	{
+		if (Attributes & PRIMITIVE_POSITION)
+		{
+			for (int i = 0; i < 3; ++i)
+				floats[at++] = vertex.Position[i];
+		}
+		if (Attributes & PRIMITIVE_NORMAL)
+		{
+			for (int i = 0; i < 3; ++i)
+				floats[at++] = vertex.Normal[i];
+		}
+		if (Attributes & PRIMITIVE_UV)
+		{
+			for (int i = 0; i < 2; ++i)
+				floats[at++] = vertex.Uv[i];
+		}
+	}
+	return floats;
+}
+
+// The same, followed by Extra floats per vertex that extra(vertex) returns as a std::array<float, Extra>: a color or
+// material slot picked from the position, for instance. extra must be usable in a constant expression (a lambda is)
+template <unsigned Attributes, size_t Extra, size_t VertexCount, size_t IndexCount, typename Fn>
+constexpr std::array<float, VertexCount * (PrimitiveFloats(Attributes) + Extra)> Interleave(const PrimitiveMesh<VertexCount, IndexCount>& mesh, Fn extra)
+{
+	const std::array<float, VertexCount * PrimitiveFloats(Attributes)> base = Interleave<Attributes>(mesh);
+	std::array<float, VertexCount * (PrimitiveFloats(Attributes) + Extra)> floats = {};
+	size_t at = 0;
+	for (size_t vertex = 0; vertex < VertexCount; ++vertex)
+	{
+		for (size_t i = 0; i < PrimitiveFloats(Attributes); ++i)
+			floats[at++] = base[vertex * PrimitiveFloats(Attributes) + i];
+		const std::array<float, Extra> added = extra(mesh.Vertices[vertex]);
+		for (size_t i = 0; i < Extra; ++i)
+			floats[at++] = added[i];
+	}
+	return floats;
+}
+#endif
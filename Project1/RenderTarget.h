@@ -0,0 +1,98 @@
+#ifndef RENDER_TARGET_H
+#define RENDER_TARGET_H
+
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include <GL/glew.h>
+
+#include "GpuMemory.h"
+
+// Offscreen color and depth buffers the scene renders into at a fraction of the window size, stretched onto the window
+// afterwards. Storage is sized for the largest scale once per window size, so a new scale only moves the viewport and
+// never reallocates. Depth is 32 bit float, which reversed-Z needs to keep its precision far from the camera
+class ScaledRenderTarget
+{
+public:
+	// returns false when the driver cannot render to the buffers
+	bool Create(int windowWidth, int windowHeight, float maxScale)
+	{
+		MaxScale = maxScale;
+		glGenFramebuffers(1, &Framebuffer);
+		glGenRenderbuffers(1, &Color);
+		glGenRenderbuffers(1, &Depth);
+		return Resize(windowWidth, windowHeight);
+	}
+
+	void Destroy()
+	{
+		glDeleteFramebuffers(1, &Framebuffer);
+		UDeleteRenderbuffers(1, &Color);
+		UDeleteRenderbuffers(1, &Depth);
+		Framebuffer = Color = Depth = 0;
+	}
+
+	// call when the window changed size; does nothing if it did not
+	bool Resize(int windowWidth, int windowHeight)
+	{
+		if (windowWidth == WindowWidth && windowHeight == WindowHeight)
+			return true;
+		WindowWidth = std::max(1, windowWidth);
+		WindowHeight = std::max(1, windowHeight);
+		StorageWidth = std::max(1, int(std::ceil(float(WindowWidth) * MaxScale)));
+		StorageHeight = std::max(1, int(std::ceil(float(WindowHeight) * MaxScale)));
+
+		glBindRenderbuffer(GL_RENDERBUFFER, Color);
+		URenderbufferStorage(Color, GL_RGBA8, StorageWidth, StorageHeight, "render target");
+		glBindRenderbuffer(GL_RENDERBUFFER, Depth);
+		URenderbufferStorage(Depth, GL_DEPTH_COMPONENT32F, StorageWidth, StorageHeight, "render target");
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, Framebuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, Color);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, Depth);
+		const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		if (status != GL_FRAMEBUFFER_COMPLETE)
+		{
+			std::cout << "ERROR::FRAMEBUFFER::INCOMPLETE " << std::hex << status << std::dec << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	// binds the target with a viewport of scale times the window size (scale is clamped to the largest it was created for)
+	void Bind(float scale)
+	{
+		scale = std::min(scale, MaxScale);
+		RenderWidth = std::min(StorageWidth, std::max(1, int(std::lround(float(WindowWidth) * scale))));
+		RenderHeight = std::min(StorageHeight, std::max(1, int(std::lround(float(WindowHeight) * scale))));
+		glBindFramebuffer(GL_FRAMEBUFFER, Framebuffer);
+		glViewport(0, 0, RenderWidth, RenderHeight);
+	}
+
+	// stretches what was rendered since Bind over the whole window, then leaves the window bound with its own viewport
+	void Present()
+	{
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, Framebuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glBlitFramebuffer(0, 0, RenderWidth, RenderHeight, 0, 0, WindowWidth, WindowHeight, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(0, 0, WindowWidth, WindowHeight);
+	}
+
+	int GetRenderWidth() const { return RenderWidth; }
+	int GetRenderHeight() const { return RenderHeight; }
+
+private:
+	GLuint Framebuffer = 0;
+	GLuint Color = 0;
+	GLuint Depth = 0;
+	float MaxScale = 1.0f;
+	int WindowWidth = 0, WindowHeight = 0;
+	int StorageWidth = 0, StorageHeight = 0;
+	int RenderWidth = 0, RenderHeight = 0;
+};
+#endif
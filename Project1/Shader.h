@@ -0,0 +1,60 @@
+#ifndef SHADER_H
+#define SHADER_H
+
+
+#include <iostream>
+
+#include <GL/glew.h>
+
+#include "GpuMemory.h"
+
+// Compiles a single shader stage and prints the info log if it fails. stageName is only used in the message
+inline bool UCompileShader(GLenum type, const char* source, const char* stageName, GLuint& shaderId)
+{
+	int success = 0;
+	char infoLog[512];
+
+	shaderId = glCreateShader(type);
+	glShaderSource(shaderId, 1, &source, NULL);
+	glCompileShader(shaderId);
+	glGetShaderiv(shaderId, GL_COMPILE_STATUS, &success);
+	if (!success)
+	{
+		glGetShaderInfoLog(shaderId, sizeof(infoLog), NULL, infoLog);
+		std::cout << "ERROR::SHADER::" << stageName << "::COMPILATION_FAILED\n" << infoLog << std::endl;
+		glDeleteShader(shaderId);
+		shaderId = 0;
+		return false;
+	}
+	return true;
+}
+
+// Links a program from one compute shader and records it under owner
+inline bool UCreateComputeProgram(const char* computeSource, GLuint& programId, const char* owner)
+{
+	int success = 0;
+	char infoLog[512];
+
+	GLuint computeShaderId;
+	if (!UCompileShader(GL_COMPUTE_SHADER, computeSource, "COMPUTE", computeShaderId))
+		return false;
+
+	programId = glCreateProgram();
+	glAttachShader(programId, computeShaderId);
+	glLinkProgram(programId);
+	// the program keeps the compiled code; the shader object is no longer needed
+	glDeleteShader(computeShaderId);
+
+	glGetProgramiv(programId, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
+		std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+		glDeleteProgram(programId);
+		programId = 0;
+		return false;
+	}
+	UTrackProgram(programId, owner);
+	return true;
+}
+#endif
@@ -12,6 +12,65 @@
 // OBJ_Loader - .obj Loader
 #include "OBJ_Loader.h"
 
+// TextureFile - KTX2/DDS headers, to check the texture maps can be streamed
+#include "TextureFile.h"
+
+// MeshNormals - smooth normals and tangents, for meshes whose file has none or inconsistent ones
+#include "MeshNormals.h"
+
+// Material - the material table the renderer's shaders read, packed from the file's materials
+#include "Material.h"
+
+// Writes what the renderer would stream for a texture map: format, size and mip levels
+void PrintTextureMap(std::ofstream& file, const char* label, const std::string& path)
+{
+	file << label << path;
+	TextureFile texture;
+	if (!path.empty() && UReadTextureHeader(path, texture))
+		file << " (" << texture.FormatName << ", " << texture.Width << "x" << texture.Height << ", " << texture.Levels.size() << " levels)";
+	file << "\n";
+}
+
+// Writes where a material landed in the material table and the four vec4s the shaders read for it
+void PrintPackedMaterial(std::ofstream& file, const MaterialTable& materials, const std::string& name)
+{
+	const uint32_t index = materials.Find(name);
+	if (index == NO_MATERIAL)
+	{
+		file << "Material Table Index: none\n";
+		return;
+	}
+	const Material& material = materials.Get(index);
+	file << "Material Table Index: " << index << "\n";
+	for (const glm::vec4* field : { &material.Ambient, &material.Diffuse, &material.Specular, &material.Params })
+		file << "  (" << field->x << ", " << field->y << ", " << field->z << ", " << field->w << ")\n";
+}
+
+// Writes the normals and tangents generated for a mesh, whatever normals its file had: position, normal and texture
+// coordinate of each loaded vertex are copied out as 8 floats
+void PrintTangentSpace(std::ofstream& file, const objl::Mesh& mesh)
+{
+	std::vector<float> vertices;
+	for (const objl::Vertex& vertex : mesh.Vertices)
+	{
+		vertices.insert(vertices.end(), { vertex.Position.X, vertex.Position.Y, vertex.Position.Z, vertex.Normal.X, vertex.Normal.Y, vertex.Normal.Z,
+			vertex.TextureCoordinate.X, vertex.TextureCoordinate.Y });
+	}
+	TangentSpaceGenerator generator;
+	TangentSpaceMesh tangentSpace;
+	generator.Generate(vertices.data(), uint32_t(mesh.Vertices.size()), 8, 6, mesh.Indices.data(), mesh.Indices.size(), MESH_DEFAULT_CREASE_ANGLE, tangentSpace);
+
+	file << "Generated Tangent Space (" << tangentSpace.Source.size() << " vertices):\n";
+	for (size_t j = 0; j < tangentSpace.Source.size(); j++)
+	{
+		const glm::vec3& normal = tangentSpace.Normals[j];
+		const glm::vec4& tangent = tangentSpace.Tangents[j];
+		file << "S" << j << ": V" << tangentSpace.Source[j] << " " <<
+			"N(" << normal.x << ", " << normal.y << ", " << normal.z << ") " <<
+			"T(" << tangent.x << ", " << tangent.y << ", " << tangent.z << ", " << tangent.w << ")\n";
+	}
+}
+
 // Main function
 int main(int argc, char* argv[])
 {
@@ -29,6 +88,11 @@ int main(int argc, char* argv[])
 		// Create/Open e1Out.txt
 		std::ofstream file("e1Out.txt");
 
+		// Pack every material the file defines into a material table, as the renderer would upload it
+		MaterialTable materials;
+		for (const objl::Material& material : Loader.LoadedMaterials)
+			materials.Add(material.name, UMaterialFromObj(material));
+
 		// Go through each loaded mesh and out its contents
 		for (int i = 0; i < Loader.LoadedMeshes.size(); i++)
 		{
@@ -61,6 +125,9 @@ int main(int argc, char* argv[])
 				file << "T" << j / 3 << ": " << curMesh.Indices[j] << ", " << curMesh.Indices[j + 1] << ", " << curMesh.Indices[j + 2] << "\n";
 			}
 
+			// Print the normals and tangents generated for it
+			PrintTangentSpace(file, curMesh);
+
 			// Print Material
 			file << "Material: " << curMesh.MeshMaterial.name << "\n";
 			file << "Ambient Color: " << curMesh.MeshMaterial.Ka.X << ", " << curMesh.MeshMaterial.Ka.Y << ", " << curMesh.MeshMaterial.Ka.Z << "\n";
@@ -70,11 +137,12 @@ int main(int argc, char* argv[])
 			file << "Optical Density: " << curMesh.MeshMaterial.Ni << "\n";
 			file << "Dissolve: " << curMesh.MeshMaterial.d << "\n";
 			file << "Illumination: " << curMesh.MeshMaterial.illum << "\n";
-			file << "Ambient Texture Map: " << curMesh.MeshMaterial.map_Ka << "\n";
-			file << "Diffuse Texture Map: " << curMesh.MeshMaterial.map_Kd << "\n";
-			file << "Specular Texture Map: " << curMesh.MeshMaterial.map_Ks << "\n";
-			file << "Alpha Texture Map: " << curMesh.MeshMaterial.map_d << "\n";
-			file << "Bump Map: " << curMesh.MeshMaterial.map_bump << "\n";
+			PrintPackedMaterial(file, materials, curMesh.MeshMaterial.name);
+			PrintTextureMap(file, "Ambient Texture Map: ", curMesh.MeshMaterial.map_Ka);
+			PrintTextureMap(file, "Diffuse Texture Map: ", curMesh.MeshMaterial.map_Kd);
+			PrintTextureMap(file, "Specular Texture Map: ", curMesh.MeshMaterial.map_Ks);
+			PrintTextureMap(file, "Alpha Texture Map: ", curMesh.MeshMaterial.map_d);
+			PrintTextureMap(file, "Bump Map: ", curMesh.MeshMaterial.map_bump);
 
 			// Leave a space to separate from the next mesh
 			file << "\n";
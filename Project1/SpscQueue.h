@@ -0,0 +1,62 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+
+#include <atomic>
+#include <cstddef>
+
+// Bounded lock-free ring buffer for exactly one producer thread and one consumer thread.
+// Neither side blocks or allocates; Push fails when the queue is full and Pop fails when it is empty.
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+	static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+public:
+	// producer side
+	bool Push(const T& item)
+	{
+		const size_t tail = Tail.load(std::memory_order_relaxed);
+		if (tail - HeadCache == Capacity)
+		{
+			// looks full; refresh our view of the consumer before giving up
+			HeadCache = Head.load(std::memory_order_acquire);
+			if (tail - HeadCache == Capacity)
+				return false;
+		}
+		Items[tail & (Capacity - 1)] = item;
+		Tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// consumer side
+	bool Pop(T& item)
+	{
+		const size_t head = Head.load(std::memory_order_relaxed);
+		if (head == TailCache)
+		{
+			TailCache = Tail.load(std::memory_order_acquire);
+			if (head == TailCache)
+				return false;
+		}
+		item = Items[head & (Capacity - 1)];
+		Head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	// only a hint when called while the other side is running
+	size_t SizeApprox() const
+	{
+		return Tail.load(std::memory_order_acquire) - Head.load(std::memory_order_acquire);
+	}
+
+private:
+	// head and tail live on separate cache lines so the two threads do not false-share;
+	// each side also keeps a cached copy of the other's index to avoid touching its line on every call
+	alignas(64) std::atomic<size_t> Head{ 0 };
+	size_t TailCache = 0;
+	alignas(64) std::atomic<size_t> Tail{ 0 };
+	size_t HeadCache = 0;
+	alignas(64) T Items[Capacity];
+};
+#endif
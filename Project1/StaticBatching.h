@@ -0,0 +1,218 @@
+#ifndef STATIC_BATCHING_H
+#define STATIC_BATCHING_H
+
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Bounds.h"
+
+// World space size of one side of a batching cell, and the most vertices one batch can address with 16 bit indices
+const float STATIC_CELL_SIZE = 8.0f;
+const uint32_t STATIC_BATCH_VERTICES = 65536;
+
+
+// A mesh as the batcher reads it: interleaved float vertices whose first three floats are the model space position, and
+// optionally three more at NormalOffset that are its normal. The position and normal are transformed; every other float
+// is copied as it is, so a layout with tangents would need them transformed as well before it can be batched
+struct StaticMesh
+{
+	const float* Vertices;
+	uint32_t VertexCount;
+	uint32_t FloatsPerVertex;
+	const uint16_t* Indices;
+	uint32_t IndexCount;
+	uint32_t NormalOffset = 0;  // 0 when the vertices have no normal
+};
+
+// Static instances of one group that fall in one cell, merged into a single world space mesh drawn with an identity
+// model matrix
+struct StaticBatch
+{
+	uint32_t Group;                     // the caller's draw state (material, texture...) every instance here shares
+	glm::ivec3 Cell;                    // counted from the lowest corner of the scenery, not the world origin
+	Aabb Bounds;                        // world space, around the merged vertices
+	uint32_t FloatsPerVertex;
+	std::vector<float> Vertices;
+	std::vector<uint16_t> Indices;
+	std::vector<uint32_t> Instances;    // what Add returned for each instance merged here
+};
+
+// What the last Build did
+struct StaticBatchStats
+{
+	int Instances = 0;
+	int Batches = 0;
+	int Vertices = 0;
+	int Triangles = 0;
+	double Milliseconds = 0.0;
+};
+
+
+// Merges scenery that never moves into as few draws as possible. Instances are queued with the mesh, model matrix and
+// draw group they would be drawn with; Build splits them by group and by the grid cell their bounds' centre falls in,
+// and concatenates each split into one world space mesh. Splitting by cell keeps every batch spatially compact, so
+// culling its bounds still discards scenery out of view. The grid starts at the lowest centre queued rather than at
+// the world origin, so scenery smaller than a cell is never cut in two. A cell that would pass STATIC_BATCH_VERTICES is
+// carried on in another batch
+class StaticBatcher
+{
+public:
+	explicit StaticBatcher(float cellSize = STATIC_CELL_SIZE) : CellSize(cellSize) {}
+
+	// forgets the queued instances and the batches built from them
+	void Clear()
+	{
+		Queued.clear();
+		Batches.clear();
+		Stats = StaticBatchStats();
+	}
+
+	// queues one instance and returns its index. The mesh's arrays must stay alive until Build
+	uint32_t Add(const StaticMesh& mesh, const glm::mat4& model, uint32_t group)
+	{
+		assert(mesh.FloatsPerVertex >= 3 && mesh.VertexCount <= STATIC_BATCH_VERTICES);
+		Aabb bounds;
+		for (uint32_t v = 0; v < mesh.VertexCount; ++v)
+		{
+			const float* position = mesh.Vertices + size_t(v) * mesh.FloatsPerVertex;
+			bounds.Grow(glm::vec3(position[0], position[1], position[2]));
+		}
+		Queued.push_back({ mesh, model, group, TransformAabb(bounds, model).Center(), glm::ivec3() });
+		return uint32_t(Queued.size() - 1);
+	}
+
+	// merges everything queued since the last Clear
+	void Build()
+	{
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		Batches.clear();
+
+		glm::vec3 origin(FLT_MAX);
+		for (const Instance& instance : Queued)
+			origin = glm::min(origin, instance.Center);
+		for (Instance& instance : Queued)
+		{
+			const glm::vec3 cell = glm::floor((instance.Center - origin) / CellSize);
+			instance.Cell = glm::ivec3(int(cell.x), int(cell.y), int(cell.z));
+		}
+
+		// group, then cell, then the order the instances came in, so the same scene always gives the same batches
+		std::vector<uint32_t> order(Queued.size());
+		for (uint32_t i = 0; i < uint32_t(order.size()); ++i)
+			order[i] = i;
+		std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b)
+		{
+			const Instance& x = Queued[a];
+			const Instance& y = Queued[b];
+			if (x.Group != y.Group)
+				return x.Group < y.Group;
+			if (x.Cell.x != y.Cell.x)
+				return x.Cell.x < y.Cell.x;
+			if (x.Cell.y != y.Cell.y)
+				return x.Cell.y < y.Cell.y;
+			if (x.Cell.z != y.Cell.z)
+				return x.Cell.z < y.Cell.z;
+			return a < b;
+		});
+
+		for (uint32_t index : order)
+		{
+			const Instance& instance = Queued[index];
+			const StaticMesh& mesh = instance.Mesh;
+			if (Batches.empty() || !fits(Batches.back(), instance))
+			{
+				Batches.push_back(StaticBatch());
+				StaticBatch& batch = Batches.back();
+				batch.Group = instance.Group;
+				batch.Cell = instance.Cell;
+				batch.FloatsPerVertex = mesh.FloatsPerVertex;
+			}
+			merge(Batches.back(), instance);
+			Batches.back().Instances.push_back(index);
+		}
+
+		Stats = StaticBatchStats();
+		Stats.Instances = int(Queued.size());
+		Stats.Batches = int(Batches.size());
+		for (const StaticBatch& batch : Batches)
+		{
+			Stats.Vertices += int(batch.Vertices.size() / batch.FloatsPerVertex);
+			Stats.Triangles += int(batch.Indices.size() / 3);
+		}
+		Stats.Milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	const std::vector<StaticBatch>& GetBatches() const { return Batches; }
+	const StaticBatchStats& GetStats() const { return Stats; }
+	float GetCellSize() const { return CellSize; }
+
+private:
+	struct Instance
+	{
+		StaticMesh Mesh;
+		glm::mat4 Model;
+		uint32_t Group;
+		glm::vec3 Center;   // of the world space bounds
+		glm::ivec3 Cell;
+	};
+
+	float CellSize;
+	std::vector<Instance> Queued;
+	std::vector<StaticBatch> Batches;
+	StaticBatchStats Stats;
+
+	bool fits(const StaticBatch& batch, const Instance& instance) const
+	{
+		const size_t vertices = batch.Vertices.size() / batch.FloatsPerVertex;
+		return batch.Group == instance.Group && batch.Cell.x == instance.Cell.x && batch.Cell.y == instance.Cell.y && batch.Cell.z == instance.Cell.z
+			&& batch.FloatsPerVertex == instance.Mesh.FloatsPerVertex && vertices + instance.Mesh.VertexCount <= STATIC_BATCH_VERTICES;
+	}
+
+	// appends the instance's vertices in world space and its indices rebased past the ones already there
+	void merge(StaticBatch& batch, const Instance& instance)
+	{
+		const StaticMesh& mesh = instance.Mesh;
+		const glm::mat4& model = instance.Model;
+		const uint32_t base = uint32_t(batch.Vertices.size() / batch.FloatsPerVertex);
+		// normals go through the inverse transpose, so they stay perpendicular to surfaces scaled unevenly
+		const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
+
+		for (uint32_t v = 0; v < mesh.VertexCount; ++v)
+		{
+			const float* source = mesh.Vertices + size_t(v) * mesh.FloatsPerVertex;
+			const glm::vec3 position = glm::vec3(model * glm::vec4(source[0], source[1], source[2], 1.0f));
+			batch.Bounds.Grow(position);
+			batch.Vertices.push_back(position.x);
+			batch.Vertices.push_back(position.y);
+			batch.Vertices.push_back(position.z);
+			batch.Vertices.insert(batch.Vertices.end(), source + 3, source + mesh.FloatsPerVertex);
+			if (mesh.NormalOffset > 0)
+			{
+				const float* normal = source + mesh.NormalOffset;
+				const glm::vec3 transformed = normalMatrix * glm::vec3(normal[0], normal[1], normal[2]);
+				const float length = glm::length(transformed);
+				float* written = &batch.Vertices[batch.Vertices.size() - mesh.FloatsPerVertex + mesh.NormalOffset];
+				for (int k = 0; k < 3; ++k)
+					written[k] = length > 0.0f ? transformed[k] / length : 0.0f;
+			}
+		}
+
+		// a mirroring matrix turns the triangles inside out; swap two corners to keep them facing the same way
+		const glm::vec3 x(model[0]), y(model[1]), z(model[2]);
+		const bool mirrored = glm::dot(glm::cross(x, y), z) < 0.0f;
+		for (uint32_t i = 0; i + 2 < mesh.IndexCount; i += 3)
+		{
+			batch.Indices.push_back(uint16_t(base + mesh.Indices[i]));
+			batch.Indices.push_back(uint16_t(base + mesh.Indices[mirrored ? i + 2 : i + 1]));
+			batch.Indices.push_back(uint16_t(base + mesh.Indices[mirrored ? i + 1 : i + 2]));
+		}
+	}
+};
+#endif
@@ -0,0 +1,299 @@
+#ifndef TEXTURE_FILE_H
+#define TEXTURE_FILE_H
+
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+// The largest side GL 4.1 guarantees a texture can have; headers claiming more are taken as corrupt
+const uint32_t TEXTURE_MAX_SIZE = 16384;
+
+// Where one mip level lives in the file
+struct TextureLevel
+{
+	uint32_t Width;
+	uint32_t Height;
+	uint64_t Offset;
+	uint64_t Size;
+};
+
+// A KTX2 or DDS file as far as the header goes. Only the level table is read up front; the pixel data of each
+// level is read on demand, so a texture can be streamed in from its smallest mip up
+struct TextureFile
+{
+	std::string Path;
+	const char* FormatName = "";
+	GLenum InternalFormat = 0;
+	bool Compressed = false;
+	uint32_t BlockBytes = 0;        // bytes per 4x4 block when compressed, per pixel otherwise
+	uint32_t Width = 0;
+	uint32_t Height = 0;
+	std::vector<TextureLevel> Levels;   // level 0 is the largest
+
+	// bytes a level takes once uploaded
+	uint64_t GetLevelBytes(uint32_t width, uint32_t height) const
+	{
+		if (Compressed)
+			return uint64_t((width + 3) / 4) * ((height + 3) / 4) * BlockBytes;
+		return uint64_t(width) * height * BlockBytes;
+	}
+};
+
+
+// Supported payloads: the BCn formats desktop GPUs sample directly, ETC2 (core since GL 4.3) and plain RGBA8
+struct TextureFormatInfo
+{
+	uint32_t Code;              // vkFormat for KTX2, DXGI_FORMAT for DDS
+	GLenum InternalFormat;
+	bool Compressed;
+	uint32_t BlockBytes;
+	const char* Name;
+};
+
+const TextureFormatInfo KTX2_FORMATS[] = {
+	{ 37, GL_RGBA8, false, 4, "RGBA8" },
+	{ 43, GL_SRGB8_ALPHA8, false, 4, "RGBA8 sRGB" },
+	{ 131, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, true, 8, "BC1 RGB" },
+	{ 132, GL_COMPRESSED_SRGB_S3TC_DXT1_EXT, true, 8, "BC1 RGB sRGB" },
+	{ 133, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, true, 8, "BC1 RGBA" },
+	{ 134, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT, true, 8, "BC1 RGBA sRGB" },
+	{ 135, GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, true, 16, "BC2" },
+	{ 136, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT, true, 16, "BC2 sRGB" },
+	{ 137, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, true, 16, "BC3" },
+	{ 138, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, true, 16, "BC3 sRGB" },
+	{ 139, GL_COMPRESSED_RED_RGTC1, true, 8, "BC4" },
+	{ 141, GL_COMPRESSED_RG_RGTC2, true, 16, "BC5" },
+	{ 145, GL_COMPRESSED_RGBA_BPTC_UNORM, true, 16, "BC7" },
+	{ 146, GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM, true, 16, "BC7 sRGB" },
+	{ 147, GL_COMPRESSED_RGB8_ETC2, true, 8, "ETC2 RGB" },
+	{ 148, GL_COMPRESSED_SRGB8_ETC2, true, 8, "ETC2 RGB sRGB" },
+	{ 151, GL_COMPRESSED_RGBA8_ETC2_EAC, true, 16, "ETC2 RGBA" },
+	{ 152, GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC, true, 16, "ETC2 RGBA sRGB" }
+};
+
+const TextureFormatInfo DDS_FORMATS[] = {
+	{ 28, GL_RGBA8, false, 4, "RGBA8" },
+	{ 29, GL_SRGB8_ALPHA8, false, 4, "RGBA8 sRGB" },
+	{ 71, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, true, 8, "BC1" },
+	{ 72, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT, true, 8, "BC1 sRGB" },
+	{ 74, GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, true, 16, "BC2" },
+	{ 75, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT, true, 16, "BC2 sRGB" },
+	{ 77, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, true, 16, "BC3" },
+	{ 78, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, true, 16, "BC3 sRGB" },
+	{ 80, GL_COMPRESSED_RED_RGTC1, true, 8, "BC4" },
+	{ 83, GL_COMPRESSED_RG_RGTC2, true, 16, "BC5" },
+	{ 98, GL_COMPRESSED_RGBA_BPTC_UNORM, true, 16, "BC7" },
+	{ 99, GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM, true, 16, "BC7 sRGB" }
+};
+
+// DXGI formats behind the legacy DDS four character codes
+const uint32_t DDS_DXGI_BC1 = 71;
+const uint32_t DDS_DXGI_BC2 = 74;
+const uint32_t DDS_DXGI_BC3 = 77;
+const uint32_t DDS_DXGI_BC4 = 80;
+const uint32_t DDS_DXGI_BC5 = 83;
+const uint32_t DDS_DXGI_RGBA8 = 28;
+
+
+template <size_t N>
+inline const TextureFormatInfo* UFindTextureFormat(const TextureFormatInfo(&formats)[N], uint32_t code)
+{
+	for (const TextureFormatInfo& format : formats)
+	{
+		if (format.Code == code)
+			return &format;
+	}
+	return nullptr;
+}
+
+inline uint32_t UReadU32(const unsigned char* bytes) { uint32_t value; std::memcpy(&value, bytes, 4); return value; }
+inline uint64_t UReadU64(const unsigned char* bytes) { uint64_t value; std::memcpy(&value, bytes, 8); return value; }
+
+inline uint32_t UFourCC(const char* code) { return UReadU32(reinterpret_cast<const unsigned char*>(code)); }
+
+inline bool UTextureError(const TextureFile& file, const char* message)
+{
+	std::cout << "ERROR::TEXTURE_FILE::" << file.Path << "::" << message << std::endl;
+	return false;
+}
+
+// a full chain halves the larger side down to 1, so it has floor(log2(max(w, h))) + 1 levels and no more
+inline uint32_t UGetMaxTextureLevels(uint32_t width, uint32_t height)
+{
+	uint32_t levels = 1;
+	for (uint32_t side = std::max(width, height); side > 1; side /= 2)
+		++levels;
+	return levels;
+}
+
+// checks the dimensions and level count a header claims before anything is sized from them
+inline bool UValidateTextureHeader(const TextureFile& file, uint32_t levelCount)
+{
+	if (file.Width == 0 || file.Height == 0)
+		return UTextureError(file, "empty image");
+	if (file.Width > TEXTURE_MAX_SIZE || file.Height > TEXTURE_MAX_SIZE)
+		return UTextureError(file, "image larger than the maximum texture size");
+	if (levelCount > UGetMaxTextureLevels(file.Width, file.Height))
+		return UTextureError(file, "more levels than the image dimensions allow");
+	return true;
+}
+
+// fills the level table of a texture whose levels are stored back to back from offset, largest first (DDS)
+inline void UFillPackedLevels(TextureFile& file, uint32_t levelCount, uint64_t offset)
+{
+	uint32_t width = file.Width, height = file.Height;
+	for (uint32_t level = 0; level < levelCount; ++level)
+	{
+		const uint64_t size = file.GetLevelBytes(width, height);
+		file.Levels.push_back({ width, height, offset, size });
+		offset += size;
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+}
+
+inline bool UReadKtx2Header(std::ifstream& stream, TextureFile& file)
+{
+	unsigned char header[80];
+	if (!stream.read(reinterpret_cast<char*>(header), sizeof(header)))
+		return UTextureError(file, "truncated header");
+
+	const uint32_t vkFormat = UReadU32(header + 12);
+	file.Width = UReadU32(header + 20);
+	file.Height = std::max(1u, UReadU32(header + 24));
+	const uint32_t depth = UReadU32(header + 28);
+	const uint32_t layers = UReadU32(header + 32);
+	const uint32_t faces = UReadU32(header + 36);
+	const uint32_t levelCount = std::max(1u, UReadU32(header + 40));
+	const uint32_t supercompression = UReadU32(header + 44);
+	if (depth > 1 || layers > 1 || faces != 1 || supercompression != 0)
+		return UTextureError(file, "only single 2D images without supercompression are supported");
+	if (!UValidateTextureHeader(file, levelCount))
+		return false;
+
+	const TextureFormatInfo* format = UFindTextureFormat(KTX2_FORMATS, vkFormat);
+	if (!format)
+		return UTextureError(file, "unsupported vkFormat");
+	file.FormatName = format->Name;
+	file.InternalFormat = format->InternalFormat;
+	file.Compressed = format->Compressed;
+	file.BlockBytes = format->BlockBytes;
+
+	// the level index follows the header, largest level first
+	std::vector<unsigned char> index(size_t(levelCount) * 24);
+	if (!stream.read(reinterpret_cast<char*>(index.data()), index.size()))
+		return UTextureError(file, "truncated level index");
+	uint32_t width = file.Width, height = file.Height;
+	for (uint32_t level = 0; level < levelCount; ++level)
+	{
+		const uint64_t offset = UReadU64(&index[level * 24]);
+		const uint64_t size = UReadU64(&index[level * 24 + 8]);
+		if (size < file.GetLevelBytes(width, height))
+			return UTextureError(file, "level smaller than its dimensions need");
+		file.Levels.push_back({ width, height, offset, size });
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+	return true;
+}
+
+inline bool UReadDdsHeader(std::ifstream& stream, TextureFile& file)
+{
+	unsigned char header[128];
+	if (!stream.read(reinterpret_cast<char*>(header), sizeof(header)))
+		return UTextureError(file, "truncated header");
+
+	file.Height = UReadU32(header + 12);
+	file.Width = UReadU32(header + 16);
+	const uint32_t levelCount = std::max(1u, UReadU32(header + 28));
+	if (!UValidateTextureHeader(file, levelCount))
+		return false;
+	const uint32_t pixelFlags = UReadU32(header + 80);
+	const uint32_t fourCC = UReadU32(header + 84);
+	uint64_t dataOffset = 128;
+
+	uint32_t dxgiFormat = 0;
+	if (pixelFlags & 0x4)
+	{
+		if (fourCC == UFourCC("DX10"))
+		{
+			unsigned char dx10[20];
+			if (!stream.read(reinterpret_cast<char*>(dx10), sizeof(dx10)))
+				return UTextureError(file, "truncated DX10 header");
+			dxgiFormat = UReadU32(dx10);
+			// resource dimension 3 is a 2D texture; array textures and cube maps are not supported
+			if (UReadU32(dx10 + 4) != 3 || UReadU32(dx10 + 12) > 1 || (UReadU32(dx10 + 8) & 0x4))
+				dxgiFormat = 0;
+			dataOffset += sizeof(dx10);
+		}
+		else if (fourCC == UFourCC("DXT1"))
+			dxgiFormat = DDS_DXGI_BC1;
+		else if (fourCC == UFourCC("DXT3"))
+			dxgiFormat = DDS_DXGI_BC2;
+		else if (fourCC == UFourCC("DXT5"))
+			dxgiFormat = DDS_DXGI_BC3;
+		else if (fourCC == UFourCC("ATI1") || fourCC == UFourCC("BC4U"))
+			dxgiFormat = DDS_DXGI_BC4;
+		else if (fourCC == UFourCC("ATI2") || fourCC == UFourCC("BC5U"))
+			dxgiFormat = DDS_DXGI_BC5;
+	}
+	else if (UReadU32(header + 88) == 32 && UReadU32(header + 92) == 0x000000ff && UReadU32(header + 100) == 0x00ff0000)
+	{
+		// 32 bit RGB(A) in R, G, B, A byte order
+		dxgiFormat = DDS_DXGI_RGBA8;
+	}
+
+	const TextureFormatInfo* format = UFindTextureFormat(DDS_FORMATS, dxgiFormat);
+	if (!format)
+		return UTextureError(file, "unsupported DDS pixel format");
+	file.FormatName = format->Name;
+	file.InternalFormat = format->InternalFormat;
+	file.Compressed = format->Compressed;
+	file.BlockBytes = format->BlockBytes;
+	UFillPackedLevels(file, levelCount, dataOffset);
+	return true;
+}
+
+// Reads the header and level table of a .ktx2 or .dds file. Prints why on failure
+inline bool UReadTextureHeader(const std::string& path, TextureFile& file)
+{
+	file = TextureFile();
+	file.Path = path;
+
+	std::ifstream stream(path, std::ios::binary);
+	unsigned char magic[12] = {};
+	if (!stream.read(reinterpret_cast<char*>(magic), sizeof(magic)))
+		return UTextureError(file, "could not be read");
+	stream.seekg(0);
+
+	static const unsigned char KTX2_MAGIC[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+	bool ok;
+	if (std::memcmp(magic, "DDS ", 4) == 0)
+		ok = UReadDdsHeader(stream, file);
+	else if (std::memcmp(magic, KTX2_MAGIC, sizeof(KTX2_MAGIC)) == 0)
+		ok = UReadKtx2Header(stream, file);
+	else
+		return UTextureError(file, "not a KTX2 or DDS file");
+
+	if (!ok)
+		file.Levels.clear();
+	return ok;
+}
+
+// Reads the pixel data of one level. The stream must be the file the header came from
+inline bool UReadTextureLevel(std::ifstream& stream, const TextureFile& file, uint32_t level, std::vector<unsigned char>& bytes)
+{
+	const TextureLevel& info = file.Levels[level];
+	bytes.resize(size_t(file.GetLevelBytes(info.Width, info.Height)));
+	stream.clear();
+	stream.seekg(std::streamoff(info.Offset));
+	return bool(stream.read(reinterpret_cast<char*>(bytes.data()), std::streamsize(bytes.size())));
+}
+#endif
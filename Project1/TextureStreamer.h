@@ -0,0 +1,424 @@
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "GpuMemory.h"
+#include "TextureFile.h"
+
+typedef uint32_t TextureHandle;
+const TextureHandle NO_TEXTURE = 0xffffffffu;
+
+// Levels this size and smaller are read as one piece when a texture is first seen, and are never evicted
+const uint32_t TEXTURE_MIP_TAIL_SIZE = 64;
+const uint64_t TEXTURE_DEFAULT_BUDGET = 64ull << 20;
+const uint64_t TEXTURE_DEFAULT_UPLOAD_PER_FRAME = 4ull << 20;
+
+struct TextureStreamingStats
+{
+	uint64_t BudgetBytes = 0;
+	uint64_t ResidentBytes = 0;
+	uint64_t UploadedBytes = 0;         // during the last Update
+	uint64_t TotalUploadedBytes = 0;
+	uint32_t PendingReads = 0;
+	uint32_t Evictions = 0;             // levels dropped to stay in budget, since Create
+	uint32_t Textures = 0;
+	uint32_t FullyResident = 0;         // textures that have every level they were asked for
+};
+
+
+// Streams mip levels of KTX2/DDS textures in and out of GPU memory. A file thread reads the level table first, then the
+// mip tail, then one finer level at a time as the texture is asked for at larger sizes on screen. Every texture lives in
+// immutable storage that holds exactly its resident levels: growing or shrinking it allocates the new chain and copies the
+// levels it keeps on the GPU (glCopyImageSubData, GL 4.3), so only new levels cross the bus.
+// Everything except the file reads happens on the thread that owns the GL context
+class TextureStreamer
+{
+public:
+	void Create(uint64_t budgetBytes = TEXTURE_DEFAULT_BUDGET, uint64_t uploadBytesPerFrame = TEXTURE_DEFAULT_UPLOAD_PER_FRAME)
+	{
+		Stats = TextureStreamingStats();
+		Stats.BudgetBytes = budgetBytes;
+		UploadBytesPerFrame = uploadBytesPerFrame;
+		Quit = false;
+		Reader = std::thread(&TextureStreamer::readLoop, this);
+	}
+
+	void Destroy()
+	{
+		{
+			std::lock_guard<std::mutex> lock(ReadMutex);
+			Quit = true;
+		}
+		ReadCondition.notify_one();
+		if (Reader.joinable())
+			Reader.join();
+		for (Streamed& texture : Textures)
+			UDeleteTextures(1, &texture.Id);
+		Textures.clear();
+	}
+
+	// starts reading the texture's header. The handle is valid at once; GetTexture returns 0 until the mip tail is in
+	TextureHandle Add(const std::string& path)
+	{
+		Textures.push_back(Streamed());
+		const TextureHandle handle = TextureHandle(Textures.size() - 1);
+		Textures[handle].File.Path = path;
+		Textures[handle].ReadPending = true;
+		queueRead({ handle, true, 0, 0, Textures[handle].File });
+		return handle;
+	}
+
+	// asks for enough detail to cover screenPixels pixels this frame. The largest request of a frame wins
+	void Request(TextureHandle handle, float screenPixels)
+	{
+		Streamed& texture = Textures[handle];
+		texture.Pixels = std::max(texture.Pixels, screenPixels);
+	}
+
+	// once a frame: takes finished reads, uploads within the per frame budget, evicts to stay within the memory budget
+	// and queues the next reads
+	void Update()
+	{
+		Stats.UploadedBytes = 0;
+		takeReads();
+
+		// neediest first: the ones furthest from the detail they were asked for, then the largest on screen
+		Order.clear();
+		for (TextureHandle handle = 0; handle < Textures.size(); ++handle)
+		{
+			Streamed& texture = Textures[handle];
+			texture.Wanted = wantedLevel(texture);
+			Order.push_back(handle);
+		}
+		std::sort(Order.begin(), Order.end(), [this](TextureHandle a, TextureHandle b) { return priority(Textures[a]) > priority(Textures[b]); });
+
+		for (TextureHandle handle : Order)
+		{
+			Streamed& texture = Textures[handle];
+			if (texture.Failed || texture.File.Levels.empty())
+				continue;
+
+			if (!texture.Staged.empty() && Stats.UploadedBytes < UploadBytesPerFrame)
+				commit(handle);
+
+			// one finer level at a time, so what is on screen sharpens progressively
+			if (!texture.ReadPending && texture.Staged.empty() && texture.Id != 0 && texture.Resident > texture.Wanted)
+			{
+				const uint32_t level = texture.Resident - 1;
+				if (makeRoom(handle, levelBytes(texture, level)))
+				{
+					texture.ReadPending = true;
+					queueRead({ handle, false, level, level, texture.File });
+				}
+			}
+		}
+
+		// the requests are kept until here as the sort and the eviction scores rank by them
+		for (Streamed& texture : Textures)
+			texture.Pixels = 0.0f;
+
+		Stats.Textures = uint32_t(Textures.size());
+		Stats.FullyResident = 0;
+		for (const Streamed& texture : Textures)
+		{
+			if (texture.Id != 0 && texture.Resident <= texture.Wanted)
+				Stats.FullyResident++;
+		}
+		std::lock_guard<std::mutex> lock(ReadMutex);
+		Stats.PendingReads = uint32_t(Pending.size()) + (Reading ? 1 : 0);
+	}
+
+	// the GL texture to bind, or 0 while nothing is resident
+	GLuint GetTexture(TextureHandle handle) const { return Textures[handle].Id; }
+	// the file level the GL texture's level 0 holds
+	uint32_t GetResidentLevel(TextureHandle handle) const { return Textures[handle].Resident; }
+	uint32_t GetWantedLevel(TextureHandle handle) const { return Textures[handle].Wanted; }
+	const TextureFile& GetFile(TextureHandle handle) const { return Textures[handle].File; }
+	const TextureStreamingStats& GetStats() const { return Stats; }
+
+private:
+	// a read for the file thread: the header, or levels [FirstLevel, LastLevel]
+	struct ReadRequest
+	{
+		TextureHandle Texture;
+		bool Header;
+		uint32_t FirstLevel;
+		uint32_t LastLevel;
+		TextureFile File;
+	};
+
+	struct ReadResult
+	{
+		TextureHandle Texture;
+		bool Ok;
+		bool Header;
+		uint32_t FirstLevel;
+		TextureFile File;
+		std::vector<std::vector<unsigned char>> Levels;
+	};
+
+	struct Streamed
+	{
+		TextureFile File;
+		bool Failed = false;
+		bool ReadPending = false;
+		GLuint Id = 0;
+		uint32_t Resident = 0;      // file level in the GL texture's level 0; Levels.size() while nothing is resident
+		uint32_t Tail = 0;          // first level of the mip tail
+		uint32_t Wanted = 0;
+		float Pixels = 0.0f;        // largest request since the last Update
+		uint32_t StagedFirst = 0;   // levels read but not uploaded yet, from StagedFirst down
+		std::vector<std::vector<unsigned char>> Staged;
+		uint64_t Bytes = 0;         // GPU memory of the resident levels
+	};
+
+	std::vector<Streamed> Textures;
+	std::vector<TextureHandle> Order;
+	TextureStreamingStats Stats;
+	uint64_t UploadBytesPerFrame = TEXTURE_DEFAULT_UPLOAD_PER_FRAME;
+
+	std::thread Reader;
+	std::mutex ReadMutex;
+	std::condition_variable ReadCondition;
+	std::deque<ReadRequest> Pending;
+	std::vector<ReadResult> Done;
+	bool Reading = false;
+	bool Quit = false;
+
+	uint64_t levelBytes(const Streamed& texture, uint32_t level) const
+	{
+		return texture.File.GetLevelBytes(texture.File.Levels[level].Width, texture.File.Levels[level].Height);
+	}
+
+	uint64_t chainBytes(const Streamed& texture, uint32_t firstLevel) const
+	{
+		uint64_t bytes = 0;
+		for (uint32_t level = firstLevel; level < texture.File.Levels.size(); ++level)
+			bytes += levelBytes(texture, level);
+		return bytes;
+	}
+
+	// the level whose texels roughly match the pixels it covers; unrequested textures only keep their tail
+	uint32_t wantedLevel(const Streamed& texture) const
+	{
+		if (texture.File.Levels.empty() || texture.Pixels <= 0.0f)
+			return texture.Tail;
+		const float texels = float(std::max(texture.File.Width, texture.File.Height));
+		const float level = std::floor(std::log2(std::max(1.0f, texels / texture.Pixels)));
+		return std::min(texture.Tail, uint32_t(level));
+	}
+
+	// how many levels short of what it wants a texture is, scaled by its size on screen to break ties
+	float priority(const Streamed& texture) const
+	{
+		const float missing = float(texture.Resident) - float(texture.Wanted);
+		return missing * 100000.0f + texture.Pixels;
+	}
+
+	// frees memory for bytes more by dropping the finest levels of less needy textures, most overdetailed first
+	bool makeRoom(TextureHandle forHandle, uint64_t bytes)
+	{
+		const int forMissing = int(Textures[forHandle].Resident) - int(Textures[forHandle].Wanted);
+		while (Stats.ResidentBytes + bytes > Stats.BudgetBytes)
+		{
+			TextureHandle victim = NO_TEXTURE;
+			float victimScore = 0.0f;
+			for (TextureHandle handle = 0; handle < Textures.size(); ++handle)
+			{
+				const Streamed& texture = Textures[handle];
+				if (handle == forHandle || texture.Id == 0 || texture.Resident >= texture.Tail)
+					continue;
+				// a level it wants is only taken if the requester stays needier after the trade, or two textures that
+				// do not both fit would keep swapping levels every frame
+				const int missing = int(texture.Resident) - int(texture.Wanted);
+				if (missing >= 0 && forMissing - 1 <= missing + 1)
+					continue;
+				// levels finer than wanted go first, then whatever has the least on screen
+				const float score = float(texture.Wanted) - float(texture.Resident) + 1.0f / (1.0f + texture.Pixels);
+				if (victim == NO_TEXTURE || score > victimScore)
+				{
+					victim = handle;
+					victimScore = score;
+				}
+			}
+			if (victim == NO_TEXTURE)
+				return false;
+			reallocate(Textures[victim], Textures[victim].Resident + 1);
+			Stats.Evictions++;
+		}
+		return true;
+	}
+
+	// replaces the texture's storage with one that starts at file level newResident, copying over the levels both share
+	void reallocate(Streamed& texture, uint32_t newResident)
+	{
+		const TextureFile& file = texture.File;
+		const uint32_t levelCount = uint32_t(file.Levels.size());
+
+		GLuint id;
+		glGenTextures(1, &id);
+		glBindTexture(GL_TEXTURE_2D, id);
+		UTexStorage2D(id, GLsizei(levelCount - newResident), file.InternalFormat, file.Levels[newResident].Width, file.Levels[newResident].Height, "streamed textures");
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+		if (texture.Id != 0)
+		{
+			for (uint32_t level = std::max(newResident, texture.Resident); level < levelCount; ++level)
+			{
+				glCopyImageSubData(texture.Id, GL_TEXTURE_2D, GLint(level - texture.Resident), 0, 0, 0,
+					id, GL_TEXTURE_2D, GLint(level - newResident), 0, 0, 0,
+					file.Levels[level].Width, file.Levels[level].Height, 1);
+			}
+			UDeleteTextures(1, &texture.Id);
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		Stats.ResidentBytes -= texture.Bytes;
+		texture.Id = id;
+		texture.Resident = newResident;
+		texture.Bytes = chainBytes(texture, newResident);
+		Stats.ResidentBytes += texture.Bytes;
+	}
+
+	// moves the staged levels into a grown texture
+	void commit(TextureHandle handle)
+	{
+		Streamed& texture = Textures[handle];
+		const uint32_t first = texture.StagedFirst;
+		const uint32_t last = first + uint32_t(texture.Staged.size()) - 1;
+		if (texture.Id != 0 && last + 1 != texture.Resident)
+		{
+			// no longer adjacent to what is resident (it was evicted meanwhile); read it again later
+			texture.Staged.clear();
+			return;
+		}
+		uint64_t bytes = 0;
+		for (uint32_t level = first; level <= last; ++level)
+			bytes += levelBytes(texture, level);
+		if (texture.Id != 0 && !makeRoom(handle, bytes))
+			return;
+
+		reallocate(texture, first);
+		glBindTexture(GL_TEXTURE_2D, texture.Id);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (uint32_t level = first; level <= last; ++level)
+		{
+			const TextureLevel& info = texture.File.Levels[level];
+			const std::vector<unsigned char>& data = texture.Staged[level - first];
+			if (texture.File.Compressed)
+				glCompressedTexSubImage2D(GL_TEXTURE_2D, GLint(level - first), 0, 0, info.Width, info.Height, texture.File.InternalFormat, GLsizei(data.size()), data.data());
+			else
+				glTexSubImage2D(GL_TEXTURE_2D, GLint(level - first), 0, 0, info.Width, info.Height, GL_RGBA, GL_UNSIGNED_BYTE, data.data());
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		texture.Staged.clear();
+		Stats.UploadedBytes += bytes;
+		Stats.TotalUploadedBytes += bytes;
+	}
+
+	void takeReads()
+	{
+		std::vector<ReadResult> done;
+		{
+			std::lock_guard<std::mutex> lock(ReadMutex);
+			done.swap(Done);
+		}
+		for (ReadResult& result : done)
+		{
+			Streamed& texture = Textures[result.Texture];
+			texture.ReadPending = false;
+			if (!result.Ok)
+			{
+				texture.Failed = true;
+				continue;
+			}
+			if (result.Header)
+			{
+				texture.File = result.File;
+				const uint32_t levelCount = uint32_t(texture.File.Levels.size());
+				texture.Resident = levelCount;
+				texture.Tail = levelCount - 1;
+				while (texture.Tail > 0 && std::max(texture.File.Levels[texture.Tail - 1].Width, texture.File.Levels[texture.Tail - 1].Height) <= TEXTURE_MIP_TAIL_SIZE)
+					texture.Tail--;
+				texture.Wanted = texture.Tail;
+				texture.ReadPending = true;
+				queueRead({ result.Texture, false, texture.Tail, levelCount - 1, texture.File });
+				continue;
+			}
+			texture.StagedFirst = result.FirstLevel;
+			texture.Staged.swap(result.Levels);
+		}
+	}
+
+	void queueRead(const ReadRequest& request)
+	{
+		{
+			std::lock_guard<std::mutex> lock(ReadMutex);
+			Pending.push_back(request);
+		}
+		ReadCondition.notify_one();
+	}
+
+	// the file thread: one request at a time, in the order they were queued
+	void readLoop()
+	{
+		for (;;)
+		{
+			ReadRequest request;
+			{
+				std::unique_lock<std::mutex> lock(ReadMutex);
+				ReadCondition.wait(lock, [this]() { return Quit || !Pending.empty(); });
+				if (Quit)
+					return;
+				request = Pending.front();
+				Pending.pop_front();
+				Reading = true;
+			}
+
+			ReadResult result;
+			result.Texture = request.Texture;
+			result.Header = request.Header;
+			result.FirstLevel = request.FirstLevel;
+			if (request.Header)
+			{
+				result.Ok = UReadTextureHeader(request.File.Path, result.File);
+			}
+			else
+			{
+				std::ifstream stream(request.File.Path, std::ios::binary);
+				result.Ok = bool(stream);
+				for (uint32_t level = request.FirstLevel; result.Ok && level <= request.LastLevel; ++level)
+				{
+					result.Levels.push_back(std::vector<unsigned char>());
+					result.Ok = UReadTextureLevel(stream, request.File, level, result.Levels.back());
+				}
+				if (!result.Ok)
+					std::cout << "ERROR::TEXTURE::" << request.File.Path << "::could not read level " << request.FirstLevel << std::endl;
+			}
+
+			std::lock_guard<std::mutex> lock(ReadMutex);
+			Done.push_back(std::move(result));
+			Reading = false;
+		}
+	}
+};
+#endif
@@ -1,6 +1,11 @@
 #include <iostream>         // cout, cerr
+#include <algorithm>
+#include <cassert>
 #include <cstdlib>          // EXIT_FAILURE
 #include <vector>
+#include <map>
+#include <string>
+#include <thread>
 #include <GL/glew.h>        // GLEW library
 #include <GLFW/glfw3.h>     // GLFW library
 
@@ -8,7 +13,33 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#define ALLOCATION_COUNTER_IMPLEMENTATION
+#include "AllocationCounter.h"
+#include "BufferHeap.h"
+#include "Bvh.h"
 #include "Camera.h"
+#include "CommandList.h"
+#include "DynamicResolution.h"
+#include "FrameArena.h"
+#include "FrameCapture.h"
+#include "FramePacer.h"
+#include "GpuCulling.h"
+#include "GpuMemory.h"
+#include "GpuParticles.h"
+#include "GpuPicker.h"
+#include "GpuTimer.h"
+#include "Input.h"
+#include "JobSystem.h"
+#include "LightClusters.h"
+#include "Material.h"
+#include "MeshNormals.h"
+#include "MeshPager.h"
+#include "OcclusionCuller.h"
+#include "Particles.h"
+#include "Primitives.h"
+#include "RenderTarget.h"
+#include "StaticBatching.h"
+#include "TextureStreamer.h"
 
 using namespace std; // Uses the standard namespace
 
@@ -21,29 +52,288 @@ namespace
     const int WINDOW_WIDTH = 800;
     const int WINDOW_HEIGHT = 600;
     
+    // Vertex layout of every mesh: x, y, z, material slot, u, v, then the normal's x, y, z
+    const GLuint FLOATS_PER_VERTEX = 9;
+    const GLuint NORMAL_OFFSET = 6;
 
     // Stores the GL data relative to a given mesh
     struct GLMesh
     {
-        GLuint vao;         // Handle for the vertex array object
-        GLuint vbos[2];     // Handles for the vertex buffer objects
+        BufferRangeHandle range;    // Where the vertices and indices sit in gMeshHeap
         GLuint nIndices;    // Number of indices of the mesh
+        Aabb bounds;        // Model space bounds of the vertices
+        std::vector<glm::vec3> positions;   // CPU copy of the triangles, rasterized when the mesh is an occluder
+        std::vector<uint16_t> indices;
+        std::vector<GLfloat> vertices;      // CPU copy of the interleaved vertices, merged into static batches
+    };
+
+    // One draw in the scene: a mesh placed by a model matrix
+    struct SceneObject
+    {
+        const GLMesh* mesh;
+        glm::mat4 model;
+        bool occluder;      // large and solid enough to hide what is behind it
+        TextureHandle texture;  // diffuse map, or NO_TEXTURE for the material color only
+        uint32_t materials;     // first material of the set the mesh's slots index
+        bool isStatic = false;  // never moves, so it can be merged into a static batch
+    };
+
+    // Plays command list packets back as GL calls, skipping binds of what is already bound. Render thread only
+    struct GLCommandBackend
+    {
+        GLuint program = 0;
+        GLuint vao = 0;
+        GLuint texture = 0;
+
+        void SetProgram(uint32_t id)
+        {
+            if (id != program)
+                glUseProgram(program = id);
+        }
+        void BindMesh(uint32_t id)
+        {
+            if (id != vao)
+                glBindVertexArray(vao = id);
+        }
+        void BindTexture(uint32_t unit, uint32_t id)
+        {
+            if (id != texture)
+            {
+                glActiveTexture(GL_TEXTURE0 + unit);
+                glBindTexture(GL_TEXTURE_2D, texture = id);
+            }
+        }
+        void SetUniform(int32_t location, const float* matrix)
+        {
+            glUniformMatrix4fv(location, 1, GL_FALSE, matrix);
+        }
+        void SetUniform(int32_t location, uint32_t value)
+        {
+            glUniform1ui(location, value);
+        }
+        void DrawIndexed(uint32_t indexCount, uint32_t firstIndex, int32_t baseVertex)
+        {
+            glDrawElementsBaseVertex(GL_TRIANGLES, indexCount, GL_UNSIGNED_SHORT, (const void*)(firstIndex * sizeof(GLushort)), baseVertex);
+        }
+        void DrawIndirect(uint32_t buffer, uint32_t firstCommand, uint32_t commandCount)
+        {
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_SHORT, (const void*)(firstCommand * sizeof(DrawElementsIndirectCommand)), commandCount, 0);
+        }
+    };
+
+    // Plays the same command lists back for the depth pre-pass: the depth program stands in for the color one, its
+    // uniform locations for the color program's, and textures and materials are left out. Render thread only
+    struct GLDepthBackend : GLCommandBackend
+    {
+        GLuint depthProgram;
+        GLint modelLocation, depthModelLocation;
+        GLint viewProjectionLocation, depthViewProjectionLocation;
+
+        GLDepthBackend(GLuint depthProgram, GLint modelLocation, GLint depthModelLocation, GLint viewProjectionLocation, GLint depthViewProjectionLocation)
+            : depthProgram(depthProgram), modelLocation(modelLocation), depthModelLocation(depthModelLocation),
+            viewProjectionLocation(viewProjectionLocation), depthViewProjectionLocation(depthViewProjectionLocation) {}
+
+        void SetProgram(uint32_t)
+        {
+            GLCommandBackend::SetProgram(depthProgram);
+        }
+        void BindTexture(uint32_t, uint32_t) {}
+        void SetUniform(int32_t location, const float* matrix)
+        {
+            if (location == modelLocation)
+                GLCommandBackend::SetUniform(depthModelLocation, matrix);
+            else if (location == viewProjectionLocation)
+                GLCommandBackend::SetUniform(depthViewProjectionLocation, matrix);
+        }
+        void SetUniform(int32_t, uint32_t) {}
     };
 
     // Main GLFW window
     GLFWwindow* gWindow;
 
+    // Every scene mesh shares the arenas of one heap. Defragmenting moves at most this much a frame
+    const uint32_t MESH_HEAP_ARENA = 1u << 20;
+    const uint64_t MESH_HEAP_DEFRAGMENT_PER_FRAME = 256u << 10;
+    BufferHeap gMeshHeap;
     GLMesh gMeshCube;
-    GLMesh gMeshTable;
-    GLMesh gMeshwalls;
     // Shader program
     GLuint gProgramId;
+    GLint gModelLocation;
+    GLint gViewProjectionLocation;
+    GLint gMaterialBaseLocation;
+
+    // Every material in one shader storage buffer. Draws pick a run of it (the set for the mesh's material slots)
+    MaterialTable gMaterials;
+    uint32_t gBoxMaterials;
+    uint32_t gTableMaterials;
+
+    // Scene objects, their world space bounds and the BVH over those bounds used for culling and picking
+    std::vector<SceneObject> gSceneObjects;
+    std::vector<Aabb> gSceneBounds;
+    Bvh gSceneBvh;
+    std::vector<uint32_t> gVisibleObjects;
+
+    // Draws are recorded into command lists by jobs, COMMAND_BATCH objects per list, and replayed in order on the render thread
+    const uint32_t COMMAND_BATCH = 64;
+    std::vector<CommandList> gCommandLists;
+    size_t gRecordedLists = 0;
+
+    // Per-frame CPU work (bounds, culling, recording draws) runs as jobs on every core; only GL calls stay on the render thread.
+    // J prints how the last frame's jobs spread over the threads
+    JobSystem gJobs;
+    bool gReportJobs = false;
+
+    // Scratch that only lives for one frame comes from the calling thread's arena, reset at the start of every frame.
+    // Once nothing has changed for STEADY_STATE_FRAMES frames a frame must not touch the heap at all. M prints the usage,
+    // and the GPU memory every module recorded with the tracker (GpuMemory.h)
+    const int STEADY_STATE_FRAMES = 60;
+    FrameArenas gFrameArenas(gJobs);
+    int gSteadyFrames = 0;
+    uint64_t gFrameAllocations = 0;
+    bool gReportMemory = false;
+
+    // Diffuse maps (KTX2 or DDS, given on the command line: table first, then the box) stream their mip levels in as they
+    // come closer. Untextured objects and textures with nothing resident yet sample a white texel. T prints the streaming stats
+    TextureStreamer gTextureStreamer;
+    TextureHandle gTableTexture = NO_TEXTURE;
+    TextureHandle gCubeTexture = NO_TEXTURE;
+    GLuint gWhiteTexture;
+    bool gReportTextures = false;
+
+    // Clustered forward lighting (toggled with L; + and - double or halve the light count): the lights are sorted into
+    // view frustum clusters on the CPU and every fragment shades only the lights of its cluster
+    const GLuint LIGHT_BINDING = 4;
+    const GLuint CLUSTER_BINDING = 5;
+    const GLuint CLUSTER_LIGHT_BINDING = 6;
+    const int MAX_LIGHTS = 4096;
+    bool gLighting = true;
+    bool gReportLights = true;
+    int gLightCount = 64;
+    float gLightTime = 0.0f;
+    std::vector<PointLight> gLights;
+    ClusteredLighting gClusters;
+    GLuint gLightBuffers[3];        // lights, cluster header and ranges, cluster light indices
+
+    // Software occlusion culling (toggled with O): occluders in view are rasterized on the CPU and hide the objects behind them
+    bool gOcclusionCulling = true;
+    OcclusionCuller gOcclusionCuller;
+    std::vector<Occluder> gOccluders;
+    std::vector<Aabb> gOccludeeBounds;
+    std::vector<uint8_t> gOccludeeVisible;
+    int gLastRejected = -1;
+
+    // Static batching (toggled with B): objects marked static are merged, per texture and material set and per grid cell,
+    // into world space meshes drawn with an identity model matrix, so the table top and its legs are one draw instead of five
+    bool gStaticBatching = true;
+    StaticBatcher gStaticBatcher;
+    std::vector<GLMesh> gStaticBatchMeshes;
+    std::vector<SceneObject> gStaticBatchObjects;
+
+    // Dynamic resolution (toggled with R): the scene renders into an offscreen target at a scale of the window size and is
+    // stretched onto the window. GPU timer queries measure every frame and the controller moves the scale to hold its target
+    bool gDynamicResolution = false;
+    bool gRenderTargetReady = false;
+    ScaledRenderTarget gRenderTarget;
+    ResolutionController gResolution;
+    GpuTimer gGpuTimer;
+    int gRenderWidth = WINDOW_WIDTH;    // size the scene is rendered at this frame
+    int gRenderHeight = WINDOW_HEIGHT;
+
+    // Frame pacing: a fence after every frame keeps the CPU at most a few frames ahead of the GPU (N cycles 1 to 3), and
+    // K switches to low latency mode, which waits for the GPU before input is sampled. Both print the latency so far
+    FramePacer gFramePacer;
+
+    // Depth pipeline. Z switches to reversed-Z: the scene goes through the offscreen target for its float depth buffer,
+    // depth runs from 1 at the near plane to 0 at an infinite far plane, and the float exponent keeps the precision even
+    // out to any distance. X adds a depth-only pre-pass, so the color pass shades just the fragment in front at each pixel
+    bool gReverseZ = false;
+    bool gDepthPrepass = false;
+    GLuint gDepthProgramId;
+    GLint gDepthModelLocation;
+    GLint gDepthViewProjectionLocation;
+    GLuint gGpuDepthProgramId;
+    GLint gGpuDepthViewProjectionLocation;
+    GLint gGpuDepthGroupOffsetLocation;
+
+    // Picking (left click): the objects whose bounds touch the few pixels at the middle of the view are drawn with their
+    // index into a small ID target, read back a frame or two later without stalling. The CPU ray cast against the BVH
+    // runs alongside, and both answers are printed
+    GpuPicker gPicker;
+    bool gPickerReady = false;
+    bool gPickRequested = false;
+    std::vector<uint32_t> gPickObjects;
+    GLuint gPickProgramId;
+    GLint gPickModelLocation;
+    GLint gPickViewProjectionLocation;
+    GLint gPickObjectLocation;
+
+    // Frame capture: F9 writes every frame to capture_00000.png, capture_00001.png..., F10 streams the frames to
+    // capture.y4m, which can be a named pipe a video encoder reads from. The pixels are read back without waiting for the
+    // GPU and encoded on a thread of their own; the same key stops the capture, and so does resizing the window
+    const char* const CAPTURE_PNG_PREFIX = "capture_";
+    const char* const CAPTURE_Y4M_PATH = "capture.y4m";
+    const int CAPTURE_FRAMES_PER_SECOND = 60;
+    FrameCapture gCapture;
+
+    // GPU particles (F cycles the budget: off, 64K, 1M): fountains around the table spawn particles that fall, bounce off
+    // the floor and fade. Spawning, simulating and retiring them all run in compute shaders, and the living particles are
+    // drawn as point sprites straight from their buffers. H steps the CPU reference simulation alongside the GPU for one
+    // frame and prints how far apart the two end up
+    const uint32_t PARTICLE_BUDGETS[] = { 0, 65536, 1u << 20 };
+    const int PARTICLE_EMITTERS = 4;
+    const float PARTICLE_FLOOR = -4.51f;        // where the table legs end
+    const float PARTICLE_SIZE = 0.015f;         // half the width of a particle
+    int gParticleBudget = 0;
+    bool gValidateParticles = false;
+    GpuParticleSystem gParticles;
+    ParticleEmitter gParticleEmitters[PARTICLE_EMITTERS];
+    ParticleStep gParticleStep;
+    uint32_t gParticleNextId = 0;
+    ParticleSimulator gParticleReference;
+    ParticleSimulator gParticleResult;
+    GLuint gParticleProgramId;
+    GLint gParticleViewProjectionLocation;
+    GLint gParticlePointScaleLocation;
+    GLint gParticleAliveOffsetLocation;
+
+    // Out-of-core geometry (toggled with V): a large terrain "site" is cut into chunks in a file on disk, and only the
+    // chunks in view or ahead of the moving camera are kept in GPU memory, within SITE_BUDGET. The file is written the
+    // first time the site is shown. Not drawn by the GPU-driven path
+    const char* const SITE_PATH = "site.mchk";
+    const int SITE_QUADS = 512;
+    const float SITE_SIZE = 256.0f;
+    const uint64_t SITE_BUDGET = 4ull << 20;
+    bool gSiteVisible = false;
+    bool gSiteReady = false;
+    MeshPager gMeshPager;
+    uint32_t gSiteMaterials;
+    CommandList gSiteCommands;
+    glm::vec3 gSiteLastEye;
+    double gSiteLastTime = 0.0;
+
+    // GPU-driven path (toggled with G): culling and draw commands are produced by a compute shader
+    bool gGpuDriven = false;
+    GLuint gGpuProgramId;
+    GLint gGpuViewProjectionLocation;
+    GLint gGpuGroupOffsetLocation;
+    GpuCuller gGpuCuller;
+    std::vector<GpuObject> gGpuObjects;
+    std::vector<const GLMesh*> gDrawGroupMeshes;   // one draw group per distinct mesh and texture; materials do not split groups
+    std::vector<TextureHandle> gDrawGroupTextures;
 
     Camera camera(glm::vec3(0.f, 1.f, 3.f));
+
+    // Window events are queued by the main (input) thread and drained once per frame by the render thread
+    InputQueue gInputQueue;
+    InputFrame gInput;
+
+    // Only touched by the input thread
     float lastX = WINDOW_WIDTH / 2.0f;
     float lastY = WINDOW_HEIGHT / 2.0f;
     bool firstMouse = true;
-    bool usePerspective = false;
+    float pendingMouseX = 0.0f;
+    float pendingMouseY = 0.0f;
 }
 
 /* User-defined Function prototypes to:
@@ -53,29 +343,78 @@ namespace
  */
 bool UInitialize(int, char* [], GLFWwindow** window);
 void UResizeWindow(GLFWwindow* window, int width, int height);
-void UProcessInput(GLFWwindow* window);
-void UCreateMeshFromVerts(GLMesh& mesh, std::vector<GLfloat> const& verts, std::vector<GLushort> const& indices);
+void UProcessInput(GLFWwindow* window, const InputFrame& input);
+void UCreateMeshFromVerts(GLMesh& mesh, const GLfloat* verts, size_t vertexCount, const GLushort* indices, size_t indexCount);
+void UMergeStaticObjects();
+void UBuildStaticBatches();
+void UReportStaticBatches();
 void URenderMesh(const GLMesh& mesh);
 void UDestroyMesh(GLMesh& mesh);
 void URender();
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId);
+void UBeginFrame();
+void UPresentFrame();
+bool UCreateRenderTarget();
+void UBeginDepthPrepass();
+void UEndDepthPrepass();
+void URenderLoop();
+void UUpdateScene();
+void UPickObject();
+void URenderPick();
+void UToggleCapture(Capture_Format format);
+void UStopCapture();
+void UCycleParticles();
+void URenderParticles(const glm::mat4& viewProjection);
+void UValidateParticles();
+void UCullOccluded(const glm::mat4& viewProjection);
+void UCheckAllocations(uint64_t allocations);
+void UReportGpuMemory();
+void UReportBufferHeap(const char* name, const BufferHeapStats& stats);
+void UReportLatency();
+bool UCreateSite();
+void UPageSite(const Frustum& frustum, const glm::mat4& viewProjection);
+void UReportSite();
+void UStreamTextures();
+void UUpdateLights(const glm::mat4& view, const glm::mat4& projection);
+void UUploadLights();
+GLuint UGetDiffuseTexture(TextureHandle texture);
+void UReportJobTimings();
+void UUploadGpuScene(bool rebuildGroups);
+void URenderGpuDriven(const glm::mat4& viewProjection);
+void UQueueInput(const InputEvent& event);
+bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId, const char* owner);
 void UDestroyShaderProgram(GLuint programId);
 
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods);
+void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 
 // Vertex Shader Program Source Code
 const char* vertexShaderSource = "#version 440 core\n"
 "layout (location = 0) in vec3 aPos;\n"
-"layout (location = 1) in vec4 colorFromVBO;\n"
-
-"uniform mat4 transform = mat4(1.0);\n"
-
-"out vec4 colorFromVS;\n"
+"layout (location = 1) in float materialSlot;\n"
+"layout (location = 2) in vec2 aUv;\n"
+"layout (location = 3) in vec3 aNormal;\n"
+
+"uniform mat4 model = mat4(1.0);\n"
+"uniform mat4 viewProjection = mat4(1.0);\n"
+"uniform uint materialBase;\n"
+
+"flat out uint materialFromVS;\n"
+"out vec2 uvFromVS;\n"
+"out vec3 worldFromVS;\n"
+"out vec3 normalFromVS;\n"
+"out vec4 clipFromVS;\n"
+"invariant gl_Position;\n"
 "void main()\n"
 "{\n"
-"   gl_Position = transform * vec4(aPos.x , aPos.y, aPos.z, 1.0);\n"
-"   colorFromVS = colorFromVBO;\n"
+"   worldFromVS = vec3(model * vec4(aPos, 1.0));\n"
+"   normalFromVS = transpose(inverse(mat3(model))) * aNormal;\n"
+"   gl_Position = viewProjection * vec4(worldFromVS, 1.0);\n"
+"   clipFromVS = gl_Position;\n"
+"   materialFromVS = materialBase + uint(materialSlot);\n"
+"   uvFromVS = aUv;\n"
 "}\n\0";
 
 /*
@@ -85,13 +424,152 @@ const char* vertexShaderSource = "#version 440 core\n"
 0   0   0   1
 */
 
-// Fragment Shader Program Source Code
+// Vertex Shader for the GPU-driven path: the model matrix comes from the object buffer, indexed through the
+// visible list the culling compute shader wrote for this draw group. The object's first material rides in boundsMax.w
+const char* gpuVertexShaderSource = "#version 440 core\n"
+"layout (location = 0) in vec3 aPos;\n"
+"layout (location = 1) in float materialSlot;\n"
+"layout (location = 2) in vec2 aUv;\n"
+"layout (location = 3) in vec3 aNormal;\n"
+
+"struct Object { mat4 model; vec4 boundsMin; vec4 boundsMax; };\n"
+"layout (std430, binding = 0) readonly buffer Objects { Object objects[]; };\n"
+"layout (std430, binding = 1) readonly buffer Visible { uint visible[]; };\n"
+
+"uniform mat4 viewProjection;\n"
+"uniform uint groupOffset;\n"
+
+"flat out uint materialFromVS;\n"
+"out vec2 uvFromVS;\n"
+"out vec3 worldFromVS;\n"
+"out vec3 normalFromVS;\n"
+"out vec4 clipFromVS;\n"
+"invariant gl_Position;\n"
+"void main()\n"
+"{\n"
+"   uint object = visible[groupOffset + uint(gl_InstanceID)];\n"
+"   worldFromVS = vec3(objects[object].model * vec4(aPos, 1.0));\n"
+"   normalFromVS = transpose(inverse(mat3(objects[object].model))) * aNormal;\n"
+"   gl_Position = viewProjection * vec4(worldFromVS, 1.0);\n"
+"   clipFromVS = gl_Position;\n"
+"   materialFromVS = uint(objects[object].boundsMax.w) + uint(materialSlot);\n"
+"   uvFromVS = aUv;\n"
+"}\n\0";
+
+// Depth pre-pass shaders: only the position, computed exactly as the color pass computes it (gl_Position is invariant in
+// both) so the color pass can test against the depth written here. The GPU-driven path pairs its own vertex shader with
+// the empty fragment shader
+const char* depthVertexShaderSource = "#version 440 core\n"
+"layout (location = 0) in vec3 aPos;\n"
+"uniform mat4 model = mat4(1.0);\n"
+"uniform mat4 viewProjection = mat4(1.0);\n"
+"invariant gl_Position;\n"
+"void main()\n"
+"{\n"
+"   vec3 world = vec3(model * vec4(aPos, 1.0));\n"
+"   gl_Position = viewProjection * vec4(world, 1.0);\n"
+"}\n\0";
+
+const char* depthFragmentShaderSource = "#version 440 core\n"
+"void main()\n"
+"{\n"
+"}\n\0";
+
+// Particle billboards, pulled from the particle buffers without any vertex attributes: vertex n is the point sprite of
+// living particle n, sized to PARTICLE_SIZE across in the world. One vertex a particle rather than a quad's six keeps the
+// vertex work down at a million particles. The color cools and dims with age
+const char* particleVertexShaderSource = "#version 440 core\n"
+"layout (std430, binding = 7) readonly buffer Positions { vec4 positionAge[]; };\n"
+"layout (std430, binding = 8) readonly buffer Velocities { vec4 velocityLife[]; };\n"
+"layout (std430, binding = 11) readonly buffer Alive { uint alive[]; };\n"
+
+"uniform mat4 viewProjection;\n"
+"uniform float pointScale;\n"
+"uniform uint aliveOffset;\n"
+
+"out vec3 colorFromVS;\n"
+"void main()\n"
+"{\n"
+"   uint particle = alive[aliveOffset + uint(gl_VertexID)];\n"
+"   vec4 positionAge = positionAge[particle];\n"
+"   float age = clamp(positionAge.w / velocityLife[particle].w, 0.0, 1.0);\n"
+"   gl_Position = viewProjection * vec4(positionAge.xyz, 1.0);\n"
+"   gl_PointSize = max(pointScale / gl_Position.w, 1.0);\n"
+"   colorFromVS = mix(vec3(1.0, 0.8, 0.4), vec3(0.6, 0.1, 0.05), age) * (1.0 - age);\n"
+"}\n\0";
+
+// Particle fragment shader: a round spot, brightest in the middle, added to what is behind it
+const char* particleFragmentShaderSource = "#version 440 core\n"
+"in vec3 colorFromVS;\n"
+"out vec4 FragColor;\n"
+"void main()\n"
+"{\n"
+"   vec2 corner = gl_PointCoord * 2.0 - 1.0;\n"
+"   float falloff = 1.0 - dot(corner, corner);\n"
+"   if (falloff <= 0.0)\n"
+"       discard;\n"
+"   FragColor = vec4(colorFromVS * falloff, 1.0);\n"
+"}\n\0";
+
+// Picking fragment shader, paired with the depth pre-pass vertex shader: the object's index plus one, 0 being nothing
+const char* pickFragmentShaderSource = "#version 440 core\n"
+"uniform uint objectId;\n"
+"layout (location = 0) out uint FragId;\n"
+"void main()\n"
+"{\n"
+"   FragId = objectId;\n"
+"}\n\0";
+
+// Fragment Shader Program Source Code: ambient plus the point lights of the fragment's cluster. The interpolated vertex
+// normal is turned to face the eye, so the back of a face is lit like its front. The cluster tile does not trust the
+// window's orientation: llvmpipe flips gl_FragCoord.y in a framebuffer object until a draw with another program
+// revalidates it, so the tile comes from the clip position
 const char* fragmentShaderSource = "#version 440 core\n"
-"in vec4 colorFromVS;\n"
+"struct Material { vec4 ambient; vec4 diffuse; vec4 specular; vec4 params; };\n"
+"layout (std430, binding = 3) readonly buffer Materials { Material materials[]; };\n"
+
+"struct Light { vec4 positionRadius; vec4 colorIntensity; };\n"
+"struct ClusterRange { uint offset; uint count; };\n"
+"layout (std430, binding = 4) readonly buffer Lights { Light lights[]; };\n"
+"layout (std430, binding = 5) readonly buffer Clusters { mat4 clusterView; uvec4 clusterCounts; vec4 clusterSlicing; vec4 clusterEye; vec4 ambient; ClusterRange clusters[]; };\n"
+"layout (std430, binding = 6) readonly buffer ClusterLights { uint clusterLights[]; };\n"
+
+"flat in uint materialFromVS;\n"
+"in vec2 uvFromVS;\n"
+"in vec3 worldFromVS;\n"
+"in vec3 normalFromVS;\n"
+"in vec4 clipFromVS;\n"
+"uniform sampler2D diffuseMap;\n"
 "out vec4 FragColor;\n"
 "void main()\n"
 "{\n"
-"   FragColor = colorFromVS;\n"
+"   Material material = materials[materialFromVS];\n"
+"   vec4 albedo = material.diffuse * texture(diffuseMap, uvFromVS);\n"
+"   vec3 color = albedo.rgb * ambient.rgb;\n"
+"   if (clusterCounts.w > 0u)\n"
+"   {\n"
+"       vec3 normal = normalize(normalFromVS);\n"
+"       vec3 toEye = normalize(clusterEye.xyz - worldFromVS);\n"
+"       normal = faceforward(normal, -toEye, normal);\n"
+"       float depth = -(clusterView * vec4(worldFromVS, 1.0)).z;\n"
+"       float slice = log(max(depth, 1e-6)) * clusterSlicing.z + clusterSlicing.w;\n"
+"       vec2 screen = clamp(clipFromVS.xy / clipFromVS.w * 0.5 + 0.5, 0.0, 1.0);\n"
+"       uvec2 tile = min(uvec2(screen * vec2(clusterCounts.xy)), clusterCounts.xy - 1u);\n"
+"       uint cell = (uint(clamp(slice, 0.0, float(clusterCounts.z - 1u))) * clusterCounts.y + tile.y) * clusterCounts.x + tile.x;\n"
+"       ClusterRange range = clusters[cell];\n"
+"       for (uint i = 0u; i < range.count; ++i)\n"
+"       {\n"
+"           Light light = lights[clusterLights[range.offset + i]];\n"
+"           vec3 toLight = light.positionRadius.xyz - worldFromVS;\n"
+"           float distance = length(toLight);\n"
+"           float falloff = clamp(1.0 - distance / light.positionRadius.w, 0.0, 1.0);\n"
+"           vec3 l = toLight / max(distance, 1e-4);\n"
+"           vec3 h = normalize(l + toEye);\n"
+"           vec3 radiance = light.colorIntensity.rgb * light.colorIntensity.w * falloff * falloff;\n"
+"           color += radiance * (albedo.rgb * max(dot(normal, l), 0.0) + material.specular.rgb * pow(max(dot(normal, h), 0.0), max(material.specular.w, 1.0)));\n"
+"       }\n"
+"   }\n"
+"   FragColor = vec4(color, albedo.a);\n"
 "}\n\0";
 
 
@@ -102,95 +580,147 @@ int main(int argc, char* argv[])
         return EXIT_FAILURE;
 
     {
-#define RED -1.0,-1.0,-1.0,-1.0
-#define GREEN 0.1,1.0,0.3,1.0
-        std::vector<GLfloat> verts = {
-            -1, -1, -1, RED,    // 0
-            -1, -1,  1, RED,    // 1
-            -1,  1, -1, GREEN,  // 2
-            -1,  1,  1, GREEN,  // 3
-             1, -1, -1, RED,    // 4
-             1, -1,  1, RED,    // 5
-             1,  1, -1, GREEN,  // 6
-             1,  1,  1, GREEN   // 7
-        };
-#undef RED
-#undef GREEN
-
-#define YELLOW 0.6,0.6,0.0,1.0
-        std::vector<GLfloat> vertsTable = {
-            -1, -1, -1, YELLOW,    // 0
-            -1, -1,  1, YELLOW,    // 1
-            -1,  1, -1, YELLOW,  // 2
-            -1,  1,  1, YELLOW,  // 3
-             1, -1, -1, YELLOW,    // 4
-             1, -1,  1, YELLOW,    // 5
-             1,  1, -1, YELLOW,  // 6
-             1,  1,  1, YELLOW   // 7
-        };
-#undef YELLOW
-#define RED -1.0,-1.0,-1.0,-1.0
-        std::vector<GLfloat> vertswalls = {
-            -1, -1, -1, RED,    // 0
-            -1, -1,  1, RED,    // 1
-            -1,  1, -1, RED,  // 2
-            -1,  1,  1, RED,  // 3
-             1, -1, -1, RED,    // 4
-             1, -1,  1, RED,    // 5
-             1,  1, -1, RED,  // 6
-             1,  1,  1, RED   // 7
-        };
-#undef RED
-
-        std::vector<GLushort> indices = {
-            0, 2, 1, // left
-            1, 2, 3,
-            4, 6, 5, // right
-            5, 6, 7,
-            2, 6, 3, // top
-            3, 6, 7,
-            0, 4, 1, // bottom
-            1, 4, 5,
-            1, 5, 3, // front
-            3, 5, 7,
-            0, 4, 2, // back
-            2, 4, 6
-        };
-      
-        // Create the mesh
-        UCreateMeshFromVerts(gMeshCube, verts, indices); // Calls the function to create the Vertex Buffer Object
-        UCreateMeshFromVerts(gMeshTable, vertsTable, indices); // Calls the function to create the Vertex Buffer Object
-        UCreateMeshFromVerts(gMeshwalls, vertswalls, indices); // Calls the function to create the Vertex Buffer Object
-        
+        // Position, material slot, UV and normal: the bottom of the box uses slot 0, the rest slot 1. The colors come from
+        // the material set each draw picks, so the box and the table share this one mesh. The diffuse map is projected
+        // from above rather than wrapped per face. Built at compile time, so the upload reads straight from read-only data
+        static constexpr PrimitiveMesh<24, 36> cube = MakeCube();
+        static constexpr auto verts = Interleave<PRIMITIVE_POSITION, FLOATS_PER_VERTEX - 3>(cube, [](const PrimitiveVertex& vertex) {
+            return std::array<float, FLOATS_PER_VERTEX - 3>{ vertex.Normal[1] < 0.0f ? 0.0f : 1.0f, vertex.Position[0] * 0.5f + 0.5f, vertex.Position[2] * 0.5f + 0.5f,
+                vertex.Normal[0], vertex.Normal[1], vertex.Normal[2] };
+        });
+
+        // Create the mesh. The heap's attributes are x, y, z; the material slot, added to the draw's material base; u, v;
+        // the normal
+        gMeshHeap.Create({ 3, 1, 2, 3 }, "scene meshes", MESH_HEAP_ARENA);
+        UCreateMeshFromVerts(gMeshCube, verts.data(), cube.GetVertexCount(), cube.Indices.data(), cube.GetIndexCount()); // Copies it into the mesh heap
+    }
+
+    // Materials for the two slots of the box mesh: the box is black below and green on top, the table yellow all over
+    {
+        Material black, green, yellow, ground;
+        black.Diffuse = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        green.Diffuse = glm::vec4(0.1f, 1.0f, 0.3f, 1.0f);
+        yellow.Diffuse = glm::vec4(0.6f, 0.6f, 0.0f, 1.0f);
+        ground.Diffuse = glm::vec4(0.35f, 0.3f, 0.25f, 1.0f);
+
+        gMaterials.Create();
+        gBoxMaterials = gMaterials.AddSet("box", { black, green });
+        gTableMaterials = gMaterials.AddSet("table", { yellow, yellow });
+        gSiteMaterials = gMaterials.AddSet("site", { ground });
+        gMaterials.Upload();
     }
 
 
     // Create the shader program
-    if (!UCreateShaderProgram(vertexShaderSource, fragmentShaderSource, gProgramId))
+    if (!UCreateShaderProgram(vertexShaderSource, fragmentShaderSource, gProgramId, "scene shaders"))
         return EXIT_FAILURE;
+    gModelLocation = glGetUniformLocation(gProgramId, "model");
+    gViewProjectionLocation = glGetUniformLocation(gProgramId, "viewProjection");
+    gMaterialBaseLocation = glGetUniformLocation(gProgramId, "materialBase");
+    if (!UCreateShaderProgram(depthVertexShaderSource, depthFragmentShaderSource, gDepthProgramId, "scene shaders"))
+        return EXIT_FAILURE;
+    gDepthModelLocation = glGetUniformLocation(gDepthProgramId, "model");
+    gDepthViewProjectionLocation = glGetUniformLocation(gDepthProgramId, "viewProjection");
+    if (!UCreateShaderProgram(depthVertexShaderSource, pickFragmentShaderSource, gPickProgramId, "picking"))
+        return EXIT_FAILURE;
+    gPickModelLocation = glGetUniformLocation(gPickProgramId, "model");
+    gPickViewProjectionLocation = glGetUniformLocation(gPickProgramId, "viewProjection");
+    gPickObjectLocation = glGetUniformLocation(gPickProgramId, "objectId");
+    if (!UCreateShaderProgram(particleVertexShaderSource, particleFragmentShaderSource, gParticleProgramId, "particles"))
+        return EXIT_FAILURE;
+    gParticleViewProjectionLocation = glGetUniformLocation(gParticleProgramId, "viewProjection");
+    gParticlePointScaleLocation = glGetUniformLocation(gParticleProgramId, "pointScale");
+    gParticleAliveOffsetLocation = glGetUniformLocation(gParticleProgramId, "aliveOffset");
+
+    // One white texel stands in for missing textures, so the shader does not need a branch
+    const GLubyte white[4] = { 255, 255, 255, 255 };
+    glGenTextures(1, &gWhiteTexture);
+    glBindTexture(GL_TEXTURE_2D, gWhiteTexture);
+    UTexStorage2D(gWhiteTexture, 1, GL_RGBA8, 1, 1, "white texel");
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, white);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    gTextureStreamer.Create();
+    if (argc > 1)
+        gTableTexture = gTextureStreamer.Add(argv[1]);
+    if (argc > 2)
+        gCubeTexture = gTextureStreamer.Add(argv[2]);
+
+    // Frames are timed on the GPU for dynamic resolution, and fenced for pacing
+    gGpuTimer.Create();
+    gFramePacer.Create(glfwGetTime);
+    gPickerReady = gPicker.Create();
+
+    // Place the objects and build the BVH over them
+    gOcclusionCuller.SetJobSystem(&gJobs);
+    gClusters.SetJobSystem(&gJobs);
+    gParticleReference.SetJobSystem(&gJobs);
+    glGenBuffers(3, gLightBuffers);
+    UUpdateScene();
+    gSceneBvh.Build(gSceneBounds);
+    UReportStaticBatches();
+
+    // The GPU-driven path gets its own copy of the scene in shader storage buffers
+    if (!UCreateShaderProgram(gpuVertexShaderSource, fragmentShaderSource, gGpuProgramId, "gpu culling") || !gGpuCuller.Create()
+        || !UCreateShaderProgram(gpuVertexShaderSource, depthFragmentShaderSource, gGpuDepthProgramId, "gpu culling"))
+        return EXIT_FAILURE;
+    gGpuViewProjectionLocation = glGetUniformLocation(gGpuProgramId, "viewProjection");
+    gGpuGroupOffsetLocation = glGetUniformLocation(gGpuProgramId, "groupOffset");
+    gGpuDepthViewProjectionLocation = glGetUniformLocation(gGpuDepthProgramId, "viewProjection");
+    gGpuDepthGroupOffsetLocation = glGetUniformLocation(gGpuDepthProgramId, "groupOffset");
+    UUploadGpuScene(true);
 
     // Sets the background color of the window to black (it will be implicitely used by glClear)
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
-    // render loop
-    // -----------
+    // The GL context moves to the render thread; this thread only services window events from here on
+    glfwMakeContextCurrent(NULL);
+    std::thread renderThread(URenderLoop);
+
+    // input loop
+    // ----------
     while (!glfwWindowShouldClose(gWindow))
     {
-        // input
-        // -----
-        UProcessInput(gWindow);
-
-        // Render this frame
-        URender();
-
-        glfwPollEvents();
+        glfwWaitEvents();
     }
 
+    renderThread.join();
+    glfwMakeContextCurrent(gWindow);
+
     // Release mesh data
     UDestroyMesh(gMeshCube);
+    for (GLMesh& mesh : gStaticBatchMeshes)
+        UDestroyMesh(mesh);
+    gMeshHeap.Destroy();
+    if (gSiteReady)
+        gMeshPager.Destroy();
+
+    // Release textures
+    gTextureStreamer.Destroy();
+    UDeleteTextures(1, &gWhiteTexture);
 
     // Release shader program
     UDestroyShaderProgram(gProgramId);
+    UDestroyShaderProgram(gGpuProgramId);
+    UDestroyShaderProgram(gDepthProgramId);
+    UDestroyShaderProgram(gGpuDepthProgramId);
+    UDestroyShaderProgram(gPickProgramId);
+    UDestroyShaderProgram(gParticleProgramId);
+    gMaterials.Destroy();
+    gGpuTimer.Destroy();
+    gFramePacer.Destroy();
+    gPicker.Destroy();
+    UStopCapture();
+    if (PARTICLE_BUDGETS[gParticleBudget] > 0)
+        gParticles.Destroy();
+    if (gRenderTargetReady)
+        gRenderTarget.Destroy();
+    UDeleteBuffers(3, gLightBuffers);
+    gGpuCuller.Destroy();
+
+    // Everything is released by now, so whatever the tracker still holds leaked
+    if (gGpuMemory.ReportLeaks() == 0)
+        cout << "INFO: GPU memory: nothing leaked, peak " << gGpuMemory.GetPeakTotalBytes() / 1024 << " KB" << endl;
 
     exit(EXIT_SUCCESS); // Terminates the program successfully
 }
@@ -220,7 +750,13 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
         return false;
     }
     glfwMakeContextCurrent(*window);
-    glfwSetFramebufferSizeCallback(*window, UResizeWindow);
+    glfwSetFramebufferSizeCallback(*window, framebuffer_size_callback);
+
+    // Start in the orthographic view, sized to the real framebuffer
+    int framebufferWidth, framebufferHeight;
+    glfwGetFramebufferSize(*window, &framebufferWidth, &framebufferHeight);
+    camera.SetViewport(framebufferWidth, framebufferHeight);
+    camera.SetPerspective(false);
 
     // GLEW: initialize
     // ----------------
@@ -239,6 +775,8 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
 
     glfwSetCursorPosCallback(*window, mouse_callback);
     glfwSetScrollCallback(*window, scroll_callback);
+    glfwSetKeyCallback(*window, key_callback);
+    glfwSetMouseButtonCallback(*window, mouse_button_callback);
 
     // glad: load all OpenGL function pointers
     glfwSetInputMode(*window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
@@ -247,44 +785,398 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
 }
 
 
-// process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
-void UProcessInput(GLFWwindow* window)
+// Runs on its own thread: owns the GL context, drains the input queued since the last frame and renders
+void URenderLoop()
 {
-    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+    glfwMakeContextCurrent(gWindow);
+
+    while (!glfwWindowShouldClose(gWindow))
+    {
+        // last frame's scratch is gone; no jobs are running between frames
+        gFrameArenas.Reset();
+        const uint64_t allocations = UGetHeapAllocations();
+
+        // input: sampled as late as possible, right before it is used. In low latency mode the pacer first waits until
+        // the GPU has caught up, otherwise it waits for a free frame slot after the input was read
+        // -----
+        gFramePacer.BeginInput();
+        gInput.Drain(gInputQueue);
+        UProcessInput(gWindow, gInput);
+        gFramePacer.BeginRender(gInput.OldestEventTime);
+
+        // Render this frame
+        URender();
+        gFramePacer.EndFrame();
+
+        UCheckAllocations(UGetHeapAllocations() - allocations);
+    }
+
+    UReportLatency();
+
+    // Hand the context back and wake the input thread in case it is waiting for events
+    glfwMakeContextCurrent(NULL);
+    glfwPostEmptyEvent();
+}
+
+
+// process all input gathered since the last frame and react accordingly. The camera is updated once per frame
+void UProcessInput(GLFWwindow* window, const InputFrame& input)
+{
+    if (input.IsKeyDown(GLFW_KEY_ESCAPE)) {
         glfwSetWindowShouldClose(window, true);
+        glfwPostEmptyEvent();
+    }
 
-    if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS) {
-        usePerspective = !usePerspective;
+    if (input.WasKeyPressed(GLFW_KEY_P)) {
+        camera.SetPerspective(!camera.IsPerspective());
     }
 
+    if (input.WasKeyPressed(GLFW_KEY_G)) {
+        gGpuDriven = !gGpuDriven;
+        cout << "INFO: GPU-driven culling " << (gGpuDriven ? "on" : "off") << endl;
+    }
+
+    if (input.WasKeyPressed(GLFW_KEY_J)) {
+        gReportJobs = true;
+        gJobs.EnableTiming(true);
+    }
+
+    if (input.WasKeyPressed(GLFW_KEY_T)) {
+        gReportTextures = true;
+    }
+
+    if (input.WasKeyPressed(GLFW_KEY_M)) {
+        gReportMemory = true;
+    }
+
+    if (input.WasKeyPressed(GLFW_KEY_L)) {
+        gLighting = !gLighting;
+        gReportLights = true;
+    }
+
+    if (input.WasKeyPressed(GLFW_KEY_EQUAL) && gLightCount < MAX_LIGHTS) {
+        gLightCount *= 2;
+        gReportLights = true;
+    }
+
+    if (input.WasKeyPressed(GLFW_KEY_MINUS) && gLightCount > 1) {
+        gLightCount /= 2;
+        gReportLights = true;
+    }
+
+    if (input.WasKeyPressed(GLFW_KEY_B)) {
+        gStaticBatching = !gStaticBatching;
+        UUpdateScene();
+        gSceneBvh.Build(gSceneBounds);
+        UUploadGpuScene(true);
+        gLastRejected = -1;
+        UReportStaticBatches();
+    }
+
+    if (input.WasKeyPressed(GLFW_KEY_R)) {
+        gDynamicResolution = !gDynamicResolution && UCreateRenderTarget();
+        gResolution.Reset();
+        cout << "INFO: Dynamic resolution " << (gDynamicResolution ? "on" : "off") << ": scale " << gResolution.GetMinScale() << " to "
+            << gResolution.GetMaxScale() << ", target " << gResolution.GetTargetMs() << " ms of GPU time" << endl;
+    }
+
+    // [ and ] halve and double the GPU time the dynamic resolution aims for
+    if (input.WasKeyPressed(GLFW_KEY_LEFT_BRACKET) || input.WasKeyPressed(GLFW_KEY_RIGHT_BRACKET)) {
+        const float factor = input.WasKeyPressed(GLFW_KEY_LEFT_BRACKET) ? 0.5f : 2.0f;
+        gResolution.SetTarget(gResolution.GetTargetMs() * factor);
+        cout << "INFO: Dynamic resolution target " << gResolution.GetTargetMs() << " ms of GPU time" << endl;
+    }
+
+    if (input.WasKeyPressed(GLFW_KEY_Z)) {
+        if (!GLEW_ARB_clip_control)
+            cout << "ERROR::DEPTH::NO_CLIP_CONTROL reversed-Z needs glClipControl (OpenGL 4.5)" << endl;
+        else
+        {
+            gReverseZ = !gReverseZ && UCreateRenderTarget();
+            glClipControl(GL_LOWER_LEFT, gReverseZ ? GL_ZERO_TO_ONE : GL_NEGATIVE_ONE_TO_ONE);
+            camera.SetReverseZ(gReverseZ);
+            cout << "INFO: Reversed-Z " << (gReverseZ ? "on: float depth, infinite far plane" : "off") << endl;
+        }
+    }
+
+    if (input.WasKeyPressed(GLFW_KEY_X)) {
+        gDepthPrepass = !gDepthPrepass;
+        cout << "INFO: Depth pre-pass " << (gDepthPrepass ? "on" : "off") << endl;
+    }
+
+    // the paging stats are reported when the site is hidden; showing it the first time writes its chunk file
+    if (input.WasKeyPressed(GLFW_KEY_V)) {
+        if (gSiteVisible)
+            UReportSite();
+        gSiteVisible = !gSiteVisible && (gSiteReady || UCreateSite());
+        gSiteLastEye = camera.GetPosition();
+        gSiteLastTime = glfwGetTime();
+        cout << "INFO: Site " << (gSiteVisible ? "on" : "off") << endl;
+    }
+
+    // the report before the switch gives what culling meshlets saved, or cost
+    if (input.WasKeyPressed(GLFW_KEY_C) && gSiteVisible) {
+        UReportSite();
+        gMeshPager.SetMeshletCulling(!gMeshPager.IsMeshletCulling());
+        cout << "INFO: Site meshlet culling " << (gMeshPager.IsMeshletCulling() ? "on" : "off") << endl;
+    }
+
+    // the latency measured so far is reported for the mode it was measured in
+    if (input.WasKeyPressed(GLFW_KEY_K)) {
+        UReportLatency();
+        gFramePacer.SetLowLatency(!gFramePacer.IsLowLatency());
+        gFramePacer.ResetStats();
+        cout << "INFO: Low latency mode " << (gFramePacer.IsLowLatency() ? "on" : "off") << endl;
+    }
+
+    if (input.WasKeyPressed(GLFW_KEY_N)) {
+        UReportLatency();
+        gFramePacer.SetMaxFramesInFlight(gFramePacer.GetMaxFramesInFlight() % 3 + 1);
+        gFramePacer.ResetStats();
+        cout << "INFO: At most " << gFramePacer.GetMaxFramesInFlight() << " frames in flight" << endl;
+    }
+
+    if (input.WasKeyPressed(GLFW_KEY_O)) {
+        gOcclusionCulling = !gOcclusionCulling;
+        gLastRejected = -1;
+        cout << "INFO: Occlusion culling " << (gOcclusionCulling ? "on" : "off") << endl;
+    }
+
+    if (input.WasKeyPressed(GLFW_KEY_F9))
+        UToggleCapture(CAPTURE_PNG);
+    if (input.WasKeyPressed(GLFW_KEY_F10))
+        UToggleCapture(CAPTURE_Y4M);
+
+    if (input.WasKeyPressed(GLFW_KEY_F))
+        UCycleParticles();
+    if (input.WasKeyPressed(GLFW_KEY_H) && PARTICLE_BUDGETS[gParticleBudget] > 0)
+        gValidateParticles = true;
+
+    if (input.Resized)
+        UResizeWindow(window, input.Width, input.Height);
+
+    if (input.WasButtonPressed(GLFW_MOUSE_BUTTON_LEFT))
+        UPickObject();
+
+    if (input.MouseX != 0.0f || input.MouseY != 0.0f)
+        camera.ProcessMouseMovement(input.MouseX, input.MouseY);
+    if (input.Scroll != 0.0f)
+        camera.ProcessMouseScroll(input.Scroll);
+
     const float deltaTime = 1.f / 60.f;
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+    if (input.IsKeyDown(GLFW_KEY_W))
         camera.ProcessKeyboard(FORWARD, deltaTime);
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+    if (input.IsKeyDown(GLFW_KEY_S))
         camera.ProcessKeyboard(BACKWARD, deltaTime);
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
+    if (input.IsKeyDown(GLFW_KEY_A))
         camera.ProcessKeyboard(LEFT, deltaTime);
-    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+    if (input.IsKeyDown(GLFW_KEY_D))
         camera.ProcessKeyboard(RIGHT, deltaTime);
-    if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
+    if (input.IsKeyDown(GLFW_KEY_Q))
         camera.ProcessKeyboard(UP, deltaTime);
-    if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
+    if (input.IsKeyDown(GLFW_KEY_E))
         camera.ProcessKeyboard(DOWN, deltaTime);
 }
 
 
-// glfw: whenever the window size changed (by OS or user resize) this callback function executes
+// called on the render thread when the input thread reported a new framebuffer size
 void UResizeWindow(GLFWwindow* window, int width, int height)
 {
+    // captured frames all have the size the capture started with
+    UStopCapture();
     glViewport(0, 0, width, height);
+    camera.SetViewport(width, height);
+    if (gRenderTargetReady)
+        gRenderTarget.Resize(width, height);
 }
 
 float angle = 0.f;
 
+// Places every object of the scene and updates its world space bounds. Call again (and refit the BVH) whenever angle changes
+void UUpdateScene()
+{
+    gSceneObjects.clear();
+    {
+        glm::mat4 model = glm::mat4(1.0f);
+        model = glm::translate(model, glm::vec3(-0.70, 0.0, 0.5));
+        model = glm::rotate(model, angle, glm::vec3(0.f, 1.f, 0.f));
+        model = glm::scale(model, glm::vec3(0.20, 0.90, 0.4));
+
+        gSceneObjects.push_back({ &gMeshCube, model, false, gCubeTexture, gBoxMaterials });
+    }
+    {
+        glm::mat4 tableModel = glm::mat4(1.0f);
+        tableModel = glm::translate(tableModel, glm::vec3(-0.70, -0.51, 0));
+        tableModel = glm::rotate(tableModel, angle, glm::vec3(0.f, 1.f, 0.f));
+
+        gSceneObjects.push_back({ &gMeshCube, glm::scale(tableModel, glm::vec3(1.75, 0.10, 0.99)), true, gTableTexture, gTableMaterials, true });
+
+        // legs, one per corner
+        const glm::vec3 legOffsets[] = {
+            glm::vec3(1.75, -2.0, 0.99),
+            glm::vec3(-1.75, -2.0, 0.99),
+            glm::vec3(-1.75, -2.0, -0.99),
+            glm::vec3(1.75, -2.0, -0.99)
+        };
+        for (const glm::vec3& offset : legOffsets)
+        {
+            glm::mat4 model = tableModel;
+            model = glm::translate(model, offset);
+            model = glm::scale(model, glm::vec3(0.1, 2.0, 0.1));
+
+            gSceneObjects.push_back({ &gMeshCube, model, false, gTableTexture, gTableMaterials, true });
+        }
+    }
+
+    UMergeStaticObjects();
+
+    gSceneBounds.resize(gSceneObjects.size());
+    gJobs.ParallelFor("bounds", uint32_t(gSceneObjects.size()), 256, [](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t i = begin; i < end; ++i)
+            gSceneBounds[i] = TransformAabb(gSceneObjects[i].mesh->bounds, gSceneObjects[i].model);
+    });
+}
+
+// Swaps the objects marked static for the batches they merge into. The batches are built on the first call and kept:
+// static objects never move, so later calls only put the same batches back
+void UMergeStaticObjects()
+{
+    if (!gStaticBatching)
+        return;
+    if (gStaticBatchMeshes.empty())
+        UBuildStaticBatches();
+
+    size_t kept = 0;
+    for (size_t i = 0; i < gSceneObjects.size(); ++i)
+    {
+        if (!gSceneObjects[i].isStatic)
+            gSceneObjects[kept++] = gSceneObjects[i];
+    }
+    gSceneObjects.resize(kept);
+    gSceneObjects.insert(gSceneObjects.end(), gStaticBatchObjects.begin(), gStaticBatchObjects.end());
+}
+
+// Merges the static objects of gSceneObjects into one mesh per texture, material set and cell. A batch is an occluder
+// when any object in it was
+void UBuildStaticBatches()
+{
+    std::vector<std::pair<TextureHandle, uint32_t> > groups;
+    std::vector<size_t> sources;
+    gStaticBatcher.Clear();
+    for (size_t i = 0; i < gSceneObjects.size(); ++i)
+    {
+        const SceneObject& object = gSceneObjects[i];
+        if (!object.isStatic)
+            continue;
+        const std::pair<TextureHandle, uint32_t> state(object.texture, object.materials);
+        const uint32_t group = uint32_t(std::find(groups.begin(), groups.end(), state) - groups.begin());
+        if (group == groups.size())
+            groups.push_back(state);
+
+        const GLMesh& mesh = *object.mesh;
+        gStaticBatcher.Add({ mesh.vertices.data(), uint32_t(mesh.positions.size()), FLOATS_PER_VERTEX, mesh.indices.data(), uint32_t(mesh.indices.size()), NORMAL_OFFSET },
+            object.model, group);
+        sources.push_back(i);
+    }
+    gStaticBatcher.Build();
+
+    // the objects point into gStaticBatchMeshes, so it is sized once before any are taken. Meshes of an earlier build are
+    // released first, or their buffers would leak
+    const std::vector<StaticBatch>& batches = gStaticBatcher.GetBatches();
+    for (GLMesh& mesh : gStaticBatchMeshes)
+        UDestroyMesh(mesh);
+    gStaticBatchMeshes.resize(batches.size());
+    gStaticBatchObjects.clear();
+    for (size_t b = 0; b < batches.size(); ++b)
+    {
+        const StaticBatch& batch = batches[b];
+        UCreateMeshFromVerts(gStaticBatchMeshes[b], batch.Vertices.data(), batch.Vertices.size() / FLOATS_PER_VERTEX, batch.Indices.data(), batch.Indices.size());
+
+        bool occluder = false;
+        for (uint32_t instance : batch.Instances)
+            occluder = occluder || gSceneObjects[sources[instance]].occluder;
+        gStaticBatchObjects.push_back({ &gStaticBatchMeshes[b], glm::mat4(1.0f), occluder, groups[batch.Group].first, groups[batch.Group].second });
+    }
+}
+
+void UReportStaticBatches()
+{
+    const StaticBatchStats& stats = gStaticBatcher.GetStats();
+    if (gStaticBatching)
+        cout << "INFO: Static batching on: " << stats.Instances << " static objects merged into " << stats.Batches << " batches (" << stats.Vertices
+            << " vertices, " << stats.Triangles << " triangles, " << stats.Milliseconds << " ms), " << gSceneObjects.size() << " draws" << endl;
+    else
+        cout << "INFO: Static batching off: " << gSceneObjects.size() << " draws" << endl;
+}
+
+// Picks at the middle of the viewport (the cursor is captured, so that is where it points) with the next frame
+void UPickObject()
+{
+    gPickRequested = true;
+}
+
+// Reports the GPU picks whose IDs came back, then starts the one asked for, if any. Both pick at the middle of the
+// viewport: the CPU ray cast hits the closest object bounds along the ray, the GPU the closest triangle around it
+void URenderPick()
+{
+    GpuPickResult result;
+    while (gPickerReady && gPicker.Poll(result))
+    {
+        // the tag is the ray cast's object plus one, 0 when it missed
+        const char* agrees = (result.Hit ? result.Object + 1 : 0) == result.Tag ? ", same as the ray cast" : ", the ray cast differs";
+        if (result.Hit)
+            cout << "INFO: GPU picked object " << result.Object;
+        else
+            cout << "INFO: GPU picked nothing";
+        cout << " (" << result.FramesLate << " frames later, GPU " << result.GpuMs << " ms)" << agrees << endl;
+    }
+
+    if (!gPickRequested)
+        return;
+    gPickRequested = false;
+    const float x = camera.GetViewportWidth() * 0.5f;
+    const float y = camera.GetViewportHeight() * 0.5f;
+
+    const double start = glfwGetTime();
+    const Ray ray = camera.GetRay(x, y);
+    uint32_t object;
+    float distance;
+    const bool hit = gSceneBvh.Raycast(ray, FAR_PLANE, object, distance);
+    const double cpuMs = (glfwGetTime() - start) * 1000.0;
+    if (hit)
+        cout << "INFO: Picked object " << object << " at distance " << distance << " (CPU " << cpuMs << " ms)" << endl;
+    else
+        cout << "INFO: Picked nothing (CPU " << cpuMs << " ms)" << endl;
+
+    if (!gPickerReady || !gPicker.Begin(gReverseZ))
+        return;
+    // only the objects in the pick frustum can cover its pixels
+    gPickObjects.clear();
+    gSceneBvh.QueryFrustum(Frustum::FromMatrix(camera.GetPickMatrix(x, y, GPU_PICK_REGION)), gPickObjects);
+    const glm::mat4 pickViewProjection = camera.GetPickMatrix(x, y, GPU_PICK_REGION, true);
+    glUseProgram(gPickProgramId);
+    glUniformMatrix4fv(gPickViewProjectionLocation, 1, GL_FALSE, glm::value_ptr(pickViewProjection));
+    for (uint32_t index : gPickObjects)
+    {
+        glUniformMatrix4fv(gPickModelLocation, 1, GL_FALSE, glm::value_ptr(gSceneObjects[index].model));
+        glUniform1ui(gPickObjectLocation, index + 1);
+        URenderMesh(*gSceneObjects[index].mesh);
+    }
+    glUseProgram(0);
+    gPicker.End(hit ? object + 1 : 0);
+}
+
 // Functioned called to render a frame
 void URender()
 {
-    // Clear the background
+    UBeginFrame();
+
+    // Meshes only move here, before any command list of this frame holds their ranges
+    if (gMeshHeap.Defragment(MESH_HEAP_DEFRAGMENT_PER_FRAME) > 0)
+        UUploadGpuScene(true);
+
+    // Clear the background (and the depth to the far value UBeginFrame set)
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -292,169 +1184,779 @@ void URender()
     glCullFace(GL_FRONT);
     //glEnable(GL_CULL_FACE);
 
-    // Set the shader to be used
-    glUseProgram(gProgramId);
+    gMaterials.Upload();
+    gMaterials.Bind();
 
-    GLint location = glGetUniformLocation(gProgramId, "transform");
-    GLsizei count = 1;
-    GLboolean transpose = GL_FALSE;
-   
+    // Projection and view are cached in the camera and only rebuilt when it moved, zoomed or the window resized. Culling
+    // uses the regular matrix; draws use the reversed-Z one when that is on
+    const glm::mat4& viewProjection = camera.GetViewProjectionMatrix();
+    const glm::mat4& drawViewProjection = camera.GetDrawViewProjectionMatrix();
 
-
-    glm::mat4 projection;
-    if (usePerspective) {
-        projection = glm::perspective(70.f, 1.0f, 0.1f, 100.f);
-    }
-    else {
-        projection = glm::ortho(-2.0f, 2.0f, -2.0f, 2.0f, 0.1f, 100.f);
+    if (gGpuDriven)
+    {
+        UUpdateLights(camera.GetViewMatrix(), camera.GetProjectionMatrix());
+        UUploadLights();
+        URenderGpuDriven(drawViewProjection);
+        URenderParticles(drawViewProjection);
+        URenderPick();
+        UStreamTextures();
+        UPresentFrame();
+        return;
     }
-    
-    //const glm::mat4 view = glm::lookAt(glm::vec3(0.f, 1.f, 3.f), glm::vec3(0.f, 0.f, 0.f), glm::vec3(0.f, 1.f, 0.f));
-    const glm::mat4 view = camera.GetViewMatrix();
-    
- 
+
+    // Culling, light clustering and draw recording run as jobs while this thread waits; recording needs the culling results
+    const Frustum& frustum = camera.GetFrustum();
+    const glm::mat4& view = camera.GetViewMatrix();
+    const glm::mat4& projection = camera.GetProjectionMatrix();
+    gJobs.BeginFrame();
+    JobCounter culled, recorded;
+    gJobs.Run("cull", [&frustum, &viewProjection]()
     {
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(-0.70, 0.0, 0.5));
-        model = glm::rotate(model, angle, glm::vec3(0.f, 1.f, 0.f));
-        model = glm::scale(model, glm::vec3(0.20, 0.90, 0.4));
+        // Only objects whose bounds touch the view frustum are drawn
+        gVisibleObjects.clear();
+        gSceneBvh.QueryFrustum(frustum, gVisibleObjects);
+        if (gOcclusionCulling)
+            UCullOccluded(viewProjection);
+    }, &culled);
+    gJobs.Run("lights", [&view, &projection]()
+    {
+        UUpdateLights(view, projection);
+    }, &culled);
+    gJobs.Run("record", [&drawViewProjection]()
+    {
+        const uint32_t count = uint32_t(gVisibleObjects.size());
+        gRecordedLists = (count + COMMAND_BATCH - 1) / COMMAND_BATCH;
+        if (gCommandLists.size() < gRecordedLists)
+            gCommandLists.resize(gRecordedLists);
+        gJobs.ParallelFor("record batch", count, COMMAND_BATCH, [&drawViewProjection](uint32_t begin, uint32_t end)
+        {
+            CommandList& list = gCommandLists[begin / COMMAND_BATCH];
+            list.Reset();
+            list.SetProgram(gProgramId);
+            list.SetUniform(gViewProjectionLocation, drawViewProjection);
+            for (uint32_t i = begin; i < end; ++i)
+            {
+                const SceneObject& object = gSceneObjects[gVisibleObjects[i]];
+                const BufferRange& range = gMeshHeap.Get(object.mesh->range);
+                list.BindMesh(range.Vao);
+                list.BindTexture(0, UGetDiffuseTexture(object.texture));
+                list.SetUniform(gModelLocation, object.model);
+                list.SetUniform(gMaterialBaseLocation, object.materials);
+                list.DrawIndexed(object.mesh->nIndices, range.FirstIndex, range.BaseVertex);
+            }
+        });
+    }, &recorded, &culled);
+
+    gJobs.Wait(recorded);
+
+    // Only the GL calls are left for this thread, paging the site in among them
+    UUploadLights();
+    UPageSite(frustum, drawViewProjection);
+    if (gDepthPrepass)
+    {
+        UBeginDepthPrepass();
+        GLDepthBackend depthBackend(gDepthProgramId, gModelLocation, gDepthModelLocation, gViewProjectionLocation, gDepthViewProjectionLocation);
+        for (size_t i = 0; i < gRecordedLists; ++i)
+            gCommandLists[i].Execute(depthBackend);
+        gSiteCommands.Execute(depthBackend);
+        UEndDepthPrepass();
+    }
+    GLCommandBackend backend;
+    for (size_t i = 0; i < gRecordedLists; ++i)
+        gCommandLists[i].Execute(backend);
+    gSiteCommands.Execute(backend);
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
 
-        glm::mat4 transform = projection * view * model;
+    URenderParticles(drawViewProjection);
+    URenderPick();
 
-        glUniformMatrix4fv(location, count, transpose, glm::value_ptr(transform));
+    // What was drawn decides which mip levels to stream in next
+    UStreamTextures();
 
-        // Render mesh1
-        URenderMesh(gMeshCube);
+    if (gReportJobs)
+        UReportJobTimings();
+
+
+    //angle += 0.0001;
+    // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
+    UPresentFrame();
+}
+
+
+// Moves to the next particle budget with an empty pool, reporting the GPU time of the steps at the last one. The
+// emitters together spawn a little more than the budget holds once the first particles retire, so the pool runs full
+void UCycleParticles()
+{
+    if (PARTICLE_BUDGETS[gParticleBudget] > 0)
+    {
+        cout << "INFO: Particles: budget " << PARTICLE_BUDGETS[gParticleBudget] << ", GPU " << gParticles.TakeMeanStepMs() << " ms a step" << endl;
+        gParticles.Destroy();
+    }
+    gParticleBudget = (gParticleBudget + 1) % 3;
+    const uint32_t budget = PARTICLE_BUDGETS[gParticleBudget];
+    if (budget == 0)
+    {
+        cout << "INFO: Particles off" << endl;
+        return;
+    }
+    if (!gParticles.Create(budget))
+    {
+        gParticles.Destroy();
+        gParticleBudget = 0;
+        return;
     }
 
+    // one fountain beyond each corner of the table
+    const float life = 2.0f;
+    const glm::vec3 corners[PARTICLE_EMITTERS] = {
+        glm::vec3(-2.8f, -0.41f, 1.4f),
+        glm::vec3(1.4f, -0.41f, 1.4f),
+        glm::vec3(-2.8f, -0.41f, -1.4f),
+        glm::vec3(1.4f, -0.41f, -1.4f)
+    };
+    for (int i = 0; i < PARTICLE_EMITTERS; ++i)
     {
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(-0.70, 0.0, 0.5));
-        model = glm::rotate(model, angle, glm::vec3(0.f, 1.f, 0.f));
-        model = glm::scale(model, glm::vec3(0.20, 0.90, 0.4));
+        ParticleEmitter& emitter = gParticleEmitters[i];
+        emitter.Position = corners[i];
+        emitter.Life = life;
+        emitter.Velocity = glm::vec3(0.0f, 3.5f, 0.0f);
+        emitter.Spread = 1.0f;
+        emitter.Rate = float(budget) / (PARTICLE_EMITTERS * life) * 1.1f;
+        emitter.Carry = 0.0f;
+    }
+    gParticleNextId = 0;
+    cout << "INFO: Particles on: budget " << budget << endl;
+}
 
-        glm::mat4 transform = projection * view * model;
+// Steps the particles and draws them over the scene, blended additively: tested against the scene's depth but not
+// writing it, so they need no sorting. The step is a fixed sixtieth of a second, as the camera's is
+void URenderParticles(const glm::mat4& viewProjection)
+{
+    if (PARTICLE_BUDGETS[gParticleBudget] == 0)
+        return;
+    UScheduleParticles(gParticleEmitters, PARTICLE_EMITTERS, 1.f / 60.f, PARTICLE_FLOOR, gParticleNextId, gParticleStep);
+    if (gValidateParticles)
+        UValidateParticles();
+    else
+        gParticles.Update(gParticleStep);
+
+    glUseProgram(gParticleProgramId);
+    glUniformMatrix4fv(gParticleViewProjectionLocation, 1, GL_FALSE, glm::value_ptr(viewProjection));
+    // pixels across a point one unit from the eye; the vertex shader divides by the distance
+    glUniform1f(gParticlePointScaleLocation, PARTICLE_SIZE * camera.GetProjectionMatrix()[1][1] * gRenderHeight);
+    gParticles.BindForDraw(gParticleAliveOffsetLocation);
+    glDepthMask(GL_FALSE);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    glEnable(GL_PROGRAM_POINT_SIZE);
+    gParticles.Draw();
+    glDisable(GL_PROGRAM_POINT_SIZE);
+    glDisable(GL_BLEND);
+    glDepthMask(GL_TRUE);
+    glUseProgram(0);
+}
 
-        glUniformMatrix4fv(location, count, transpose, glm::value_ptr(transform));
+// Takes this frame's step on the GPU and the CPU reference both, from the particles the GPU has now, and matches the
+// results by id. Waits for the GPU twice to read the particles back
+void UValidateParticles()
+{
+    gValidateParticles = false;
+    gParticleReference.Create(gParticles.GetCapacity());
+    gParticleResult.Create(gParticles.GetCapacity());
+    gParticles.ReadBack(gParticleReference);
+    const uint32_t before = gParticleReference.GetCount();
+    gParticles.Update(gParticleStep);
+
+    const double start = glfwGetTime();
+    gParticleReference.Step(gParticleStep);
+    const double cpuMs = (glfwGetTime() - start) * 1000.0;
+    gParticles.ReadBack(gParticleResult);
+    const ParticleComparison comparison = UCompareParticles(gParticleReference, gParticleResult);
+    cout << "INFO: Particle step checked on the CPU (" << before << " particles, " << cpuMs << " ms): " << comparison.Matched << " matched, "
+        << comparison.Missing << " missing, " << comparison.Extra << " extra, " << comparison.AgeMismatches << " of another age; largest error "
+        << comparison.MaxPositionError << " in position, " << comparison.MaxVelocityError << " in velocity" << endl;
+}
 
-        // Render mesh1
-        URenderMesh(gMeshCube);
+// Points rendering at the offscreen target when dynamic resolution (scaled, and timed on the GPU) or reversed-Z (for the
+// float depth buffer) needs it, at the window otherwise, and sets up the depth test for the depth mode
+void UBeginFrame()
+{
+    if (gDynamicResolution || gReverseZ)
+    {
+        gRenderTarget.Bind(gDynamicResolution ? gResolution.GetScale() : gResolution.GetMaxScale());
+        gRenderWidth = gRenderTarget.GetRenderWidth();
+        gRenderHeight = gRenderTarget.GetRenderHeight();
     }
+    else
     {
-        glm::mat4 tableModel = glm::mat4(1.0f);
-        tableModel = glm::translate(tableModel, glm::vec3(-0.70, -0.51, 0));
-        tableModel = glm::rotate(tableModel, angle, glm::vec3(0.f, 1.f, 0.f));
+        gRenderWidth = camera.GetViewportWidth();
+        gRenderHeight = camera.GetViewportHeight();
+    }
+    if (gDynamicResolution)
+        gGpuTimer.Begin();
 
-        glm::mat4 transform = projection * view * glm::scale(tableModel, glm::vec3(1.75, 0.10, 0.99));
+    // reversed-Z clears to 0, the far end, and keeps what is greater
+    glDepthMask(GL_TRUE);
+    glDepthFunc(gReverseZ ? GL_GREATER : GL_LESS);
+    glClearDepth(gReverseZ ? 0.0 : 1.0);
+}
 
-        glUniformMatrix4fv(location, count, transpose, glm::value_ptr(transform));
+// Stretches the offscreen frame onto the window and feeds the GPU times that have come back to the controller, then
+// captures the frame if that is on and swaps. The results are a few frames old; the controller allows for that
+void UPresentFrame()
+{
+    if (gDynamicResolution)
+        gGpuTimer.End();
+    if (gDynamicResolution || gReverseZ)
+        gRenderTarget.Present();
 
-        // Render mesh1
-        URenderMesh(gMeshTable);
+    if (gDynamicResolution)
+    {
+        double gpuMs;
+        const float scale = gResolution.GetScale();
+        if (gGpuTimer.Poll(gpuMs) && gResolution.Update(gpuMs) != scale)
+            cout << "INFO: Render scale " << gResolution.GetScale() << " (GPU " << gpuMs << " ms, target " << gResolution.GetTargetMs() << " ms)" << endl;
+    }
 
-        {
-            glm::mat4 model = tableModel;
-            model = glm::translate(model, glm::vec3(1.75, -2.0, 0.99));
-            model = glm::scale(model, glm::vec3(0.1, 2.0, 0.1));
+    gCapture.Capture();
+    glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
+}
 
-            glm::mat4 transform = projection * view * model;
+// Starts capturing the window's frames in the format, or stops the capture running in it
+void UToggleCapture(Capture_Format format)
+{
+    const bool running = gCapture.IsCapturing() && gCapture.GetFormat() == format;
+    UStopCapture();
+    if (running)
+        return;
+    const char* path = format == CAPTURE_PNG ? CAPTURE_PNG_PREFIX : CAPTURE_Y4M_PATH;
+    if (gCapture.Start(path, format, camera.GetViewportWidth(), camera.GetViewportHeight(), CAPTURE_FRAMES_PER_SECOND))
+        cout << "INFO: Capturing " << camera.GetViewportWidth() << "x" << camera.GetViewportHeight() << " frames to " << path
+            << (format == CAPTURE_PNG ? "*.png" : "") << endl;
+}
 
-            glUniformMatrix4fv(location, count, transpose, glm::value_ptr(transform));
+// Waits for the captured frames to be written and reports them
+void UStopCapture()
+{
+    if (!gCapture.IsCapturing())
+        return;
+    gCapture.Stop();
+    const FrameCaptureStats stats = gCapture.GetStats();
+    cout << "INFO: Capture stopped: " << stats.Written << " of " << stats.Captured << " frames written to " << gCapture.GetPath()
+        << (gCapture.GetFormat() == CAPTURE_PNG ? "*.png" : "") << " (" << stats.Bytes / 1024 << " KB, " << stats.WriteMs
+        << " ms a frame), " << stats.Dropped << " dropped" << endl;
+}
 
-            // Render mesh1
-            URenderMesh(gMeshTable);
-        }
-        {
-            glm::mat4 model = tableModel;
-            model = glm::translate(model, glm::vec3(-1.75, -2.0, 0.99));
-            model = glm::scale(model, glm::vec3(0.1, 2.0, 0.1));
+// Creates the offscreen target the first time a mode needs it; false if the driver cannot render to it
+bool UCreateRenderTarget()
+{
+    if (!gRenderTargetReady)
+        gRenderTargetReady = gRenderTarget.Create(camera.GetViewportWidth(), camera.GetViewportHeight(), gResolution.GetMaxScale());
+    return gRenderTargetReady;
+}
 
-            glm::mat4 transform = projection * view * model;
+// The pre-pass writes depth only; afterwards the color pass tests for equal depth without writing it, so every pixel is
+// shaded once, by the fragment that ended up in front
+void UBeginDepthPrepass()
+{
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+}
 
-            glUniformMatrix4fv(location, count, transpose, glm::value_ptr(transform));
+void UEndDepthPrepass()
+{
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthMask(GL_FALSE);
+    glDepthFunc(gReverseZ ? GL_GEQUAL : GL_LEQUAL);
+}
+
+
+// Prints the latency percentiles of the frames completed since the pacing mode last changed
+void UReportLatency()
+{
+    const FramePacerStats& stats = gFramePacer.GetStats();
+    cout << "INFO: Latency over " << stats.Frames << " frames (" << stats.MaxFramesInFlight << " in flight" << (stats.LowLatency ? ", low latency" : "")
+        << "): input to GPU done p50 " << stats.LatencyP50Ms << " ms, p95 " << stats.LatencyP95Ms << " ms, p99 " << stats.LatencyP99Ms
+        << " ms, max " << stats.LatencyMaxMs << " ms; input to submit " << stats.InputToSubmitMs << " ms; " << stats.WaitMs << " ms waited per frame" << endl;
+    if (stats.EventFrames > 0)
+        cout << "    window event to GPU done over " << stats.EventFrames << " frames: p50 " << stats.EventLatencyP50Ms << " ms, p99 "
+            << stats.EventLatencyP99Ms << " ms" << endl;
+}
 
-            // Render mesh1
-            URenderMesh(gMeshTable);
+// Writes the site's chunk file unless an earlier run left one, and starts paging it. The site is a rolling heightfield of
+// SITE_QUADS by SITE_QUADS quads, SITE_SIZE wide, centered under the table
+bool UCreateSite()
+{
+    // written again by a build that changed the format or the vertex layout
+    MeshChunkFile written;
+    if (UReadMeshChunkVersion(SITE_PATH) != MESH_CHUNK_VERSION || !UReadMeshChunkTable(SITE_PATH, written) || written.FloatsPerVertex != FLOATS_PER_VERTEX)
+    {
+        const int side = SITE_QUADS + 1;
+        std::vector<GLfloat> grid;
+        std::vector<uint32_t> indices;
+        grid.reserve(size_t(side) * side * NORMAL_OFFSET);
+        indices.reserve(size_t(SITE_QUADS) * SITE_QUADS * 6);
+        for (int row = 0; row < side; ++row)
+        {
+            for (int column = 0; column < side; ++column)
+            {
+                const float x = (float(column) / SITE_QUADS - 0.5f) * SITE_SIZE;
+                const float z = (float(row) / SITE_QUADS - 0.5f) * SITE_SIZE;
+                const float y = -3.0f + 1.5f * std::sin(x * 0.11f) * std::cos(z * 0.07f) + 0.4f * std::sin(x * 0.37f + z * 0.23f);
+                grid.insert(grid.end(), { x, y, z, 0.0f, x * 0.25f, z * 0.25f });
+            }
         }
+        for (int row = 0; row < SITE_QUADS; ++row)
         {
-            glm::mat4 model = tableModel;
-            model = glm::translate(model, glm::vec3(-1.75, -2.0, -0.99));
-            model = glm::scale(model, glm::vec3(0.1, 2.0, 0.1));
+            for (int column = 0; column < SITE_QUADS; ++column)
+            {
+                const uint32_t corner = uint32_t(row * side + column);
+                indices.insert(indices.end(), { corner, corner + side, corner + 1, corner + 1, corner + side, corner + side + 1 });
+            }
+        }
 
-            glm::mat4 transform = projection * view * model;
+        // smooth normals for the hills. There is no normal map to need tangents
+        TangentSpaceGenerator generator;
+        TangentSpaceMesh tangentSpace;
+        generator.SetJobSystem(&gJobs);
+        generator.Generate(grid.data(), uint32_t(grid.size() / NORMAL_OFFSET), NORMAL_OFFSET, MESH_NO_UV, indices.data(), indices.size(), MESH_DEFAULT_CREASE_ANGLE, tangentSpace);
+        std::vector<GLfloat> vertices;
+        vertices.reserve(tangentSpace.Source.size() * FLOATS_PER_VERTEX);
+        for (size_t v = 0; v < tangentSpace.Source.size(); ++v)
+        {
+            const GLfloat* source = grid.data() + size_t(tangentSpace.Source[v]) * NORMAL_OFFSET;
+            const glm::vec3& normal = tangentSpace.Normals[v];
+            vertices.insert(vertices.end(), source, source + NORMAL_OFFSET);
+            vertices.insert(vertices.end(), { normal.x, normal.y, normal.z });
+        }
+        indices.swap(tangentSpace.Indices);
+
+        std::vector<MeshChunk> chunks;
+        USplitMeshIntoChunks(vertices.data(), uint32_t(vertices.size() / FLOATS_PER_VERTEX), FLOATS_PER_VERTEX, indices.data(), indices.size(), MESH_CHUNK_SIZE, chunks);
+        UBuildChunkMeshlets(FLOATS_PER_VERTEX, chunks);
+        if (!UWriteMeshChunks(SITE_PATH, FLOATS_PER_VERTEX, chunks))
+            return false;
+        size_t meshlets = 0;
+        for (const MeshChunk& chunk : chunks)
+            meshlets += chunk.Meshlets.size();
+        cout << "INFO: Wrote " << SITE_PATH << ": " << chunks.size() << " chunks, " << meshlets << " meshlets, " << indices.size() / 3 << " triangles" << endl;
+    }
 
-            glUniformMatrix4fv(location, count, transpose, glm::value_ptr(transform));
+    // position, material slot, UV and normal, as UCreateMeshFromVerts lays them out
+    gMeshPager.Create({ 3, 1, 2, 3 }, SITE_BUDGET);
+    if (gMeshPager.Add(SITE_PATH) == NO_MESH_PAGE)
+    {
+        gMeshPager.Destroy();
+        return false;
+    }
+    gSiteReady = true;
+    return true;
+}
 
-            // Render mesh1
-            URenderMesh(gMeshTable);
-        }
+// Pages the site's chunks for this frame's view and records draws for the resident ones in view. The camera's velocity
+// comes from how far it moved since the last frame; the pager reads ahead along it
+void UPageSite(const Frustum& frustum, const glm::mat4& viewProjection)
+{
+    gSiteCommands.Reset();
+    if (!gSiteVisible)
+        return;
+
+    const glm::vec3& eye = camera.GetPosition();
+    const double now = glfwGetTime();
+    const float elapsed = float(now - gSiteLastTime);
+    const glm::vec3 velocity = elapsed > 0.0f && elapsed < 0.5f ? (eye - gSiteLastEye) / elapsed : glm::vec3(0.0f);
+    gSiteLastEye = eye;
+    gSiteLastTime = now;
+    gMeshPager.Update(frustum, eye, velocity);
+
+    gSiteCommands.SetProgram(gProgramId);
+    gSiteCommands.SetUniform(gViewProjectionLocation, viewProjection);
+    gSiteCommands.BindTexture(0, gWhiteTexture);
+    gSiteCommands.SetUniform(gModelLocation, glm::mat4(1.0f));
+    gSiteCommands.SetUniform(gMaterialBaseLocation, gSiteMaterials);
+    for (const PagedDraw& draw : gMeshPager.GetVisible())
+    {
+        gSiteCommands.BindMesh(draw.Vao);
+        gSiteCommands.DrawIndirect(gMeshPager.GetCommandBuffer(), draw.FirstCommand, draw.CommandCount);
+    }
+}
+
+void UReportSite()
+{
+    const MeshPagingStats& stats = gMeshPager.GetStats();
+    cout << "INFO: Site paging: " << stats.ResidentChunks << " of " << stats.Chunks << " chunks resident, " << stats.ResidentBytes / 1024 << " of "
+        << stats.BudgetBytes / 1024 << " KB; " << stats.VisibleChunks << " in view, " << stats.Misses << " of them missing; " << stats.TotalUploadedBytes / 1024
+        << " KB uploaded, " << stats.Prefetched << " chunks prefetched, " << stats.Evictions << " evicted, " << stats.PendingReads << " reads pending" << endl;
+    cout << "INFO: Site meshlets " << (gMeshPager.IsMeshletCulling() ? "culled" : "not culled") << ": " << stats.Meshlets << " in resident chunks in view, "
+        << stats.FrustumCulledMeshlets << " outside the frustum, " << stats.BackfacingMeshlets << " facing away; " << stats.Commands << " indirect draws of "
+        << stats.Triangles << " triangles" << endl;
+    UReportBufferHeap("site", gMeshPager.GetHeapStats());
+}
+
+// Removes the objects hidden behind occluders from gVisibleObjects. Only occluders that passed frustum culling are
+// rasterized, nearest first, so the ones that matter most still make it if the culler runs out of time
+void UCullOccluded(const glm::mat4& viewProjection)
+{
+    const glm::vec3& eye = camera.GetPosition();
+    FrameVector<std::pair<float, uint32_t> > nearest{ ArenaAllocator<std::pair<float, uint32_t> >(gFrameArenas.Get()) };
+    nearest.reserve(gVisibleObjects.size());
+    gOccludeeBounds.clear();
+    for (uint32_t index : gVisibleObjects)
+    {
+        if (gSceneObjects[index].occluder)
+            nearest.push_back({ glm::length(gSceneBounds[index].Center() - eye), index });
+        gOccludeeBounds.push_back(gSceneBounds[index]);
+    }
+    if (nearest.empty())
+        return;
+    std::sort(nearest.begin(), nearest.end());
+
+    gOccluders.clear();
+    for (const std::pair<float, uint32_t>& occluder : nearest)
+    {
+        const SceneObject& object = gSceneObjects[occluder.second];
+        gOccluders.push_back({ object.mesh->positions.data(), object.mesh->indices.data(), uint32_t(object.mesh->indices.size()), object.model });
+    }
+
+    // occluders are always drawn; they would only ever hide themselves
+    gOccludeeVisible.resize(gVisibleObjects.size());
+    for (size_t i = 0; i < gVisibleObjects.size(); ++i)
+        gOccludeeVisible[i] = gSceneObjects[gVisibleObjects[i]].occluder ? 0 : 1;
+
+    gOcclusionCuller.Cull(viewProjection, gOccluders, gOccludeeBounds, gOccludeeVisible);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < gVisibleObjects.size(); ++i)
+    {
+        if (gOccludeeVisible[i] || gSceneObjects[gVisibleObjects[i]].occluder)
+            gVisibleObjects[kept++] = gVisibleObjects[i];
+    }
+    gVisibleObjects.resize(kept);
+
+    const OcclusionStats& stats = gOcclusionCuller.GetStats();
+    if (stats.Rejected != gLastRejected)
+    {
+        gLastRejected = stats.Rejected;
+        cout << "INFO: Occlusion culling rejected " << stats.Rejected << " of " << stats.Tested << " draws ("
+            << stats.OccludersRasterized << " occluders, " << stats.OccludersSkipped << " over budget, " << stats.Milliseconds << " ms)" << endl;
+    }
+}
+
+// Counts the frames in a row in which nothing changed (no key or button went down, no resize, no texture or chunk read in flight;
+// the streamers' file threads allocate too). After STEADY_STATE_FRAMES of them every frame must run without a single
+// heap allocation: per-frame scratch lives in the frame arenas and everything else keeps its memory from earlier frames
+void UCheckAllocations(uint64_t allocations)
+{
+    gFrameAllocations = allocations;
+    const bool changed = gInput.PressCount > 0 || gInput.Resized || gTextureStreamer.GetStats().PendingReads > 0
+        || (gSiteReady && gMeshPager.GetStats().PendingReads > 0);
+    gSteadyFrames = changed ? 0 : gSteadyFrames + 1;
+    if (gSteadyFrames > STEADY_STATE_FRAMES && allocations != 0)
+    {
+        cout << "ERROR::MEMORY::STEADY_STATE_ALLOCATION " << allocations << " heap allocations in a steady frame" << endl;
+        assert(allocations == 0);
+    }
+
+    if (gReportMemory)
+    {
+        cout << "INFO: Memory: " << allocations << " heap allocations last frame" << endl;
+        for (int thread = 0; thread < gFrameArenas.GetCount(); ++thread)
         {
-            glm::mat4 model = tableModel;
-            model = glm::translate(model, glm::vec3(1.75, -2.0, -0.99));
-            model = glm::scale(model, glm::vec3(0.1, 2.0, 0.1));
+            const FrameArena& arena = gFrameArenas.Get(thread);
+            cout << "    thread " << thread << " arena: " << arena.GetUsed() / 1024 << " KB used, peak " << arena.GetPeak() / 1024 << " of "
+                << arena.GetCapacity() / 1024 << " KB, grown " << arena.GetGrowCount() << " times" << endl;
+        }
+        UReportGpuMemory();
+        gReportMemory = false;
+    }
+}
+
+// Prints the live GPU memory by kind and by owner with their peaks, and what the driver reports where it says
+void UReportGpuMemory()
+{
+    cout << "INFO: GPU memory: " << gGpuMemory.GetTotalBytes() / 1024 << " KB live, peak " << gGpuMemory.GetPeakTotalBytes() / 1024 << " KB" << endl;
+    for (int type = 0; type < GPU_RESOURCE_COUNT; ++type)
+    {
+        const GpuMemoryCategory& category = gGpuMemory.GetCategory(Gpu_Resource(type));
+        cout << "    " << GPU_RESOURCE_NAMES[type] << ": " << category.Count << " objects, " << category.Bytes / 1024 << " KB, peak "
+            << category.PeakCount << " objects, " << category.PeakBytes / 1024 << " KB" << endl;
+    }
+    for (const GpuMemoryOwner& owner : gGpuMemory.GetOwners())
+        cout << "    " << owner.Tag << ": " << owner.Count << " objects, " << owner.Bytes << " bytes, peak " << owner.PeakBytes << " bytes" << endl;
+    UReportBufferHeap("scene", gMeshHeap.GetStats());
+
+    GpuDriverMemory driver;
+    if (!gGpuMemory.QueryDriver(driver))
+        cout << "    driver: no memory info extension" << endl;
+    else
+    {
+        cout << "    driver (" << driver.Source << "): " << driver.FreeBytes / 1048576 << " MB free";
+        if (driver.TotalBytes != 0)
+            cout << " of " << driver.TotalBytes / 1048576 << " MB (" << driver.DedicatedBytes / 1048576 << " MB dedicated), " << driver.Evictions << " evictions";
+        cout << endl;
+    }
+}
 
-            glm::mat4 transform = projection * view * model;
+// Prints how full the arenas of a mesh heap are and how much defragmenting moved
+void UReportBufferHeap(const char* name, const BufferHeapStats& stats)
+{
+    cout << "INFO: " << name << " mesh heap: " << stats.Ranges << " meshes in " << stats.Arenas << " arenas, " << stats.UsedBytes / 1024 << " of "
+        << stats.ArenaBytes / 1024 << " KB used, largest free block " << stats.LargestFreeBytes / 1024 << " KB; " << stats.Moves << " meshes ("
+        << stats.MovedBytes / 1024 << " KB) moved by defragmenting" << endl;
+}
 
-            glUniformMatrix4fv(location, count, transpose, glm::value_ptr(transform));
+// Asks the streamer for as much detail as each textured object in view covers on screen, then lets it upload what finished
+// loading. Resident textures are only swapped here, on the render thread, between frames
+void UStreamTextures()
+{
+    const glm::mat4& projection = camera.GetProjectionMatrix();
+    const glm::mat4& viewProjection = camera.GetViewProjectionMatrix();
+    // pixels of the render target, which is smaller than the window in dynamic resolution mode
+    const float pixelsPerUnit = projection[1][1] * 0.5f * float(gRenderHeight);
+    // the GPU-driven path never tells the CPU what it culled, so there every object asks
+    const size_t count = gGpuDriven ? gSceneObjects.size() : gVisibleObjects.size();
+    for (size_t i = 0; i < count; ++i)
+    {
+        const uint32_t index = gGpuDriven ? uint32_t(i) : gVisibleObjects[i];
+        const SceneObject& object = gSceneObjects[index];
+        if (object.texture == NO_TEXTURE)
+            continue;
+        // the bounding box's diagonal on screen; w is the view depth in perspective and 1 in orthographic
+        const Aabb& bounds = gSceneBounds[index];
+        const float w = std::max(0.01f, (viewProjection * glm::vec4(bounds.Center(), 1.0f)).w);
+        gTextureStreamer.Request(object.texture, glm::length(bounds.Extent()) * pixelsPerUnit / w);
+    }
+    gTextureStreamer.Update();
 
-            // Render mesh1
-            URenderMesh(gMeshTable);
+    if (gReportTextures)
+    {
+        const TextureStreamingStats& stats = gTextureStreamer.GetStats();
+        cout << "INFO: Textures: " << stats.FullyResident << " of " << stats.Textures << " at full detail, " << stats.ResidentBytes / 1024 << " of "
+            << stats.BudgetBytes / 1024 << " KB resident, " << stats.TotalUploadedBytes / 1024 << " KB uploaded, " << stats.PendingReads << " reads pending, "
+            << stats.Evictions << " levels evicted" << endl;
+        for (TextureHandle texture : { gTableTexture, gCubeTexture })
+        {
+            if (texture != NO_TEXTURE)
+                cout << "    " << gTextureStreamer.GetFile(texture).Path << ": level " << gTextureStreamer.GetResidentLevel(texture) << " resident, level "
+                    << gTextureStreamer.GetWantedLevel(texture) << " wanted" << endl;
         }
-        
+        gReportTextures = false;
     }
+}
 
+// Moves the lights along their orbits around the table and sorts them into the clusters of the current view. Runs as a
+// job, so it only touches the lights and the cluster grid
+void UUpdateLights(const glm::mat4& view, const glm::mat4& projection)
+{
+    gLightTime += 1.f / 60.f;
+    gLights.resize(gLighting ? gLightCount : 0);
+    for (int i = 0; i < int(gLights.size()); ++i)
+    {
+        // spread over a disc around the table (golden angle spiral), each light circling at its own speed and height
+        const float spread = std::sqrt((float(i) + 0.5f) / float(gLights.size()));
+        const float angle = float(i) * 2.39996f + gLightTime * (0.2f + 0.6f * std::fmod(float(i) * 0.618034f, 1.0f));
+        const float height = -0.45f + 1.2f * std::fmod(float(i) * 0.754878f, 1.0f);
+        PointLight& light = gLights[i];
+        light.Position = glm::vec3(-0.7f + 2.5f * spread * std::cos(angle), height, 2.0f * spread * std::sin(angle));
+        // fewer, wider lights or more, smaller ones: about as many reach any one point whatever the count
+        light.Radius = 0.9f * std::min(1.0f, std::cbrt(64.0f / float(gLights.size())));
+        const float hue = std::fmod(float(i) * 0.137f, 1.0f) * 6.0f;
+        light.Color = glm::clamp(glm::vec3(std::fabs(hue - 3.0f) - 1.0f, 2.0f - std::fabs(hue - 2.0f), 2.0f - std::fabs(hue - 4.0f)), 0.0f, 1.0f);
+        light.Intensity = 1.0f;
+    }
 
-    //angle += 0.0001;
-    // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
-    glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
+    // with lighting off everything is shown at its plain material color
+    gClusters.SetAmbient(glm::vec3(gLighting ? 0.35f : 1.0f));
+    // tiles are in the pixels the fragment shader sees, those of the render target
+    gClusters.Assign(gLights, view, projection, gRenderWidth, gRenderHeight, NEAR_PLANE, FAR_PLANE);
+}
+
+// Sends this frame's lights and cluster lists to the shader storage buffers the fragment shader reads
+void UUploadLights()
+{
+    FrameVector<glm::vec4> lights{ ArenaAllocator<glm::vec4>(gFrameArenas.Get()) };
+    lights.reserve(gLights.size() * 2 + 2);
+    for (const PointLight& light : gLights)
+    {
+        lights.push_back(glm::vec4(light.Position, light.Radius));
+        lights.push_back(glm::vec4(light.Color, light.Intensity));
+    }
+    if (lights.empty())
+        lights.resize(2);
+
+    const ClusterHeader& header = gClusters.GetHeader();
+    const std::vector<ClusterRange>& ranges = gClusters.GetRanges();
+    const std::vector<uint32_t>& indices = gClusters.GetLightIndices();
+    const GLsizeiptr clusterBytes = sizeof(ClusterHeader) + ranges.size() * sizeof(ClusterRange);
+
+    // orphan and refill: the previous frame's draws may still be reading the old contents
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gLightBuffers[0]);
+    UBufferData(GL_SHADER_STORAGE_BUFFER, gLightBuffers[0], lights.size() * sizeof(glm::vec4), lights.data(), GL_STREAM_DRAW, "lights");
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gLightBuffers[1]);
+    UBufferData(GL_SHADER_STORAGE_BUFFER, gLightBuffers[1], clusterBytes, NULL, GL_STREAM_DRAW, "lights");
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(ClusterHeader), &header);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(ClusterHeader), ranges.size() * sizeof(ClusterRange), ranges.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gLightBuffers[2]);
+    UBufferData(GL_SHADER_STORAGE_BUFFER, gLightBuffers[2], (indices.empty() ? 1 : indices.size()) * sizeof(uint32_t), indices.empty() ? NULL : indices.data(), GL_STREAM_DRAW, "lights");
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_BINDING, gLightBuffers[0]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_BINDING, gLightBuffers[1]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_LIGHT_BINDING, gLightBuffers[2]);
+
+    if (gReportLights)
+    {
+        const ClusterStats& stats = gClusters.GetStats();
+        cout << "INFO: Lighting " << (gLighting ? "on" : "off") << ": " << stats.Lights << " lights, " << stats.LightsInView << " in view, "
+            << stats.Assignments << " in " << gClusters.GetClusterCount() << " clusters (at most " << stats.MaxPerCluster << " per cluster), "
+            << stats.Milliseconds << " ms" << endl;
+        gReportLights = false;
+    }
 }
 
+// The texture to bind for an object's diffuse map: white until the streamer has something resident
+GLuint UGetDiffuseTexture(TextureHandle texture)
+{
+    if (texture == NO_TEXTURE || gTextureStreamer.GetTexture(texture) == 0)
+        return gWhiteTexture;
+    return gTextureStreamer.GetTexture(texture);
+}
 
-void URenderMesh(const GLMesh& mesh) {
-    glBindVertexArray(mesh.vao);
-    glDrawElements(GL_TRIANGLES, mesh.nIndices, GL_UNSIGNED_SHORT, NULL); // Draws the triangle
-    glBindVertexArray(0);
+// Prints which threads ran this frame's jobs and for how long, then turns job timing off again
+void UReportJobTimings()
+{
+    const std::vector<JobTiming> timings = gJobs.CollectTimings();
+    std::map<std::string, std::pair<int, double> > byName;
+    std::vector<double> busy(gJobs.GetThreadCount(), 0.0);
+    double span = 0.0;
+    for (const JobTiming& timing : timings)
+    {
+        byName[timing.Name].first++;
+        byName[timing.Name].second += timing.DurationMs;
+        busy[timing.Thread] += timing.DurationMs;
+        span = std::max(span, timing.StartMs + timing.DurationMs);
+    }
+
+    cout << "INFO: " << timings.size() << " jobs on " << gJobs.GetThreadCount() << " threads, done " << span << " ms into the frame" << endl;
+    for (const auto& name : byName)
+        cout << "    " << name.first << ": " << name.second.first << " jobs, " << name.second.second << " ms" << endl;
+    for (size_t thread = 0; thread < busy.size(); ++thread)
+        cout << "    thread " << thread << ": busy " << busy[thread] << " ms" << endl;
+
+    gReportJobs = false;
+    gJobs.EnableTiming(false);
 }
 
-void UCreateMeshFromVerts(GLMesh& mesh, std::vector<GLfloat> const& verts, std::vector<GLushort> const& indices) {
-    glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(mesh.vao);
+// Mirrors the scene objects into the GPU culler. Objects that share a mesh and texture share a draw group, whatever their
+// materials. Pass true the first time (or when objects were added or removed); false only refreshes transforms and bounds
+void UUploadGpuScene(bool rebuildGroups)
+{
+    if (rebuildGroups)
+    {
+        gDrawGroupMeshes.clear();
+        gDrawGroupTextures.clear();
+    }
 
-    // Creates the Vertex Attribute Pointer for the screen coordinates
-    const GLuint floatsPerVertex = 3; // Number of coordinates per vertex
-    const GLuint floatsPerColor = 4;  // (r, g, b, a)
+    gGpuObjects.resize(gSceneObjects.size());
+    for (size_t i = 0; i < gSceneObjects.size(); ++i)
+    {
+        const SceneObject& object = gSceneObjects[i];
+        size_t group = 0;
+        while (group < gDrawGroupMeshes.size() && (gDrawGroupMeshes[group] != object.mesh || gDrawGroupTextures[group] != object.texture))
+            ++group;
+        if (group == gDrawGroupMeshes.size())
+        {
+            gDrawGroupMeshes.push_back(object.mesh);
+            gDrawGroupTextures.push_back(object.texture);
+        }
 
-    // Strides between vertex coordinates is 6 (x, y, r, g, b, a). A tightly packed stride is 0.
-    const GLint stride = sizeof(GLfloat) * (floatsPerVertex + floatsPerColor);// The number of floats before each
+        gGpuObjects[i].Model = object.model;
+        gGpuObjects[i].BoundsMin = glm::vec4(gSceneBounds[i].Min, float(group));
+        gGpuObjects[i].BoundsMax = glm::vec4(gSceneBounds[i].Max, float(object.materials));
+    }
 
-    // Create 2 buffers: first one for the vertex data; second one for the indices
-    glGenBuffers(2, mesh.vbos);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, verts.size() * stride, verts.data(), GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+    if (rebuildGroups)
+    {
+        std::vector<GpuDrawRange> groupRanges;
+        for (const GLMesh* mesh : gDrawGroupMeshes)
+        {
+            const BufferRange& range = gMeshHeap.Get(mesh->range);
+            groupRanges.push_back({ mesh->nIndices, range.FirstIndex, range.BaseVertex });
+        }
+        gGpuCuller.SetObjects(gGpuObjects, groupRanges);
+    }
+    else
+    {
+        gGpuCuller.UpdateObjects(gGpuObjects);
+    }
+}
+
+// Culls on the GPU and draws each mesh group with one indirect call; the CPU never learns what was visible
+void URenderGpuDriven(const glm::mat4& viewProjection)
+{
+    gGpuCuller.Cull(camera.GetFrustum());
+    gGpuCuller.BindForDraw();
+
+    // the pre-pass replays the same indirect draws with the depth program
+    const auto drawGroups = [&viewProjection](GLuint program, GLint viewProjectionLocation, GLint groupOffsetLocation, bool textured)
+    {
+        glUseProgram(program);
+        glUniformMatrix4fv(viewProjectionLocation, 1, GL_FALSE, glm::value_ptr(viewProjection));
+        for (GLuint group = 0; group < gDrawGroupMeshes.size(); ++group)
+        {
+            glBindVertexArray(gMeshHeap.Get(gDrawGroupMeshes[group]->range).Vao);
+            if (textured)
+                glBindTexture(GL_TEXTURE_2D, UGetDiffuseTexture(gDrawGroupTextures[group]));
+            gGpuCuller.DrawGroup(group, groupOffsetLocation);
+        }
+    };
+    if (gDepthPrepass)
+    {
+        UBeginDepthPrepass();
+        drawGroups(gGpuDepthProgramId, gGpuDepthViewProjectionLocation, gGpuDepthGroupOffsetLocation, false);
+        UEndDepthPrepass();
+    }
+    drawGroups(gGpuProgramId, gGpuViewProjectionLocation, gGpuGroupOffsetLocation, true);
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
 
-    // Creates a buffer object for the indices
-    mesh.nIndices = indices.size();
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), indices.data(), GL_STATIC_DRAW);
+void URenderMesh(const GLMesh& mesh) {
+    const BufferRange& range = gMeshHeap.Get(mesh.range);
+    glBindVertexArray(range.Vao);
+    glDrawElementsBaseVertex(GL_TRIANGLES, mesh.nIndices, GL_UNSIGNED_SHORT, (const void*)(range.FirstIndex * sizeof(GLushort)), range.BaseVertex); // Draws the triangle
+    glBindVertexArray(0);
+}
 
-    // Creates the Vertex Attribute Pointer
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
+// Copies a mesh into gMeshHeap, keeping what the CPU side needs of it
+void UCreateMeshFromVerts(GLMesh& mesh, const GLfloat* verts, size_t vertexCount, const GLushort* indices, size_t indexCount) {
+    // verts holds FLOATS_PER_VERTEX floats a vertex, the layout gMeshHeap was created with
+    mesh.range = gMeshHeap.Allocate(verts, GLuint(vertexCount), indices, GLuint(indexCount));
+    mesh.nIndices = indexCount;
 
-    glVertexAttribPointer(1, floatsPerColor, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(GLfloat) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
+    // Keep the bounds of the positions for culling and picking, and the bare triangles for the occlusion culler
+    mesh.bounds = Aabb();
+    mesh.positions.clear();
+    for (size_t i = 0; i < vertexCount; ++i)
+    {
+        const GLfloat* position = verts + i * FLOATS_PER_VERTEX;
+        mesh.positions.push_back(glm::vec3(position[0], position[1], position[2]));
+        mesh.bounds.Grow(mesh.positions.back());
+    }
+    mesh.indices.assign(indices, indices + indexCount);
+    mesh.vertices.assign(verts, verts + vertexCount * FLOATS_PER_VERTEX);
 }
 
 void UDestroyMesh(GLMesh& mesh)
 {
-    glDeleteVertexArrays(1, &mesh.vao);
-    glDeleteBuffers(2, mesh.vbos);
+    gMeshHeap.Free(mesh.range);
+    mesh.range = NO_BUFFER_RANGE;
 }
 
 
-// Implements the UCreateShaders function
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId)
+// Implements the UCreateShaders function. The linked program is recorded under owner
+bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId, const char* owner)
 {
     // Compilation and linkage error reporting
     int success = 0;
@@ -508,16 +2010,50 @@ bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSou
 
         return false;
     }
+    UTrackProgram(programId, owner);
 
     glUseProgram(programId);    // Uses the shader program
 
     return true;
 }
+// Queues an event for the render thread. The queue only fills up if rendering stalls, so wait a while for room rather
+// than drop it; but not once the render thread is leaving, or for long, or this thread would never get back to join it
+void UQueueInput(const InputEvent& event)
+{
+    const double giveUp = glfwGetTime() + 0.25;
+    while (!gInputQueue.Push(event))
+    {
+        if (glfwWindowShouldClose(gWindow) || glfwGetTime() > giveUp)
+        {
+            cout << "INFO: input queue full, dropped an event" << endl;
+            return;
+        }
+        std::this_thread::yield();
+    }
+}
 // glfw: whenever the mouse scroll wheel scrolls, this callback is called
 // ----------------------------------------------------------------------
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
-    camera.ProcessMouseScroll(yoffset);
+    UQueueInput({ INPUT_SCROLL, glfwGetTime(), xoffset, yoffset, 0, 0 });
+}
+// glfw: whenever a key is pressed, repeated or released, this callback is called
+// ------------------------------------------------------------------------------
+void key_callback(GLFWwindow*, int key, int, int action, int)
+{
+    UQueueInput({ INPUT_KEY, glfwGetTime(), 0.0, 0.0, key, action });
+}
+// glfw: whenever a mouse button is pressed or released, this callback is called
+// -----------------------------------------------------------------------------
+void mouse_button_callback(GLFWwindow*, int button, int action, int)
+{
+    UQueueInput({ INPUT_MOUSE_BUTTON, glfwGetTime(), 0.0, 0.0, button, action });
+}
+// glfw: whenever the window size changed (by OS or user resize) this callback function executes
+// ---------------------------------------------------------------------------------------------
+void framebuffer_size_callback(GLFWwindow*, int width, int height)
+{
+    UQueueInput({ INPUT_RESIZE, glfwGetTime(), double(width), double(height), 0, 0 });
 }
 // glfw: whenever the mouse moves, this callback is called
 // -------------------------------------------------------
@@ -535,14 +2071,20 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 
     lastX = xpos;
     lastY = ypos;
-   
 
-    camera.ProcessMouseMovement(xoffset, yoffset);
+    // if the render thread is behind and the queue is full, carry the delta into the next event instead of blocking
+    pendingMouseX += xoffset;
+    pendingMouseY += yoffset;
+    if (gInputQueue.Push({ INPUT_MOUSE_MOVE, glfwGetTime(), pendingMouseX, pendingMouseY, 0, 0 }))
+    {
+        pendingMouseX = 0.0f;
+        pendingMouseY = 0.0f;
+    }
 }
 
 void UDestroyShaderProgram(GLuint programId)
 {
-    glDeleteProgram(programId);
+    UDeleteProgram(programId);
 }
 
 
@@ -1,6 +1,6 @@
 #include <iostream>         // cout, cerr
 #include <cstdlib>          // EXIT_FAILURE
-#include <vector>
+#include <array>
 #include <GL/glew.h>        // GLEW library
 #include <GLFW/glfw3.h>     // GLFW library
 
@@ -9,6 +9,7 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "Camera.h"
+#include "Primitives.h"
 
 using namespace std; // Uses the standard namespace
 
@@ -53,7 +54,7 @@ namespace
 bool UInitialize(int, char* [], GLFWwindow** window);
 void UResizeWindow(GLFWwindow* window, int width, int height);
 void UProcessInput(GLFWwindow* window);
-void UCreateMeshFromVerts(GLMesh& mesh, std::vector<GLfloat> const& verts, std::vector<GLushort> const& indices);
+void UCreateMeshFromVerts(GLMesh& mesh, const GLfloat* verts, size_t vertexCount, const GLushort* indices, size_t indexCount);
 void URenderMesh(const GLMesh& mesh);
 void UDestroyMesh(GLMesh& mesh);
 void URender();
@@ -101,52 +102,19 @@ int main(int argc, char* argv[])
         return EXIT_FAILURE;
 
     {
-#define RED -1.0,-1.0,-1.0,-1.0
-#define GREEN 0.1,1.0,0.3,1.0
-        std::vector<GLfloat> verts = {
-            -1, -1, -1, RED,    // 0
-            -1, -1,  1, RED,    // 1
-            -1,  1, -1, GREEN,  // 2
-            -1,  1,  1, GREEN,  // 3
-             1, -1, -1, RED,    // 4
-             1, -1,  1, RED,    // 5
-             1,  1, -1, GREEN,  // 6
-             1,  1,  1, GREEN   // 7
-        };
-#undef RED
-#undef GREEN
-
-#define YELLOW 0.6,0.6,0.0,1.0
-        std::vector<GLfloat> vertsTable = {
-            -1, -1, -1, YELLOW,    // 0
-            -1, -1,  1, YELLOW,    // 1
-            -1,  1, -1, YELLOW,  // 2
-            -1,  1,  1, YELLOW,  // 3
-             1, -1, -1, YELLOW,    // 4
-             1, -1,  1, YELLOW,    // 5
-             1,  1, -1, YELLOW,  // 6
-             1,  1,  1, YELLOW   // 7
-        };
-#undef YELLOW
-
-        std::vector<GLushort> indices = {
-            0, 2, 1, // left
-            1, 2, 3,
-            4, 6, 5, // right
-            5, 6, 7,
-            2, 6, 3, // top
-            3, 6, 7,
-            0, 4, 1, // bottom
-            1, 4, 5,
-            1, 5, 3, // front
-            3, 5, 7,
-            0, 4, 2, // back
-            2, 4, 6
-        };
+        // Position and color. The box is red below and green on top, the table yellow all over
+        static constexpr PrimitiveMesh<24, 36> cube = MakeCube();
+        static constexpr auto verts = Interleave<PRIMITIVE_POSITION, 4>(cube, [](const PrimitiveVertex& vertex) {
+            return vertex.Position[1] < 0.0f ? std::array<float, 4>{ -1.0f, -1.0f, -1.0f, -1.0f } : std::array<float, 4>{ 0.1f, 1.0f, 0.3f, 1.0f };
+        });
+        static constexpr auto vertsTable = Interleave<PRIMITIVE_POSITION, 4>(cube, [](const PrimitiveVertex&) {
+            return std::array<float, 4>{ 0.6f, 0.6f, 0.0f, 1.0f };
+        });
+
         // Create the mesh
-        UCreateMeshFromVerts(gMeshCube, verts, indices); // Calls the function to create the Vertex Buffer Object
-        UCreateMeshFromVerts(gMeshTable, vertsTable, indices); // Calls the function to create the Vertex Buffer Object
-        UCreateMeshFromVerts(gMeshTableleg, verts, indices); // Calls the function to create the Vertex Buffer Object
+        UCreateMeshFromVerts(gMeshCube, verts.data(), cube.GetVertexCount(), cube.Indices.data(), cube.GetIndexCount()); // Calls the function to create the Vertex Buffer Object
+        UCreateMeshFromVerts(gMeshTable, vertsTable.data(), cube.GetVertexCount(), cube.Indices.data(), cube.GetIndexCount()); // Calls the function to create the Vertex Buffer Object
+        UCreateMeshFromVerts(gMeshTableleg, verts.data(), cube.GetVertexCount(), cube.Indices.data(), cube.GetIndexCount()); // Calls the function to create the Vertex Buffer Object
     }
 
 
@@ -173,6 +141,8 @@ int main(int argc, char* argv[])
 
     // Release mesh data
     UDestroyMesh(gMeshCube);
+    UDestroyMesh(gMeshTable);
+    UDestroyMesh(gMeshTableleg);
 
     // Release shader program
     UDestroyShaderProgram(gProgramId);
@@ -380,7 +350,7 @@ void URenderMesh(const GLMesh& mesh) {
     glBindVertexArray(0);
 }
 
-void UCreateMeshFromVerts(GLMesh& mesh, std::vector<GLfloat> const& verts, std::vector<GLushort> const& indices) {
+void UCreateMeshFromVerts(GLMesh& mesh, const GLfloat* verts, size_t vertexCount, const GLushort* indices, size_t indexCount) {
     glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
     glBindVertexArray(mesh.vao);
 
@@ -394,13 +364,13 @@ void UCreateMeshFromVerts(GLMesh& mesh, std::vector<GLfloat> const& verts, std::
     // Create 2 buffers: first one for the vertex data; second one for the indices
     glGenBuffers(2, mesh.vbos);
     glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, verts.size() * stride, verts.data(), GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+    glBufferData(GL_ARRAY_BUFFER, vertexCount * stride, verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
 
     // Creates a buffer object for the indices
-    mesh.nIndices = indices.size();
+    mesh.nIndices = indexCount;
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), indices.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(GLushort), indices, GL_STATIC_DRAW);
 
     // Creates the Vertex Attribute Pointer
     glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
@@ -7,6 +7,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include "Camera.h"
+#include "Primitives.h"
 
 using namespace std; // Uses the standard namespace
 
@@ -259,84 +260,16 @@ void URender()
 // Implements the UCreateMesh function
 void UCreateMesh(GLMesh& mesh)
 {
-    GLfloat verts[] =
-    {
-        0, 1, 0, // top - 0
-        1.0f, 1.0f, 1.0f, 1.0f, // white
-
-        -0.5, 0, -0.5, // 1
-        1.0f, 0.0f, 0.0f, 1.0f, // red
-
-        -0.5, 0, 0.5, // 2
-        1.0f, 1.0f, 0.0f, 1.0f, // red
-
-        0.5, 0, -0.5, // 3
-        1.0f, 0.0f, 1.0f, 1.0f, // red
-
-        0.5, 0, 0.5, // 4
-        0.0f, 1.0f, 0.0f, 1.0f, // red
-    };
-
-
-    /*
-
-    ^
-    +Y
-
-
-                  0
-
-
-
-
-            2 ---------------- 4
-
-    1 ---------------- 3
-
-
-    <---- -X                    +X  ---->
-
-    */
-
-    GLushort indices[] = {
-        0, 1, 3, // front
-        0, 3, 4, // right
-        0, 4, 2, // back
-        0, 2, 1, // left
-
-        1, 2, 3, // base
-        2, 4, 3
-    };
-
-
-    // Specifies Normalized Device Coordinates (x,y,z) and color (r,g,b,a) for triangle vertices
-    GLfloat verts2[] =
-    {
-        // The two triangles will be drawn using indices
-        // Left triangle indices: 0, 1, 2
-        // Right triangle indices: 3, 2, 4
-
-        // index 0
-     // index 0
-    -0.99f, 0.0f, 0.0f,      // top-first third of the screen
-    1.0f, 0.0f, 0.0f, 1.0f, // red
-
-    // index 1
-    -1.0f, 1.0f, 0.0f,     // bottom-left of the screen
-    0.0f, 0.0f, 1.0f, 1.0f, // blue
-
-    // index 2
-    -0.4f, 0.0f, 0.0f,      // bottom-center of the screen
-    0.0f, 1.0f, 0.0f, 1.0f, // green
-
-    // index 3
-    0.20f, 0.0f, 0.0f,       // top-second third of the screen
-    1.0f, 0.0f, 0.0f, 1.0f, // red
-
-    // index 4
-    0.20f, -1.0f, 0.0f,      // bottom-right of the screen
-    0.0f, 1.0f, 0.0f, 1.0f  // green
-    };
+    // Position and color (r, g, b, a): a white apex over a red, yellow, magenta and green base, colored by corner
+    static constexpr PrimitiveMesh<16, 18> pyramid = MakePyramid();
+    static constexpr auto verts = Interleave<PRIMITIVE_POSITION, 4>(pyramid, [](const PrimitiveVertex& vertex) {
+        const float x = vertex.Position[0], y = vertex.Position[1], z = vertex.Position[2];
+        if (y > 0.0f)
+            return std::array<float, 4>{ 1.0f, 1.0f, 1.0f, 1.0f };
+        if (x < 0.0f)
+            return z < 0.0f ? std::array<float, 4>{ 1.0f, 0.0f, 0.0f, 1.0f } : std::array<float, 4>{ 1.0f, 1.0f, 0.0f, 1.0f };
+        return z < 0.0f ? std::array<float, 4>{ 1.0f, 0.0f, 1.0f, 1.0f } : std::array<float, 4>{ 0.0f, 1.0f, 0.0f, 1.0f };
+    });
 
 
     glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
@@ -345,14 +278,13 @@ void UCreateMesh(GLMesh& mesh)
     // Create 2 buffers: first one for the vertex data; second one for the indices
     glGenBuffers(2, mesh.vbos);
     glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts.data(), GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
 
     // Creates a buffer object for the indices
-    GLushort indices2[] = { 0, 1, 2, 3, 2, 4 }; // Using index 2 twice
-    mesh.nIndices = sizeof(indices) / sizeof(indices[0]);
+    mesh.nIndices = pyramid.GetIndexCount();
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(pyramid.Indices), pyramid.Indices.data(), GL_STATIC_DRAW);
 
     // Creates the Vertex Attribute Pointer for the screen coordinates
     const GLuint floatsPerVertex = 3; // Number of coordinates per vertex